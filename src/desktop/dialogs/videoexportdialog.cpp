@@ -137,8 +137,8 @@ void VideoExportDialog::updateUi()
 		m_ui->optionStack->setCurrentIndex(0);
 	} else {
 		m_ui->optionStack->setCurrentIndex(1);
-		QStringList args =
-			FfmpegExporter::getCommonArguments(m_ui->fps->value());
+		QStringList args = FfmpegExporter::getCommonArguments(
+			m_ui->fps->value(), QStringLiteral("<WIDTH>x<HEIGHT>"));
 		if(format == VideoExporter::FFMPEG_MP4) {
 			args.append(FfmpegExporter::getDefaultMp4Arguments());
 		} else if(format == VideoExporter::FFMPEG_WEBM) {
@@ -786,6 +786,10 @@ static StartupOptions initApp(DrawpileApp &app)
 	app.initState();
 	desktop::settings::Settings &settings = app.settings();
 	settings.bindWriteLogFile(&utils::enableLogFile);
+	settings.bindEngineTileCacheSize([](int megabytes) {
+		drawdance::setTileCompressionCacheLimit(
+			size_t(qMax(0, megabytes)) * 1024 * 1024);
+	});
 	app.initTheme();
 	app.initCanvasImplementation(parser.value(renderer));
 	app.initInterface();
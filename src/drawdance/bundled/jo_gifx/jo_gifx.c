@@ -366,27 +366,23 @@ jo_gifx_t *jo_gifx_start(jo_gifx_write_fn write_fn, void *user, uint16_t width,
     return gif;
 }
 
-bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
-                   uint32_t *rgba, uint16_t delayCsec)
+size_t jo_gifx_frame_quantize_buffer_size(const jo_gifx_t *gif)
+{
+    return (size_t)gif->width * (size_t)gif->height * 4;
+}
+
+void jo_gifx_frame_quantize(const jo_gifx_t *gif, const uint32_t *rgba,
+                            unsigned char *buffer,
+                            unsigned char *indexedPixels)
 {
     uint16_t width = gif->width;
     uint16_t height = gif->height;
     size_t size = (size_t)width * (size_t)height;
 
-    unsigned char *palette = gif->palette;
-    unsigned char *indexedPixels, *prevIndexedPixels;
-    if (gif->frame % 2 == 0) {
-        indexedPixels = gif->pixels;
-        prevIndexedPixels = gif->pixels + size;
-    }
-    else {
-        indexedPixels = gif->pixels + size;
-        prevIndexedPixels = gif->pixels;
-    }
-
+    const unsigned char *palette = gif->palette;
     int usableColors = gif->numColors - 1; // Last color is transparency.
     {
-        unsigned char *ditheredPixels = gif->pixels + size * 2;
+        unsigned char *ditheredPixels = buffer;
         for (size_t i = 0; i < size; ++i) {
             uint32_t color = rgba[i];
             ditheredPixels[i * 4 + 0] = (color >> 16) & 0xff;
@@ -447,7 +443,26 @@ bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
             }
         }
     }
+}
+
+static bool jo_gifx_write_frame(jo_gifx_write_fn write_fn, void *user,
+                                jo_gifx_t *gif, uint16_t delayCsec)
+{
+    uint16_t width = gif->width;
+    uint16_t height = gif->height;
+    size_t size = (size_t)width * (size_t)height;
+
+    unsigned char *indexedPixels, *prevIndexedPixels;
+    if (gif->frame % 2 == 0) {
+        indexedPixels = gif->pixels;
+        prevIndexedPixels = gif->pixels + size;
+    }
+    else {
+        indexedPixels = gif->pixels + size;
+        prevIndexedPixels = gif->pixels;
+    }
 
+    int usableColors = gif->numColors - 1; // Last color is transparency.
     unsigned char *outputPixels;
     if (gif->frame > 0) {
         outputPixels = gif->pixels + size * 2;
@@ -488,6 +503,30 @@ bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
     return ok;
 }
 
+static unsigned char *jo_gifx_next_indexed_pixels(jo_gifx_t *gif)
+{
+    size_t size = (size_t)gif->width * (size_t)gif->height;
+    return gif->frame % 2 == 0 ? gif->pixels : gif->pixels + size;
+}
+
+bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
+                   uint32_t *rgba, uint16_t delayCsec)
+{
+    size_t size = (size_t)gif->width * (size_t)gif->height;
+    jo_gifx_frame_quantize(gif, rgba, gif->pixels + size * 2,
+                           jo_gifx_next_indexed_pixels(gif));
+    return jo_gifx_write_frame(write_fn, user, gif, delayCsec);
+}
+
+bool jo_gifx_frame_indexed(jo_gifx_write_fn write_fn, void *user,
+                           jo_gifx_t *gif, const unsigned char *indexedPixels,
+                           uint16_t delayCsec)
+{
+    size_t size = (size_t)gif->width * (size_t)gif->height;
+    memcpy(jo_gifx_next_indexed_pixels(gif), indexedPixels, size);
+    return jo_gifx_write_frame(write_fn, user, gif, delayCsec);
+}
+
 bool jo_gifx_end(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif)
 {
     free(gif);
@@ -53,6 +53,23 @@ jo_gifx_t *jo_gifx_start(jo_gifx_write_fn write_fn, void *user, uint16_t width,
 bool jo_gifx_frame(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif,
                    uint32_t *rgba, uint16_t delayCsec);
 
+// Splits jo_gifx_frame into two steps, so that frames can be quantized in
+// parallel and then appended in order. Quantizing maps the given pixels onto
+// the palette, writing width * height palette indexes into indexedPixels. It
+// only reads from the handle, so it can be called from multiple threads at
+// once, each with its own buffer of jo_gifx_frame_quantize_buffer_size bytes.
+size_t jo_gifx_frame_quantize_buffer_size(const jo_gifx_t *gif);
+
+void jo_gifx_frame_quantize(const jo_gifx_t *gif, const uint32_t *rgba,
+                            unsigned char *buffer,
+                            unsigned char *indexedPixels);
+
+// Appends a frame quantized by the above function. Same as jo_gifx_frame
+// otherwise.
+bool jo_gifx_frame_indexed(jo_gifx_write_fn write_fn, void *user,
+                           jo_gifx_t *gif, const unsigned char *indexedPixels,
+                           uint16_t delayCsec);
+
 // Frees the handle, writes trailer and returns if that worked. The handle
 // *always* gets freed, even if writing the trailer failed.
 bool jo_gifx_end(jo_gifx_write_fn write_fn, void *user, jo_gifx_t *gif);
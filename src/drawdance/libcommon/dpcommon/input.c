@@ -26,8 +26,13 @@
 #include <stdio.h>
 #include <string.h>
 
-#ifdef DP_QT_IO
+#if defined(DP_QT_IO)
 #    include "input_qt.h"
+#elif !defined(_WIN32)
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
 #endif
 
 
@@ -168,6 +173,14 @@ QIODevice *DP_input_qiodevice(DP_Input *input)
     return qiodevice ? qiodevice(input->internal) : NULL;
 }
 
+const unsigned char *DP_input_view(DP_Input *input, size_t *out_size)
+{
+    DP_ASSERT(input);
+    DP_ASSERT(out_size);
+    const unsigned char *(*view)(void *, size_t *) = input->methods->view;
+    return view ? view(input->internal, out_size) : NULL;
+}
+
 
 typedef struct DP_FileInputState {
     FILE *fp;
@@ -289,6 +302,7 @@ static const DP_InputMethods file_input_methods = {
     file_input_seek_by,
     NULL,
     file_input_dispose,
+    NULL,
 };
 
 const DP_InputMethods *file_input_init(void *internal, void *arg)
@@ -376,7 +390,7 @@ static bool mem_input_rewind_by(void *internal, size_t size)
 static bool mem_input_seek(void *internal, size_t offset)
 {
     DP_MemInputState *state = internal;
-    if (offset < state->size) {
+    if (offset <= state->size) {
         state->pos = offset;
         return true;
     }
@@ -393,6 +407,14 @@ static bool mem_input_seek_by(void *internal, size_t size)
     return mem_input_seek(internal, state->pos + size);
 }
 
+static const unsigned char *mem_input_view(void *internal, size_t *out_size)
+{
+    DP_MemInputState *state = internal;
+    DP_ASSERT(state->pos <= state->size);
+    *out_size = state->size - state->pos;
+    return (const unsigned char *)state->buffer + state->pos;
+}
+
 static void mem_input_dispose(void *internal)
 {
     DP_MemInputState *state = internal;
@@ -411,6 +433,7 @@ static const DP_InputMethods mem_input_methods = {
     mem_input_seek_by,
     NULL,
     mem_input_dispose,
+    mem_input_view,
 };
 
 const DP_InputMethods *mem_input_init(void *internal, void *arg)
@@ -443,6 +466,70 @@ DP_Input *DP_mem_input_new_keep_on_close(const void *buffer, size_t size)
 }
 
 
+#if !defined(DP_QT_IO) && !defined(_WIN32)
+static void mmap_input_unmap(void *buffer, size_t size,
+                             DP_UNUSED void *free_arg)
+{
+    if (munmap(buffer, size) != 0) {
+        DP_warn("Mmap input unmap error: %s", strerror(errno));
+    }
+}
+
+static DP_Input *mmap_input_new(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        DP_error_set("Can't open '%s': %s", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    void *buffer = MAP_FAILED;
+    size_t size = 0;
+    if (fstat(fd, &st) != 0) {
+        DP_error_set("Can't stat '%s': %s", path, strerror(errno));
+    }
+    else if (!S_ISREG(st.st_mode) || st.st_size <= 0
+             || (uintmax_t)st.st_size > SIZE_MAX) {
+        DP_error_set("Can't map '%s' of size %jd", path, (intmax_t)st.st_size);
+    }
+    else {
+        size = (size_t)st.st_size;
+        buffer = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buffer == MAP_FAILED) {
+            DP_error_set("Can't map '%s': %s", path, strerror(errno));
+        }
+    }
+
+    // The mapping keeps its own reference to the file.
+    close(fd);
+    return buffer == MAP_FAILED
+             ? NULL
+             : DP_mem_input_new(buffer, size, mmap_input_unmap, NULL);
+}
+#endif
+
+DP_Input *DP_mmap_input_new_from_path(const char *path)
+{
+    DP_ASSERT(path);
+#if defined(DP_QT_IO)
+    DP_Input *input = DP_qfile_mmap_input_new_from_path(path, DP_mem_input_new);
+#elif defined(_WIN32)
+    DP_error_set("Mapping files not implemented");
+    DP_Input *input = NULL;
+#else
+    DP_Input *input = mmap_input_new(path);
+#endif
+    if (input) {
+        return input;
+    }
+    else {
+        DP_debug("Reading '%s' without mapping: %s", path, DP_error());
+        return DP_file_input_new_from_path(path);
+    }
+}
+
+
 DP_BufferedInput DP_buffered_input_init(DP_Input *input)
 {
     DP_ASSERT(input);
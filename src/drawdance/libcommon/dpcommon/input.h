@@ -42,6 +42,7 @@ typedef struct DP_InputMethods {
     bool (*seek_by)(void *internal, size_t size);
     QIODevice *(*qiodevice)(void *internal);
     void (*dispose)(void *internal);
+    const unsigned char *(*view)(void *internal, size_t *out_size);
 } DP_InputMethods;
 
 typedef const DP_InputMethods *(*DP_InputInitFn)(void *internal, void *arg);
@@ -65,6 +66,12 @@ bool DP_input_seek_by(DP_Input *input, size_t size);
 
 QIODevice *DP_input_qiodevice(DP_Input *input);
 
+// Returns the remaining input starting at the current position without copying
+// it, or NULL if the input doesn't support that. The returned memory stays
+// valid until the input is freed. Doesn't advance the position, seek past the
+// bytes you've consumed.
+const unsigned char *DP_input_view(DP_Input *input, size_t *out_size);
+
 
 #ifndef RUST_BINDGEN
 DP_Input *DP_file_input_new(FILE *fp, bool close);
@@ -84,6 +91,10 @@ DP_Input *DP_mem_input_new_free_on_close(void *buffer, size_t size);
 
 DP_Input *DP_mem_input_new_keep_on_close(const void *buffer, size_t size);
 
+// Maps the file into memory, giving an input that supports DP_input_view. If
+// the file can't be mapped, falls back to DP_file_input_new_from_path.
+DP_Input *DP_mmap_input_new_from_path(const char *path);
+
 
 #define DP_BUFFERED_INPUT_NULL \
     (DP_BufferedInput)        \
@@ -120,7 +120,7 @@ static void qfile_input_dispose(void *internal)
 static const DP_InputMethods qfile_input_methods = {
     qfile_input_read,      qfile_input_length,  qfile_input_rewind,
     qfile_input_rewind_by, qfile_input_seek,    qfile_input_seek_by,
-    qfile_input_qiodevice, qfile_input_dispose,
+    qfile_input_qiodevice, qfile_input_dispose, nullptr,
 };
 
 const DP_InputMethods *qfile_input_init(void *internal, void *arg)
@@ -151,3 +151,37 @@ extern "C" DP_Input *DP_qfile_input_new_from_path(const char *path,
         return nullptr;
     }
 }
+
+
+static void qfile_mmap_input_unmap(DP_UNUSED void *buffer,
+                                   DP_UNUSED size_t size, void *free_arg)
+{
+    // Destroying the file unmaps everything it mapped.
+    delete static_cast<QFile *>(free_arg);
+}
+
+extern "C" DP_Input *
+DP_qfile_mmap_input_new_from_path(const char *path,
+                                  DP_InputQtMemNewFn mem_new_fn)
+{
+    QFile *file = new QFile{QString::fromUtf8(path)};
+    if (!file->open(QIODevice::ReadOnly)) {
+        DP_error_set("Can't open '%s': %s", path,
+                     qUtf8Printable(file->errorString()));
+        delete file;
+        return nullptr;
+    }
+
+    qint64 size = file->size();
+    uchar *buffer = size > 0 && quint64(size) <= SIZE_MAX
+                      ? file->map(0, size)
+                      : nullptr;
+    if (!buffer) {
+        DP_error_set("Can't map '%s': %s", path,
+                     qUtf8Printable(file->errorString()));
+        delete file;
+        return nullptr;
+    }
+
+    return mem_new_fn(buffer, size_t(size), qfile_mmap_input_unmap, file);
+}
@@ -14,11 +14,21 @@ typedef struct QFile QFile;
 typedef DP_Input *(*DP_InputQtNewFn)(DP_InputInitFn init, void *arg,
                                      size_t internal_size);
 
+// Same deal for DP_mem_input_new.
+typedef DP_Input *(*DP_InputQtMemNewFn)(void *buffer, size_t size,
+                                        DP_MemInputFreeFn free,
+                                        void *free_arg);
+
 
 DP_Input *DP_qfile_input_new(QFile *file, bool close, DP_InputQtNewFn new_fn);
 
 DP_Input *DP_qfile_input_new_from_path(const char *path,
                                        DP_InputQtNewFn new_fn);
 
+// Returns NULL if the file can't be mapped, the caller should fall back to
+// reading it normally in that case.
+DP_Input *DP_qfile_mmap_input_new_from_path(const char *path,
+                                            DP_InputQtMemNewFn mem_new_fn);
+
 
 #endif
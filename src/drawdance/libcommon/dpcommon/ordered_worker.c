@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: MIT
+#include "ordered_worker.h"
+#include "atomic.h"
+#include "common.h"
+#include "conversions.h"
+#include "threading.h"
+#include "worker.h"
+
+
+typedef struct DP_OrderedWorkerSlot {
+    DP_Atomic done;
+    void *buffer;
+    size_t size;
+    char *error;
+} DP_OrderedWorkerSlot;
+
+struct DP_OrderedWorker {
+    DP_Worker *worker;
+    DP_Semaphore *sem;
+    int thread_count;
+    int slot_count;
+    // Only valid during a run. Workers see them through the job push.
+    DP_OrderedWorkerEncodeFn encode_fn;
+    void *user;
+    DP_OrderedWorkerSlot slots[];
+};
+
+struct DP_OrderedWorkerJob {
+    DP_OrderedWorker *ow;
+    int index;
+};
+
+
+static void encode_to_slot(DP_OrderedWorker *ow, DP_OrderedWorkerSlot *slot,
+                           int index, int thread_index)
+{
+    size_t size = 0;
+    void *buffer = ow->encode_fn(ow->user, index, thread_index, &size);
+    slot->buffer = buffer;
+    slot->size = buffer ? size : 0;
+    // The error message is thread-local, so it has to be carried over.
+    slot->error = buffer ? NULL : DP_strdup(DP_error());
+}
+
+static DP_OrderedWorkerSlot *slot_at(DP_OrderedWorker *ow, int index)
+{
+    return &ow->slots[index % ow->slot_count];
+}
+
+static void run_job(void *element, int thread_index)
+{
+    struct DP_OrderedWorkerJob *job = element;
+    DP_OrderedWorker *ow = job->ow;
+    DP_OrderedWorkerSlot *slot = slot_at(ow, job->index);
+    encode_to_slot(ow, slot, job->index, thread_index);
+    DP_atomic_set(&slot->done, 1);
+    DP_SEMAPHORE_MUST_POST(ow->sem);
+}
+
+DP_OrderedWorker *DP_ordered_worker_new(int thread_count, int window)
+{
+    DP_ASSERT(window > 0);
+    int slot_count = thread_count > 1 ? thread_count * window : 1;
+    DP_OrderedWorker *ow = DP_malloc_zeroed(DP_FLEX_SIZEOF(
+        DP_OrderedWorker, slots, DP_int_to_size(slot_count)));
+    ow->thread_count = 1;
+    ow->slot_count = slot_count;
+
+    if (thread_count > 1) {
+        ow->sem = DP_semaphore_new(0);
+        if (ow->sem) {
+            ow->worker =
+                DP_worker_new(DP_int_to_size(slot_count),
+                              sizeof(struct DP_OrderedWorkerJob), thread_count,
+                              run_job);
+        }
+        if (ow->worker) {
+            ow->thread_count = DP_worker_thread_count(ow->worker);
+        }
+        else {
+            DP_warn("Ordered worker: %s, running serially", DP_error());
+        }
+    }
+
+    return ow;
+}
+
+void DP_ordered_worker_free(DP_OrderedWorker *ow)
+{
+    if (ow) {
+        DP_worker_free_join(ow->worker);
+        if (ow->sem) {
+            DP_semaphore_free(ow->sem);
+        }
+        DP_free(ow);
+    }
+}
+
+int DP_ordered_worker_thread_count(DP_OrderedWorker *ow)
+{
+    DP_ASSERT(ow);
+    return ow->thread_count;
+}
+
+
+static bool write_slot(DP_OrderedWorkerSlot *slot, int index,
+                       DP_OrderedWorkerWriteFn write_fn, void *user)
+{
+    if (slot->error) {
+        DP_error_set("%s", slot->error);
+        DP_free(slot->error);
+        slot->error = NULL;
+    }
+    return write_fn(user, index, slot->buffer, slot->size);
+}
+
+static bool run_serial(DP_OrderedWorker *ow, int count,
+                       DP_OrderedWorkerWriteFn write_fn, void *user)
+{
+    DP_OrderedWorkerSlot *slot = &ow->slots[0];
+    for (int i = 0; i < count; ++i) {
+        encode_to_slot(ow, slot, i, 0);
+        if (!write_slot(slot, i, write_fn, user)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int wait_for_slot(DP_OrderedWorker *ow, DP_OrderedWorkerSlot *slot)
+{
+    // Every finished job posts once, so if this slot isn't done yet, there's
+    // still a post coming for it. Other jobs finishing wakes us up early.
+    int waits = 0;
+    while (!DP_atomic_get(&slot->done)) {
+        DP_SEMAPHORE_MUST_WAIT(ow->sem);
+        ++waits;
+    }
+    DP_atomic_set(&slot->done, 0);
+    return waits;
+}
+
+static bool run_parallel(DP_OrderedWorker *ow, int count,
+                         DP_OrderedWorkerWriteFn write_fn, void *user)
+{
+    int pushed = 0;
+    int waits = 0;
+    bool ok = true;
+    int i = 0;
+    for (; ok && i < count; ++i) {
+        int push_end = DP_min_int(count, i + ow->slot_count);
+        while (pushed < push_end) {
+            DP_worker_push(ow->worker,
+                           &(struct DP_OrderedWorkerJob){ow, pushed++});
+        }
+        DP_OrderedWorkerSlot *slot = slot_at(ow, i);
+        waits += wait_for_slot(ow, slot);
+        ok = write_slot(slot, i, write_fn, user);
+    }
+
+    // If we stopped early, the jobs still in flight need to finish before the
+    // caller's data goes away. Their results just get thrown away.
+    for (; i < pushed; ++i) {
+        DP_OrderedWorkerSlot *slot = slot_at(ow, i);
+        waits += wait_for_slot(ow, slot);
+        DP_free(slot->buffer);
+        DP_free(slot->error);
+        slot->error = NULL;
+    }
+
+    // Consume the remaining posts so that the next run starts from zero.
+    if (pushed > waits) {
+        DP_SEMAPHORE_MUST_WAIT_N(ow->sem, pushed - waits);
+    }
+    return ok;
+}
+
+bool DP_ordered_worker_run(DP_OrderedWorker *ow, int count,
+                           DP_OrderedWorkerEncodeFn encode_fn,
+                           DP_OrderedWorkerWriteFn write_fn, void *user)
+{
+    DP_ASSERT(ow);
+    DP_ASSERT(count >= 0);
+    DP_ASSERT(encode_fn);
+    DP_ASSERT(write_fn);
+    ow->encode_fn = encode_fn;
+    ow->user = user;
+    bool ok = ow->worker && count > 1 ? run_parallel(ow, count, write_fn, user)
+                                      : run_serial(ow, count, write_fn, user);
+    ow->encode_fn = NULL;
+    ow->user = NULL;
+    return ok;
+}
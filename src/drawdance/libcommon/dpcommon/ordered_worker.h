@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: MIT
+#ifndef DPCOMMON_ORDERED_WORKER_H
+#define DPCOMMON_ORDERED_WORKER_H
+#include "common.h"
+
+
+// A worker that encodes a sequence of items in parallel, but hands the results
+// back to the calling thread in their original order. Used for compressing
+// tiles and layers, where the output has to be deterministic, but producing
+// each piece is expensive and independent of the others.
+typedef struct DP_OrderedWorker DP_OrderedWorker;
+
+// Called on a worker thread. Returns a buffer allocated with DP_malloc and
+// its size, or NULL with DP_error set on failure. The thread index is less
+// than DP_ordered_worker_thread_count and can be used for scratch buffers.
+typedef void *(*DP_OrderedWorkerEncodeFn)(void *user, int index,
+                                          int thread_index, size_t *out_size);
+
+// Called on the calling thread, in order of the indexes. Takes ownership of
+// the buffer. If encoding failed, the buffer is NULL and DP_error is set to
+// what the encode function reported. Returning false stops the run.
+typedef bool (*DP_OrderedWorkerWriteFn)(void *user, int index, void *buffer,
+                                        size_t size);
+
+// Spawns the given number of threads. With a thread count of 1 or less, or if
+// the threads can't be spawned, everything runs on the calling thread instead.
+// The window is how many items per thread may be in flight or waiting to be
+// written at the same time, which bounds the memory used for the results.
+DP_OrderedWorker *DP_ordered_worker_new(int thread_count, int window);
+
+void DP_ordered_worker_free(DP_OrderedWorker *ow);
+
+int DP_ordered_worker_thread_count(DP_OrderedWorker *ow);
+
+// Encodes the items from 0 to count - 1 and writes them in order. Blocks until
+// everything is written. Returns false if a write function returned false.
+bool DP_ordered_worker_run(DP_OrderedWorker *ow, int count,
+                           DP_OrderedWorkerEncodeFn encode_fn,
+                           DP_OrderedWorkerWriteFn write_fn, void *user);
+
+
+#endif
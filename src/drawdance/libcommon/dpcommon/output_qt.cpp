@@ -128,11 +128,12 @@ extern "C" DP_Output *DP_qfile_output_new(QFile *file, bool close,
     return new_fn(qfile_output_init, &state, sizeof(DP_QFileOutputState));
 }
 
-extern "C" DP_Output *DP_qfile_output_new_from_path(const char *path,
-                                                    DP_OutputQtNewFn new_fn)
+static DP_Output *qfile_output_open(const char *path,
+                                    QIODevice::OpenMode mode,
+                                    DP_OutputQtNewFn new_fn)
 {
     QFile *file = new QFile{QString::fromUtf8(path)};
-    if (file->open(QIODevice::WriteOnly)) {
+    if (file->open(mode)) {
         return DP_qfile_output_new(file, true, new_fn);
     }
     else {
@@ -143,6 +144,19 @@ extern "C" DP_Output *DP_qfile_output_new_from_path(const char *path,
     }
 }
 
+extern "C" DP_Output *DP_qfile_output_new_from_path(const char *path,
+                                                    DP_OutputQtNewFn new_fn)
+{
+    return qfile_output_open(path, QIODevice::WriteOnly, new_fn);
+}
+
+// Opening with read access too keeps the existing contents of the file.
+extern "C" DP_Output *
+DP_qfile_output_update_new_from_path(const char *path, DP_OutputQtNewFn new_fn)
+{
+    return qfile_output_open(path, QIODevice::ReadWrite, new_fn);
+}
+
 
 struct DP_QSaveFileOutputState {
     QSaveFile *sf;
@@ -21,6 +21,9 @@ DP_Output *DP_qfile_output_new(QFile *file, bool close,
 DP_Output *DP_qfile_output_new_from_path(const char *path,
                                          DP_OutputQtNewFn new_fn);
 
+DP_Output *DP_qfile_output_update_new_from_path(const char *path,
+                                                DP_OutputQtNewFn new_fn);
+
 DP_Output *DP_qsavefile_output_new_from_path(const char *path,
                                              DP_OutputQtNewFn new_fn);
 
@@ -20,7 +20,9 @@
  * SOFTWARE.
  */
 #include "queue.h"
+#include "atomic.h"
 #include "common.h"
+#include "threading.h"
 
 
 void DP_queue_init(DP_Queue *queue, size_t initial_capacity,
@@ -215,3 +217,177 @@ size_t DP_queue_search_last_index(DP_Queue *queue, size_t element_size,
     }
     return used;
 }
+
+
+struct DP_MpscQueueBatch {
+    DP_AtomicPtr next;
+    size_t capacity;
+    size_t count;
+    void *elements[];
+};
+
+// Producers swap their batch into the tail and then link the previous tail to
+// it. The consumer holds on to the batch it's currently reading from and only
+// moves on once it's exhausted and something got linked to it, so the tail is
+// never freed from under a producer. The initial batch is an empty one.
+struct DP_MpscQueue {
+    DP_AtomicPtr tail;
+    DP_MpscQueueBatch *head;
+    size_t index;
+};
+
+DP_MpscQueue *DP_mpsc_queue_new(void)
+{
+    DP_MpscQueueBatch *batch = DP_mpsc_queue_batch_new(0);
+    DP_MpscQueue *queue = DP_malloc(sizeof(*queue));
+    DP_atomic_ptr_set(&queue->tail, batch);
+    queue->head = batch;
+    queue->index = 0;
+    return queue;
+}
+
+void DP_mpsc_queue_free(DP_MpscQueue *queue,
+                        void (*dispose_element)(void *element))
+{
+    if (queue) {
+        DP_MpscQueueBatch *batch = queue->head;
+        size_t index = queue->index;
+        while (batch) {
+            if (dispose_element) {
+                for (size_t i = index; i < batch->count; ++i) {
+                    dispose_element(batch->elements[i]);
+                }
+            }
+            DP_MpscQueueBatch *next = DP_atomic_ptr_get(&batch->next);
+            DP_free(batch);
+            batch = next;
+            index = 0;
+        }
+        DP_free(queue);
+    }
+}
+
+DP_MpscQueueBatch *DP_mpsc_queue_batch_new(size_t capacity)
+{
+    DP_MpscQueueBatch *batch =
+        DP_malloc(DP_FLEX_SIZEOF(DP_MpscQueueBatch, elements, capacity));
+    DP_atomic_ptr_set(&batch->next, NULL);
+    batch->capacity = capacity;
+    batch->count = 0;
+    return batch;
+}
+
+void DP_mpsc_queue_batch_free(DP_MpscQueueBatch *batch)
+{
+    DP_free(batch);
+}
+
+void DP_mpsc_queue_batch_add(DP_MpscQueueBatch *batch, void *element)
+{
+    DP_ASSERT(batch);
+    DP_ASSERT(batch->count < batch->capacity);
+    batch->elements[batch->count++] = element;
+}
+
+size_t DP_mpsc_queue_batch_count(DP_MpscQueueBatch *batch)
+{
+    DP_ASSERT(batch);
+    return batch->count;
+}
+
+void DP_mpsc_queue_push_batch(DP_MpscQueue *queue, DP_MpscQueueBatch *batch)
+{
+    DP_ASSERT(queue);
+    DP_ASSERT(batch);
+    DP_ASSERT(!DP_atomic_ptr_get(&batch->next));
+    DP_MpscQueueBatch *prev = DP_atomic_ptr_xch(&queue->tail, batch);
+    DP_atomic_ptr_set(&prev->next, batch);
+}
+
+void DP_mpsc_queue_push(DP_MpscQueue *queue, void *element)
+{
+    DP_MpscQueueBatch *batch = DP_mpsc_queue_batch_new(1);
+    DP_mpsc_queue_batch_add(batch, element);
+    DP_mpsc_queue_push_batch(queue, batch);
+}
+
+void *DP_mpsc_queue_peek(DP_MpscQueue *queue)
+{
+    DP_ASSERT(queue);
+    DP_MpscQueueBatch *head = queue->head;
+    while (queue->index == head->count) {
+        DP_MpscQueueBatch *next = DP_atomic_ptr_get(&head->next);
+        if (next) {
+            DP_free(head);
+            queue->head = head = next;
+            queue->index = 0;
+        }
+        else {
+            return NULL;
+        }
+    }
+    return head->elements[queue->index];
+}
+
+void *DP_mpsc_queue_shift(DP_MpscQueue *queue)
+{
+    void *element = DP_mpsc_queue_peek(queue);
+    if (element) {
+        ++queue->index;
+    }
+    return element;
+}
+
+
+struct DP_QueueWaker {
+    DP_Semaphore *sem;
+    DP_Atomic sleeping;
+};
+
+DP_QueueWaker *DP_queue_waker_new(void)
+{
+    DP_Semaphore *sem = DP_semaphore_new(0);
+    if (sem) {
+        DP_QueueWaker *qw = DP_malloc(sizeof(*qw));
+        qw->sem = sem;
+        DP_atomic_set(&qw->sleeping, 0);
+        return qw;
+    }
+    else {
+        return NULL;
+    }
+}
+
+void DP_queue_waker_free(DP_QueueWaker *qw)
+{
+    if (qw) {
+        DP_semaphore_free(qw->sem);
+        DP_free(qw);
+    }
+}
+
+void DP_queue_waker_wake(DP_QueueWaker *qw)
+{
+    DP_ASSERT(qw);
+    // The pushes before this and the consumer announcing its sleep before
+    // checking the queues means at least one side sees the other.
+    if (DP_atomic_get(&qw->sleeping) && DP_atomic_xch(&qw->sleeping, 0)) {
+        DP_SEMAPHORE_MUST_POST(qw->sem);
+    }
+}
+
+void DP_queue_waker_wait(DP_QueueWaker *qw, bool (*should_sleep)(void *user),
+                         void *user)
+{
+    DP_ASSERT(qw);
+    DP_ASSERT(should_sleep);
+    DP_atomic_set(&qw->sleeping, 1);
+    if (should_sleep(user)) {
+        DP_SEMAPHORE_MUST_WAIT(qw->sem);
+    }
+    else if (!DP_atomic_xch(&qw->sleeping, 0)) {
+        // A producer got to the flag first and posted, eat that post so that
+        // it doesn't wake us up for nothing later.
+        DP_SEMAPHORE_MUST_WAIT(qw->sem);
+    }
+}
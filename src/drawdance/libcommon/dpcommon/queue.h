@@ -76,4 +76,56 @@ size_t DP_queue_search_last_index(DP_Queue *queue, size_t element_size,
                                   void *user);
 
 
+// Lock-free queue of pointers for any number of producer threads and a single
+// consumer thread. Producers push batches of elements, the consumer gets each
+// batch in one piece, in the order they were pushed. There's no capacity limit,
+// every batch is its own allocation.
+typedef struct DP_MpscQueue DP_MpscQueue;
+typedef struct DP_MpscQueueBatch DP_MpscQueueBatch;
+
+DP_MpscQueue *DP_mpsc_queue_new(void);
+
+// No producers may be left when freeing. If dispose_element isn't NULL, it's
+// called on every element still in the queue.
+void DP_mpsc_queue_free(DP_MpscQueue *queue,
+                        void (*dispose_element)(void *element));
+
+DP_MpscQueueBatch *DP_mpsc_queue_batch_new(size_t capacity);
+
+void DP_mpsc_queue_batch_free(DP_MpscQueueBatch *batch);
+
+void DP_mpsc_queue_batch_add(DP_MpscQueueBatch *batch, void *element);
+
+size_t DP_mpsc_queue_batch_count(DP_MpscQueueBatch *batch);
+
+// Producer side. Takes ownership of the batch.
+void DP_mpsc_queue_push_batch(DP_MpscQueue *queue, DP_MpscQueueBatch *batch);
+
+void DP_mpsc_queue_push(DP_MpscQueue *queue, void *element);
+
+// Consumer side. Returns NULL if the queue is empty or if the only thing in it
+// is a batch that's still in the middle of getting pushed.
+void *DP_mpsc_queue_peek(DP_MpscQueue *queue);
+
+void *DP_mpsc_queue_shift(DP_MpscQueue *queue);
+
+
+// Lets the consumer of one or more queues sleep while they're empty. Producers
+// only touch the semaphore when the consumer is actually asleep, so while it's
+// busy, waking it just costs an atomic load.
+typedef struct DP_QueueWaker DP_QueueWaker;
+
+DP_QueueWaker *DP_queue_waker_new(void);
+
+void DP_queue_waker_free(DP_QueueWaker *qw);
+
+// Producer side, call after pushing.
+void DP_queue_waker_wake(DP_QueueWaker *qw);
+
+// Consumer side. Announces that the consumer is going to sleep, then sleeps
+// if should_sleep returns true, which should check the queues for emptiness.
+void DP_queue_waker_wait(DP_QueueWaker *qw, bool (*should_sleep)(void *user),
+                         void *user);
+
+
 #endif
@@ -43,8 +43,10 @@ typedef unsigned long long DP_ThreadId;
 typedef struct DP_Mutex DP_Mutex;
 typedef struct DP_Semaphore DP_Semaphore;
 typedef struct DP_Thread DP_Thread;
+typedef struct DP_ThreadLocal DP_ThreadLocal;
 
 typedef void (*DP_ThreadFn)(void *data);
+typedef void (*DP_ThreadLocalDestructorFn)(void *value);
 
 typedef enum DP_MutexResult {
     DP_MUTEX_OK,
@@ -156,6 +158,16 @@ DP_Thread *DP_thread_new(DP_ThreadFn fn, void *data);
 void DP_thread_free_join(DP_Thread *thread);
 
 
+// Thread-local storage slot. When a thread that set a non-null value exits,
+// the destructor is called on it. Slots are meant to be created once and live
+// until the program exits, there's no way to free them.
+DP_ThreadLocal *DP_thread_local_new(DP_ThreadLocalDestructorFn destructor);
+
+void *DP_thread_local_get(DP_ThreadLocal *tl);
+
+void DP_thread_local_set(DP_ThreadLocal *tl, void *value);
+
+
 DP_ErrorState DP_thread_error_state_get(void);
 
 DP_ErrorState DP_thread_error_state_resize(size_t size);
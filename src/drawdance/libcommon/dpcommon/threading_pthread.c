@@ -285,6 +285,36 @@ void DP_thread_free_join(DP_Thread *thread)
 }
 
 
+struct DP_ThreadLocal {
+    pthread_key_t key;
+};
+
+DP_ThreadLocal *DP_thread_local_new(DP_ThreadLocalDestructorFn destructor)
+{
+    DP_ThreadLocal *tl = DP_malloc(sizeof(*tl));
+    int error = pthread_key_create(&tl->key, destructor);
+    if (error != 0) {
+        DP_panic("Error creating thread-local key: %s", strerror(error));
+    }
+    return tl;
+}
+
+void *DP_thread_local_get(DP_ThreadLocal *tl)
+{
+    DP_ASSERT(tl);
+    return pthread_getspecific(tl->key);
+}
+
+void DP_thread_local_set(DP_ThreadLocal *tl, void *value)
+{
+    DP_ASSERT(tl);
+    int error = pthread_setspecific(tl->key, value);
+    if (error != 0) {
+        DP_panic("Error setting thread-local: %s", strerror(error));
+    }
+}
+
+
 typedef struct DP_PthreadErrorState {
     unsigned int count;
     size_t buffer_size;
@@ -301,16 +331,19 @@ static void free_pthread_errror_state(void *arg)
 static DP_PthreadErrorState *get_pthread_error_state(void)
 {
     DP_ATOMIC_DECLARE_STATIC_SPIN_LOCK(lock);
+    // Zero is a valid key, so it can't be used to check for initialization.
+    static DP_Atomic key_created;
     static pthread_key_t key;
 
-    if (key == 0) {
+    if (!DP_atomic_get(&key_created)) {
         DP_atomic_lock(&lock);
-        if (key == 0) {
+        if (!DP_atomic_get(&key_created)) {
             int error = pthread_key_create(&key, free_pthread_errror_state);
             if (error != 0) {
                 DP_panic("Error creating thread-local key: %s",
                          strerror(error));
             }
+            DP_atomic_set(&key_created, 1);
         }
         DP_atomic_unlock(&lock);
     }
@@ -171,6 +171,74 @@ extern "C" void DP_thread_free_join(DP_Thread *thread)
 }
 
 
+// QThreadStorage deletes pointers it holds when the thread exits, so this
+// wrapper runs the destructor from there.
+class DP_QtThreadLocalValue final {
+  public:
+    DP_QtThreadLocalValue(DP_ThreadLocalDestructorFn destructor, void *value)
+        : m_destructor{destructor}, m_value{value}
+    {
+    }
+
+    ~DP_QtThreadLocalValue()
+    {
+        if (m_destructor && m_value) {
+            m_destructor(m_value);
+        }
+    }
+
+    DP_QtThreadLocalValue(const DP_QtThreadLocalValue &) = delete;
+    DP_QtThreadLocalValue &operator=(const DP_QtThreadLocalValue &) = delete;
+
+    void *value() const
+    {
+        return m_value;
+    }
+
+    void setValue(void *value)
+    {
+        m_value = value;
+    }
+
+  private:
+    DP_ThreadLocalDestructorFn m_destructor;
+    void *m_value;
+};
+
+struct DP_ThreadLocal {
+    DP_ThreadLocalDestructorFn destructor;
+    QThreadStorage<DP_QtThreadLocalValue *> storage;
+};
+
+extern "C" DP_ThreadLocal *
+DP_thread_local_new(DP_ThreadLocalDestructorFn destructor)
+{
+    DP_ThreadLocal *tl = new DP_ThreadLocal;
+    tl->destructor = destructor;
+    return tl;
+}
+
+extern "C" void *DP_thread_local_get(DP_ThreadLocal *tl)
+{
+    DP_ASSERT(tl);
+    return tl->storage.hasLocalData() ? tl->storage.localData()->value()
+                                      : nullptr;
+}
+
+extern "C" void DP_thread_local_set(DP_ThreadLocal *tl, void *value)
+{
+    DP_ASSERT(tl);
+    // Replacing the value must not run the destructor on the old one.
+    if (tl->storage.hasLocalData()) {
+        tl->storage.localData()->setValue(value);
+    }
+    else {
+        tl->storage.setLocalData(
+            new DP_QtThreadLocalValue{tl->destructor, value});
+    }
+}
+
+
 class DP_QtErrorState final {
   public:
     DP_QtErrorState()
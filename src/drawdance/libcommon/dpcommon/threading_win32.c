@@ -187,6 +187,67 @@ void DP_thread_free_join(DP_Thread *thread)
     }
 }
 
+
+// Fiber-local storage is used instead of thread-local storage because it
+// supports destructors. The callback only gets the value though, so it's
+// wrapped together with the destructor to call.
+struct DP_ThreadLocal {
+    DWORD index;
+    DP_ThreadLocalDestructorFn destructor;
+};
+
+typedef struct DP_Win32ThreadLocalValue {
+    DP_ThreadLocalDestructorFn destructor;
+    void *value;
+} DP_Win32ThreadLocalValue;
+
+static VOID NTAPI destroy_thread_local_value(PVOID data)
+{
+    DP_Win32ThreadLocalValue *tlv = data;
+    if (tlv) {
+        if (tlv->destructor && tlv->value) {
+            tlv->destructor(tlv->value);
+        }
+        DP_free(tlv);
+    }
+}
+
+DP_ThreadLocal *DP_thread_local_new(DP_ThreadLocalDestructorFn destructor)
+{
+    DWORD index = FlsAlloc(destroy_thread_local_value);
+    if (index == FLS_OUT_OF_INDEXES) {
+        DP_panic("Error creating thread-local: out of indexes");
+    }
+    DP_ThreadLocal *tl = DP_malloc(sizeof(*tl));
+    tl->index = index;
+    tl->destructor = destructor;
+    return tl;
+}
+
+void *DP_thread_local_get(DP_ThreadLocal *tl)
+{
+    DP_ASSERT(tl);
+    DP_Win32ThreadLocalValue *tlv = FlsGetValue(tl->index);
+    return tlv ? tlv->value : NULL;
+}
+
+void DP_thread_local_set(DP_ThreadLocal *tl, void *value)
+{
+    DP_ASSERT(tl);
+    DP_Win32ThreadLocalValue *tlv = FlsGetValue(tl->index);
+    if (tlv) {
+        tlv->value = value;
+    }
+    else {
+        tlv = DP_malloc(sizeof(*tlv));
+        tlv->destructor = tl->destructor;
+        tlv->value = value;
+        if (!FlsSetValue(tl->index, tlv)) {
+            DP_panic("Error setting thread-local: error %lu", GetLastError());
+        }
+    }
+}
+
 #ifdef _MSC_VER
 #    define THREAD_LOCAL __declspec(thread)
 #else
@@ -20,6 +20,7 @@
  * SOFTWARE.
  */
 #include "worker.h"
+#include "atomic.h"
 #include "common.h"
 #include "conversions.h"
 #include "queue.h"
@@ -41,6 +42,9 @@ struct DP_WorkerParams {
     int thread_index;
 };
 
+// Set to the owning worker on every worker thread.
+static DP_ThreadLocal *worker_thread_local;
+
 
 int DP_worker_cpu_count(int max)
 {
@@ -81,6 +85,7 @@ static void run_worker_thread(void *data)
     DP_Mutex *queue_mutex = worker->queue_mutex;
     DP_Queue *queue = &worker->queue;
     void *element = DP_malloc(element_size);
+    DP_thread_local_set(worker_thread_local, worker);
     while (true) {
         DP_SEMAPHORE_MUST_WAIT(sem);
         if (shift_worker_element(queue_mutex, queue, element_size, element)) {
@@ -93,6 +98,18 @@ static void run_worker_thread(void *data)
     DP_free(element);
 }
 
+static void init_worker_thread_local(void)
+{
+    DP_ATOMIC_DECLARE_STATIC_SPIN_LOCK(worker_thread_local_spinlock);
+    if (!worker_thread_local) {
+        DP_atomic_lock(&worker_thread_local_spinlock);
+        if (!worker_thread_local) {
+            worker_thread_local = DP_thread_local_new(NULL);
+        }
+        DP_atomic_unlock(&worker_thread_local_spinlock);
+    }
+}
+
 DP_Worker *DP_worker_new(size_t initial_capacity, size_t element_size,
                          int thread_count, DP_WorkerJobFn job_fn)
 {
@@ -100,6 +117,7 @@ DP_Worker *DP_worker_new(size_t initial_capacity, size_t element_size,
     DP_ASSERT(element_size > 0);
     DP_ASSERT(thread_count > 0);
     DP_ASSERT(job_fn);
+    init_worker_thread_local();
 
     DP_Worker *worker = DP_malloc_zeroed(
         DP_FLEX_SIZEOF(DP_Worker, threads, DP_int_to_size(thread_count)));
@@ -173,3 +191,9 @@ void DP_worker_push(DP_Worker *worker, void *element)
     DP_MUTEX_MUST_UNLOCK(queue_mutex);
     DP_SEMAPHORE_MUST_POST(worker->sem);
 }
+
+bool DP_worker_on_worker_thread(void)
+{
+    // If no worker was ever created, this can't be a worker thread.
+    return worker_thread_local && DP_thread_local_get(worker_thread_local);
+}
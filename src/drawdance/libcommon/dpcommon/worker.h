@@ -39,5 +39,10 @@ int DP_worker_thread_count(DP_Worker *worker);
 
 void DP_worker_push(DP_Worker *worker, void *element);
 
+// Whether the calling thread belongs to a worker. Work done on such a thread is
+// already running in parallel with its siblings, so it shouldn't fan out to
+// further threads of its own.
+bool DP_worker_on_worker_thread(void);
+
 
 #endif
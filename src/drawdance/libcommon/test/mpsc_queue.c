@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/atomic.h>
+#include <dpcommon/common.h>
+#include <dpcommon/queue.h>
+#include <dpcommon/threading.h>
+#include <dptest.h>
+
+#define PRODUCER_COUNT 4
+#define BATCH_COUNT    2000
+#define MAX_BATCH_SIZE 7
+
+
+struct MpscQueueTest {
+    DP_MpscQueue *queue;
+    DP_QueueWaker *qw;
+    DP_Atomic producers_left;
+};
+
+struct MpscQueueProducer {
+    struct MpscQueueTest *mqt;
+    int id;
+};
+
+// Elements are encoded as producer id, sequence number and the number of
+// elements left in their batch, none of which are zero to avoid NULL.
+static void *encode(int id, int seq, int left)
+{
+    return (void *)(((uintptr_t)(seq + 1) << 12) | ((uintptr_t)left << 4)
+                    | (uintptr_t)(id + 1));
+}
+
+static void decode(void *element, int *out_id, int *out_seq, int *out_left)
+{
+    uintptr_t value = (uintptr_t)element;
+    *out_id = (int)(value & 0xfu) - 1;
+    *out_left = (int)((value >> 4) & 0xffu);
+    *out_seq = (int)(value >> 12) - 1;
+}
+
+static void run_producer(void *data)
+{
+    struct MpscQueueProducer *p = data;
+    struct MpscQueueTest *mqt = p->mqt;
+    int seq = 0;
+    for (int i = 0; i < BATCH_COUNT; ++i) {
+        int size = (i + p->id) % MAX_BATCH_SIZE + 1;
+        DP_MpscQueueBatch *batch = DP_mpsc_queue_batch_new((size_t)size);
+        for (int j = 0; j < size; ++j) {
+            DP_mpsc_queue_batch_add(batch, encode(p->id, seq++, size - j - 1));
+        }
+        DP_mpsc_queue_push_batch(mqt->queue, batch);
+        DP_queue_waker_wake(mqt->qw);
+    }
+    (void)DP_atomic_dec(&mqt->producers_left);
+    DP_queue_waker_wake(mqt->qw);
+}
+
+static bool should_sleep(void *user)
+{
+    struct MpscQueueTest *mqt = user;
+    return DP_atomic_get(&mqt->producers_left) != 0
+        && !DP_mpsc_queue_peek(mqt->queue);
+}
+
+static void mpsc_queue_single(TEST_PARAMS)
+{
+    DP_MpscQueue *queue = DP_mpsc_queue_new();
+    OK(!DP_mpsc_queue_peek(queue), "new queue is empty");
+
+    DP_mpsc_queue_push(queue, encode(0, 0, 0));
+    DP_MpscQueueBatch *batch = DP_mpsc_queue_batch_new(3);
+    DP_mpsc_queue_batch_add(batch, encode(0, 1, 1));
+    DP_mpsc_queue_batch_add(batch, encode(0, 2, 0));
+    UINT_EQ_OK(DP_mpsc_queue_batch_count(batch), 2, "batch has 2 elements");
+    DP_mpsc_queue_push_batch(queue, batch);
+    DP_mpsc_queue_push_batch(queue, DP_mpsc_queue_batch_new(0));
+    DP_mpsc_queue_push(queue, encode(0, 3, 0));
+
+    bool in_order = true;
+    for (int i = 0; i < 4; ++i) {
+        void *peeked = DP_mpsc_queue_peek(queue);
+        void *shifted = DP_mpsc_queue_shift(queue);
+        int id, seq, left;
+        decode(shifted, &id, &seq, &left);
+        in_order = in_order && peeked == shifted && id == 0 && seq == i;
+    }
+    OK(in_order, "elements come out in order, empty batches skipped");
+    OK(!DP_mpsc_queue_shift(queue), "queue empty after shifting everything");
+
+    DP_mpsc_queue_push(queue, encode(0, 4, 0));
+    DP_mpsc_queue_free(queue, NULL);
+}
+
+static void mpsc_queue_threads(TEST_PARAMS)
+{
+    struct MpscQueueTest mqt = {DP_mpsc_queue_new(), DP_queue_waker_new(),
+                                DP_ATOMIC_INIT(PRODUCER_COUNT)};
+    FATAL(NOT_NULL_OK(mqt.qw, "got queue waker"));
+
+    struct MpscQueueProducer producers[PRODUCER_COUNT];
+    DP_Thread *threads[PRODUCER_COUNT];
+    for (int i = 0; i < PRODUCER_COUNT; ++i) {
+        producers[i] = (struct MpscQueueProducer){&mqt, i};
+        threads[i] = DP_thread_new(run_producer, &producers[i]);
+    }
+
+    int next_seq[PRODUCER_COUNT] = {0};
+    int batch_id = -1;
+    int batch_left = 0;
+    int out_of_order = 0;
+    int torn_batches = 0;
+    while (true) {
+        void *element = DP_mpsc_queue_shift(mqt.queue);
+        if (element) {
+            int id, seq, left;
+            decode(element, &id, &seq, &left);
+            if (seq != next_seq[id]++) {
+                ++out_of_order;
+            }
+            if (batch_left != 0 && (id != batch_id || left != batch_left - 1)) {
+                ++torn_batches;
+            }
+            batch_id = id;
+            batch_left = left;
+        }
+        else if (DP_atomic_get(&mqt.producers_left) == 0
+                 && !DP_mpsc_queue_peek(mqt.queue)) {
+            break;
+        }
+        else {
+            DP_queue_waker_wait(mqt.qw, should_sleep, &mqt);
+        }
+    }
+
+    for (int i = 0; i < PRODUCER_COUNT; ++i) {
+        DP_thread_free_join(threads[i]);
+    }
+
+    int expected_count = 0;
+    for (int i = 0; i < BATCH_COUNT; ++i) {
+        expected_count += i % MAX_BATCH_SIZE + 1;
+    }
+    bool all_received = true;
+    for (int i = 0; i < PRODUCER_COUNT; ++i) {
+        int count = 0;
+        for (int j = 0; j < BATCH_COUNT; ++j) {
+            count += (j + i) % MAX_BATCH_SIZE + 1;
+        }
+        all_received = all_received && next_seq[i] == count;
+    }
+    OK(expected_count > 0 && all_received, "received every element");
+    INT_EQ_OK(out_of_order, 0, "elements of each producer in order");
+    INT_EQ_OK(torn_batches, 0, "batches arrive in one piece");
+
+    DP_queue_waker_free(mqt.qw);
+    DP_mpsc_queue_free(mqt.queue, NULL);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(mpsc_queue_single);
+    REGISTER_TEST(mpsc_queue_threads);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
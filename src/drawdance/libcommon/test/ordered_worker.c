@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/ordered_worker.h>
+#include <dptest.h>
+
+#define ITEM_COUNT   1000
+#define FAIL_INDEX   777
+#define STOP_INDEX   500
+#define THREAD_COUNT 4
+#define WINDOW       3
+
+
+struct OrderedWorkerTest {
+    int stop_index;
+    int next_index;
+    int out_of_order;
+    int failures;
+    bool error_message_ok;
+};
+
+static void *encode_item(DP_UNUSED void *user, int index,
+                         DP_UNUSED int thread_index, size_t *out_size)
+{
+    if (index == FAIL_INDEX) {
+        DP_error_set("Failed on %d", index);
+        return NULL;
+    }
+    else {
+        int *value = DP_malloc(sizeof(*value));
+        *value = index * 2;
+        *out_size = sizeof(*value);
+        return value;
+    }
+}
+
+static bool write_item(void *user, int index, void *buffer, size_t size)
+{
+    struct OrderedWorkerTest *owt = user;
+    if (index != owt->next_index++) {
+        ++owt->out_of_order;
+    }
+
+    if (buffer) {
+        if (size != sizeof(int) || *(int *)buffer != index * 2) {
+            ++owt->out_of_order;
+        }
+        DP_free(buffer);
+    }
+    else {
+        ++owt->failures;
+        owt->error_message_ok = DP_str_equal(DP_error(), "Failed on 777");
+    }
+    return index != owt->stop_index;
+}
+
+static void run_ordered(TEST_PARAMS, int thread_count)
+{
+    DP_OrderedWorker *ow = DP_ordered_worker_new(thread_count, WINDOW);
+    NOT_NULL_OK(ow, "ordered worker created");
+
+    // Run twice, the worker should be reusable.
+    for (int i = 0; i < 2; ++i) {
+        struct OrderedWorkerTest owt = {STOP_INDEX, 0, 0, 0, false};
+        bool ok = DP_ordered_worker_run(ow, ITEM_COUNT, encode_item,
+                                        write_item, &owt);
+        NOK(ok, "run reports stopping");
+        INT_EQ_OK(owt.next_index, STOP_INDEX + 1, "stopped after write");
+        INT_EQ_OK(owt.out_of_order, 0, "everything written in order");
+        INT_EQ_OK(owt.failures, 0, "no failure before stopping");
+    }
+
+    struct OrderedWorkerTest owt = {-1, 0, 0, 0, false};
+    bool ok = DP_ordered_worker_run(ow, FAIL_INDEX + 1, encode_item,
+                                    write_item, &owt);
+    OK(ok, "run to the end succeeds");
+    INT_EQ_OK(owt.next_index, FAIL_INDEX + 1, "all items written");
+    INT_EQ_OK(owt.out_of_order, 0, "everything written in order");
+    INT_EQ_OK(owt.failures, 1, "failure passed to write function");
+    OK(owt.error_message_ok, "error message carried over");
+
+    DP_ordered_worker_free(ow);
+}
+
+static void ordered_worker_serial(TEST_PARAMS)
+{
+    run_ordered(TEST_ARGS, 1);
+}
+
+static void ordered_worker_parallel(TEST_PARAMS)
+{
+    run_ordered(TEST_ARGS, THREAD_COUNT);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(ordered_worker_serial);
+    REGISTER_TEST(ordered_worker_parallel);
+}
+
+int main(int argc, char **argv)
+{
+    return DP_test_main(argc, argv, register_tests, NULL);
+}
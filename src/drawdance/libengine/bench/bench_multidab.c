@@ -400,7 +400,7 @@ static void bench(int count, DP_Message **msgs, const char *save_path)
     DP_CanvasState *cs = init_canvas_state(dc);
     unsigned long long start = DP_perf_time();
     DP_CanvasState *next_cs =
-        DP_canvas_state_handle_multidab(cs, dc, NULL, count, msgs);
+        DP_canvas_state_handle_multidab(cs, dc, NULL, NULL, count, msgs);
     unsigned long long end = DP_perf_time();
 
     if (save_path && !save_image(next_cs, save_path)) {
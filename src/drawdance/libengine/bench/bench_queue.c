@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include <dpcommon/atomic.h>
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/perf.h>
+#include <dpcommon/queue.h>
+#include <dpcommon/threading.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+
+// Pushes batches of pointers into a queue from several producer threads while
+// a single consumer drains it, the same way the GUI and network threads feed
+// the paint engine. Compares a mutex-guarded DP_Queue with a semaphore post
+// per element, which is what the paint engine used to do, against the
+// lock-free DP_MpscQueue with its idle-only wakeup. Reports the time spent
+// in each push call, which is what producers are blocked on.
+
+#define MAX_THREADS 256
+
+typedef enum Mode {
+    MODE_MUTEX,
+    MODE_MPSC,
+} Mode;
+
+struct Args {
+    Mode mode;
+    int threads;
+    int batches;
+    int batch_size;
+};
+
+struct MutexQueue {
+    DP_Mutex *mutex;
+    DP_Semaphore *sem;
+    DP_Queue queue;
+};
+
+struct MpscQueue {
+    DP_MpscQueue *queue;
+    DP_QueueWaker *qw;
+};
+
+struct BenchQueue {
+    const struct Args *args;
+    DP_Semaphore *start_sem;
+    DP_Atomic producers_left;
+    struct MutexQueue mq;
+    struct MpscQueue mpsc;
+};
+
+struct ProducerParams {
+    struct BenchQueue *bq;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+};
+
+static bool parse_int_arg(const char *s, int min_inclusive, int max_inclusive,
+                          int *out_value)
+{
+    char *end;
+    long long value = strtoll(s, &end, 10);
+    if (*end != '\0') {
+        DP_warn("Can't parse '%s'", s);
+        return false;
+    }
+    else if (value < min_inclusive || value > max_inclusive) {
+        DP_warn("%lld out of bounds, min %d, max %d", value, min_inclusive,
+                max_inclusive);
+        return false;
+    }
+    else {
+        *out_value = DP_llong_to_int(value);
+        return true;
+    }
+}
+
+static bool parse_mode_arg(const char *s, Mode *out_mode)
+{
+    if (strcmp(s, "mutex") == 0) {
+        *out_mode = MODE_MUTEX;
+        return true;
+    }
+    else if (strcmp(s, "mpsc") == 0) {
+        *out_mode = MODE_MPSC;
+        return true;
+    }
+    else {
+        DP_warn("Unknown mode '%s', must be 'mutex' or 'mpsc'", s);
+        return false;
+    }
+}
+
+static bool parse_arguments(int argc, char **argv, struct Args *out_args)
+{
+    if (argc != 5) {
+        DP_warn("Usage: %s mutex|mpsc THREADS BATCHES BATCH_SIZE",
+                argc > 0 ? argv[0] : "bench_queue");
+        return false;
+    }
+    return parse_mode_arg(argv[1], &out_args->mode)
+        && parse_int_arg(argv[2], 1, MAX_THREADS, &out_args->threads)
+        && parse_int_arg(argv[3], 1, INT_MAX, &out_args->batches)
+        && parse_int_arg(argv[4], 1, 4096, &out_args->batch_size);
+}
+
+
+static void push_mutex(struct MutexQueue *mq, void *element, int batch_size)
+{
+    DP_MUTEX_MUST_LOCK(mq->mutex);
+    for (int i = 0; i < batch_size; ++i) {
+        *(void **)DP_queue_push(&mq->queue, sizeof(void *)) = element;
+    }
+    DP_MUTEX_MUST_UNLOCK(mq->mutex);
+    DP_SEMAPHORE_MUST_POST_N(mq->sem, batch_size);
+}
+
+static void push_mpsc(struct MpscQueue *mpsc, void *element, int batch_size)
+{
+    DP_MpscQueueBatch *batch =
+        DP_mpsc_queue_batch_new(DP_int_to_size(batch_size));
+    for (int i = 0; i < batch_size; ++i) {
+        DP_mpsc_queue_batch_add(batch, element);
+    }
+    DP_mpsc_queue_push_batch(mpsc->queue, batch);
+    DP_queue_waker_wake(mpsc->qw);
+}
+
+static void run_producer(void *data)
+{
+    struct ProducerParams *params = data;
+    struct BenchQueue *bq = params->bq;
+    const struct Args *args = bq->args;
+    int batch_size = args->batch_size;
+
+    DP_SEMAPHORE_MUST_WAIT(bq->start_sem);
+    for (int i = 0; i < args->batches; ++i) {
+        unsigned long long start = DP_perf_time();
+        if (args->mode == MODE_MUTEX) {
+            push_mutex(&bq->mq, params, batch_size);
+        }
+        else {
+            push_mpsc(&bq->mpsc, params, batch_size);
+        }
+        unsigned long long ns = DP_perf_time() - start;
+        params->total_ns += ns;
+        if (ns > params->max_ns) {
+            params->max_ns = ns;
+        }
+    }
+
+    if (args->mode == MODE_MPSC) {
+        (void)DP_atomic_dec(&bq->producers_left);
+        DP_queue_waker_wake(bq->mpsc.qw);
+    }
+}
+
+static long long consume_mutex(struct MutexQueue *mq, long long total)
+{
+    long long consumed = 0;
+    while (consumed < total) {
+        DP_SEMAPHORE_MUST_WAIT(mq->sem);
+        DP_MUTEX_MUST_LOCK(mq->mutex);
+        DP_queue_shift(&mq->queue);
+        DP_MUTEX_MUST_UNLOCK(mq->mutex);
+        ++consumed;
+    }
+    return consumed;
+}
+
+static bool should_consumer_sleep(void *user)
+{
+    struct BenchQueue *bq = user;
+    return DP_atomic_get(&bq->producers_left) != 0
+        && !DP_mpsc_queue_peek(bq->mpsc.queue);
+}
+
+static long long consume_mpsc(struct BenchQueue *bq)
+{
+    long long consumed = 0;
+    while (true) {
+        if (DP_mpsc_queue_shift(bq->mpsc.queue)) {
+            ++consumed;
+        }
+        else if (DP_atomic_get(&bq->producers_left) == 0
+                 && !DP_mpsc_queue_peek(bq->mpsc.queue)) {
+            return consumed;
+        }
+        else {
+            DP_queue_waker_wait(bq->mpsc.qw, should_consumer_sleep, bq);
+        }
+    }
+}
+
+static void bench(const struct Args *args)
+{
+    int threads = args->threads;
+    struct BenchQueue bq = {args, DP_semaphore_new(0),
+                            DP_ATOMIC_INIT(threads),
+                            {NULL, NULL, DP_QUEUE_NULL},
+                            {NULL, NULL}};
+    if (args->mode == MODE_MUTEX) {
+        bq.mq.mutex = DP_mutex_new();
+        bq.mq.sem = DP_semaphore_new(0);
+        DP_queue_init(&bq.mq.queue, 64, sizeof(void *));
+    }
+    else {
+        bq.mpsc.queue = DP_mpsc_queue_new();
+        bq.mpsc.qw = DP_queue_waker_new();
+    }
+
+    struct ProducerParams params[MAX_THREADS];
+    DP_Thread *thread_handles[MAX_THREADS];
+    for (int i = 0; i < threads; ++i) {
+        params[i] = (struct ProducerParams){&bq, 0, 0};
+        thread_handles[i] = DP_thread_new(run_producer, &params[i]);
+    }
+
+    long long total = DP_int_to_llong(threads)
+                    * DP_int_to_llong(args->batches)
+                    * DP_int_to_llong(args->batch_size);
+    unsigned long long start = DP_perf_time();
+    DP_SEMAPHORE_MUST_POST_N(bq.start_sem, threads);
+    long long consumed = args->mode == MODE_MUTEX
+                           ? consume_mutex(&bq.mq, total)
+                           : consume_mpsc(&bq);
+    for (int i = 0; i < threads; ++i) {
+        DP_thread_free_join(thread_handles[i]);
+    }
+    unsigned long long end = DP_perf_time();
+
+    unsigned long long push_total_ns = 0;
+    unsigned long long push_max_ns = 0;
+    for (int i = 0; i < threads; ++i) {
+        push_total_ns += params[i].total_ns;
+        if (params[i].max_ns > push_max_ns) {
+            push_max_ns = params[i].max_ns;
+        }
+    }
+
+    if (args->mode == MODE_MUTEX) {
+        DP_queue_dispose(&bq.mq.queue);
+        DP_semaphore_free(bq.mq.sem);
+        DP_mutex_free(bq.mq.mutex);
+    }
+    else {
+        DP_queue_waker_free(bq.mpsc.qw);
+        DP_mpsc_queue_free(bq.mpsc.queue, NULL);
+    }
+    DP_semaphore_free(bq.start_sem);
+
+    unsigned long long pushes =
+        DP_int_to_ullong(threads) * DP_int_to_ullong(args->batches);
+    printf("%s, threads %d, %lld of %lld elements, %llu ns\n",
+           args->mode == MODE_MUTEX ? "mutex" : "mpsc", threads, consumed,
+           total, end - start);
+    printf("push %.2f ns average, %llu ns max, %.2f ns per element\n",
+           (double)push_total_ns / (double)pushes, push_max_ns,
+           (double)push_total_ns / (double)total);
+}
+
+int main(int argc, char **argv)
+{
+    struct Args args;
+    if (parse_arguments(argc, argv, &args)) {
+        bench(&args);
+        return 0;
+    }
+    else {
+        return 2;
+    }
+}
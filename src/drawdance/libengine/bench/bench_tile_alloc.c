@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/memory_pool.h>
+#include <dpcommon/perf.h>
+#include <dpcommon/threading.h>
+#include <dpengine/tile.h>
+#include <limits.h>
+#include <stdio.h>
+
+
+// Allocates and frees tiles from several threads at once, similar to what
+// render workers do, to measure contention on the tile memory pool.
+
+#define MAX_THREADS 256
+
+struct Args {
+    int threads;
+    int iterations;
+    int tiles_per_iteration;
+};
+
+struct ThreadParams {
+    const struct Args *args;
+    DP_Semaphore *start_sem;
+    DP_TransientTile **tts;
+};
+
+static bool parse_int_arg(const char *s, int min_inclusive, int max_inclusive,
+                          int *out_value)
+{
+    char *end;
+    long long value = strtoll(s, &end, 10);
+    if (*end != '\0') {
+        DP_warn("Can't parse '%s'", s);
+        return false;
+    }
+    else if (value < min_inclusive || value > max_inclusive) {
+        DP_warn("%lld out of bounds, min %d, max %d", value, min_inclusive,
+                max_inclusive);
+        return false;
+    }
+    else {
+        *out_value = DP_llong_to_int(value);
+        return true;
+    }
+}
+
+static bool parse_arguments(int argc, char **argv, struct Args *out_args)
+{
+    if (argc != 4) {
+        DP_warn("Usage: %s THREADS ITERATIONS TILES_PER_ITERATION",
+                argc > 0 ? argv[0] : "bench_tile_alloc");
+        return false;
+    }
+    return parse_int_arg(argv[1], 1, MAX_THREADS, &out_args->threads)
+        && parse_int_arg(argv[2], 1, INT_MAX, &out_args->iterations)
+        && parse_int_arg(argv[3], 1, 4096, &out_args->tiles_per_iteration);
+}
+
+static void run_thread(void *data)
+{
+    struct ThreadParams *params = data;
+    const struct Args *args = params->args;
+    DP_TransientTile **tts = params->tts;
+    int count = args->tiles_per_iteration;
+
+    DP_SEMAPHORE_MUST_WAIT(params->start_sem);
+    for (int i = 0; i < args->iterations; ++i) {
+        for (int j = 0; j < count; ++j) {
+            tts[j] = DP_transient_tile_new_blank(0);
+        }
+        for (int j = 0; j < count; ++j) {
+            DP_transient_tile_decref(tts[j]);
+        }
+    }
+}
+
+static void bench(const struct Args *args)
+{
+    int threads = args->threads;
+    size_t tiles_per_iteration = DP_int_to_size(args->tiles_per_iteration);
+    DP_Semaphore *start_sem = DP_semaphore_new(0);
+    struct ThreadParams params[MAX_THREADS];
+    DP_Thread *thread_handles[MAX_THREADS];
+
+    for (int i = 0; i < threads; ++i) {
+        params[i] = (struct ThreadParams){
+            args, start_sem,
+            DP_malloc(sizeof(*params[i].tts) * tiles_per_iteration)};
+        thread_handles[i] = DP_thread_new(run_thread, &params[i]);
+    }
+
+    unsigned long long start = DP_perf_time();
+    DP_SEMAPHORE_MUST_POST_N(start_sem, threads);
+    for (int i = 0; i < threads; ++i) {
+        DP_thread_free_join(thread_handles[i]);
+    }
+    unsigned long long end = DP_perf_time();
+
+    for (int i = 0; i < threads; ++i) {
+        DP_free(params[i].tts);
+    }
+    DP_semaphore_free(start_sem);
+
+    unsigned long long total = DP_int_to_ullong(threads)
+                             * DP_int_to_ullong(args->iterations)
+                             * DP_int_to_ullong(args->tiles_per_iteration);
+    DP_MemoryPoolStatistics mps = DP_tile_memory_usage();
+    printf("threads %d, %llu tiles, %llu ns, %.2f ns per tile\n", threads,
+           total, end - start, (double)(end - start) / (double)total);
+    printf("pool %zu buckets of %zu tiles, %zu free\n", mps.buckets_len,
+           mps.bucket_el_count, mps.el_free);
+}
+
+int main(int argc, char **argv)
+{
+    struct Args args;
+    if (parse_arguments(argc, argv, &args)) {
+        bench(&args);
+        return 0;
+    }
+    else {
+        return 2;
+    }
+}
@@ -107,7 +107,7 @@ static DP_CanvasState *handle_preview_messages_multidab(DP_CanvasState *cs,
                                                         DP_Message **msgs)
 {
     DP_CanvasState *next =
-        DP_canvas_state_handle_multidab(cs, dc, NULL, count, msgs);
+        DP_canvas_state_handle_multidab(cs, dc, NULL, NULL, count, msgs);
     if (next) {
         DP_canvas_state_decref(cs);
         return next;
@@ -78,9 +78,14 @@ void DP_canvas_diff_begin(DP_CanvasDiff *diff, int old_width, int old_height,
     diff->xtiles = xtiles;
     diff->ytiles = ytiles;
     if (diff->tile_changes_reserved < count) {
+        int reserved = diff->tile_changes_reserved;
         diff->tile_changes_reserved = count;
         size_t size = DP_int_to_size(count) * sizeof(*diff->tile_changes);
         diff->tile_changes = DP_realloc(diff->tile_changes, size);
+        // Start out unchanged, so that diffs of same-sized canvases only end
+        // up with the tiles marked that were actually checked as changed.
+        memset(diff->tile_changes + reserved, 0,
+               DP_int_to_size(count - reserved) * sizeof(*diff->tile_changes));
     }
     if (old_width != current_width || old_height != current_height) {
         bool *tile_changes = diff->tile_changes;
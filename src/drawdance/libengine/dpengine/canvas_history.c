@@ -81,6 +81,7 @@ struct DP_CanvasHistory {
         DP_Message *buffer[REPLAY_BUFFER_CAPACITY];
     } replay;
     DP_Atomic local_drawing_in_progress;
+    DP_MultidabWorker *mw;
     struct {
         bool want;
         char *dir;
@@ -309,7 +310,8 @@ static void dump_snapshot_message(void *user, DP_Message *msg)
 static void dump_snapshot(DP_CanvasHistory *ch, DP_CanvasState *cs)
 {
     if (dump_check(ch, NULL)) {
-        DP_reset_image_build(cs, 0, dump_snapshot_message, ch);
+        DP_reset_image_build(cs, 0, DP_COMPRESS_PROFILE_MAX,
+                             dump_snapshot_message, ch);
     }
 }
 
@@ -511,6 +513,7 @@ DP_CanvasHistory *DP_canvas_history_new_inc(
         {save_point_fn, save_point_user},
         {0, {0}},
         DP_ATOMIC_INIT(0),
+        NULL,
         {want_dump, DP_strdup(dump_dir), NULL, 0, NULL},
     };
     DP_user_cursors_init(&ch->ucs);
@@ -597,6 +600,13 @@ void DP_canvas_history_want_dump_set(DP_CanvasHistory *ch, bool want_dump)
     ch->dump.want = want_dump;
 }
 
+void DP_canvas_history_multidab_worker_set(DP_CanvasHistory *ch,
+                                           DP_MultidabWorker *mw_or_null)
+{
+    DP_ASSERT(ch);
+    ch->mw = mw_or_null;
+}
+
 DP_CanvasState *DP_canvas_history_get(DP_CanvasHistory *ch)
 {
     DP_ASSERT(ch);
@@ -715,7 +725,7 @@ static DP_CanvasState *flush_replay_buffer(DP_CanvasHistory *ch,
                                            DP_DrawContext *dc)
 {
     DP_CanvasState *next = DP_canvas_state_handle_multidab(
-        cs, dc, NULL, ch->replay.used, ch->replay.buffer);
+        cs, dc, ch->mw, NULL, ch->replay.used, ch->replay.buffer);
     ch->replay.used = 0;
     if (next) {
         DP_canvas_state_decref(cs);
@@ -1560,7 +1570,8 @@ void DP_canvas_history_handle_multidab_dec(DP_CanvasHistory *ch,
 
     if (offset != count) {
         DP_CanvasState *cs = DP_canvas_state_handle_multidab(
-            ch->current_state, dc, &ch->ucs, count - offset, msgs + offset);
+            ch->current_state, dc, ch->mw, &ch->ucs, count - offset,
+            msgs + offset);
         if (cs) {
             set_current_state_with_cursors_noinc(ch, cs);
         }
@@ -1588,8 +1599,8 @@ void DP_canvas_history_handle_local_multidab_dec(DP_CanvasHistory *ch,
         push_fork_entry_noinc(ch, msgs[i]);
     }
 
-    DP_CanvasState *cs = DP_canvas_state_handle_multidab(ch->current_state, dc,
-                                                         &ch->ucs, count, msgs);
+    DP_CanvasState *cs = DP_canvas_state_handle_multidab(
+        ch->current_state, dc, ch->mw, &ch->ucs, count, msgs);
     if (cs) {
         set_current_state_with_cursors_noinc(ch, cs);
     }
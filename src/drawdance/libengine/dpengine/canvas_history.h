@@ -29,6 +29,7 @@
 
 typedef struct DP_DrawContext DP_DrawContext;
 typedef struct DP_Message DP_Message;
+typedef struct DP_MultidabWorker DP_MultidabWorker;
 typedef struct json_value_t JSON_Value;
 
 
@@ -98,6 +99,11 @@ bool DP_canvas_history_want_dump(DP_CanvasHistory *ch);
 
 void DP_canvas_history_want_dump_set(DP_CanvasHistory *ch, bool want_dump);
 
+// Lets multidab batches be drawn in parallel. The worker isn't owned by the
+// history, it has to outlive it or be unset before being freed.
+void DP_canvas_history_multidab_worker_set(DP_CanvasHistory *ch,
+                                           DP_MultidabWorker *mw_or_null);
+
 DP_CanvasState *DP_canvas_history_get(DP_CanvasHistory *ch);
 
 DP_CanvasState *
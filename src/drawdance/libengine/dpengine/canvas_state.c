@@ -47,6 +47,8 @@
 #include <dpcommon/conversions.h>
 #include <dpcommon/geom.h>
 #include <dpcommon/perf.h>
+#include <dpcommon/threading.h>
+#include <dpcommon/worker.h>
 #include <dpmsg/blend_mode.h>
 #include <dpmsg/message.h>
 #include <limits.h>
@@ -808,11 +810,12 @@ static bool next_dab(void *user, DP_PaintDrawDabsParams *out_params)
 }
 
 static DP_CanvasState *handle_draw_dabs(DP_CanvasState *cs, DP_DrawContext *dc,
+                                        DP_MultidabWorker *mw_or_null,
                                         DP_UserCursors *ucs_or_null, int count,
                                         DP_Message **msgs)
 {
     struct DP_NextDabContext c = {0, count, msgs};
-    return DP_ops_draw_dabs(cs, dc, ucs_or_null, next_dab, &c);
+    return DP_ops_draw_dabs(cs, dc, mw_or_null, ucs_or_null, next_dab, &c);
 }
 
 
@@ -1216,7 +1219,7 @@ static DP_CanvasState *handle(DP_CanvasState *cs, DP_DrawContext *dc,
     case DP_MSG_DRAW_DABS_PIXEL:
     case DP_MSG_DRAW_DABS_PIXEL_SQUARE:
     case DP_MSG_DRAW_DABS_MYPAINT:
-        return handle_draw_dabs(cs, dc, ucs_or_null, 1, &msg);
+        return handle_draw_dabs(cs, dc, NULL, ucs_or_null, 1, &msg);
     case DP_MSG_MOVE_RECT:
         return handle_move_rect(cs, ucs_or_null, DP_message_context_id(msg),
                                 DP_msg_move_rect_cast(msg));
@@ -1274,6 +1277,7 @@ DP_CanvasState *DP_canvas_state_handle(DP_CanvasState *cs, DP_DrawContext *dc,
 
 DP_CanvasState *DP_canvas_state_handle_multidab(DP_CanvasState *cs,
                                                 DP_DrawContext *dc,
+                                                DP_MultidabWorker *mw_or_null,
                                                 DP_UserCursors *ucs_or_null,
                                                 int count, DP_Message **msgs)
 {
@@ -1282,7 +1286,7 @@ DP_CanvasState *DP_canvas_state_handle_multidab(DP_CanvasState *cs,
     DP_ASSERT(count <= 0 || msgs);
     DP_PERF_BEGIN_DETAIL(fn, "handle_multidab", "count=%d", (int)count);
     DP_CanvasState *next_cs =
-        handle_draw_dabs(cs, dc, ucs_or_null, count, msgs);
+        handle_draw_dabs(cs, dc, mw_or_null, ucs_or_null, count, msgs);
     DP_PERF_END(fn);
     return next_cs;
 }
@@ -1338,6 +1342,120 @@ static void init_flattening_tile(DP_TransientTile *tt, DP_Tile *background_tile)
     }
 }
 
+// Tiles are flattened independently of each other, so larger areas get spread
+// across a pool of worker threads. The pool is shared by all callers and lives
+// as long as the process, since spinning up threads for every flattening is too
+// expensive. Handing off isn't free either, so it's not worth it for just a
+// handful of tiles.
+#define FLATTEN_PARALLEL_MIN_TILES 16
+
+typedef void (*DP_FlattenTileFn)(void *context, DP_TileIterator *ti,
+                                 int tile_index, int thread_index);
+
+struct DP_FlattenJob {
+    DP_FlattenTileFn fn;
+    void *context;
+    DP_Semaphore *sem;
+    DP_TileIterator ti;
+    int tile_index;
+};
+
+static DP_Worker *flatten_worker;
+static bool flatten_worker_initialized;
+
+static void flatten_job(void *element, int thread_index)
+{
+    struct DP_FlattenJob *job = element;
+    job->fn(job->context, &job->ti, job->tile_index, thread_index);
+    DP_SEMAPHORE_MUST_POST(job->sem);
+}
+
+static void init_flatten_worker(void)
+{
+    DP_ATOMIC_DECLARE_STATIC_SPIN_LOCK(flatten_worker_spinlock);
+    if (!flatten_worker_initialized) {
+        DP_atomic_lock(&flatten_worker_spinlock);
+        if (!flatten_worker_initialized) {
+            int thread_count = DP_worker_cpu_count(128);
+            if (thread_count > 1) {
+                flatten_worker =
+                    DP_worker_new(128, sizeof(struct DP_FlattenJob),
+                                  thread_count, flatten_job);
+                if (!flatten_worker) {
+                    DP_warn("Flatten worker: %s, flattening serially",
+                            DP_error());
+                }
+            }
+            flatten_worker_initialized = true;
+        }
+        DP_atomic_unlock(&flatten_worker_spinlock);
+    }
+}
+
+// Returns NULL if the tiles should be flattened on the calling thread instead.
+// That's the case for small areas and on single-core machines, but also when
+// we're on a worker thread already, such as when saving animation frames. Those
+// threads already keep the cores busy and would just pile up in the queue.
+static DP_Worker *flatten_worker_get(int tile_count)
+{
+    if (tile_count < FLATTEN_PARALLEL_MIN_TILES
+        || DP_worker_on_worker_thread()) {
+        return NULL;
+    }
+    init_flatten_worker();
+    return flatten_worker;
+}
+
+static int count_area_tiles(DP_TileIterator *ti)
+{
+    return DP_rect_width(ti->tile_area) * DP_rect_height(ti->tile_area);
+}
+
+// Calls the given function for every tile of the iterator, on the worker if
+// given, and waits until all of them are done. Thread indexes passed to the
+// function are less than the worker's thread count, or 0 without a worker.
+static void flatten_each_tile(DP_Worker *worker_or_null, DP_TileIterator *ti,
+                              int wt, DP_FlattenTileFn fn, void *context)
+{
+    DP_Semaphore *sem = worker_or_null ? DP_semaphore_new(0) : NULL;
+    int pushed = 0;
+    while (DP_tile_iterator_next(ti)) {
+        int i = ti->row * wt + ti->col;
+        if (sem) {
+            DP_worker_push(worker_or_null,
+                           &(struct DP_FlattenJob){fn, context, sem, *ti, i});
+            ++pushed;
+        }
+        else {
+            fn(context, ti, i, 0);
+        }
+    }
+    if (sem) {
+        DP_SEMAPHORE_MUST_WAIT_N(sem, pushed);
+        DP_semaphore_free(sem);
+    }
+}
+
+struct DP_FlatLayerContext {
+    DP_CanvasState *cs;
+    DP_TransientLayerContent *tlc;
+    DP_Tile *background_tile;
+    bool include_sublayers;
+    DP_ViewModeFilter vmf;
+};
+
+static void flatten_layer_tile(void *context, DP_UNUSED DP_TileIterator *ti,
+                               int tile_index, DP_UNUSED int thread_index)
+{
+    struct DP_FlatLayerContext *c = context;
+    DP_TransientTile *tt = DP_transient_tile_new_blank(0);
+    init_flattening_tile(tt, c->background_tile);
+    DP_canvas_state_flatten_tile_to(c->cs, tile_index, tt, c->include_sublayers,
+                                    &c->vmf);
+    DP_transient_layer_content_transient_tile_set_noinc(c->tlc, tt,
+                                                        tile_index);
+}
+
 DP_TransientLayerContent *
 DP_canvas_state_to_flat_layer(DP_CanvasState *cs, unsigned int flags,
                               const DP_ViewModeFilter *vmf_or_null)
@@ -1349,21 +1467,19 @@ DP_canvas_state_to_flat_layer(DP_CanvasState *cs, unsigned int flags,
     DP_TransientLayerContent *tlc =
         DP_transient_layer_content_new_init(width, height, NULL);
 
-    DP_Tile *background_tile = get_flat_background_tile_or_null(cs, flags);
+    struct DP_FlatLayerContext c = {
+        cs,
+        tlc,
+        get_flat_background_tile_or_null(cs, flags),
+        flags & DP_FLAT_IMAGE_INCLUDE_SUBLAYERS,
+        vmf_or_null ? *vmf_or_null : DP_view_mode_filter_make_default(),
+    };
     int wt = DP_tile_count_round(width);
-    bool include_sublayers = flags & DP_FLAT_IMAGE_INCLUDE_SUBLAYERS;
-    DP_ViewModeFilter vmf =
-        vmf_or_null ? *vmf_or_null : DP_view_mode_filter_make_default();
 
     DP_TileIterator ti = DP_tile_iterator_make(
         cs->width, cs->height, DP_rect_make(0, 0, width, height));
-    while (DP_tile_iterator_next(&ti)) {
-        DP_TransientTile *tt = DP_transient_tile_new_blank(0);
-        init_flattening_tile(tt, background_tile);
-        int i = ti.row * wt + ti.col;
-        DP_canvas_state_flatten_tile_to(cs, i, tt, include_sublayers, &vmf);
-        DP_transient_layer_content_transient_tile_set_noinc(tlc, tt, i);
-    }
+    flatten_each_tile(flatten_worker_get(count_area_tiles(&ti)), &ti, wt,
+                      flatten_layer_tile, &c);
 
     return tlc;
 }
@@ -1427,6 +1543,32 @@ DP_TransientTile *DP_canvas_state_flatten_tile_to(DP_CanvasState *cs,
     return tt;
 }
 
+struct DP_FlattenCanvasContext {
+    DP_CanvasState *cs;
+    DP_Tile *background_tile;
+    bool include_sublayers;
+    DP_ViewModeFilter vmf;
+    void (*to_buffer)(void *, DP_TransientTile *, DP_TileIterator *);
+    void *buffer;
+    // One scratch tile per worker thread, allocated on first use.
+    DP_TransientTile **tts;
+};
+
+static void flatten_canvas_tile(void *context, DP_TileIterator *ti,
+                                int tile_index, int thread_index)
+{
+    struct DP_FlattenCanvasContext *c = context;
+    DP_TransientTile *tt = c->tts[thread_index];
+    if (!tt) {
+        tt = DP_transient_tile_new_blank(0);
+        c->tts[thread_index] = tt;
+    }
+    init_flattening_tile(tt, c->background_tile);
+    DP_canvas_state_flatten_tile_to(c->cs, tile_index, tt,
+                                    c->include_sublayers, &c->vmf);
+    c->to_buffer(c->buffer, tt, ti);
+}
+
 static void *flatten_canvas(
     DP_CanvasState *cs, unsigned int flags, const DP_Rect *area_or_null,
     const DP_ViewModeFilter *vmf_or_null, void *(*get_buffer)(void *, int, int),
@@ -1440,22 +1582,28 @@ static void *flatten_canvas(
         return NULL;
     }
 
-    DP_Tile *background_tile = get_flat_background_tile_or_null(cs, flags);
-    int wt = DP_tile_count_round(cs->width);
-    bool include_sublayers = flags & DP_FLAT_IMAGE_INCLUDE_SUBLAYERS;
-    DP_ViewModeFilter vmf =
-        vmf_or_null ? *vmf_or_null : DP_view_mode_filter_make_default();
-
     void *buffer = get_buffer(user, DP_rect_width(area), DP_rect_height(area));
-    DP_TransientTile *tt = DP_transient_tile_new_blank(0);
     DP_TileIterator ti = DP_tile_iterator_make(cs->width, cs->height, area);
-    while (DP_tile_iterator_next(&ti)) {
-        init_flattening_tile(tt, background_tile);
-        int i = ti.row * wt + ti.col;
-        DP_canvas_state_flatten_tile_to(cs, i, tt, include_sublayers, &vmf);
-        to_buffer(buffer, tt, &ti);
+    DP_Worker *worker = flatten_worker_get(count_area_tiles(&ti));
+    int thread_count = worker ? DP_worker_thread_count(worker) : 1;
+
+    struct DP_FlattenCanvasContext c = {
+        cs,
+        get_flat_background_tile_or_null(cs, flags),
+        flags & DP_FLAT_IMAGE_INCLUDE_SUBLAYERS,
+        vmf_or_null ? *vmf_or_null : DP_view_mode_filter_make_default(),
+        to_buffer,
+        buffer,
+        DP_malloc_zeroed(sizeof(*c.tts) * DP_int_to_size(thread_count)),
+    };
+    int wt = DP_tile_count_round(cs->width);
+
+    flatten_each_tile(worker, &ti, wt, flatten_canvas_tile, &c);
+
+    for (int i = 0; i < thread_count; ++i) {
+        DP_transient_tile_decref_nullable(c.tts[i]);
     }
-    DP_transient_tile_decref(tt);
+    DP_free(c.tts);
     return buffer;
 }
 
@@ -1488,6 +1636,21 @@ DP_Image *DP_canvas_state_to_flat_image(DP_CanvasState *cs, unsigned int flags,
                           NULL);
 }
 
+DP_UPixel8 *DP_canvas_state_to_flat_upixels8_cropped(
+    DP_CanvasState *cs, unsigned int flags,
+    const DP_ViewModeFilter *vmf_or_null, int *out_offset_x, int *out_offset_y,
+    int *out_width, int *out_height)
+{
+    DP_ASSERT(cs);
+    DP_ASSERT(DP_atomic_get(&cs->refcount) > 0);
+    DP_LayerContent *lc = DP_transient_layer_content_persist(
+        DP_canvas_state_to_flat_layer(cs, flags, vmf_or_null));
+    DP_UPixel8 *pixels = DP_layer_content_to_upixels8_cropped(
+        lc, false, out_offset_x, out_offset_y, out_width, out_height);
+    DP_layer_content_decref(lc);
+    return pixels;
+}
+
 static void *to_flat_separated_urgba8_get_buffer(void *user,
                                                  DP_UNUSED int width,
                                                  DP_UNUSED int height)
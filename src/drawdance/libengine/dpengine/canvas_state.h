@@ -34,6 +34,7 @@ typedef struct DP_LayerList DP_LayerList;
 typedef struct DP_LayerPropsList DP_LayerPropsList;
 typedef struct DP_LayerRoutes DP_LayerRoutes;
 typedef struct DP_Message DP_Message;
+typedef struct DP_MultidabWorker DP_MultidabWorker;
 typedef struct DP_Rect DP_Rect;
 typedef struct DP_Tile DP_Tile;
 typedef struct DP_Timeline DP_Timeline;
@@ -118,8 +119,10 @@ DP_CanvasState *DP_canvas_state_handle(DP_CanvasState *cs, DP_DrawContext *dc,
                                        DP_UserCursors *ucs_or_null,
                                        DP_Message *msg);
 
+// If a worker is given, independent parts of the batch are drawn in parallel.
 DP_CanvasState *DP_canvas_state_handle_multidab(DP_CanvasState *cs,
                                                 DP_DrawContext *dc,
+                                                DP_MultidabWorker *mw_or_null,
                                                 DP_UserCursors *ucs_or_null,
                                                 int count, DP_Message **msgs);
 
@@ -136,6 +139,13 @@ DP_Image *DP_canvas_state_to_flat_image(DP_CanvasState *cs, unsigned int flags,
                                         const DP_Rect *area_or_null,
                                         const DP_ViewModeFilter *vmf_or_null);
 
+// Flattens the canvas and returns only the part of it that isn't transparent,
+// see DP_layer_content_to_upixels8_cropped. Returns NULL if there's nothing.
+DP_UPixel8 *DP_canvas_state_to_flat_upixels8_cropped(
+    DP_CanvasState *cs, unsigned int flags,
+    const DP_ViewModeFilter *vmf_or_null, int *out_offset_x, int *out_offset_y,
+    int *out_width, int *out_height);
+
 bool DP_canvas_state_to_flat_separated_urgba8(
     DP_CanvasState *cs, unsigned int flags, const DP_Rect *area_or_null,
     const DP_ViewModeFilter *vmf_or_null, unsigned char *buffer);
@@ -20,9 +20,11 @@
  * SOFTWARE.
  */
 #include "compress.h"
+#include <dpcommon/atomic.h>
 #include <dpcommon/binary.h>
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
+#include <dpcommon/threading.h>
 #include <zlib.h>
 
 
@@ -108,44 +110,121 @@ static void free_deflate_z_stream(z_stream *stream)
     }
 }
 
+typedef struct DP_DeflateContext {
+    bool initialized[DP_COMPRESS_PROFILE_COUNT];
+    z_stream streams[DP_COMPRESS_PROFILE_COUNT];
+} DP_DeflateContext;
+
+static DP_ThreadLocal *deflate_context_local;
+
+static void deflate_context_free(void *value)
+{
+    DP_DeflateContext *dc = value;
+    for (int i = 0; i < DP_COMPRESS_PROFILE_COUNT; ++i) {
+        if (dc->initialized[i]) {
+            free_deflate_z_stream(&dc->streams[i]);
+        }
+    }
+    DP_free(dc);
+}
+
+static DP_DeflateContext *deflate_context_get(void)
+{
+    DP_ATOMIC_DECLARE_STATIC_SPIN_LOCK(deflate_context_spinlock);
+    if (!deflate_context_local) {
+        DP_atomic_lock(&deflate_context_spinlock);
+        if (!deflate_context_local) {
+            deflate_context_local = DP_thread_local_new(deflate_context_free);
+        }
+        DP_atomic_unlock(&deflate_context_spinlock);
+    }
+
+    DP_DeflateContext *dc = DP_thread_local_get(deflate_context_local);
+    if (!dc) {
+        dc = DP_malloc_zeroed(sizeof(*dc));
+        DP_thread_local_set(deflate_context_local, dc);
+    }
+    return dc;
+}
+
+static int profile_to_level(DP_CompressProfile profile)
+{
+    switch (profile) {
+    case DP_COMPRESS_PROFILE_FAST:
+        return 1;
+    case DP_COMPRESS_PROFILE_BALANCED:
+        return 6;
+    case DP_COMPRESS_PROFILE_MAX:
+        return 9;
+    }
+    DP_UNREACHABLE();
+}
+
+static z_stream *deflate_stream_get(DP_CompressProfile profile)
+{
+    DP_DeflateContext *dc = deflate_context_get();
+    z_stream *stream = &dc->streams[profile];
+    if (dc->initialized[profile]) {
+        int ret = deflateReset(stream);
+        if (ret == Z_OK) {
+            return stream;
+        }
+        DP_warn("Deflate reset error %d: %s", ret, get_z_error(stream));
+        free_deflate_z_stream(stream);
+        dc->initialized[profile] = false;
+    }
+
+    *stream = (z_stream){0};
+    stream->zalloc = malloc_z;
+    stream->zfree = free_z;
+    int ret = deflateInit(stream, profile_to_level(profile));
+    if (ret != Z_OK) {
+        DP_error_set("Deflate init error %d: %s", ret, get_z_error(stream));
+        return NULL;
+    }
+    dc->initialized[profile] = true;
+    return stream;
+}
+
 size_t DP_compress_deflate(const unsigned char *in, size_t in_size,
                            unsigned char *(*get_output_buffer)(size_t, void *),
                            void *user)
 {
-    z_stream stream = {0};
-    stream.zalloc = malloc_z;
-    stream.zfree = free_z;
+    return DP_compress_deflate_profile(DP_COMPRESS_PROFILE_MAX, in, in_size,
+                                       get_output_buffer, user);
+}
 
-    int ret = deflateInit(&stream, 9);
-    if (ret != Z_OK) {
-        DP_error_set("Deflate init error %d: %s", ret, get_z_error(&stream));
+size_t DP_compress_deflate_profile(
+    DP_CompressProfile profile, const unsigned char *in, size_t in_size,
+    unsigned char *(*get_output_buffer)(size_t, void *), void *user)
+{
+    DP_ASSERT(profile >= 0);
+    DP_ASSERT(profile < DP_COMPRESS_PROFILE_COUNT);
+    z_stream *stream = deflate_stream_get(profile);
+    if (!stream) {
         return 0;
     }
 
-    unsigned long bound = deflateBound(&stream, DP_size_to_ulong(in_size));
+    unsigned long bound = deflateBound(stream, DP_size_to_ulong(in_size));
     size_t out_size = bound + 4;
 
     unsigned char *out = get_output_buffer(out_size, user);
     if (!out) {
-        free_deflate_z_stream(&stream);
         return 0; // The function should have already set the error message.
     }
 
     DP_write_bigendian_uint32(DP_size_to_uint32(in_size), out);
 
-    stream.avail_out = DP_ulong_to_uint(bound);
-    stream.next_out = out + 4;
-    stream.avail_in = DP_size_to_uint(in_size);
-    stream.next_in = (z_const unsigned char *)in;
-    ret = deflate(&stream, Z_FINISH);
+    stream->avail_out = DP_ulong_to_uint(bound);
+    stream->next_out = out + 4;
+    stream->avail_in = DP_size_to_uint(in_size);
+    stream->next_in = (z_const unsigned char *)in;
+    int ret = deflate(stream, Z_FINISH);
     if (ret != Z_STREAM_END) {
         DP_error_set("Deflate compression error %d: %s", ret,
-                     get_z_error(&stream));
-        free_deflate_z_stream(&stream);
+                     get_z_error(stream));
         return 0;
     }
 
-    size_t out_used = out_size - stream.avail_out;
-    free_deflate_z_stream(&stream);
-    return out_used;
+    return out_size - stream->avail_out;
 }
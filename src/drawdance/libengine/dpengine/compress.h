@@ -28,9 +28,28 @@ bool DP_compress_inflate(const unsigned char *in, size_t in_size,
                          unsigned char *(*get_output_buffer)(size_t, void *),
                          void *user);
 
+// How hard deflate should try. Live data, like tiles that are sent to other
+// clients right away, should use something quick, while data that gets saved
+// or sent around many times is worth the extra time for the smallest result.
+typedef enum DP_CompressProfile {
+    DP_COMPRESS_PROFILE_FAST,
+    DP_COMPRESS_PROFILE_BALANCED,
+    DP_COMPRESS_PROFILE_MAX,
+} DP_CompressProfile;
+
+#define DP_COMPRESS_PROFILE_COUNT (DP_COMPRESS_PROFILE_MAX + 1)
+
+// Compresses with the maximum profile.
 size_t DP_compress_deflate(const unsigned char *in, size_t in_size,
                            unsigned char *(*get_output_buffer)(size_t, void *),
                            void *user);
 
+// Each thread keeps a compressor around for each profile and resets it between
+// calls, so compressing lots of small buffers doesn't set up and tear down the
+// whole deflate state every time.
+size_t DP_compress_deflate_profile(
+    DP_CompressProfile profile, const unsigned char *in, size_t in_size,
+    unsigned char *(*get_output_buffer)(size_t, void *), void *user);
+
 
 #endif
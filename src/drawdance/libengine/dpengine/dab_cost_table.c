@@ -0,0 +1,366 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "dab_cost_table.h"
+#include "brush.h"
+#include "canvas_state.h"
+#include "dab_cost.h"
+#include "layer_content.h"
+#include "layer_list.h"
+#include "layer_props.h"
+#include "layer_props_list.h"
+#include "tile.h"
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/perf.h>
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+
+
+// Small dabs on a small canvas, so that a calibration step stays short even
+// for the slowest blend modes. That overestimates the cost a bit, since the
+// per-dab overhead weighs in more, but erring on that side is harmless.
+#define CALIBRATION_LAYER_ID      0x100
+#define CALIBRATION_CANVAS        256
+#define CALIBRATION_DAB_SIZE      64
+#define CALIBRATION_DAB_COUNT     4
+#define CALIBRATION_RUNS          3
+#define CALIBRATION_MYPAINT_STEPS 5
+
+static void update_fallback(DP_DabCostBlendModes *bm)
+{
+    double fallback = bm->indirect;
+    for (int i = 0; i < DP_BLEND_MODE_COUNT; ++i) {
+        if (DP_blend_mode_valid_for_brush(i) && bm->direct[i] > fallback) {
+            fallback = bm->direct[i];
+        }
+    }
+
+    bm->fallback = fallback;
+    for (int i = 0; i < DP_BLEND_MODE_COUNT; ++i) {
+        if (!DP_blend_mode_valid_for_brush(i)) {
+            bm->direct[i] = fallback;
+        }
+    }
+}
+
+static void init_blend_modes(DP_DabCostBlendModes *bm,
+                             double (*get_cost)(bool, int))
+{
+    bm->indirect = get_cost(true, DP_BLEND_MODE_NORMAL);
+    for (int i = 0; i < DP_BLEND_MODE_COUNT; ++i) {
+        bm->direct[i] = DP_blend_mode_valid_for_brush(i) ? get_cost(false, i)
+                                                         : 0.0;
+    }
+    update_fallback(bm);
+}
+
+void DP_dab_cost_table_init(DP_DabCostTable *table)
+{
+    DP_ASSERT(table);
+    init_blend_modes(&table->pixel, DP_dab_cost_pixel);
+    init_blend_modes(&table->pixel_square, DP_dab_cost_pixel_square);
+    init_blend_modes(&table->classic, DP_dab_cost_classic);
+    table->mypaint = (DP_DabCostMyPaint){
+        DP_dab_cost_mypaint(true, 0, 0, 0),
+        DP_dab_cost_mypaint(false, UINT8_MAX, 0, 0),
+        DP_dab_cost_mypaint(false, 0, UINT8_MAX, 0),
+        DP_dab_cost_mypaint(false, 0, 0, UINT8_MAX),
+        DP_dab_cost_mypaint(false, 0, 0, 0),
+    };
+}
+
+
+static double get_blend_mode_cost(const DP_DabCostBlendModes *bm,
+                                  bool indirect, int blend_mode)
+{
+    if (indirect) {
+        return bm->indirect;
+    }
+    else if (blend_mode >= 0 && blend_mode < DP_BLEND_MODE_COUNT) {
+        return bm->direct[blend_mode];
+    }
+    else {
+        return bm->fallback;
+    }
+}
+
+double DP_dab_cost_table_pixel(const DP_DabCostTable *table, bool indirect,
+                               int blend_mode)
+{
+    DP_ASSERT(table);
+    return get_blend_mode_cost(&table->pixel, indirect, blend_mode);
+}
+
+double DP_dab_cost_table_pixel_square(const DP_DabCostTable *table,
+                                      bool indirect, int blend_mode)
+{
+    DP_ASSERT(table);
+    return get_blend_mode_cost(&table->pixel_square, indirect, blend_mode);
+}
+
+double DP_dab_cost_table_classic(const DP_DabCostTable *table, bool indirect,
+                                 int blend_mode)
+{
+    DP_ASSERT(table);
+    return get_blend_mode_cost(&table->classic, indirect, blend_mode);
+}
+
+double DP_dab_cost_table_mypaint(const DP_DabCostTable *table, bool indirect,
+                                 uint8_t lock_alpha, uint8_t colorize,
+                                 uint8_t posterize)
+{
+    DP_ASSERT(table);
+    const DP_DabCostMyPaint *mp = &table->mypaint;
+    if (indirect) {
+        return mp->indirect;
+    }
+    else {
+        double cost = 0.0;
+        if (lock_alpha != 0) {
+            cost += mp->lock_alpha;
+        }
+        if (colorize != 0) {
+            cost += mp->colorize;
+        }
+        if (posterize != 0) {
+            cost += mp->posterize;
+        }
+        if (lock_alpha != UINT8_MAX && colorize != UINT8_MAX
+            && posterize != UINT8_MAX) {
+            cost += mp->normal;
+        }
+        return cost;
+    }
+}
+
+
+typedef enum DP_DabCostKind {
+    DP_DAB_COST_KIND_PIXEL,
+    DP_DAB_COST_KIND_PIXEL_SQUARE,
+    DP_DAB_COST_KIND_CLASSIC,
+    DP_DAB_COST_KIND_MYPAINT,
+} DP_DabCostKind;
+
+static int count_brush_blend_modes(void)
+{
+    int count = 0;
+    for (int i = 0; i < DP_BLEND_MODE_COUNT; ++i) {
+        if (DP_blend_mode_valid_for_brush(i)) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+static int nth_brush_blend_mode(int n)
+{
+    int i = 0;
+    while (!DP_blend_mode_valid_for_brush(i) || n-- != 0) {
+        ++i;
+        DP_ASSERT(i < DP_BLEND_MODE_COUNT);
+    }
+    return i;
+}
+
+int DP_dab_cost_table_calibration_step_count(void)
+{
+    // Indirect plus every blend mode for pixel, pixel square and classic.
+    return (count_brush_blend_modes() + 1) * 3 + CALIBRATION_MYPAINT_STEPS;
+}
+
+static void set_pixel_dabs(int count, DP_PixelDab *pds, DP_UNUSED void *user)
+{
+    for (int i = 0; i < count; ++i) {
+        DP_pixel_dab_init(pds, i, 0, 0, CALIBRATION_DAB_SIZE, UINT8_MAX);
+    }
+}
+
+static void set_classic_dabs(int count, DP_ClassicDab *cds,
+                             DP_UNUSED void *user)
+{
+    for (int i = 0; i < count; ++i) {
+        DP_classic_dab_init(cds, i, 0, 0, CALIBRATION_DAB_SIZE * 256, 127,
+                            UINT8_MAX);
+    }
+}
+
+static void set_mypaint_dabs(int count, DP_MyPaintDab *mpds,
+                             DP_UNUSED void *user)
+{
+    for (int i = 0; i < count; ++i) {
+        DP_mypaint_dab_init(mpds, i, 0, 0, CALIBRATION_DAB_SIZE * 256, 127,
+                            UINT8_MAX, 0, 0);
+    }
+}
+
+static DP_Message *make_blend_mode_message(DP_DabCostKind kind, bool indirect,
+                                           int blend_mode)
+{
+    int32_t center = CALIBRATION_CANVAS / 2;
+    uint32_t color = indirect ? 0xff336699u : 0x00336699u;
+    uint8_t mode = DP_int_to_uint8(blend_mode);
+    if (kind == DP_DAB_COST_KIND_PIXEL) {
+        return DP_msg_draw_dabs_pixel_new(
+            1, CALIBRATION_LAYER_ID, center, center, color, mode,
+            set_pixel_dabs, CALIBRATION_DAB_COUNT, NULL);
+    }
+    else if (kind == DP_DAB_COST_KIND_PIXEL_SQUARE) {
+        return DP_msg_draw_dabs_pixel_square_new(
+            1, CALIBRATION_LAYER_ID, center, center, color, mode,
+            set_pixel_dabs, CALIBRATION_DAB_COUNT, NULL);
+    }
+    else {
+        DP_ASSERT(kind == DP_DAB_COST_KIND_CLASSIC);
+        return DP_msg_draw_dabs_classic_new(
+            1, CALIBRATION_LAYER_ID, center * 4, center * 4, color, mode,
+            set_classic_dabs, CALIBRATION_DAB_COUNT, NULL);
+    }
+}
+
+// Same parameters that generate_dab_cost.py uses for the default table.
+static DP_Message *make_mypaint_message(int index)
+{
+    static const uint8_t params[CALIBRATION_MYPAINT_STEPS][4] = {
+        {0, 0, 0, DP_MYPAINT_BRUSH_MODE_FLAG | DP_MYPAINT_BRUSH_MODE_NORMAL},
+        {UINT8_MAX, 0, 0, 0},
+        {0, UINT8_MAX, 0, 0},
+        {0, 0, UINT8_MAX, 127},
+        {0, 0, 0, 0},
+    };
+    int32_t center = CALIBRATION_CANVAS / 2 * 4;
+    const uint8_t *p = params[index];
+    return DP_msg_draw_dabs_mypaint_new(1, CALIBRATION_LAYER_ID, center,
+                                        center, 0xff336699u, p[0], p[1], p[2],
+                                        p[3], set_mypaint_dabs,
+                                        CALIBRATION_DAB_COUNT, NULL);
+}
+
+static DP_CanvasState *make_canvas_state(DP_DrawContext *dc)
+{
+    DP_TransientCanvasState *tcs = DP_transient_canvas_state_new_init();
+    DP_transient_canvas_state_width_set(tcs, CALIBRATION_CANVAS);
+    DP_transient_canvas_state_height_set(tcs, CALIBRATION_CANVAS);
+
+    DP_TransientLayerList *tll =
+        DP_transient_canvas_state_transient_layers(tcs, 1);
+    DP_TransientLayerPropsList *tlpl =
+        DP_transient_canvas_state_transient_layer_props(tcs, 1);
+
+    DP_Tile *t = DP_tile_new_from_bgra(0, 0xffffffff);
+    DP_TransientLayerContent *tlc = DP_transient_layer_content_new_init(
+        CALIBRATION_CANVAS, CALIBRATION_CANVAS, t);
+    DP_tile_decref(t);
+
+    DP_TransientLayerProps *tlp =
+        DP_transient_layer_props_new_init(CALIBRATION_LAYER_ID, false);
+
+    DP_transient_layer_list_insert_transient_content_noinc(tll, tlc, 0);
+    DP_transient_layer_props_list_insert_transient_noinc(tlpl, tlp, 0);
+
+    DP_transient_canvas_state_layer_routes_reindex(tcs, dc);
+    return DP_transient_canvas_state_persist(tcs);
+}
+
+// Returns the median time of drawing the message onto a fresh canvas, divided
+// by the number of dabs and the square of their size in the given units.
+static double measure(DP_DrawContext *dc, DP_Message *msg, double size)
+{
+    DP_CanvasState *cs = make_canvas_state(dc);
+    unsigned long long times[CALIBRATION_RUNS];
+    for (int i = 0; i < CALIBRATION_RUNS; ++i) {
+        unsigned long long start = DP_perf_time();
+        DP_CanvasState *next_cs =
+            DP_canvas_state_handle_multidab(cs, dc, NULL, NULL, 1, &msg);
+        times[i] = DP_perf_time() - start;
+        DP_canvas_state_decref(next_cs);
+    }
+    DP_canvas_state_decref(cs);
+    DP_message_decref(msg);
+
+    for (int i = 1; i < CALIBRATION_RUNS; ++i) {
+        for (int j = i; j > 0 && times[j - 1] > times[j]; --j) {
+            unsigned long long tmp = times[j - 1];
+            times[j - 1] = times[j];
+            times[j] = tmp;
+        }
+    }
+    double median = (double)times[CALIBRATION_RUNS / 2];
+    return median / (CALIBRATION_DAB_COUNT * size * size);
+}
+
+static void calibrate_blend_mode(DP_DabCostBlendModes *bm, DP_DrawContext *dc,
+                                 DP_DabCostKind kind, int index)
+{
+    double size = kind == DP_DAB_COST_KIND_CLASSIC
+                    ? CALIBRATION_DAB_SIZE * 256.0
+                    : (double)CALIBRATION_DAB_SIZE;
+    if (index == 0) {
+        DP_Message *msg =
+            make_blend_mode_message(kind, true, DP_BLEND_MODE_NORMAL);
+        bm->indirect = measure(dc, msg, size);
+    }
+    else {
+        int blend_mode = nth_brush_blend_mode(index - 1);
+        DP_Message *msg = make_blend_mode_message(kind, false, blend_mode);
+        bm->direct[blend_mode] = measure(dc, msg, size);
+    }
+    update_fallback(bm);
+}
+
+static void calibrate_mypaint(DP_DabCostMyPaint *mp, DP_DrawContext *dc,
+                              int index)
+{
+    double cost = measure(dc, make_mypaint_message(index),
+                          CALIBRATION_DAB_SIZE * 256.0);
+    switch (index) {
+    case 0:
+        mp->indirect = cost;
+        break;
+    case 1:
+        mp->lock_alpha = cost;
+        break;
+    case 2:
+        mp->colorize = cost;
+        break;
+    case 3:
+        mp->posterize = cost;
+        break;
+    default:
+        mp->normal = cost;
+        break;
+    }
+}
+
+void DP_dab_cost_table_calibrate_step(DP_DabCostTable *table,
+                                      DP_DrawContext *dc, int step)
+{
+    DP_ASSERT(table);
+    DP_ASSERT(dc);
+    DP_ASSERT(step >= 0);
+    DP_ASSERT(step < DP_dab_cost_table_calibration_step_count());
+    int per_kind = count_brush_blend_modes() + 1;
+    switch (step / per_kind) {
+    case DP_DAB_COST_KIND_PIXEL:
+        calibrate_blend_mode(&table->pixel, dc, DP_DAB_COST_KIND_PIXEL,
+                             step % per_kind);
+        break;
+    case DP_DAB_COST_KIND_PIXEL_SQUARE:
+        calibrate_blend_mode(&table->pixel_square, dc,
+                             DP_DAB_COST_KIND_PIXEL_SQUARE, step % per_kind);
+        break;
+    case DP_DAB_COST_KIND_CLASSIC:
+        calibrate_blend_mode(&table->classic, dc, DP_DAB_COST_KIND_CLASSIC,
+                             step % per_kind);
+        break;
+    default:
+        calibrate_mypaint(&table->mypaint, dc, step - per_kind * 3);
+        break;
+    }
+}
+
+void DP_dab_cost_table_calibrate(DP_DabCostTable *table, DP_DrawContext *dc)
+{
+    int step_count = DP_dab_cost_table_calibration_step_count();
+    for (int i = 0; i < step_count; ++i) {
+        DP_dab_cost_table_calibrate_step(table, dc, i);
+    }
+}
@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DPENGINE_DAB_COST_TABLE_H
+#define DPENGINE_DAB_COST_TABLE_H
+#include <dpcommon/common.h>
+#include <dpmsg/blend_mode.h>
+
+typedef struct DP_DrawContext DP_DrawContext;
+
+
+// Cost of drawing dabs, in nanoseconds per square of the dab size, used to
+// decide how many draw dabs messages get batched together. The defaults come
+// from the table in dab_cost.c, which was measured on a single machine. Since
+// the relative cost of blend modes varies a lot between CPUs, it can be
+// measured on the current machine instead through the calibration steps.
+
+typedef struct DP_DabCostBlendModes {
+    double indirect;
+    // Cost for blend modes that are out of range or not valid for brushes.
+    double fallback;
+    double direct[DP_BLEND_MODE_COUNT];
+} DP_DabCostBlendModes;
+
+typedef struct DP_DabCostMyPaint {
+    double indirect;
+    double lock_alpha;
+    double colorize;
+    double posterize;
+    double normal;
+} DP_DabCostMyPaint;
+
+typedef struct DP_DabCostTable {
+    DP_DabCostBlendModes pixel;
+    DP_DabCostBlendModes pixel_square;
+    DP_DabCostBlendModes classic;
+    DP_DabCostMyPaint mypaint;
+} DP_DabCostTable;
+
+void DP_dab_cost_table_init(DP_DabCostTable *table);
+
+double DP_dab_cost_table_pixel(const DP_DabCostTable *table, bool indirect,
+                               int blend_mode);
+
+double DP_dab_cost_table_pixel_square(const DP_DabCostTable *table,
+                                      bool indirect, int blend_mode);
+
+double DP_dab_cost_table_classic(const DP_DabCostTable *table, bool indirect,
+                                 int blend_mode);
+
+double DP_dab_cost_table_mypaint(const DP_DabCostTable *table, bool indirect,
+                                 uint8_t lock_alpha, uint8_t colorize,
+                                 uint8_t posterize);
+
+
+// Calibration is split into steps that each take a few milliseconds at most,
+// so that it can be interleaved with other work. Each step measures a single
+// entry of the table by actually drawing dabs onto a scratch canvas.
+int DP_dab_cost_table_calibration_step_count(void);
+
+void DP_dab_cost_table_calibrate_step(DP_DabCostTable *table,
+                                      DP_DrawContext *dc, int step);
+
+// Runs all calibration steps in one go.
+void DP_dab_cost_table_calibrate(DP_DabCostTable *table, DP_DrawContext *dc);
+
+
+#endif
@@ -35,6 +35,7 @@
 #include <dpcommon/conversions.h>
 #include <dpcommon/geom.h>
 #include <dpmsg/blend_mode.h>
+#include <limits.h>
 
 
 #ifdef DP_NO_STRICT_ALIASING
@@ -607,6 +608,66 @@ DP_Image *DP_layer_content_to_image(DP_LayerContent *lc)
     return img;
 }
 
+static DP_Tile *cropped_tile_at(DP_LayerContent *lc, DP_Tile *censor_tile,
+                                int x, int y)
+{
+    DP_Tile *t = DP_layer_content_tile_at_noinc(lc, x, y);
+    return t && censor_tile ? censor_tile : t;
+}
+
+// Extends the given pixel bounds by the pixels in the tile that don't end up
+// transparent in 8 bits, which isn't the same as the tile not being blank:
+// almost transparent 15 bit pixels become actually transparent in 8 bits.
+static void extend_visible_pixel_bounds(DP_Tile *t, int tile_x, int tile_y,
+                                        int *in_out_min_x, int *in_out_min_y,
+                                        int *in_out_max_x, int *in_out_max_y)
+{
+    if (!t || DP_tile_blank(t)) {
+        return;
+    }
+
+    const DP_Pixel15 *pixels = DP_tile_pixels(t);
+    int base_x = tile_x * DP_TILE_SIZE;
+    int base_y = tile_y * DP_TILE_SIZE;
+    for (int y = 0; y < DP_TILE_SIZE; ++y) {
+        const DP_Pixel15 *row = pixels + y * DP_TILE_SIZE;
+        int first = -1;
+        int last = -1;
+        for (int x = 0; x < DP_TILE_SIZE; ++x) {
+            if (DP_channel15_to_8(row[x].a) != 0) {
+                if (first == -1) {
+                    first = x;
+                }
+                last = x;
+            }
+        }
+        if (first != -1) {
+            *in_out_min_x = DP_min_int(*in_out_min_x, base_x + first);
+            *in_out_max_x = DP_max_int(*in_out_max_x, base_x + last);
+            *in_out_min_y = DP_min_int(*in_out_min_y, base_y + y);
+            *in_out_max_y = DP_max_int(*in_out_max_y, base_y + y);
+        }
+    }
+}
+
+static void extend_visible_tile_bounds(DP_LayerContent *lc,
+                                       DP_Tile *censor_tile, int x, int y,
+                                       int *in_out_min_x, int *in_out_min_y,
+                                       int *in_out_max_x, int *in_out_max_y)
+{
+    // A tile that lies entirely within the bounds found so far can't extend
+    // them, so it doesn't need to be looked at.
+    int tile_left = x * DP_TILE_SIZE;
+    int tile_top = y * DP_TILE_SIZE;
+    if (tile_left < *in_out_min_x || tile_top < *in_out_min_y
+        || tile_left + DP_TILE_SIZE - 1 > *in_out_max_x
+        || tile_top + DP_TILE_SIZE - 1 > *in_out_max_y) {
+        extend_visible_pixel_bounds(cropped_tile_at(lc, censor_tile, x, y), x,
+                                    y, in_out_min_x, in_out_min_y,
+                                    in_out_max_x, in_out_max_y);
+    }
+}
+
 DP_UPixel8 *
 DP_layer_content_to_upixels8_cropped(DP_LayerContent *lc, bool censored,
                                      int *out_offset_x, int *out_offset_y,
@@ -620,80 +681,81 @@ DP_layer_content_to_upixels8_cropped(DP_LayerContent *lc, bool censored,
         return NULL; // Whole layer seems to be blank.
     }
 
-    int width = (right - left + 1) * DP_TILE_SIZE;
-    int height = (bottom - top + 1) * DP_TILE_SIZE;
-    DP_UPixel8 *pixels = DP_malloc(sizeof(*pixels) * DP_int_to_size(width)
-                                   * DP_int_to_size(height));
+    // Refine the tile bounds to pixel bounds. The tiles around the edge go
+    // first, since they usually determine the result, after which the inner
+    // tiles are within the bounds and get skipped without looking at them.
     DP_Tile *censor_tile = censored ? DP_tile_censored_noinc() : NULL;
-    for (int y = top; y <= bottom; ++y) {
-        int target_y = (y - top) * DP_TILE_SIZE;
-        for (int x = left; x <= right; ++x) {
-            DP_Tile *t = DP_layer_content_tile_at_noinc(lc, x, y);
-            int target_x = (x - left) * DP_TILE_SIZE;
-            DP_tile_copy_to_upixels8(censored && t ? censor_tile : t, pixels,
-                                     target_x, target_y, width, height);
-        }
-    }
-
-    int min_x = width;
-    int min_y = height;
+    int min_x = INT_MAX;
+    int min_y = INT_MAX;
     int max_x = -1;
     int max_y = -1;
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            DP_UPixel8 pixel = pixels[y * width + x];
-            if (pixel.a != 0) {
-                if (x < min_x) {
-                    min_x = x;
-                }
-                if (y < min_y) {
-                    min_y = y;
-                }
-                if (x > max_x) {
-                    max_x = x;
-                }
-                if (y > max_y) {
-                    max_y = y;
-                }
-            }
+    for (int x = left; x <= right; ++x) {
+        extend_visible_tile_bounds(lc, censor_tile, x, top, &min_x, &min_y,
+                                   &max_x, &max_y);
+        if (bottom != top) {
+            extend_visible_tile_bounds(lc, censor_tile, x, bottom, &min_x,
+                                       &min_y, &max_x, &max_y);
+        }
+    }
+    for (int y = top + 1; y < bottom; ++y) {
+        extend_visible_tile_bounds(lc, censor_tile, left, y, &min_x, &min_y,
+                                   &max_x, &max_y);
+        if (right != left) {
+            extend_visible_tile_bounds(lc, censor_tile, right, y, &min_x,
+                                       &min_y, &max_x, &max_y);
+        }
+    }
+    for (int y = top + 1; y < bottom; ++y) {
+        for (int x = left + 1; x < right; ++x) {
+            extend_visible_tile_bounds(lc, censor_tile, x, y, &min_x, &min_y,
+                                       &max_x, &max_y);
         }
     }
 
     if (max_x < min_x || max_y < min_y) {
-        // Turns out the image is empty after all. Can happen if almost
-        // transparent 15 bit pixels become actually transparent in 8 bits.
-        DP_free(pixels);
-        return NULL;
+        return NULL; // Turns out the image is empty in 8 bits after all.
     }
 
-    int pixel_width, pixel_height;
-    if (min_x == 0 && min_y == 0 && max_x == width - 1 && max_y == height - 1) {
-        pixel_width = width;
-        pixel_height = height;
-    }
-    else {
-        pixel_width = max_x - min_x + 1;
-        pixel_height = max_y - min_y + 1;
-        for (int y = 0; y < pixel_height; ++y) {
-            for (int x = 0; x < pixel_width; ++x) {
-                int tx = x + min_x;
-                int ty = y + min_y;
-                pixels[y * pixel_width + x] = pixels[ty * width + tx];
+    // Convert only the pixels inside of the bounds, straight into place.
+    int width = max_x - min_x + 1;
+    int height = max_y - min_y + 1;
+    DP_UPixel8 *pixels = DP_malloc(sizeof(*pixels) * DP_int_to_size(width)
+                                   * DP_int_to_size(height));
+    for (int y = min_y / DP_TILE_SIZE; y <= max_y / DP_TILE_SIZE; ++y) {
+        int tile_top = y * DP_TILE_SIZE;
+        int src_y = DP_max_int(min_y - tile_top, 0);
+        int src_end_y = DP_min_int(max_y - tile_top + 1, DP_TILE_SIZE);
+        for (int x = min_x / DP_TILE_SIZE; x <= max_x / DP_TILE_SIZE; ++x) {
+            int tile_left = x * DP_TILE_SIZE;
+            int src_x = DP_max_int(min_x - tile_left, 0);
+            int count = DP_min_int(max_x - tile_left + 1, DP_TILE_SIZE) - src_x;
+            DP_Tile *t = cropped_tile_at(lc, censor_tile, x, y);
+            for (int i = src_y; i < src_end_y; ++i) {
+                DP_UPixel8 *dst = pixels + (tile_top + i - min_y) * width
+                                + (tile_left + src_x - min_x);
+                if (t) {
+                    DP_pixels15_to_8_unpremultiply(
+                        dst, DP_tile_pixels(t) + i * DP_TILE_SIZE + src_x,
+                        count);
+                }
+                else {
+                    memset(dst, 0, sizeof(*dst) * DP_int_to_size(count));
+                }
             }
         }
     }
 
     if (out_offset_x) {
-        *out_offset_x = left * DP_TILE_SIZE + min_x;
+        *out_offset_x = min_x;
     }
     if (out_offset_y) {
-        *out_offset_y = top * DP_TILE_SIZE + min_y;
+        *out_offset_y = min_y;
     }
     if (out_width) {
-        *out_width = pixel_width;
+        *out_width = width;
     }
     if (out_height) {
-        *out_height = pixel_height;
+        *out_height = height;
     }
     return pixels;
 }
@@ -103,6 +103,10 @@ bool DP_layer_content_search_change_bounds(DP_LayerContent *lc,
 
 DP_Image *DP_layer_content_to_image(DP_LayerContent *lc);
 
+// Converts only the part of the layer that's not transparent in 8 bits and
+// returns its bounds. Tiles are only looked at pixel by pixel where they can
+// change those bounds, the inside just gets converted. Returns NULL if there
+// are no visible pixels at all.
 DP_UPixel8 *
 DP_layer_content_to_upixels8_cropped(DP_LayerContent *lc, bool censored,
                                      int *out_offset_x, int *out_offset_y,
@@ -1362,7 +1362,7 @@ DP_Player *DP_load_recording(const char *path, DP_LoadResult *out_result)
 {
     if (path) {
         DP_PERF_BEGIN_DETAIL(fn, "recording", "path=%s", path);
-        DP_Input *input = DP_file_input_new_from_path(path);
+        DP_Input *input = DP_mmap_input_new_from_path(path);
         DP_Player *player;
         if (input) {
             player =
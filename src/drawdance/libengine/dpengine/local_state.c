@@ -665,7 +665,8 @@ DP_Message *DP_local_state_msg_background_tile_new(DP_DrawContext *dc,
         DP_ASSERT(dc);
         size_t size =
             DP_tile_compress(tile_or_null, DP_draw_context_tile8_buffer(dc),
-                             get_compression_buffer, dc);
+                             DP_COMPRESS_PROFILE_FAST, get_compression_buffer,
+                             dc);
         if (size == 0) {
             return NULL;
         }
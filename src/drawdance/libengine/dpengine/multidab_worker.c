@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "multidab_worker.h"
+#include "draw_context.h"
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/threading.h>
+#include <dpcommon/worker.h>
+
+struct DP_MultidabWorker {
+    DP_Worker *worker;
+    DP_Semaphore *sem;
+    int thread_count;
+    DP_DrawContext *dcs[];
+};
+
+struct DP_MultidabJob {
+    DP_MultidabWorker *mw;
+    DP_MultidabWorkerFn fn;
+    void *user;
+    int index;
+};
+
+static void run_multidab_job(void *element, int thread_index)
+{
+    struct DP_MultidabJob *job = element;
+    DP_MultidabWorker *mw = job->mw;
+    job->fn(job->user, mw->dcs[thread_index], job->index);
+    DP_SEMAPHORE_MUST_POST(mw->sem);
+}
+
+DP_MultidabWorker *DP_multidab_worker_new(int thread_count)
+{
+    if (thread_count < 1) {
+        return NULL;
+    }
+
+    DP_MultidabWorker *mw = DP_malloc_zeroed(DP_FLEX_SIZEOF(
+        DP_MultidabWorker, dcs, DP_int_to_size(thread_count)));
+    mw->thread_count = thread_count;
+    mw->sem = DP_semaphore_new(0);
+    if (!mw->sem) {
+        DP_multidab_worker_free_join(mw);
+        return NULL;
+    }
+
+    for (int i = 0; i < thread_count; ++i) {
+        mw->dcs[i] = DP_draw_context_new();
+    }
+
+    mw->worker = DP_worker_new(DP_int_to_size(thread_count),
+                               sizeof(struct DP_MultidabJob), thread_count,
+                               run_multidab_job);
+    if (!mw->worker) {
+        DP_multidab_worker_free_join(mw);
+        return NULL;
+    }
+
+    return mw;
+}
+
+void DP_multidab_worker_free_join(DP_MultidabWorker *mw)
+{
+    if (mw) {
+        DP_worker_free_join(mw->worker);
+        for (int i = 0; i < mw->thread_count; ++i) {
+            DP_draw_context_free(mw->dcs[i]);
+        }
+        DP_semaphore_free(mw->sem);
+        DP_free(mw);
+    }
+}
+
+int DP_multidab_worker_thread_count(DP_MultidabWorker *mw)
+{
+    DP_ASSERT(mw);
+    return mw->thread_count;
+}
+
+void DP_multidab_worker_run(DP_MultidabWorker *mw, DP_DrawContext *dc,
+                            int count, DP_MultidabWorkerFn fn, void *user)
+{
+    DP_ASSERT(mw);
+    DP_ASSERT(dc);
+    DP_ASSERT(fn);
+    if (count > 0) {
+        for (int i = 1; i < count; ++i) {
+            DP_worker_push(mw->worker,
+                           &(struct DP_MultidabJob){mw, fn, user, i});
+        }
+        fn(user, dc, 0);
+        if (count > 1) {
+            DP_SEMAPHORE_MUST_WAIT_N(mw->sem, count - 1);
+        }
+    }
+}
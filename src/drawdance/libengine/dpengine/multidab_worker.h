@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DPENGINE_MULTIDAB_WORKER_H
+#define DPENGINE_MULTIDAB_WORKER_H
+#include <dpcommon/common.h>
+
+typedef struct DP_DrawContext DP_DrawContext;
+
+
+// Threads for drawing the independent parts of a multidab batch at the same
+// time, see DP_ops_draw_dabs for how a batch gets split up. Each thread has its
+// own draw context, since those hold the scratch buffers for brush stamps.
+typedef struct DP_MultidabWorker DP_MultidabWorker;
+
+typedef void (*DP_MultidabWorkerFn)(void *user, DP_DrawContext *dc, int index);
+
+// Returns NULL if the thread count is below 1, meaning to draw serially.
+DP_MultidabWorker *DP_multidab_worker_new(int thread_count);
+
+void DP_multidab_worker_free_join(DP_MultidabWorker *mw);
+
+int DP_multidab_worker_thread_count(DP_MultidabWorker *mw);
+
+// Calls the function for each index from 0 to count - 1 and waits until all of
+// them are done. The calling thread handles index 0 with the given context.
+void DP_multidab_worker_run(DP_MultidabWorker *mw, DP_DrawContext *dc,
+                            int count, DP_MultidabWorkerFn fn, void *user);
+
+
+#endif
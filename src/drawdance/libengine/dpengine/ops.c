@@ -33,6 +33,7 @@
 #include "layer_props.h"
 #include "layer_props_list.h"
 #include "layer_routes.h"
+#include "multidab_worker.h"
 #include "paint.h"
 #include "tile.h"
 #include "timeline.h"
@@ -41,6 +42,7 @@
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/geom.h>
+#include <dpcommon/vector.h>
 #include <dpmsg/blend_mode.h>
 
 
@@ -1241,91 +1243,322 @@ DP_CanvasStateChange DP_ops_draw_dabs(DP_CanvasState *cs, int sublayer_id,
 }
 */
 
-DP_CanvasState *DP_ops_draw_dabs(DP_CanvasState *cs, DP_DrawContext *dc,
-                                 DP_UserCursors *ucs_or_null,
-                                 bool (*next)(void *, DP_PaintDrawDabsParams *),
-                                 void *user)
+struct DP_DrawDabsTargets {
+    DP_CanvasState *cs;
+    DP_LayerRoutes *lr;
+    DP_TransientCanvasState *tcs;
+    DP_TransientLayerContent *tlc;
+    DP_TransientLayerContent *sub_tlc;
+    int last_layer_id;
+    int last_sublayer_id;
+};
+
+// Figures out which layer or sublayer the dabs get drawn onto, creating the
+// sublayer if it doesn't exist yet. Returns NULL if they should be skipped.
+static DP_TransientLayerContent *
+get_draw_dabs_target(struct DP_DrawDabsTargets *t,
+                     DP_PaintDrawDabsParams *params)
 {
-    // Drawing dabs is by far the most common operation and they come in
-    // bunches, so we support batching them for the sake of speed. This makes
-    // this operation kinda complicated, but the speedup is worth it.
-    DP_LayerRoutes *lr = DP_canvas_state_layer_routes_noinc(cs);
-    DP_TransientCanvasState *tcs = NULL;
-    DP_TransientLayerContent *tlc = NULL;
-    DP_TransientLayerContent *sub_tlc = NULL;
-    int last_layer_id = -1;
-    int last_sublayer_id = -1;
+    if (params->dab_count < 1) {
+        return NULL;
+    }
 
-    DP_PaintDrawDabsParams params;
-    while (next(user, &params)) {
-        if (params.dab_count < 1) {
-            continue;
-        }
+    int blend_mode = params->blend_mode;
+    if (!DP_blend_mode_valid_for_brush(blend_mode)) {
+        DP_debug("Draw dabs: blend mode %s not applicable to brushes",
+                 DP_blend_mode_enum_name_unprefixed(blend_mode));
+        return NULL;
+    }
 
-        int blend_mode = params.blend_mode;
-        if (!DP_blend_mode_valid_for_brush(blend_mode)) {
-            DP_debug("Draw dabs: blend mode %s not applicable to brushes",
-                     DP_blend_mode_enum_name_unprefixed(blend_mode));
-            continue;
+    int layer_id = params->layer_id;
+    if (layer_id != t->last_layer_id) {
+        DP_LayerRoutesEntry *lre = DP_layer_routes_search(t->lr, layer_id);
+        if (lre && !DP_layer_routes_entry_is_group(lre)) {
+            t->last_layer_id = layer_id;
+            t->last_sublayer_id = -1;
+            if (!t->tcs) {
+                t->tcs = DP_transient_canvas_state_new(t->cs);
+            }
+            t->tlc = DP_layer_routes_entry_transient_content(lre, t->tcs);
+        }
+        else {
+            DP_debug("Draw dabs: bad layer id %d", layer_id);
+            return NULL;
         }
+    }
 
-        int layer_id = params.layer_id;
-        if (layer_id != last_layer_id) {
-            DP_LayerRoutesEntry *lre = DP_layer_routes_search(lr, layer_id);
-            if (lre && !DP_layer_routes_entry_is_group(lre)) {
-                last_layer_id = layer_id;
-                last_sublayer_id = -1;
-                if (!tcs) {
-                    tcs = DP_transient_canvas_state_new(cs);
-                }
-                tlc = DP_layer_routes_entry_transient_content(lre, tcs);
+    if (params->indirect) {
+        params->blend_mode = params->indirect_compat
+                               ? DP_BLEND_MODE_NORMAL
+                               : DP_BLEND_MODE_ALPHA_DARKEN;
+        int sublayer_id = DP_uint_to_int(params->context_id);
+        if (t->last_sublayer_id != sublayer_id) {
+            t->last_sublayer_id = sublayer_id;
+            DP_LayerPropsList *lpl =
+                DP_transient_layer_content_sub_props_noinc(t->tlc);
+            int sublayer_index =
+                DP_layer_props_list_index_by_id(lpl, sublayer_id);
+            if (sublayer_index < 0) {
+                DP_TransientLayerProps *tlp;
+                DP_transient_layer_content_transient_sublayer(
+                    t->tlc, sublayer_id, &t->sub_tlc, &tlp);
+                // Only set these once, when the sublayer is created. They
+                // should always be the same values for a single sublayer.
+                DP_transient_layer_props_blend_mode_set(tlp, blend_mode);
+                DP_transient_layer_props_opacity_set(
+                    tlp, DP_channel8_to_15(DP_uint32_to_uint8(
+                             (params->color & 0xff000000) >> 24)));
             }
             else {
-                DP_debug("Draw dabs: bad layer id %d", layer_id);
-                continue;
+                DP_transient_layer_content_transient_sublayer_at(
+                    t->tlc, sublayer_index, &t->sub_tlc, NULL);
             }
         }
+        return t->sub_tlc;
+    }
+    else {
+        return t->tlc;
+    }
+}
+
+static void draw_dabs_serial(struct DP_DrawDabsTargets *t, DP_DrawContext *dc,
+                             DP_UserCursors *ucs_or_null,
+                             bool (*next)(void *, DP_PaintDrawDabsParams *),
+                             void *user)
+{
+    DP_PaintDrawDabsParams params;
+    while (next(user, &params)) {
+        DP_TransientLayerContent *target = get_draw_dabs_target(t, &params);
+        if (target) {
+            DP_paint_draw_dabs(dc, ucs_or_null, &params, target);
+        }
+    }
+}
 
-        DP_TransientLayerContent *target;
-        if (params.indirect) {
-            params.blend_mode = params.indirect_compat
-                                  ? DP_BLEND_MODE_NORMAL
-                                  : DP_BLEND_MODE_ALPHA_DARKEN;
-            int sublayer_id = DP_uint_to_int(params.context_id);
-            if (last_sublayer_id != sublayer_id) {
-                last_sublayer_id = sublayer_id;
-                DP_LayerPropsList *lpl =
-                    DP_transient_layer_content_sub_props_noinc(tlc);
-                int sublayer_index =
-                    DP_layer_props_list_index_by_id(lpl, sublayer_id);
-                if (sublayer_index < 0) {
-                    DP_TransientLayerProps *tlp;
-                    DP_transient_layer_content_transient_sublayer(
-                        tlc, sublayer_id, &sub_tlc, &tlp);
-                    // Only set these once, when the sublayer is created. They
-                    // should always be the same values for a single sublayer.
-                    DP_transient_layer_props_blend_mode_set(tlp, blend_mode);
-                    DP_transient_layer_props_opacity_set(
-                        tlp, DP_channel8_to_15(DP_uint32_to_uint8(
-                                 (params.color & 0xff000000) >> 24)));
-                }
-                else {
-                    DP_transient_layer_content_transient_sublayer_at(
-                        tlc, sublayer_index, &sub_tlc, NULL);
-                }
+
+// Splitting a batch up and waking the worker threads isn't free, so small ones
+// are better off drawn in one go.
+#define DRAW_DABS_PARALLEL_MIN_DABS 256
+
+struct DP_DrawDabsEntry {
+    DP_PaintDrawDabsParams params;
+    DP_TransientLayerContent *target;
+    DP_Rect tiles;
+    int next; // Next entry in the same partition, -1 at the end.
+};
+
+// Tiles of a single layer content touched by a partition so far.
+struct DP_DrawDabsRegion {
+    DP_TransientLayerContent *target;
+    DP_Rect tiles;
+    unsigned int context_id;
+};
+
+struct DP_DrawDabsPartitions {
+    DP_Vector entries;
+    DP_Vector regions;
+    DP_Vector heads;
+    DP_UserCursors *ucs_or_null;
+    // Partitions are identified by a context id, so all commands by the same
+    // user land in the same one. This is a union-find forest over those ids.
+    uint8_t parents[DP_USER_CURSOR_COUNT];
+};
+
+static int tile_index_floor(int i)
+{
+    return i < 0 ? (i - DP_TILE_SIZE + 1) / DP_TILE_SIZE : i / DP_TILE_SIZE;
+}
+
+static DP_Rect get_draw_dabs_tile_bounds(const DP_PaintDrawDabsParams *params)
+{
+    DP_Rect bounds = DP_paint_draw_dabs_bounds(params);
+    return (DP_Rect){tile_index_floor(bounds.x1), tile_index_floor(bounds.y1),
+                     tile_index_floor(bounds.x2), tile_index_floor(bounds.y2)};
+}
+
+static unsigned int find_partition(struct DP_DrawDabsPartitions *p,
+                                   unsigned int context_id)
+{
+    while (p->parents[context_id] != context_id) {
+        context_id = p->parents[context_id];
+    }
+    return context_id;
+}
+
+static void merge_regions(struct DP_DrawDabsPartitions *p,
+                          struct DP_DrawDabsRegion *region)
+{
+    // Growing a region can make it run into the regions of other partitions on
+    // the same target. Those have to be merged, which can grow it further, so
+    // keep going until it doesn't hit anything anymore.
+    unsigned int partition = find_partition(p, region->context_id);
+    size_t i = 0;
+    while (i < p->regions.used) {
+        struct DP_DrawDabsRegion *other =
+            &DP_VECTOR_AT_TYPE(&p->regions, struct DP_DrawDabsRegion, i);
+        unsigned int other_partition;
+        if (other != region && other->target == region->target
+            && (other_partition = find_partition(p, other->context_id))
+                   != partition
+            && DP_rect_intersects(other->tiles, region->tiles)) {
+            p->parents[other_partition] = DP_uint_to_uint8(partition);
+            region->tiles = DP_rect_union(region->tiles, other->tiles);
+            i = 0;
+        }
+        else {
+            ++i;
+        }
+    }
+}
+
+static void assign_partition(struct DP_DrawDabsPartitions *p,
+                             unsigned int context_id, DP_Rect tiles,
+                             DP_TransientLayerContent *target)
+{
+    unsigned int partition = find_partition(p, context_id);
+    size_t count = p->regions.used;
+    for (size_t i = 0; i < count; ++i) {
+        struct DP_DrawDabsRegion *region =
+            &DP_VECTOR_AT_TYPE(&p->regions, struct DP_DrawDabsRegion, i);
+        if (region->target == target
+            && find_partition(p, region->context_id) == partition) {
+            region->tiles = DP_rect_union(region->tiles, tiles);
+            merge_regions(p, region);
+            return;
+        }
+    }
+    DP_VECTOR_PUSH_TYPE(&p->regions, struct DP_DrawDabsRegion,
+                        ((struct DP_DrawDabsRegion){target, tiles, partition}));
+    merge_regions(
+        p, &DP_VECTOR_LAST_TYPE(&p->regions, struct DP_DrawDabsRegion));
+}
+
+static int collect_draw_dabs(struct DP_DrawDabsPartitions *p,
+                             struct DP_DrawDabsTargets *t,
+                             bool (*next)(void *, DP_PaintDrawDabsParams *),
+                             void *user)
+{
+    int total_dabs = 0;
+    DP_PaintDrawDabsParams params;
+    while (next(user, &params)) {
+        DP_TransientLayerContent *target = get_draw_dabs_target(t, &params);
+        if (target) {
+            unsigned int context_id = params.context_id;
+            DP_ASSERT(context_id < DP_USER_CURSOR_COUNT);
+            DP_Rect tiles = get_draw_dabs_tile_bounds(&params);
+            DP_VECTOR_PUSH_TYPE(
+                &p->entries, struct DP_DrawDabsEntry,
+                ((struct DP_DrawDabsEntry){params, target, tiles, -1}));
+            assign_partition(p, context_id, tiles, target);
+            // Activate the cursors up front, in the same order as drawing
+            // serially would. The threads only update their own user's cursor.
+            if (p->ucs_or_null) {
+                DP_user_cursors_activate(p->ucs_or_null, context_id);
             }
-            target = sub_tlc;
+            total_dabs += params.dab_count;
+        }
+    }
+    return total_dabs;
+}
+
+static void link_partitions(struct DP_DrawDabsPartitions *p)
+{
+    int last_entries[DP_USER_CURSOR_COUNT];
+    for (int i = 0; i < DP_USER_CURSOR_COUNT; ++i) {
+        last_entries[i] = -1;
+    }
+
+    int count = DP_size_to_int(p->entries.used);
+    for (int i = 0; i < count; ++i) {
+        struct DP_DrawDabsEntry *entry =
+            &DP_VECTOR_AT_TYPE(&p->entries, struct DP_DrawDabsEntry, i);
+        unsigned int partition = find_partition(p, entry->params.context_id);
+        int last = last_entries[partition];
+        if (last == -1) {
+            DP_VECTOR_PUSH_TYPE(&p->heads, int, i);
         }
         else {
-            target = tlc;
+            DP_VECTOR_AT_TYPE(&p->entries, struct DP_DrawDabsEntry, last).next =
+                i;
         }
+        last_entries[partition] = i;
+    }
+}
+
+static void draw_dabs_partition(void *user, DP_DrawContext *dc, int index)
+{
+    struct DP_DrawDabsPartitions *p = user;
+    int i = DP_VECTOR_AT_TYPE(&p->heads, int, index);
+    while (i != -1) {
+        struct DP_DrawDabsEntry *entry =
+            &DP_VECTOR_AT_TYPE(&p->entries, struct DP_DrawDabsEntry, i);
+        DP_paint_draw_dabs(dc, p->ucs_or_null, &entry->params, entry->target);
+        i = entry->next;
+    }
+}
 
-        DP_paint_draw_dabs(dc, ucs_or_null, &params, target);
+// Commands in a batch that don't touch the same tiles of the same layer don't
+// affect each other, so they can be drawn at the same time. Commands by the
+// same user are kept together, since they share a sublayer and user cursor,
+// everything else gets split up by layer and the tiles it touches. Within a
+// partition, commands are drawn in their original order, so the result is the
+// same as drawing everything serially.
+static void draw_dabs_parallel(struct DP_DrawDabsTargets *t, DP_DrawContext *dc,
+                               DP_MultidabWorker *mw,
+                               DP_UserCursors *ucs_or_null,
+                               bool (*next)(void *, DP_PaintDrawDabsParams *),
+                               void *user)
+{
+    struct DP_DrawDabsPartitions p;
+    DP_VECTOR_INIT_TYPE(&p.entries, struct DP_DrawDabsEntry, 64);
+    DP_VECTOR_INIT_TYPE(&p.regions, struct DP_DrawDabsRegion, 16);
+    DP_VECTOR_INIT_TYPE(&p.heads, int, 16);
+    p.ucs_or_null = ucs_or_null;
+    for (int i = 0; i < DP_USER_CURSOR_COUNT; ++i) {
+        p.parents[i] = DP_int_to_uint8(i);
+    }
+
+    int total_dabs = collect_draw_dabs(&p, t, next, user);
+    link_partitions(&p);
+
+    int partition_count = DP_size_to_int(p.heads.used);
+    if (partition_count > 1 && total_dabs >= DRAW_DABS_PARALLEL_MIN_DABS) {
+        DP_multidab_worker_run(mw, dc, partition_count, draw_dabs_partition,
+                               &p);
+    }
+    else {
+        size_t count = p.entries.used;
+        for (size_t i = 0; i < count; ++i) {
+            struct DP_DrawDabsEntry *entry =
+                &DP_VECTOR_AT_TYPE(&p.entries, struct DP_DrawDabsEntry, i);
+            DP_paint_draw_dabs(dc, ucs_or_null, &entry->params, entry->target);
+        }
     }
 
-    return tcs ? DP_transient_canvas_state_persist(tcs) : NULL;
+    DP_vector_dispose(&p.heads);
+    DP_vector_dispose(&p.regions);
+    DP_vector_dispose(&p.entries);
 }
 
+DP_CanvasState *DP_ops_draw_dabs(DP_CanvasState *cs, DP_DrawContext *dc,
+                                 DP_MultidabWorker *mw_or_null,
+                                 DP_UserCursors *ucs_or_null,
+                                 bool (*next)(void *, DP_PaintDrawDabsParams *),
+                                 void *user)
+{
+    // Drawing dabs is by far the most common operation and they come in
+    // bunches, so we support batching them for the sake of speed. This makes
+    // this operation kinda complicated, but the speedup is worth it.
+    struct DP_DrawDabsTargets t = {
+        cs, DP_canvas_state_layer_routes_noinc(cs), NULL, NULL, NULL, -1, -1};
+    if (mw_or_null) {
+        draw_dabs_parallel(&t, dc, mw_or_null, ucs_or_null, next, user);
+    }
+    else {
+        draw_dabs_serial(&t, dc, ucs_or_null, next, user);
+    }
+    return t.tcs ? DP_transient_canvas_state_persist(t.tcs) : NULL;
+}
 
 DP_CanvasState *DP_ops_track_create(DP_CanvasState *cs, int new_id,
                                     int insert_id, int source_id,
@@ -28,6 +28,7 @@ typedef struct DP_CanvasState DP_CanvasState;
 typedef struct DP_DrawContext DP_DrawContext;
 typedef struct DP_Image DP_Image;
 typedef struct DP_KeyFrameLayer DP_KeyFrameLayer;
+typedef struct DP_MultidabWorker DP_MultidabWorker;
 typedef struct DP_PaintDrawDabsParams DP_PaintDrawDabsParams;
 typedef struct DP_Quad DP_Quad;
 typedef struct DP_Rect DP_Rect;
@@ -124,6 +125,7 @@ DP_CanvasState *DP_ops_annotation_edit(DP_CanvasState *cs, int annotation_id,
 DP_CanvasState *DP_ops_annotation_delete(DP_CanvasState *cs, int annotation_id);
 
 DP_CanvasState *DP_ops_draw_dabs(DP_CanvasState *cs, DP_DrawContext *dc,
+                                 DP_MultidabWorker *mw_or_null,
                                  DP_UserCursors *ucs_or_null,
                                  bool (*next)(void *, DP_PaintDrawDabsParams *),
                                  void *user);
@@ -42,6 +42,7 @@
 #include <dpcommon/cpu.h>
 #include <dpmsg/blend_mode.h>
 #include <dpmsg/message.h>
+#include <limits.h>
 #include <math.h>
 #include <helpers.h> // CLAMP
 
@@ -1056,6 +1057,66 @@ void DP_paint_draw_dabs(DP_DrawContext *dc, DP_UserCursors *ucs_or_null,
     }
 }
 
+// Stamps stick out a bit past the nominal dab size, because the mask diameter
+// gets rounded up and shifted around for subpixel positioning.
+#define DRAW_DABS_BOUNDS_MARGIN 4
+
+static void include_dab_bounds(DP_Rect *bounds, int x, int y, int radius)
+{
+    int r = radius + DRAW_DABS_BOUNDS_MARGIN;
+    bounds->x1 = DP_min_int(bounds->x1, x - r);
+    bounds->y1 = DP_min_int(bounds->y1, y - r);
+    bounds->x2 = DP_max_int(bounds->x2, x + r);
+    bounds->y2 = DP_max_int(bounds->y2, y + r);
+}
+
+DP_Rect DP_paint_draw_dabs_bounds(const DP_PaintDrawDabsParams *params)
+{
+    DP_ASSERT(params);
+    DP_ASSERT(params->dab_count > 0); // This should be checked beforehand.
+    int dab_count = params->dab_count;
+    int last_x = params->origin_x;
+    int last_y = params->origin_y;
+    DP_Rect bounds = {INT_MAX, INT_MAX, INT_MIN, INT_MIN};
+    // Classic and MyPaint dabs are positioned in quarter pixels and sized in
+    // 1/256 pixels, pixel dabs use whole pixels for both.
+    switch (params->type) {
+    case DP_MSG_DRAW_DABS_CLASSIC:
+        for (int i = 0; i < dab_count; ++i) {
+            const DP_ClassicDab *dab =
+                DP_classic_dab_at(params->classic.dabs, i);
+            last_x += DP_classic_dab_x(dab);
+            last_y += DP_classic_dab_y(dab);
+            include_dab_bounds(&bounds, last_x / 4, last_y / 4,
+                               DP_classic_dab_size(dab) / 512 + 1);
+        }
+        break;
+    case DP_MSG_DRAW_DABS_PIXEL:
+    case DP_MSG_DRAW_DABS_PIXEL_SQUARE:
+        for (int i = 0; i < dab_count; ++i) {
+            const DP_PixelDab *dab = DP_pixel_dab_at(params->pixel.dabs, i);
+            last_x += DP_pixel_dab_x(dab);
+            last_y += DP_pixel_dab_y(dab);
+            include_dab_bounds(&bounds, last_x, last_y,
+                               DP_pixel_dab_size(dab) / 2 + 1);
+        }
+        break;
+    case DP_MSG_DRAW_DABS_MYPAINT:
+        for (int i = 0; i < dab_count; ++i) {
+            const DP_MyPaintDab *dab =
+                DP_mypaint_dab_at(params->mypaint.dabs, i);
+            last_x += DP_mypaint_dab_x(dab);
+            last_y += DP_mypaint_dab_y(dab);
+            include_dab_bounds(&bounds, last_x / 4, last_y / 4,
+                               DP_mypaint_dab_size(dab) / 512 + 1);
+        }
+        break;
+    default:
+        DP_UNREACHABLE();
+    }
+    return bounds;
+}
+
 
 DP_BrushStamp DP_paint_color_sampling_stamp_make(uint16_t *data, int diameter,
                                                  int left, int top,
@@ -23,6 +23,7 @@
 #define DPENGINE_PAINT_H
 #include "pixels.h"
 #include <dpcommon/common.h>
+#include <dpcommon/geom.h>
 
 typedef struct DP_CanvasState DP_CanvasState;
 typedef struct DP_ClassicDab DP_ClassicDab;
@@ -78,6 +79,9 @@ void DP_paint_draw_dabs(DP_DrawContext *dc, DP_UserCursors *ucs_or_null,
                         DP_PaintDrawDabsParams *params,
                         DP_TransientLayerContent *tlc);
 
+// Conservative bounds of the pixels that drawing the given dabs may touch.
+DP_Rect DP_paint_draw_dabs_bounds(const DP_PaintDrawDabsParams *params);
+
 DP_BrushStamp DP_paint_color_sampling_stamp_make(uint16_t *data, int diameter,
                                                  int left, int top,
                                                  int last_diameter);
@@ -24,7 +24,7 @@
 #include "canvas_diff.h"
 #include "canvas_history.h"
 #include "canvas_state.h"
-#include "dab_cost.h"
+#include "dab_cost_table.h"
 #include "draw_context.h"
 #include "image.h"
 #include "layer_content.h"
@@ -34,6 +34,7 @@
 #include "layer_props_list.h"
 #include "layer_routes.h"
 #include "local_state.h"
+#include "multidab_worker.h"
 #include "paint.h"
 #include "player.h"
 #include "preview.h"
@@ -58,7 +59,6 @@
 #include <dpmsg/acl.h>
 #include <dpmsg/blend_mode.h>
 #include <dpmsg/message.h>
-#include <dpmsg/message_queue.h>
 #include <dpmsg/msg_internal.h>
 #include <ctype.h>
 #include <limits.h>
@@ -66,8 +66,6 @@
 #define DP_PERF_CONTEXT "paint_engine"
 
 
-#define INITIAL_QUEUE_CAPACITY 64
-
 #define INSPECT_SUBLAYER_ID -200
 
 #define RECORDER_UNCHANGED 0
@@ -100,6 +98,7 @@ typedef struct DP_PaintEngineCursorChange {
 struct DP_PaintEngine {
     DP_AclState *acls;
     DP_CanvasHistory *ch;
+    DP_MultidabWorker *multidab_worker;
     struct {
         DP_CanvasHistorySoftResetFn fn;
         void *user;
@@ -131,15 +130,20 @@ struct DP_PaintEngine {
     DP_AtomicPtr next_previews[DP_PREVIEW_COUNT];
     DP_Atomic preview_rerendered;
     DP_PreviewRenderer *preview_renderer;
-    DP_Queue local_queue;
-    DP_Queue remote_queue;
-    DP_Semaphore *queue_sem;
-    DP_Mutex *queue_mutex;
+    DP_MpscQueue *local_queue;
+    DP_MpscQueue *remote_queue;
+    DP_QueueWaker *queue_waker;
     DP_Atomic running;
     DP_Atomic catchup;
     DP_Atomic default_layer_id;
     DP_Atomic undo_depth_limit;
     DP_Atomic just_reset;
+    struct {
+        DP_DabCostTable table;
+        DP_DabCostTable calibration;
+        int calibration_step;
+        DP_Atomic calibrate;
+    } dab_costs;
     bool catching_up;
     bool reset_locked;
     DP_Thread *paint_thread;
@@ -152,6 +156,7 @@ struct DP_PaintEngine {
     struct {
         char *path;
         DP_Recorder *recorder;
+        DP_Mutex *mutex;
         DP_Semaphore *start_sem;
         int state_change;
         DP_RecorderGetTimeMsFn get_time_ms_fn;
@@ -172,11 +177,26 @@ struct DP_PaintEngine {
 };
 
 
+static void push_message_noinc(DP_PaintEngine *pe, DP_MpscQueue *queue,
+                               DP_Message *msg)
+{
+    DP_mpsc_queue_push(queue, msg);
+    DP_queue_waker_wake(pe->queue_waker);
+}
+
+static int push_batch(DP_PaintEngine *pe, DP_MpscQueue *queue,
+                      DP_MpscQueueBatch *batch)
+{
+    int pushed = DP_size_to_int(DP_mpsc_queue_batch_count(batch));
+    DP_mpsc_queue_push_batch(queue, batch);
+    DP_queue_waker_wake(pe->queue_waker);
+    return pushed;
+}
+
 static void push_cleanup_message(void *user, DP_Message *msg)
 {
-    DP_PaintEngine *pe = user;
-    DP_message_queue_push_noinc(&pe->remote_queue, msg);
-    DP_SEMAPHORE_MUST_POST(pe->queue_sem);
+    DP_Vector *cleanup_msgs = user;
+    DP_VECTOR_PUSH_TYPE(cleanup_msgs, DP_Message *, msg);
 }
 
 static void free_preview(DP_Preview *pv)
@@ -305,18 +325,32 @@ static void handle_internal(DP_PaintEngine *pe, DP_DrawContext *dc,
         }
         break;
     }
-    case DP_MSG_INTERNAL_TYPE_CLEANUP:
-        DP_MUTEX_MUST_LOCK(pe->queue_mutex);
-        DP_canvas_history_cleanup(pe->ch, dc, push_cleanup_message, pe);
-        while (pe->local_queue.used != 0) {
-            DP_message_queue_push_noinc(
-                &pe->remote_queue, DP_message_queue_shift(&pe->local_queue));
+    case DP_MSG_INTERNAL_TYPE_CLEANUP: {
+        // The cleanup messages and whatever is left in the local queue get
+        // pushed as a single batch, so nothing else can end up between them.
+        DP_Vector cleanup_msgs;
+        DP_VECTOR_INIT_TYPE(&cleanup_msgs, DP_Message *, 64);
+        DP_MUTEX_MUST_LOCK(pe->record.mutex);
+        DP_canvas_history_cleanup(pe->ch, dc, push_cleanup_message,
+                                  &cleanup_msgs);
+        DP_MUTEX_MUST_UNLOCK(pe->record.mutex);
+        DP_Message *msg;
+        while ((msg = DP_mpsc_queue_shift(pe->local_queue)) != NULL) {
+            push_cleanup_message(&cleanup_msgs, msg);
         }
         // We might have gotten disconnected while catching up after joining the
         // session or during a reset, so say we're 100% caught up after cleanup.
-        push_cleanup_message(pe, DP_msg_internal_catchup_new(0, 100));
-        DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+        push_cleanup_message(&cleanup_msgs,
+                             DP_msg_internal_catchup_new(0, 100));
+        DP_MpscQueueBatch *batch = DP_mpsc_queue_batch_new(cleanup_msgs.used);
+        for (size_t i = 0; i < cleanup_msgs.used; ++i) {
+            DP_mpsc_queue_batch_add(
+                batch, DP_VECTOR_AT_TYPE(&cleanup_msgs, DP_Message *, i));
+        }
+        push_batch(pe, pe->remote_queue, batch);
+        DP_vector_dispose(&cleanup_msgs);
         break;
+    }
     case DP_MSG_INTERNAL_TYPE_SYNC_CANVAS_STATE:
         if (pe->sync_canvas_state.fn) {
             DP_CanvasState *cs = DP_canvas_history_get(pe->ch);
@@ -369,10 +403,17 @@ static void handle_internal(DP_PaintEngine *pe, DP_DrawContext *dc,
 // handling to deal with them in batches. That makes the code more complicated,
 // but it gives significantly better performance, so it's worth it in the end.
 // These limits are measured using the bench_multidab program in dpengine/bench.
+// The cost of each dab comes from the dab cost table, which starts out with
+// the measurements from generate_dab_cost.py and can be calibrated at runtime.
 
 // Maximum number of multidab messages in a single go.
 #define MAX_MULTIDAB_MESSAGES 8192
 
+// Threads for drawing independent parts of a batch in parallel. The paint
+// thread draws too, so one fewer than the number of cores is needed. Batches
+// rarely hit more than a handful of layers and users at once anyway.
+#define MULTIDAB_MAX_THREADS 7
+
 // 0.2 milliseconds, according to benchmark numbers. Hopefully enough for slow
 // machines to not drop below 60 fps, fast machines don't care anyway.
 #define MAX_MULTIDAB_COST 200000.0
@@ -380,25 +421,26 @@ static void handle_internal(DP_PaintEngine *pe, DP_DrawContext *dc,
 static bool shift_first_message(DP_PaintEngine *pe, DP_Message **msgs)
 {
     // Local queue takes priority, we want our own strokes to be responsive.
-    DP_Message *msg = DP_message_queue_shift(&pe->local_queue);
+    DP_Message *msg = DP_mpsc_queue_shift(pe->local_queue);
     if (msg) {
         msgs[0] = msg;
         return true;
     }
     else {
-        msgs[0] = DP_message_queue_shift(&pe->remote_queue);
+        msgs[0] = DP_mpsc_queue_shift(pe->remote_queue);
         return false;
     }
 }
 
-static double get_classic_dabs_cost(DP_MsgDrawDabsClassic *mddc,
+static double get_classic_dabs_cost(const DP_DabCostTable *costs,
+                                    DP_MsgDrawDabsClassic *mddc,
                                     double dabs_cost)
 {
     int count;
     const DP_ClassicDab *cds = DP_msg_draw_dabs_classic_dabs(mddc, &count);
-    double base_cost =
-        DP_dab_cost_classic(DP_msg_draw_dabs_classic_indirect(mddc),
-                            DP_msg_draw_dabs_classic_mode(mddc));
+    double base_cost = DP_dab_cost_table_classic(
+        costs, DP_msg_draw_dabs_classic_indirect(mddc),
+        DP_msg_draw_dabs_classic_mode(mddc));
     for (int i = 0; i < count && dabs_cost < MAX_MULTIDAB_COST; ++i) {
         double size =
             DP_int_to_double(DP_classic_dab_size(DP_classic_dab_at(cds, i)));
@@ -408,12 +450,14 @@ static double get_classic_dabs_cost(DP_MsgDrawDabsClassic *mddc,
     return dabs_cost;
 }
 
-static double get_pixel_dabs_cost(DP_MsgDrawDabsPixel *mddp, double dabs_cost)
+static double get_pixel_dabs_cost(const DP_DabCostTable *costs,
+                                  DP_MsgDrawDabsPixel *mddp, double dabs_cost)
 {
     int count;
     const DP_PixelDab *pds = DP_msg_draw_dabs_pixel_dabs(mddp, &count);
-    double base_cost = DP_dab_cost_pixel(DP_msg_draw_dabs_pixel_indirect(mddp),
-                                         DP_msg_draw_dabs_pixel_mode(mddp));
+    double base_cost =
+        DP_dab_cost_table_pixel(costs, DP_msg_draw_dabs_pixel_indirect(mddp),
+                                DP_msg_draw_dabs_pixel_mode(mddp));
     for (int i = 0; i < count && dabs_cost < MAX_MULTIDAB_COST; ++i) {
         double size = DP_pixel_dab_size(DP_pixel_dab_at(pds, i));
         double cost = base_cost * size * size;
@@ -422,14 +466,15 @@ static double get_pixel_dabs_cost(DP_MsgDrawDabsPixel *mddp, double dabs_cost)
     return dabs_cost;
 }
 
-static double get_pixel_square_dabs_cost(DP_MsgDrawDabsPixel *mddp,
+static double get_pixel_square_dabs_cost(const DP_DabCostTable *costs,
+                                         DP_MsgDrawDabsPixel *mddp,
                                          double dabs_cost)
 {
     int count;
     const DP_PixelDab *pds = DP_msg_draw_dabs_pixel_dabs(mddp, &count);
-    double base_cost =
-        DP_dab_cost_pixel_square(DP_msg_draw_dabs_pixel_indirect(mddp),
-                                 DP_msg_draw_dabs_pixel_mode(mddp));
+    double base_cost = DP_dab_cost_table_pixel_square(
+        costs, DP_msg_draw_dabs_pixel_indirect(mddp),
+        DP_msg_draw_dabs_pixel_mode(mddp));
     for (int i = 0; i < count && dabs_cost < MAX_MULTIDAB_COST; ++i) {
         double size = DP_pixel_dab_size(DP_pixel_dab_at(pds, i));
         double cost = base_cost * size * size;
@@ -438,12 +483,14 @@ static double get_pixel_square_dabs_cost(DP_MsgDrawDabsPixel *mddp,
     return dabs_cost;
 }
 
-static double get_mypaint_dabs_cost(DP_MsgDrawDabsMyPaint *mddmp,
+static double get_mypaint_dabs_cost(const DP_DabCostTable *costs,
+                                    DP_MsgDrawDabsMyPaint *mddmp,
                                     double dabs_cost)
 {
     int count;
     const DP_MyPaintDab *mpds = DP_msg_draw_dabs_mypaint_dabs(mddmp, &count);
-    double base_cost = DP_dab_cost_mypaint(
+    double base_cost = DP_dab_cost_table_mypaint(
+        costs,
         DP_mypaint_brush_mode_indirect(DP_msg_draw_dabs_mypaint_mode(mddmp)),
         DP_msg_draw_dabs_mypaint_lock_alpha(mddmp),
         DP_msg_draw_dabs_mypaint_colorize(mddmp),
@@ -456,18 +503,21 @@ static double get_mypaint_dabs_cost(DP_MsgDrawDabsMyPaint *mddmp,
     return dabs_cost;
 }
 
-static double get_dabs_cost(DP_Message *msg, DP_MessageType type,
-                            double dabs_cost)
+static double get_dabs_cost(const DP_DabCostTable *costs, DP_Message *msg,
+                            DP_MessageType type, double dabs_cost)
 {
     switch (type) {
     case DP_MSG_DRAW_DABS_CLASSIC:
-        return get_classic_dabs_cost(DP_message_internal(msg), dabs_cost);
+        return get_classic_dabs_cost(costs, DP_message_internal(msg),
+                                     dabs_cost);
     case DP_MSG_DRAW_DABS_PIXEL:
-        return get_pixel_dabs_cost(DP_message_internal(msg), dabs_cost);
+        return get_pixel_dabs_cost(costs, DP_message_internal(msg), dabs_cost);
     case DP_MSG_DRAW_DABS_PIXEL_SQUARE:
-        return get_pixel_square_dabs_cost(DP_message_internal(msg), dabs_cost);
+        return get_pixel_square_dabs_cost(costs, DP_message_internal(msg),
+                                          dabs_cost);
     case DP_MSG_DRAW_DABS_MYPAINT:
-        return get_mypaint_dabs_cost(DP_message_internal(msg), dabs_cost);
+        return get_mypaint_dabs_cost(costs, DP_message_internal(msg),
+                                     dabs_cost);
     default:
         return MAX_MULTIDAB_COST + 1.0;
     }
@@ -475,41 +525,40 @@ static double get_dabs_cost(DP_Message *msg, DP_MessageType type,
 
 static int shift_more_draw_dabs_messages(DP_PaintEngine *pe, bool local,
                                          DP_Message **msgs,
-                                         double initial_dabs_cost)
+                                         double *in_out_dabs_cost)
 {
     int count = 1;
-    double total_dabs_cost = initial_dabs_cost;
-    DP_Queue *queue = local ? &pe->local_queue : &pe->remote_queue;
+    const DP_DabCostTable *costs = &pe->dab_costs.table;
+    double total_dabs_cost = *in_out_dabs_cost;
+    DP_MpscQueue *queue = local ? pe->local_queue : pe->remote_queue;
 
     DP_Message *msg;
     while (count < MAX_MULTIDAB_MESSAGES
-           && (msg = DP_message_queue_peek(queue)) != NULL) {
-        total_dabs_cost =
-            get_dabs_cost(msg, DP_message_type(msg), total_dabs_cost);
-        if (total_dabs_cost <= MAX_MULTIDAB_COST) {
-            DP_queue_shift(queue);
+           && (msg = DP_mpsc_queue_peek(queue)) != NULL) {
+        double next_dabs_cost =
+            get_dabs_cost(costs, msg, DP_message_type(msg), total_dabs_cost);
+        if (next_dabs_cost <= MAX_MULTIDAB_COST) {
+            DP_mpsc_queue_shift(queue);
             msgs[count++] = msg;
+            total_dabs_cost = next_dabs_cost;
         }
         else {
             break;
         }
     }
 
-    if (count > 1) {
-        int n = count - 1;
-        DP_ASSERT(DP_semaphore_value(pe->queue_sem) >= n);
-        DP_SEMAPHORE_MUST_WAIT_N(pe->queue_sem, n);
-    }
-
+    *in_out_dabs_cost = total_dabs_cost;
     return count;
 }
 
 static int maybe_shift_more_messages(DP_PaintEngine *pe, bool local,
-                                     DP_MessageType type, DP_Message **msgs)
+                                     DP_MessageType type, DP_Message **msgs,
+                                     double *out_dabs_cost)
 {
-    double dabs_cost = get_dabs_cost(msgs[0], type, 0);
+    double dabs_cost = get_dabs_cost(&pe->dab_costs.table, msgs[0], type, 0);
+    *out_dabs_cost = dabs_cost;
     if (dabs_cost <= MAX_MULTIDAB_COST) {
-        return shift_more_draw_dabs_messages(pe, local, msgs, dabs_cost);
+        return shift_more_draw_dabs_messages(pe, local, msgs, out_dabs_cost);
     }
     else {
         return 1;
@@ -557,51 +606,92 @@ static void handle_single_message(DP_PaintEngine *pe, DP_DrawContext *dc,
     DP_message_decref(msg);
 }
 
+// The predicted cost is in nanoseconds, so comparing it to the actual time
+// this takes in the perf output shows how well the dab cost table fits.
 static void handle_multidab(DP_PaintEngine *pe, DP_DrawContext *dc, bool local,
-                            int count, DP_Message **msgs)
+                            int count, DP_Message **msgs, double dabs_cost)
 {
+    DP_PERF_BEGIN_DETAIL(fn, "multidab", "count=%d,local=%d,predicted_ns=%.0f",
+                         count, (int)local, dabs_cost);
     if (local) {
         DP_canvas_history_handle_local_multidab_dec(pe->ch, dc, count, msgs);
     }
     else {
         DP_canvas_history_handle_multidab_dec(pe->ch, dc, count, msgs);
     }
+    DP_PERF_END(fn);
 }
 
-static void handle_message(DP_PaintEngine *pe, DP_DrawContext *dc,
+static bool handle_message(DP_PaintEngine *pe, DP_DrawContext *dc,
                            DP_Message **msgs)
 {
-    DP_MUTEX_MUST_LOCK(pe->queue_mutex);
     bool local = shift_first_message(pe, msgs);
     DP_Message *first = msgs[0];
-    DP_MessageType type = DP_message_type(first);
-    int count = maybe_shift_more_messages(pe, local, type, msgs);
-    DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+    if (!first) {
+        return false;
+    }
 
+    DP_MessageType type = DP_message_type(first);
+    double dabs_cost;
+    int count = maybe_shift_more_messages(pe, local, type, msgs, &dabs_cost);
     DP_ASSERT(count > 0);
     DP_ASSERT(count <= MAX_MULTIDAB_MESSAGES);
     if (count == 1) {
         handle_single_message(pe, dc, local, type, first);
     }
     else {
-        handle_multidab(pe, dc, local, count, msgs);
+        handle_multidab(pe, dc, local, count, msgs, dabs_cost);
+    }
+    return true;
+}
+
+// Dab cost calibration only happens while there's nothing else to do and one
+// step at a time, so it doesn't hold up any incoming messages for long.
+static bool calibrate_dab_costs_step(DP_PaintEngine *pe, DP_DrawContext *dc)
+{
+    int step = pe->dab_costs.calibration_step;
+    if (step < 0) {
+        if (DP_atomic_xch(&pe->dab_costs.calibrate, 0)) {
+            pe->dab_costs.calibration = pe->dab_costs.table;
+            step = 0;
+        }
+        else {
+            return false;
+        }
+    }
+
+    DP_dab_cost_table_calibrate_step(&pe->dab_costs.calibration, dc, step++);
+    if (step < DP_dab_cost_table_calibration_step_count()) {
+        pe->dab_costs.calibration_step = step;
+    }
+    else {
+        pe->dab_costs.table = pe->dab_costs.calibration;
+        pe->dab_costs.calibration_step = -1;
+        DP_debug("Dab costs calibrated");
     }
+    return true;
+}
+
+static bool should_paint_engine_sleep(void *user)
+{
+    DP_PaintEngine *pe = user;
+    return DP_atomic_get(&pe->running) && !DP_mpsc_queue_peek(pe->local_queue)
+        && !DP_mpsc_queue_peek(pe->remote_queue)
+        && pe->dab_costs.calibration_step < 0
+        && !DP_atomic_get(&pe->dab_costs.calibrate);
 }
 
 static void run_paint_engine(void *user)
 {
     DP_PaintEngine *pe = user;
     DP_DrawContext *dc = pe->paint_dc;
-    DP_Semaphore *sem = pe->queue_sem;
+    DP_QueueWaker *qw = pe->queue_waker;
     // NOLINTNEXTLINE(bugprone-sizeof-expression)
     DP_Message **msgs = DP_malloc(sizeof(*msgs) * MAX_MULTIDAB_MESSAGES);
-    while (true) {
-        DP_SEMAPHORE_MUST_WAIT(sem);
-        if (DP_atomic_get(&pe->running)) {
-            handle_message(pe, dc, msgs);
-        }
-        else {
-            break;
+    while (DP_atomic_get(&pe->running)) {
+        if (!handle_message(pe, dc, msgs)
+            && !calibrate_dab_costs_step(pe, dc)) {
+            DP_queue_waker_wait(qw, should_paint_engine_sleep, pe);
         }
     }
     DP_free(msgs);
@@ -647,10 +737,7 @@ static void sync_preview(DP_PaintEngine *pe, DP_PreviewType type,
     // as previews are created and cleared. There may still be flickering, but
     // it won't look like transforms undo themselves for a moment.
     DP_Message *msg = DP_msg_internal_preview_new(0, (int)type, pv);
-    DP_MUTEX_MUST_LOCK(pe->queue_mutex);
-    DP_message_queue_push_noinc(&pe->local_queue, msg);
-    DP_SEMAPHORE_MUST_POST(pe->queue_sem);
-    DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+    push_message_noinc(pe, pe->local_queue, msg);
 }
 
 static void preview_rendered(void *user, DP_Preview *pv)
@@ -687,12 +774,17 @@ DP_PaintEngine *DP_paint_engine_new_inc(
     DP_PaintEngineSyncCanvasStateFn sync_canvas_state_fn,
     void *sync_canvas_state_user)
 {
+    bool headless = !renderer_tile_fn;
+    DP_PERF_BEGIN_DETAIL(fn, "new", "headless=%d", headless);
     DP_PaintEngine *pe = DP_malloc(sizeof(*pe));
 
     pe->acls = acls;
     pe->ch = DP_canvas_history_new_inc(
         cs_or_null, save_point_fn, save_point_user, want_canvas_history_dump,
         canvas_history_dump_dir);
+    pe->multidab_worker = DP_multidab_worker_new(
+        DP_worker_cpu_count(MULTIDAB_MAX_THREADS + 1) - 1);
+    DP_canvas_history_multidab_worker_set(pe->ch, pe->multidab_worker);
     pe->soft_reset.fn = soft_reset_fn;
     pe->soft_reset.user = soft_reset_user;
     pe->diff = DP_canvas_diff_new();
@@ -718,31 +810,39 @@ DP_PaintEngine *DP_paint_engine_new_inc(
         DP_atomic_ptr_set(&pe->next_previews[i], NULL);
     }
     DP_atomic_set(&pe->preview_rerendered, false);
-    pe->preview_renderer = DP_preview_renderer_new(
-        preview_dc, preview_rendered, preview_rerendered, preview_clear, pe);
-    DP_message_queue_init(&pe->local_queue, INITIAL_QUEUE_CAPACITY);
-    DP_message_queue_init(&pe->remote_queue, INITIAL_QUEUE_CAPACITY);
-    pe->queue_sem = DP_semaphore_new(0);
-    pe->queue_mutex = DP_mutex_new();
+    pe->preview_renderer =
+        headless ? NULL
+                 : DP_preview_renderer_new(preview_dc, preview_rendered,
+                                           preview_rerendered, preview_clear,
+                                           pe);
+    pe->local_queue = DP_mpsc_queue_new();
+    pe->remote_queue = DP_mpsc_queue_new();
+    pe->queue_waker = DP_queue_waker_new();
     DP_atomic_set(&pe->running, true);
     DP_atomic_set(&pe->catchup, -1);
     DP_atomic_set(&pe->default_layer_id, -1);
     DP_atomic_set(&pe->undo_depth_limit,
                   DP_canvas_history_undo_depth_limit(pe->ch));
     DP_atomic_set(&pe->just_reset, false);
+    DP_dab_cost_table_init(&pe->dab_costs.table);
+    pe->dab_costs.calibration_step = -1;
+    DP_atomic_set(&pe->dab_costs.calibrate, 0);
     pe->catching_up = false;
     pe->reset_locked = false;
     pe->paint_thread = DP_thread_new(run_paint_engine, pe);
     pe->renderer =
-        DP_renderer_new(DP_worker_cpu_count(128), renderer_checker,
-                        pe->local_view.checker_color1,
-                        pe->local_view.checker_color2, renderer_tile_fn,
-                        renderer_unlock_fn, renderer_resize_fn, renderer_user);
+        headless ? NULL
+                 : DP_renderer_new(DP_worker_cpu_count(128), renderer_checker,
+                                   pe->local_view.checker_color1,
+                                   pe->local_view.checker_color2,
+                                   renderer_tile_fn, renderer_unlock_fn,
+                                   renderer_resize_fn, renderer_user);
     pe->meta.acl_change_flags = 0;
     DP_VECTOR_INIT_TYPE(&pe->meta.cursor_changes, DP_PaintEngineCursorChange,
                         8);
     pe->record.path = NULL;
     pe->record.recorder = NULL;
+    pe->record.mutex = DP_mutex_new();
     pe->record.start_sem = DP_semaphore_new(0);
     pe->record.state_change = RECORDER_STOPPED;
     pe->record.get_time_ms_fn = get_time_ms_fn;
@@ -755,50 +855,54 @@ DP_PaintEngine *DP_paint_engine_new_inc(
     pe->playback.user = playback_user;
     pe->sync_canvas_state.fn = sync_canvas_state_fn;
     pe->sync_canvas_state.user = sync_canvas_state_user;
+    DP_PERF_END(fn);
     return pe;
 }
 
+static void dispose_queued_message(void *element)
+{
+    DP_Message *msg = element;
+    if (DP_message_type(msg) == DP_MSG_INTERNAL) {
+        DP_MsgInternal *mi = DP_msg_internal_cast(msg);
+        switch (DP_msg_internal_type(mi)) {
+        case DP_MSG_INTERNAL_TYPE_RESET_TO_STATE:
+            DP_canvas_state_decref(DP_msg_internal_reset_to_state_data(mi));
+            break;
+        case DP_MSG_INTERNAL_TYPE_PREVIEW:
+            free_preview(DP_msg_internal_preview_data(mi));
+            break;
+        case DP_MSG_INTERNAL_TYPE_DUMP_COMMAND: {
+            int count;
+            DP_Message **msgs =
+                DP_msg_internal_dump_command_messages(mi, &count);
+            decref_messages(count, msgs);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    DP_message_decref(msg);
+}
+
 void DP_paint_engine_free_join(DP_PaintEngine *pe)
 {
     if (pe) {
         DP_paint_engine_recorder_stop(pe);
         DP_atomic_set(&pe->running, false);
-        DP_SEMAPHORE_MUST_POST(pe->queue_sem);
+        DP_queue_waker_wake(pe->queue_waker);
         DP_thread_free_join(pe->paint_thread);
         DP_player_free(pe->playback.player);
         DP_semaphore_free(pe->record.start_sem);
         DP_vector_dispose(&pe->meta.cursor_changes);
         DP_renderer_free(pe->renderer);
-        DP_mutex_free(pe->queue_mutex);
-        DP_semaphore_free(pe->queue_sem);
-        DP_message_queue_dispose(&pe->remote_queue);
-        DP_Message *msg;
-        while ((msg = DP_message_queue_shift(&pe->local_queue)) != NULL) {
-            if (DP_message_type(msg) == DP_MSG_INTERNAL) {
-                DP_MsgInternal *mi = DP_msg_internal_cast(msg);
-                switch (DP_msg_internal_type(mi)) {
-                case DP_MSG_INTERNAL_TYPE_RESET_TO_STATE:
-                    DP_canvas_state_decref(
-                        DP_msg_internal_reset_to_state_data(mi));
-                    break;
-                case DP_MSG_INTERNAL_TYPE_PREVIEW:
-                    free_preview(DP_msg_internal_preview_data(mi));
-                    break;
-                case DP_MSG_INTERNAL_TYPE_DUMP_COMMAND: {
-                    int count;
-                    DP_Message **msgs =
-                        DP_msg_internal_dump_command_messages(mi, &count);
-                    decref_messages(count, msgs);
-                    break;
-                }
-                default:
-                    break;
-                }
-            }
-            DP_message_decref(msg);
-        }
-        DP_message_queue_dispose(&pe->local_queue);
+        // The preview renderer pushes into the local queue, so it has to be
+        // gone before the queues are.
         DP_preview_renderer_free(pe->preview_renderer);
+        DP_mutex_free(pe->record.mutex);
+        DP_queue_waker_free(pe->queue_waker);
+        DP_mpsc_queue_free(pe->remote_queue, dispose_queued_message);
+        DP_mpsc_queue_free(pe->local_queue, dispose_queued_message);
         for (int i = 0; i < DP_PREVIEW_COUNT; ++i) {
             free_preview(DP_atomic_ptr_xch(&pe->next_previews[i], NULL));
             DP_preview_decref_nullable(pe->previews[i]);
@@ -813,14 +917,21 @@ void DP_paint_engine_free_join(DP_PaintEngine *pe)
         DP_canvas_state_decref_nullable(pe->view_cs);
         DP_canvas_diff_free(pe->diff);
         DP_canvas_history_free(pe->ch);
+        DP_multidab_worker_free_join(pe->multidab_worker);
         DP_free(pe);
     }
 }
 
+bool DP_paint_engine_headless(DP_PaintEngine *pe)
+{
+    DP_ASSERT(pe);
+    return !pe->renderer;
+}
+
 int DP_paint_engine_render_thread_count(DP_PaintEngine *pe)
 {
     DP_ASSERT(pe);
-    return DP_renderer_thread_count(pe->renderer);
+    return pe->renderer ? DP_renderer_thread_count(pe->renderer) : 0;
 }
 
 void DP_paint_engine_local_drawing_in_progress_set(
@@ -844,6 +955,13 @@ void DP_paint_engine_want_canvas_history_dump_set(DP_PaintEngine *pe,
     DP_canvas_history_want_dump_set(pe->ch, want_canvas_history_dump);
 }
 
+void DP_paint_engine_dab_costs_calibrate(DP_PaintEngine *pe)
+{
+    DP_ASSERT(pe);
+    DP_atomic_set(&pe->dab_costs.calibrate, 1);
+    DP_queue_waker_wake(pe->queue_waker);
+}
+
 
 bool DP_paint_engine_local_state_reset_image_build(
     DP_PaintEngine *pe, DP_LocalStateAcceptResetMessageFn fn, void *user)
@@ -932,7 +1050,7 @@ void DP_paint_engine_inspect_set(DP_PaintEngine *pe, unsigned int context_id,
 bool DP_paint_engine_checkers_visible(DP_PaintEngine *pe)
 {
     DP_ASSERT(pe);
-    return DP_renderer_checkers_visible(pe->renderer);
+    return pe->renderer && DP_renderer_checkers_visible(pe->renderer);
 }
 
 uint32_t DP_paint_engine_checker_color1(DP_PaintEngine *pe)
@@ -952,7 +1070,7 @@ void DP_paint_engine_checker_color1_set(DP_PaintEngine *pe, uint32_t color1)
     DP_ASSERT(pe);
     if (pe->local_view.checker_color1.color != color1) {
         pe->local_view.checker_color1.color = color1;
-        if (DP_renderer_checkers(pe->renderer)) {
+        if (pe->renderer && DP_renderer_checkers(pe->renderer)) {
             invalidate_local_view(pe, true);
         }
     }
@@ -963,7 +1081,7 @@ void DP_paint_engine_checker_color2_set(DP_PaintEngine *pe, uint32_t color2)
     DP_ASSERT(pe);
     if (pe->local_view.checker_color2.color != color2) {
         pe->local_view.checker_color2.color = color2;
-        if (DP_renderer_checkers(pe->renderer)) {
+        if (pe->renderer && DP_renderer_checkers(pe->renderer)) {
             invalidate_local_view(pe, true);
         }
     }
@@ -998,15 +1116,11 @@ static bool start_recording(DP_PaintEngine *pe, DP_RecorderType type,
         // and then block this thread (which must be the only thread interacting
         // with the paint engine, maybe we should verify that somehow) until the
         // paint thread gets to it.
-        DP_MUTEX_MUST_LOCK(pe->queue_mutex);
-        DP_message_queue_push_noinc(&pe->remote_queue,
-                                    DP_msg_internal_recorder_start_new(0));
-        DP_SEMAPHORE_MUST_POST(pe->queue_sem);
-        DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+        push_message_noinc(pe, pe->remote_queue,
+                           DP_msg_internal_recorder_start_new(0));
         // The paint thread will post to this semaphore when it reaches our
         // recorder start message.
         DP_SEMAPHORE_MUST_WAIT(pe->record.start_sem);
-        DP_ASSERT(pe->remote_queue.used == 0);
 
         // Now all queued messages have been handled. We can't just take the
         // current canvas state from the canvas history though, since that would
@@ -1044,12 +1158,11 @@ static bool start_recording(DP_PaintEngine *pe, DP_RecorderType type,
         }
         // When dealing with cleanup after a disconnect, the recorder might
         // currently be in the process of being fed messages from the local
-        // fork, so we have to take a lock around manipulating it. We re-use
-        // the queue mutex for that, since it's what the cleanup uses too.
-        DP_MUTEX_MUST_LOCK(pe->queue_mutex);
+        // fork, so we have to take a lock around manipulating it.
+        DP_MUTEX_MUST_LOCK(pe->record.mutex);
         pe->record.path = path;
         pe->record.recorder = r;
-        DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+        DP_MUTEX_MUST_UNLOCK(pe->record.mutex);
         pe->record.state_change = RECORDER_STARTED;
         return true;
     }
@@ -1069,12 +1182,12 @@ bool DP_paint_engine_recorder_stop(DP_PaintEngine *pe)
 {
     if (pe->record.recorder) {
         // Need to take a lock due to cleanup handling, see explanation above.
-        DP_MUTEX_MUST_LOCK(pe->queue_mutex);
+        DP_MUTEX_MUST_LOCK(pe->record.mutex);
         DP_recorder_free_join(pe->record.recorder, NULL);
         DP_free(pe->record.path);
         pe->record.path = NULL;
         pe->record.recorder = NULL;
-        DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
+        DP_MUTEX_MUST_UNLOCK(pe->record.mutex);
         pe->record.state_change = RECORDER_STOPPED;
         return true;
     }
@@ -1823,60 +1936,53 @@ static int should_push_message_local(DP_UNUSED DP_PaintEngine *pe,
     }
 }
 
-static int push_more_messages(DP_PaintEngine *pe, DP_Queue *queue,
-                              bool override_acls, int count, DP_Message **msgs,
-                              int (*should_push)(DP_PaintEngine *, DP_Message *,
-                                                 bool))
+static void push_more_messages(DP_PaintEngine *pe, DP_MpscQueueBatch *batch,
+                               bool override_acls, int count,
+                               DP_Message **msgs,
+                               int (*should_push)(DP_PaintEngine *,
+                                                  DP_Message *, bool))
 {
-    int pushed = 1;
     for (int i = 1; i < count; ++i) {
         DP_Message *msg = msgs[i];
         switch (should_push(pe, msg, override_acls)) {
         case NO_PUSH:
             break;
         case PUSH_MESSAGE:
-            DP_message_queue_push_inc(queue, msg);
-            ++pushed;
+            DP_mpsc_queue_batch_add(batch, DP_message_incref(msg));
             break;
         case PUSH_CLEAR_LOCAL_FORK:
-            DP_message_queue_push_noinc(
-                queue, DP_msg_internal_local_fork_clear_new(0));
-            ++pushed;
+            DP_mpsc_queue_batch_add(batch,
+                                    DP_msg_internal_local_fork_clear_new(0));
             break;
         default:
             DP_UNREACHABLE();
         }
     }
-    DP_SEMAPHORE_MUST_POST_N(pe->queue_sem, pushed);
-    return pushed;
 }
 
-static int push_messages(DP_PaintEngine *pe, DP_Queue *queue,
+static int push_messages(DP_PaintEngine *pe, DP_MpscQueue *queue,
                          bool override_acls, int count, DP_Message **msgs,
                          int (*should_push)(DP_PaintEngine *, DP_Message *,
                                             bool))
 {
-    DP_MUTEX_MUST_LOCK(pe->queue_mutex);
+    // Every message pushes at most one, so the batch can't overflow.
+    DP_MpscQueueBatch *batch = DP_mpsc_queue_batch_new(DP_int_to_size(count));
     // First message is the one that triggered the call to this function,
     // push it unconditionally. Then keep checking the rest again.
-    DP_message_queue_push_inc(queue, msgs[0]);
-    int pushed =
-        push_more_messages(pe, queue, override_acls, count, msgs, should_push);
-    DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
-    return pushed;
+    DP_mpsc_queue_batch_add(batch, DP_message_incref(msgs[0]));
+    push_more_messages(pe, batch, override_acls, count, msgs, should_push);
+    return push_batch(pe, queue, batch);
 }
 
 static int push_clear_local_fork_messages(
-    DP_PaintEngine *pe, DP_Queue *queue, bool override_acls, int count,
+    DP_PaintEngine *pe, DP_MpscQueue *queue, bool override_acls, int count,
     DP_Message **msgs, int (*should_push)(DP_PaintEngine *, DP_Message *, bool))
 {
-    DP_MUTEX_MUST_LOCK(pe->queue_mutex);
+    DP_MpscQueueBatch *batch = DP_mpsc_queue_batch_new(DP_int_to_size(count));
     // First message is to instruct the paint engine to clear the local fork.
-    DP_message_queue_push_noinc(queue, DP_msg_internal_local_fork_clear_new(0));
-    int pushed =
-        push_more_messages(pe, queue, override_acls, count, msgs, should_push);
-    DP_MUTEX_MUST_UNLOCK(pe->queue_mutex);
-    return pushed;
+    DP_mpsc_queue_batch_add(batch, DP_msg_internal_local_fork_clear_new(0));
+    push_more_messages(pe, batch, override_acls, count, msgs, should_push);
+    return push_batch(pe, queue, batch);
 }
 
 int DP_paint_engine_handle_inc(DP_PaintEngine *pe, bool local,
@@ -1897,7 +2003,7 @@ int DP_paint_engine_handle_inc(DP_PaintEngine *pe, bool local,
     DP_Vector *cursor_changes = &pe->meta.cursor_changes;
     cursor_changes->used = 0;
 
-    // Don't lock anything until we actually find a message to push.
+    // Don't allocate a batch until we actually find a message to push.
     int pushed = 0;
     for (int i = 0; i < count; ++i) {
         int push = should_push(pe, msgs[i], override_acls);
@@ -1905,7 +2011,7 @@ int DP_paint_engine_handle_inc(DP_PaintEngine *pe, bool local,
             DP_PERF_BEGIN(push, "handle:push");
             pushed = (push == PUSH_MESSAGE ? push_messages
                                            : push_clear_local_fork_messages)(
-                pe, local ? &pe->local_queue : &pe->remote_queue, override_acls,
+                pe, local ? pe->local_queue : pe->remote_queue, override_acls,
                 count - i, msgs + i, should_push);
             DP_PERF_END(push);
             break;
@@ -2291,16 +2397,27 @@ emit_changes(DP_PaintEngine *pe, DP_CanvasState *prev, DP_CanvasState *cs,
              DP_PaintEngineTimelineChangedFn timeline_changed,
              DP_PaintEngineCursorMovedFn cursor_moved, void *user)
 {
-    DP_CanvasDiff *diff = pe->diff;
-    DP_canvas_state_diff(cs, prev, diff);
-    DP_renderer_apply(pe->renderer, cs, pe->local_state, diff,
-                      pe->local_view.layers_can_decrease_opacity,
-                      pe->local_view.checker_color1,
-                      pe->local_view.checker_color2, tile_bounds,
-                      render_outside_tile_bounds, DP_RENDERER_CONTINUOUS);
+    bool layer_props_changed_reset;
+    if (pe->renderer) {
+        DP_CanvasDiff *diff = pe->diff;
+        DP_canvas_state_diff(cs, prev, diff);
+        DP_renderer_apply(pe->renderer, cs, pe->local_state, diff,
+                          pe->local_view.layers_can_decrease_opacity,
+                          pe->local_view.checker_color1,
+                          pe->local_view.checker_color2, tile_bounds,
+                          render_outside_tile_bounds, DP_RENDERER_CONTINUOUS);
+        layer_props_changed_reset =
+            DP_canvas_diff_layer_props_changed_reset(diff);
+    }
+    else {
+        // Nothing to render, so the tiles don't need diffing. The layer props
+        // are all that anyone is interested in and those can be compared as-is.
+        layer_props_changed_reset = DP_canvas_state_layer_props_noinc(cs)
+                                 != DP_canvas_state_layer_props_noinc(prev);
+    }
 
     if (!catching_up) {
-        if (DP_canvas_diff_layer_props_changed_reset(diff) || catchup_done) {
+        if (layer_props_changed_reset || catchup_done) {
             layer_props_changed(user, DP_canvas_state_layer_props_noinc(cs));
         }
 
@@ -2471,32 +2588,41 @@ void DP_paint_engine_tick(
 void DP_paint_engine_render_continuous(DP_PaintEngine *pe, DP_Rect tile_bounds,
                                        bool render_outside_tile_bounds)
 {
-    DP_renderer_apply(pe->renderer, pe->view_cs, pe->local_state, pe->diff,
-                      pe->local_view.layers_can_decrease_opacity,
-                      pe->local_view.checker_color1,
-                      pe->local_view.checker_color2, tile_bounds,
-                      render_outside_tile_bounds, DP_RENDERER_CONTINUOUS);
+    DP_ASSERT(pe);
+    if (pe->renderer) {
+        DP_renderer_apply(pe->renderer, pe->view_cs, pe->local_state, pe->diff,
+                          pe->local_view.layers_can_decrease_opacity,
+                          pe->local_view.checker_color1,
+                          pe->local_view.checker_color2, tile_bounds,
+                          render_outside_tile_bounds, DP_RENDERER_CONTINUOUS);
+    }
 }
 
 void DP_paint_engine_change_bounds(DP_PaintEngine *pe, DP_Rect tile_bounds,
                                    bool render_outside_tile_bounds)
 {
-    DP_renderer_apply(pe->renderer, pe->view_cs, pe->local_state, pe->diff,
-                      pe->local_view.layers_can_decrease_opacity,
-                      pe->local_view.checker_color1,
-                      pe->local_view.checker_color2, tile_bounds,
-                      render_outside_tile_bounds,
-                      DP_RENDERER_VIEW_BOUNDS_CHANGED);
+    DP_ASSERT(pe);
+    if (pe->renderer) {
+        DP_renderer_apply(pe->renderer, pe->view_cs, pe->local_state, pe->diff,
+                          pe->local_view.layers_can_decrease_opacity,
+                          pe->local_view.checker_color1,
+                          pe->local_view.checker_color2, tile_bounds,
+                          render_outside_tile_bounds,
+                          DP_RENDERER_VIEW_BOUNDS_CHANGED);
+    }
 }
 
 void DP_paint_engine_render_everything(DP_PaintEngine *pe)
 {
-    DP_renderer_apply(pe->renderer, pe->view_cs, pe->local_state, pe->diff,
-                      pe->local_view.layers_can_decrease_opacity,
-                      pe->local_view.checker_color1,
-                      pe->local_view.checker_color2,
-                      DP_rect_make(0, 0, UINT16_MAX, UINT16_MAX), false,
-                      DP_RENDERER_EVERYTHING);
+    DP_ASSERT(pe);
+    if (pe->renderer) {
+        DP_renderer_apply(pe->renderer, pe->view_cs, pe->local_state, pe->diff,
+                          pe->local_view.layers_can_decrease_opacity,
+                          pe->local_view.checker_color1,
+                          pe->local_view.checker_color2,
+                          DP_rect_make(0, 0, UINT16_MAX, UINT16_MAX), false,
+                          DP_RENDERER_EVERYTHING);
+    }
 }
 
 
@@ -2505,6 +2631,9 @@ void DP_paint_engine_preview_cut(DP_PaintEngine *pe, int layer_id, int x, int y,
                                  const DP_Pixel8 *mask_or_null)
 {
     DP_ASSERT(pe);
+    if (!pe->preview_renderer) {
+        return;
+    }
     DP_CanvasState *cs = pe->view_cs;
     int offset_x = DP_canvas_state_offset_x(cs);
     int offset_y = DP_canvas_state_offset_y(cs);
@@ -2522,7 +2651,10 @@ void DP_paint_engine_preview_transform(
     DP_PreviewTransformDisposePixelsFn dispose_pixels, void *user)
 {
     DP_ASSERT(dispose_pixels);
-    if (width > 0 && height > 0) {
+    if (!pe->preview_renderer) {
+        dispose_pixels(user);
+    }
+    else if (width > 0 && height > 0) {
         DP_CanvasState *cs = pe->view_cs;
         int offset_x = DP_canvas_state_offset_x(cs);
         int offset_y = DP_canvas_state_offset_y(cs);
@@ -2543,6 +2675,10 @@ void DP_paint_engine_preview_dabs_inc(DP_PaintEngine *pe, int layer_id,
                                       int count, DP_Message **messages)
 {
     DP_ASSERT(pe);
+    if (!pe->preview_renderer) {
+        return;
+    }
+
     if (count > 0) {
         DP_CanvasState *cs = pe->view_cs;
         int offset_x = DP_canvas_state_offset_x(cs);
@@ -2563,7 +2699,9 @@ void DP_paint_engine_preview_clear(DP_PaintEngine *pe, DP_PreviewType type)
     DP_ASSERT(pe);
     DP_ASSERT(type >= 0);
     DP_ASSERT(type < DP_PREVIEW_COUNT);
-    DP_preview_renderer_cancel(pe->preview_renderer, type);
+    if (pe->preview_renderer) {
+        DP_preview_renderer_cancel(pe->preview_renderer, type);
+    }
 }
 
 
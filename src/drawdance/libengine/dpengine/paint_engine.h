@@ -79,6 +79,11 @@ typedef void (*DP_PaintEnginePushMessageFn)(void *user, DP_Message *msg);
 
 typedef struct DP_PaintEngine DP_PaintEngine;
 
+// Passing a NULL renderer tile function makes a headless paint engine, for
+// consumers that only need the canvas state, not pixels on a screen. It spawns
+// no render threads or preview renderer, so the preview draw context and the
+// other renderer callbacks may be NULL too. Ticking it skips diffing tiles,
+// rendering and previews are ignored.
 DP_PaintEngine *DP_paint_engine_new_inc(
     DP_DrawContext *paint_dc, DP_DrawContext *main_dc,
     DP_DrawContext *preview_dc, DP_AclState *acls, DP_CanvasState *cs_or_null,
@@ -96,6 +101,8 @@ DP_PaintEngine *DP_paint_engine_new_inc(
 
 void DP_paint_engine_free_join(DP_PaintEngine *pe);
 
+bool DP_paint_engine_headless(DP_PaintEngine *pe);
+
 int DP_paint_engine_render_thread_count(DP_PaintEngine *pe);
 
 void DP_paint_engine_local_drawing_in_progress_set(
@@ -106,6 +113,10 @@ bool DP_paint_engine_want_canvas_history_dump(DP_PaintEngine *pe);
 void DP_paint_engine_want_canvas_history_dump_set(
     DP_PaintEngine *pe, bool want_canvas_history_dump);
 
+// Measures the dab cost table used to batch draw dabs messages on this machine.
+// Happens bit by bit on the paint thread whenever it's idle.
+void DP_paint_engine_dab_costs_calibrate(DP_PaintEngine *pe);
+
 bool DP_paint_engine_local_state_reset_image_build(
     DP_PaintEngine *pe, DP_LocalStateAcceptResetMessageFn fn, void *user);
 
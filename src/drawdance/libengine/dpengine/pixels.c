@@ -998,6 +998,355 @@ static void blend_mask_pixels_recolor_sse42(DP_Pixel15 *dst, DP_UPixel15 src,
     }
     // clang-format on
 }
+
+// Integer division of non-negative 32 bit lanes via doubles. Every quotient we
+// compute here is far below the point where a double loses precision, so the
+// truncated result is exactly the same as the scalar integer division.
+static __m128i div_sse42(__m128i a, __m128i b)
+{
+    __m128d lo = _mm_div_pd(_mm_cvtepi32_pd(a), _mm_cvtepi32_pd(b));
+    __m128d hi = _mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(a, 8)),
+                            _mm_cvtepi32_pd(_mm_srli_si128(b, 8)));
+    return _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+}
+
+// Same result as fix15_sqrt, which comes out to floor(sqrt(x << 15)).
+static __m128i sqrt_sse42(__m128i x)
+{
+    __m128d bit15 = _mm_set1_pd(BIT15_DOUBLE);
+    __m128d lo = _mm_sqrt_pd(_mm_mul_pd(_mm_cvtepi32_pd(x), bit15));
+    __m128d hi =
+        _mm_sqrt_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(x, 8)), bit15));
+    return _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+}
+
+static __m128i clamp_sse42(__m128i x)
+{
+    return _mm_min_epi32(_mm_max_epi32(x, _mm_setzero_si128()),
+                         _mm_set1_epi32(DP_BIT15));
+}
+
+static __m128i comp_multiply_sse42(__m128i a, __m128i b)
+{
+    return mul_sse42(a, b);
+}
+
+static __m128i comp_divide_sse42(__m128i a, __m128i b)
+{
+    __m128i n = _mm_add_epi32(_mm_mullo_epi32(a, _mm_set1_epi32(DP_BIT15 + 1)),
+                              _mm_srli_epi32(b, 1));
+    __m128i d = _mm_add_epi32(b, _mm_set1_epi32(1));
+    return _mm_min_epi32(div_sse42(n, d), _mm_set1_epi32(DP_BIT15));
+}
+
+static __m128i comp_burn_sse42(__m128i a, __m128i b)
+{
+    __m128i bit15 = _mm_set1_epi32(DP_BIT15);
+    __m128i n =
+        _mm_mullo_epi32(_mm_sub_epi32(bit15, a), _mm_set1_epi32(DP_BIT15 + 1));
+    __m128i d = _mm_add_epi32(b, _mm_set1_epi32(1));
+    return clamp_sse42(_mm_sub_epi32(bit15, div_sse42(n, d)));
+}
+
+static __m128i comp_dodge_sse42(__m128i a, __m128i b)
+{
+    __m128i n = _mm_mullo_epi32(a, _mm_set1_epi32(DP_BIT15 + 1));
+    __m128i d = _mm_sub_epi32(_mm_set1_epi32(DP_BIT15 + 1), b);
+    return _mm_min_epi32(div_sse42(n, d), _mm_set1_epi32(DP_BIT15));
+}
+
+static __m128i comp_lighten_sse42(__m128i a, __m128i b)
+{
+    return _mm_max_epi32(a, b);
+}
+
+static __m128i comp_darken_sse42(__m128i a, __m128i b)
+{
+    return _mm_min_epi32(a, b);
+}
+
+static __m128i comp_subtract_sse42(__m128i a, __m128i b)
+{
+    return _mm_max_epi32(_mm_sub_epi32(a, b), _mm_setzero_si128());
+}
+
+static __m128i comp_add_sse42(__m128i a, __m128i b)
+{
+    return _mm_min_epi32(_mm_add_epi32(a, b), _mm_set1_epi32(DP_BIT15));
+}
+
+static __m128i comp_screen_sse42(__m128i a, __m128i b)
+{
+    __m128i bit15 = _mm_set1_epi32(DP_BIT15);
+    __m128i a1 = _mm_sub_epi32(bit15, a);
+    __m128i b1 = _mm_sub_epi32(bit15, b);
+    return _mm_sub_epi32(bit15, mul_sse42(a1, b1));
+}
+
+static __m128i comp_hard_light_sse42(__m128i a, __m128i b)
+{
+    __m128i bit15 = _mm_set1_epi32(DP_BIT15);
+    __m128i b2 = _mm_slli_epi32(b, 1);
+    __m128i multiplied = mul_sse42(a, b2);
+    __m128i screened = comp_screen_sse42(a, _mm_sub_epi32(b2, bit15));
+    return _mm_blendv_epi8(multiplied, screened, _mm_cmpgt_epi32(b2, bit15));
+}
+
+static __m128i comp_overlay_sse42(__m128i a, __m128i b)
+{
+    return comp_hard_light_sse42(b, a);
+}
+
+static __m128i comp_soft_light_sse42(__m128i a, __m128i b)
+{
+    __m128i bit15 = _mm_set1_epi32(DP_BIT15);
+    __m128i b2 = _mm_slli_epi32(b, 1);
+    __m128i a1 = _mm_sub_epi32(bit15, a);
+    __m128i lower =
+        _mm_sub_epi32(a, mul_sse42(mul_sse42(_mm_sub_epi32(bit15, b2), a), a1));
+
+    __m128i a4 = _mm_slli_epi32(a, 2);
+    __m128i squared = mul_sse42(a, a);
+    __m128i cubed16 = _mm_slli_epi32(mul_sse42(squared, a), 4);
+    __m128i squared12 = _mm_mullo_epi32(squared, _mm_set1_epi32(12));
+    __m128i polynomial = _mm_sub_epi32(_mm_add_epi32(a4, cubed16), squared12);
+    __m128i d = _mm_blendv_epi8(polynomial, sqrt_sse42(a),
+                                _mm_cmpgt_epi32(a4, bit15));
+    __m128i upper = _mm_add_epi32(
+        a, mul_sse42(_mm_sub_epi32(b2, bit15), _mm_sub_epi32(d, a)));
+
+    return _mm_blendv_epi8(lower, upper, _mm_cmpgt_epi32(b2, bit15));
+}
+
+static __m128i comp_linear_burn_sse42(__m128i a, __m128i b)
+{
+    __m128i c = _mm_sub_epi32(_mm_add_epi32(a, b), _mm_set1_epi32(DP_BIT15));
+    return _mm_max_epi32(c, _mm_setzero_si128());
+}
+
+static __m128i comp_linear_light_sse42(__m128i a, __m128i b)
+{
+    __m128i c = _mm_add_epi32(a, _mm_slli_epi32(b, 1));
+    return clamp_sse42(_mm_sub_epi32(c, _mm_set1_epi32(DP_BIT15)));
+}
+
+// Unpremultiplies the destination channel, composites it with the source
+// channel, mixes the result by the given opacity and premultiplies it again.
+// Transparent pixels are passed through unchanged, the divisor is the
+// destination alpha clamped to at least 1 to avoid dividing by zero.
+DP_FORCE_INLINE __m128i
+composite_separable_sse42(__m128i cb, __m128i cs, __m128i ab, __m128i divisor,
+                          __m128i o, __m128i transparent,
+                          __m128i (*comp_op)(__m128i, __m128i))
+{
+    __m128i ub = div_sse42(_mm_slli_epi32(cb, 15), divisor);
+    __m128i o1 = _mm_sub_epi32(_mm_set1_epi32(DP_BIT15), o);
+    __m128i cr = mul_sse42(sumprods_sse42(o1, ub, o, comp_op(ub, cs)), ab);
+    return _mm_blendv_epi8(cr, cb, transparent);
+}
+
+// Same as above, but for Luminosity/Shine (SAI), where the opacity is part of
+// the compositing operation instead of being mixed in afterwards.
+static __m128i composite_luminosity_shine_sai_sse42(__m128i cb, __m128i cs,
+                                                    __m128i ab, __m128i divisor,
+                                                    __m128i o,
+                                                    __m128i transparent)
+{
+    __m128i ub = div_sse42(_mm_slli_epi32(cb, 15), divisor);
+    __m128i cr = mul_sse42(comp_add_sse42(ub, mul_sse42(cs, o)), ab);
+    return _mm_blendv_epi8(cr, cb, transparent);
+}
+
+// Turns premultiplied source channels into unpremultiplied ones. A transparent
+// source pixel leads to zero opacity, so it doesn't matter what it turns into.
+static void unpremultiply_source_sse42(__m128i *srcB, __m128i *srcG,
+                                       __m128i *srcR, __m128i srcA)
+{
+    __m128i divisor = _mm_max_epi32(srcA, _mm_set1_epi32(1));
+    *srcB = div_sse42(_mm_slli_epi32(*srcB, 15), divisor);
+    *srcG = div_sse42(_mm_slli_epi32(*srcG, 15), divisor);
+    *srcR = div_sse42(_mm_slli_epi32(*srcR, 15), divisor);
+}
+
+DP_FORCE_INLINE void blend_mask_pixels_composite_separable_sse42(
+    DP_Pixel15 *dst, DP_UPixel15 src, const uint16_t *mask_int,
+    Fix15 opacity_int, int count, __m128i (*comp_op)(__m128i, __m128i))
+{
+    DP_ASSERT(count % 4 == 0);
+
+    __m128i srcB = _mm_set1_epi32(src.b);
+    __m128i srcG = _mm_set1_epi32(src.g);
+    __m128i srcR = _mm_set1_epi32(src.r);
+
+    __m128i opacity = _mm_set1_epi32((int)opacity_int);
+
+    for (int x = 0; x < count; x += 4, dst += 4, mask_int += 4) {
+        // Load dest
+        __m128i dstB, dstG, dstR, dstA;
+        load_unaligned_sse42(dst, &dstB, &dstG, &dstR, &dstA);
+
+        // Alpha is preserved, so fully transparent pixels can be skipped.
+        __m128i transparent = _mm_cmpeq_epi32(dstA, _mm_setzero_si128());
+        if (_mm_movemask_epi8(transparent) == 0xffff) {
+            continue;
+        }
+
+        // load mask
+        __m128i mask = _mm_cvtepu16_epi32(_mm_loadl_epi64((void *)mask_int));
+        __m128i o = mul_sse42(mask, opacity);
+        __m128i divisor = _mm_max_epi32(dstA, _mm_set1_epi32(1));
+
+        dstB = composite_separable_sse42(dstB, srcB, dstA, divisor, o,
+                                         transparent, comp_op);
+        dstG = composite_separable_sse42(dstG, srcG, dstA, divisor, o,
+                                         transparent, comp_op);
+        dstR = composite_separable_sse42(dstR, srcR, dstA, divisor, o,
+                                         transparent, comp_op);
+
+        store_unaligned_sse42(dstB, dstG, dstR, dstA, dst);
+    }
+}
+
+DP_FORCE_INLINE void blend_tile_composite_separable_sse42(
+    DP_Pixel15 *DP_RESTRICT dst, const DP_Pixel15 *DP_RESTRICT src,
+    uint16_t opacity, __m128i (*comp_op)(__m128i, __m128i))
+{
+    __m128i opacity4 = _mm_set1_epi32(opacity);
+
+    // 4 pixels are loaded at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 4) {
+        __m128i dstB, dstG, dstR, dstA;
+        load_aligned_sse42(&dst[i], &dstB, &dstG, &dstR, &dstA);
+
+        // Alpha is preserved, so fully transparent pixels can be skipped.
+        __m128i transparent = _mm_cmpeq_epi32(dstA, _mm_setzero_si128());
+        if (_mm_movemask_epi8(transparent) == 0xffff) {
+            continue;
+        }
+
+        __m128i srcB, srcG, srcR, srcA;
+        load_aligned_sse42(&src[i], &srcB, &srcG, &srcR, &srcA);
+        unpremultiply_source_sse42(&srcB, &srcG, &srcR, srcA);
+
+        __m128i o = mul_sse42(srcA, opacity4);
+        __m128i divisor = _mm_max_epi32(dstA, _mm_set1_epi32(1));
+
+        dstB = composite_separable_sse42(dstB, srcB, dstA, divisor, o,
+                                         transparent, comp_op);
+        dstG = composite_separable_sse42(dstG, srcG, dstA, divisor, o,
+                                         transparent, comp_op);
+        dstR = composite_separable_sse42(dstR, srcR, dstA, divisor, o,
+                                         transparent, comp_op);
+
+        store_aligned_sse42(dstB, dstG, dstR, dstA, &dst[i]);
+    }
+}
+
+static void blend_mask_pixels_luminosity_shine_sai_sse42(
+    DP_Pixel15 *dst, DP_UPixel15 src, const uint16_t *mask_int,
+    Fix15 opacity_int, int count)
+{
+    DP_ASSERT(count % 4 == 0);
+
+    __m128i srcB = _mm_set1_epi32(src.b);
+    __m128i srcG = _mm_set1_epi32(src.g);
+    __m128i srcR = _mm_set1_epi32(src.r);
+
+    __m128i opacity = _mm_set1_epi32((int)opacity_int);
+
+    for (int x = 0; x < count; x += 4, dst += 4, mask_int += 4) {
+        // Load dest
+        __m128i dstB, dstG, dstR, dstA;
+        load_unaligned_sse42(dst, &dstB, &dstG, &dstR, &dstA);
+
+        // Alpha is preserved, so fully transparent pixels can be skipped.
+        __m128i transparent = _mm_cmpeq_epi32(dstA, _mm_setzero_si128());
+        if (_mm_movemask_epi8(transparent) == 0xffff) {
+            continue;
+        }
+
+        // load mask
+        __m128i mask = _mm_cvtepu16_epi32(_mm_loadl_epi64((void *)mask_int));
+        __m128i o = mul_sse42(mask, opacity);
+        __m128i divisor = _mm_max_epi32(dstA, _mm_set1_epi32(1));
+
+        dstB = composite_luminosity_shine_sai_sse42(dstB, srcB, dstA, divisor,
+                                                    o, transparent);
+        dstG = composite_luminosity_shine_sai_sse42(dstG, srcG, dstA, divisor,
+                                                    o, transparent);
+        dstR = composite_luminosity_shine_sai_sse42(dstR, srcR, dstA, divisor,
+                                                    o, transparent);
+
+        store_unaligned_sse42(dstB, dstG, dstR, dstA, dst);
+    }
+}
+
+static void blend_tile_luminosity_shine_sai_sse42(
+    DP_Pixel15 *DP_RESTRICT dst, const DP_Pixel15 *DP_RESTRICT src,
+    uint16_t opacity)
+{
+    __m128i opacity4 = _mm_set1_epi32(opacity);
+
+    // 4 pixels are loaded at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 4) {
+        __m128i dstB, dstG, dstR, dstA;
+        load_aligned_sse42(&dst[i], &dstB, &dstG, &dstR, &dstA);
+
+        // Alpha is preserved, so fully transparent pixels can be skipped.
+        __m128i transparent = _mm_cmpeq_epi32(dstA, _mm_setzero_si128());
+        if (_mm_movemask_epi8(transparent) == 0xffff) {
+            continue;
+        }
+
+        __m128i srcB, srcG, srcR, srcA;
+        load_aligned_sse42(&src[i], &srcB, &srcG, &srcR, &srcA);
+        unpremultiply_source_sse42(&srcB, &srcG, &srcR, srcA);
+
+        __m128i o = mul_sse42(srcA, opacity4);
+        __m128i divisor = _mm_max_epi32(dstA, _mm_set1_epi32(1));
+
+        dstB = composite_luminosity_shine_sai_sse42(dstB, srcB, dstA, divisor,
+                                                    o, transparent);
+        dstG = composite_luminosity_shine_sai_sse42(dstG, srcG, dstA, divisor,
+                                                    o, transparent);
+        dstR = composite_luminosity_shine_sai_sse42(dstR, srcR, dstA, divisor,
+                                                    o, transparent);
+
+        store_aligned_sse42(dstB, dstG, dstR, dstA, &dst[i]);
+    }
+}
+
+#define DEFINE_SEPARABLE_SSE42(NAME)                                         \
+    static void blend_mask_pixels_##NAME##_sse42(                            \
+        DP_Pixel15 *dst, DP_UPixel15 src, const uint16_t *mask_int,          \
+        Fix15 opacity_int, int count)                                        \
+    {                                                                        \
+        blend_mask_pixels_composite_separable_sse42(                         \
+            dst, src, mask_int, opacity_int, count, comp_##NAME##_sse42);    \
+    }                                                                        \
+                                                                             \
+    static void blend_tile_##NAME##_sse42(DP_Pixel15 *DP_RESTRICT dst,       \
+                                          const DP_Pixel15 *DP_RESTRICT src, \
+                                          uint16_t opacity)                  \
+    {                                                                        \
+        blend_tile_composite_separable_sse42(dst, src, opacity,              \
+                                             comp_##NAME##_sse42);           \
+    }
+
+DEFINE_SEPARABLE_SSE42(multiply)
+DEFINE_SEPARABLE_SSE42(divide)
+DEFINE_SEPARABLE_SSE42(burn)
+DEFINE_SEPARABLE_SSE42(dodge)
+DEFINE_SEPARABLE_SSE42(darken)
+DEFINE_SEPARABLE_SSE42(lighten)
+DEFINE_SEPARABLE_SSE42(subtract)
+DEFINE_SEPARABLE_SSE42(add)
+DEFINE_SEPARABLE_SSE42(screen)
+DEFINE_SEPARABLE_SSE42(overlay)
+DEFINE_SEPARABLE_SSE42(hard_light)
+DEFINE_SEPARABLE_SSE42(soft_light)
+DEFINE_SEPARABLE_SSE42(linear_burn)
+DEFINE_SEPARABLE_SSE42(linear_light)
 DP_TARGET_END
 
 DP_TARGET_BEGIN("avx2")
@@ -1290,6 +1639,375 @@ static void blend_mask_pixels_recolor_avx2(DP_Pixel15 *dst, DP_UPixel15 src,
     _mm256_zeroupper();
     // clang-format on
 }
+
+// See div_sse42, just split into two halves of four doubles each.
+static __m256i div_avx2(__m256i a, __m256i b)
+{
+    __m256d lo = _mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(a)),
+                               _mm256_cvtepi32_pd(_mm256_castsi256_si128(b)));
+    __m256d hi =
+        _mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(a, 1)),
+                      _mm256_cvtepi32_pd(_mm256_extracti128_si256(b, 1)));
+    return _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm256_cvttpd_epi32(lo)),
+        _mm256_cvttpd_epi32(hi), 1);
+}
+
+// Same result as fix15_sqrt, see sqrt_sse42.
+static __m256i sqrt_avx2(__m256i x)
+{
+    __m256d bit15 = _mm256_set1_pd(BIT15_DOUBLE);
+    __m256d lo = _mm256_sqrt_pd(_mm256_mul_pd(
+        _mm256_cvtepi32_pd(_mm256_castsi256_si128(x)), bit15));
+    __m256d hi = _mm256_sqrt_pd(_mm256_mul_pd(
+        _mm256_cvtepi32_pd(_mm256_extracti128_si256(x, 1)), bit15));
+    return _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm256_cvttpd_epi32(lo)),
+        _mm256_cvttpd_epi32(hi), 1);
+}
+
+static __m256i clamp_avx2(__m256i x)
+{
+    return _mm256_min_epi32(_mm256_max_epi32(x, _mm256_setzero_si256()),
+                         _mm256_set1_epi32(DP_BIT15));
+}
+
+static __m256i comp_multiply_avx2(__m256i a, __m256i b)
+{
+    return mul_avx2(a, b);
+}
+
+static __m256i comp_divide_avx2(__m256i a, __m256i b)
+{
+    __m256i n = _mm256_add_epi32(
+        _mm256_mullo_epi32(a, _mm256_set1_epi32(DP_BIT15 + 1)),
+        _mm256_srli_epi32(b, 1));
+    __m256i d = _mm256_add_epi32(b, _mm256_set1_epi32(1));
+    return _mm256_min_epi32(div_avx2(n, d), _mm256_set1_epi32(DP_BIT15));
+}
+
+static __m256i comp_burn_avx2(__m256i a, __m256i b)
+{
+    __m256i bit15 = _mm256_set1_epi32(DP_BIT15);
+    __m256i n = _mm256_mullo_epi32(_mm256_sub_epi32(bit15, a),
+                                   _mm256_set1_epi32(DP_BIT15 + 1));
+    __m256i d = _mm256_add_epi32(b, _mm256_set1_epi32(1));
+    return clamp_avx2(_mm256_sub_epi32(bit15, div_avx2(n, d)));
+}
+
+static __m256i comp_dodge_avx2(__m256i a, __m256i b)
+{
+    __m256i n = _mm256_mullo_epi32(a, _mm256_set1_epi32(DP_BIT15 + 1));
+    __m256i d = _mm256_sub_epi32(_mm256_set1_epi32(DP_BIT15 + 1), b);
+    return _mm256_min_epi32(div_avx2(n, d), _mm256_set1_epi32(DP_BIT15));
+}
+
+static __m256i comp_lighten_avx2(__m256i a, __m256i b)
+{
+    return _mm256_max_epi32(a, b);
+}
+
+static __m256i comp_darken_avx2(__m256i a, __m256i b)
+{
+    return _mm256_min_epi32(a, b);
+}
+
+static __m256i comp_subtract_avx2(__m256i a, __m256i b)
+{
+    return _mm256_max_epi32(_mm256_sub_epi32(a, b), _mm256_setzero_si256());
+}
+
+static __m256i comp_add_avx2(__m256i a, __m256i b)
+{
+    return _mm256_min_epi32(_mm256_add_epi32(a, b),
+                            _mm256_set1_epi32(DP_BIT15));
+}
+
+static __m256i comp_screen_avx2(__m256i a, __m256i b)
+{
+    __m256i bit15 = _mm256_set1_epi32(DP_BIT15);
+    __m256i a1 = _mm256_sub_epi32(bit15, a);
+    __m256i b1 = _mm256_sub_epi32(bit15, b);
+    return _mm256_sub_epi32(bit15, mul_avx2(a1, b1));
+}
+
+static __m256i comp_hard_light_avx2(__m256i a, __m256i b)
+{
+    __m256i bit15 = _mm256_set1_epi32(DP_BIT15);
+    __m256i b2 = _mm256_slli_epi32(b, 1);
+    __m256i multiplied = mul_avx2(a, b2);
+    __m256i screened = comp_screen_avx2(a, _mm256_sub_epi32(b2, bit15));
+    return _mm256_blendv_epi8(multiplied, screened,
+                              _mm256_cmpgt_epi32(b2, bit15));
+}
+
+static __m256i comp_overlay_avx2(__m256i a, __m256i b)
+{
+    return comp_hard_light_avx2(b, a);
+}
+
+static __m256i comp_soft_light_avx2(__m256i a, __m256i b)
+{
+    __m256i bit15 = _mm256_set1_epi32(DP_BIT15);
+    __m256i b2 = _mm256_slli_epi32(b, 1);
+    __m256i a1 = _mm256_sub_epi32(bit15, a);
+    __m256i lower = _mm256_sub_epi32(
+        a, mul_avx2(mul_avx2(_mm256_sub_epi32(bit15, b2), a), a1));
+
+    __m256i a4 = _mm256_slli_epi32(a, 2);
+    __m256i squared = mul_avx2(a, a);
+    __m256i cubed16 = _mm256_slli_epi32(mul_avx2(squared, a), 4);
+    __m256i squared12 = _mm256_mullo_epi32(squared, _mm256_set1_epi32(12));
+    __m256i polynomial =
+        _mm256_sub_epi32(_mm256_add_epi32(a4, cubed16), squared12);
+    __m256i d = _mm256_blendv_epi8(polynomial, sqrt_avx2(a),
+                                _mm256_cmpgt_epi32(a4, bit15));
+    __m256i upper = _mm256_add_epi32(
+        a, mul_avx2(_mm256_sub_epi32(b2, bit15), _mm256_sub_epi32(d, a)));
+
+    return _mm256_blendv_epi8(lower, upper, _mm256_cmpgt_epi32(b2, bit15));
+}
+
+static __m256i comp_linear_burn_avx2(__m256i a, __m256i b)
+{
+    __m256i c =
+        _mm256_sub_epi32(_mm256_add_epi32(a, b), _mm256_set1_epi32(DP_BIT15));
+    return _mm256_max_epi32(c, _mm256_setzero_si256());
+}
+
+static __m256i comp_linear_light_avx2(__m256i a, __m256i b)
+{
+    __m256i c = _mm256_add_epi32(a, _mm256_slli_epi32(b, 1));
+    return clamp_avx2(_mm256_sub_epi32(c, _mm256_set1_epi32(DP_BIT15)));
+}
+
+// Unpremultiplies the destination channel, composites it with the source
+// channel, mixes the result by the given opacity and premultiplies it again.
+// Transparent pixels are passed through unchanged, the divisor is the
+// destination alpha clamped to at least 1 to avoid dividing by zero.
+DP_FORCE_INLINE __m256i
+composite_separable_avx2(__m256i cb, __m256i cs, __m256i ab, __m256i divisor,
+                         __m256i o, __m256i transparent,
+                         __m256i (*comp_op)(__m256i, __m256i))
+{
+    __m256i ub = div_avx2(_mm256_slli_epi32(cb, 15), divisor);
+    __m256i o1 = _mm256_sub_epi32(_mm256_set1_epi32(DP_BIT15), o);
+    __m256i cr = mul_avx2(sumprods_avx2(o1, ub, o, comp_op(ub, cs)), ab);
+    return _mm256_blendv_epi8(cr, cb, transparent);
+}
+
+// Same as above, but for Luminosity/Shine (SAI), where the opacity is part of
+// the compositing operation instead of being mixed in afterwards.
+static __m256i composite_luminosity_shine_sai_avx2(__m256i cb, __m256i cs,
+                                                   __m256i ab, __m256i divisor,
+                                                   __m256i o,
+                                                   __m256i transparent)
+{
+    __m256i ub = div_avx2(_mm256_slli_epi32(cb, 15), divisor);
+    __m256i cr = mul_avx2(comp_add_avx2(ub, mul_avx2(cs, o)), ab);
+    return _mm256_blendv_epi8(cr, cb, transparent);
+}
+
+// Turns premultiplied source channels into unpremultiplied ones. A transparent
+// source pixel leads to zero opacity, so it doesn't matter what it turns into.
+static void unpremultiply_source_avx2(__m256i *srcB, __m256i *srcG,
+                                      __m256i *srcR, __m256i srcA)
+{
+    __m256i divisor = _mm256_max_epi32(srcA, _mm256_set1_epi32(1));
+    *srcB = div_avx2(_mm256_slli_epi32(*srcB, 15), divisor);
+    *srcG = div_avx2(_mm256_slli_epi32(*srcG, 15), divisor);
+    *srcR = div_avx2(_mm256_slli_epi32(*srcR, 15), divisor);
+}
+
+DP_FORCE_INLINE void blend_mask_pixels_composite_separable_avx2(
+    DP_Pixel15 *dst, DP_UPixel15 src, const uint16_t *mask_int,
+    Fix15 opacity_int, int count, __m256i (*comp_op)(__m256i, __m256i))
+{
+    DP_ASSERT(count % 8 == 0);
+
+    __m256i srcB = _mm256_set1_epi32(src.b);
+    __m256i srcG = _mm256_set1_epi32(src.g);
+    __m256i srcR = _mm256_set1_epi32(src.r);
+
+    __m256i opacity = _mm256_set1_epi32((int)opacity_int);
+
+    for (int x = 0; x < count; x += 8, dst += 8, mask_int += 8) {
+        // Load dest
+        __m256i dstB, dstG, dstR, dstA;
+        load_unaligned_avx2(dst, &dstB, &dstG, &dstR, &dstA);
+
+        // Alpha is preserved, so fully transparent pixels can be skipped.
+        __m256i transparent = _mm256_cmpeq_epi32(dstA, _mm256_setzero_si256());
+        if (_mm256_movemask_epi8(transparent) == -1) {
+            continue;
+        }
+
+        // load mask
+        __m256i mask = _mm256_cvtepu16_epi32(_mm_loadu_si128((void *)mask_int));
+        // Permute mask to fit pixel load order (15263748)
+        mask = _mm256_permutevar8x32_epi32(
+            mask, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        __m256i o = mul_avx2(mask, opacity);
+        __m256i divisor = _mm256_max_epi32(dstA, _mm256_set1_epi32(1));
+
+        dstB = composite_separable_avx2(dstB, srcB, dstA, divisor, o,
+                                        transparent, comp_op);
+        dstG = composite_separable_avx2(dstG, srcG, dstA, divisor, o,
+                                        transparent, comp_op);
+        dstR = composite_separable_avx2(dstR, srcR, dstA, divisor, o,
+                                        transparent, comp_op);
+
+        store_unaligned_avx2(dstB, dstG, dstR, dstA, dst);
+    }
+    _mm256_zeroupper();
+}
+
+DP_FORCE_INLINE void blend_tile_composite_separable_avx2(
+    DP_Pixel15 *DP_RESTRICT dst, const DP_Pixel15 *DP_RESTRICT src,
+    uint16_t opacity, __m256i (*comp_op)(__m256i, __m256i))
+{
+    __m256i opacity8 = _mm256_set1_epi32(opacity);
+
+    // 8 pixels are loaded at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
+        __m256i dstB, dstG, dstR, dstA;
+        load_aligned_avx2(&dst[i], &dstB, &dstG, &dstR, &dstA);
+
+        // Alpha is preserved, so fully transparent pixels can be skipped.
+        __m256i transparent = _mm256_cmpeq_epi32(dstA, _mm256_setzero_si256());
+        if (_mm256_movemask_epi8(transparent) == -1) {
+            continue;
+        }
+
+        __m256i srcB, srcG, srcR, srcA;
+        load_aligned_avx2(&src[i], &srcB, &srcG, &srcR, &srcA);
+        unpremultiply_source_avx2(&srcB, &srcG, &srcR, srcA);
+
+        __m256i o = mul_avx2(srcA, opacity8);
+        __m256i divisor = _mm256_max_epi32(dstA, _mm256_set1_epi32(1));
+
+        dstB = composite_separable_avx2(dstB, srcB, dstA, divisor, o,
+                                        transparent, comp_op);
+        dstG = composite_separable_avx2(dstG, srcG, dstA, divisor, o,
+                                        transparent, comp_op);
+        dstR = composite_separable_avx2(dstR, srcR, dstA, divisor, o,
+                                        transparent, comp_op);
+
+        store_aligned_avx2(dstB, dstG, dstR, dstA, &dst[i]);
+    }
+    _mm256_zeroupper();
+}
+
+static void blend_mask_pixels_luminosity_shine_sai_avx2(
+    DP_Pixel15 *dst, DP_UPixel15 src, const uint16_t *mask_int,
+    Fix15 opacity_int, int count)
+{
+    DP_ASSERT(count % 8 == 0);
+
+    __m256i srcB = _mm256_set1_epi32(src.b);
+    __m256i srcG = _mm256_set1_epi32(src.g);
+    __m256i srcR = _mm256_set1_epi32(src.r);
+
+    __m256i opacity = _mm256_set1_epi32((int)opacity_int);
+
+    for (int x = 0; x < count; x += 8, dst += 8, mask_int += 8) {
+        // Load dest
+        __m256i dstB, dstG, dstR, dstA;
+        load_unaligned_avx2(dst, &dstB, &dstG, &dstR, &dstA);
+
+        // Alpha is preserved, so fully transparent pixels can be skipped.
+        __m256i transparent = _mm256_cmpeq_epi32(dstA, _mm256_setzero_si256());
+        if (_mm256_movemask_epi8(transparent) == -1) {
+            continue;
+        }
+
+        // load mask
+        __m256i mask = _mm256_cvtepu16_epi32(_mm_loadu_si128((void *)mask_int));
+        // Permute mask to fit pixel load order (15263748)
+        mask = _mm256_permutevar8x32_epi32(
+            mask, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        __m256i o = mul_avx2(mask, opacity);
+        __m256i divisor = _mm256_max_epi32(dstA, _mm256_set1_epi32(1));
+
+        dstB = composite_luminosity_shine_sai_avx2(dstB, srcB, dstA, divisor, o,
+                                                   transparent);
+        dstG = composite_luminosity_shine_sai_avx2(dstG, srcG, dstA, divisor, o,
+                                                   transparent);
+        dstR = composite_luminosity_shine_sai_avx2(dstR, srcR, dstA, divisor, o,
+                                                   transparent);
+
+        store_unaligned_avx2(dstB, dstG, dstR, dstA, dst);
+    }
+    _mm256_zeroupper();
+}
+
+static void blend_tile_luminosity_shine_sai_avx2(
+    DP_Pixel15 *DP_RESTRICT dst, const DP_Pixel15 *DP_RESTRICT src,
+    uint16_t opacity)
+{
+    __m256i opacity8 = _mm256_set1_epi32(opacity);
+
+    // 8 pixels are loaded at a time
+    for (int i = 0; i < DP_TILE_LENGTH; i += 8) {
+        __m256i dstB, dstG, dstR, dstA;
+        load_aligned_avx2(&dst[i], &dstB, &dstG, &dstR, &dstA);
+
+        // Alpha is preserved, so fully transparent pixels can be skipped.
+        __m256i transparent = _mm256_cmpeq_epi32(dstA, _mm256_setzero_si256());
+        if (_mm256_movemask_epi8(transparent) == -1) {
+            continue;
+        }
+
+        __m256i srcB, srcG, srcR, srcA;
+        load_aligned_avx2(&src[i], &srcB, &srcG, &srcR, &srcA);
+        unpremultiply_source_avx2(&srcB, &srcG, &srcR, srcA);
+
+        __m256i o = mul_avx2(srcA, opacity8);
+        __m256i divisor = _mm256_max_epi32(dstA, _mm256_set1_epi32(1));
+
+        dstB = composite_luminosity_shine_sai_avx2(dstB, srcB, dstA, divisor, o,
+                                                   transparent);
+        dstG = composite_luminosity_shine_sai_avx2(dstG, srcG, dstA, divisor, o,
+                                                   transparent);
+        dstR = composite_luminosity_shine_sai_avx2(dstR, srcR, dstA, divisor, o,
+                                                   transparent);
+
+        store_aligned_avx2(dstB, dstG, dstR, dstA, &dst[i]);
+    }
+    _mm256_zeroupper();
+}
+
+#define DEFINE_SEPARABLE_AVX2(NAME)                                         \
+    static void blend_mask_pixels_##NAME##_avx2(                            \
+        DP_Pixel15 *dst, DP_UPixel15 src, const uint16_t *mask_int,         \
+        Fix15 opacity_int, int count)                                       \
+    {                                                                       \
+        blend_mask_pixels_composite_separable_avx2(                         \
+            dst, src, mask_int, opacity_int, count, comp_##NAME##_avx2);    \
+    }                                                                       \
+                                                                            \
+    static void blend_tile_##NAME##_avx2(DP_Pixel15 *DP_RESTRICT dst,       \
+                                         const DP_Pixel15 *DP_RESTRICT src, \
+                                         uint16_t opacity)                  \
+    {                                                                       \
+        blend_tile_composite_separable_avx2(dst, src, opacity,              \
+                                            comp_##NAME##_avx2);            \
+    }
+
+DEFINE_SEPARABLE_AVX2(multiply)
+DEFINE_SEPARABLE_AVX2(divide)
+DEFINE_SEPARABLE_AVX2(burn)
+DEFINE_SEPARABLE_AVX2(dodge)
+DEFINE_SEPARABLE_AVX2(darken)
+DEFINE_SEPARABLE_AVX2(lighten)
+DEFINE_SEPARABLE_AVX2(subtract)
+DEFINE_SEPARABLE_AVX2(add)
+DEFINE_SEPARABLE_AVX2(screen)
+DEFINE_SEPARABLE_AVX2(overlay)
+DEFINE_SEPARABLE_AVX2(hard_light)
+DEFINE_SEPARABLE_AVX2(soft_light)
+DEFINE_SEPARABLE_AVX2(linear_burn)
+DEFINE_SEPARABLE_AVX2(linear_light)
 DP_TARGET_END
 #endif
 
@@ -1884,6 +2602,85 @@ static void blend_mask_recolor(DP_Pixel15 *dst, DP_UPixel15 src,
 #endif
 }
 
+#ifdef DP_CPU_X64
+typedef void (*BlendMaskPixelsFn)(DP_Pixel15 *, DP_UPixel15, const uint16_t *,
+                                  Fix15, int);
+
+// Runs the widest available vectorized kernel over as much of the row as it
+// can handle. Returns how many pixels were blended, the rest is left over for
+// the scalar implementation to deal with.
+static int blend_mask_row_simd(DP_Pixel15 *dst, DP_UPixel15 src,
+                               const uint16_t *mask, Fix15 opacity, int w,
+                               BlendMaskPixelsFn sse42_fn,
+                               BlendMaskPixelsFn avx2_fn)
+{
+    int done = 0;
+
+    if (DP_cpu_support >= DP_CPU_SUPPORT_AVX2) {
+        int avx_width = w - w % 8;
+        avx2_fn(dst, src, mask, opacity, avx_width);
+        done += avx_width;
+    }
+
+    if (DP_cpu_support >= DP_CPU_SUPPORT_SSE42) {
+        int remaining = w - done;
+        int sse_width = remaining - remaining % 4;
+        sse42_fn(dst + done, src, mask + done, opacity, sse_width);
+        done += sse_width;
+    }
+
+    return done;
+}
+
+static void blend_mask_composite_separable_simd(
+    DP_Pixel15 *dst, DP_UPixel15 src, const uint16_t *mask, Fix15 opacity,
+    int w, int h, int mask_skip, int base_skip, Fix15 (*comp_op)(Fix15, Fix15),
+    BlendMaskPixelsFn sse42_fn, BlendMaskPixelsFn avx2_fn)
+{
+    for (int y = 0; y < h; ++y) {
+        int done =
+            blend_mask_row_simd(dst, src, mask, opacity, w, sse42_fn, avx2_fn);
+        blend_mask_composite_separable(dst + done, src, mask + done, opacity,
+                                       w - done, 1, 0, 0, comp_op);
+        dst += w + base_skip;
+        mask += w + mask_skip;
+    }
+}
+
+#    define BLEND_MASK_SEPARABLE(NAME)                                        \
+        blend_mask_composite_separable_simd(                                  \
+            dst, src, mask, opacity, w, h, mask_skip, base_skip, comp_##NAME, \
+            blend_mask_pixels_##NAME##_sse42, blend_mask_pixels_##NAME##_avx2)
+#else
+#    define BLEND_MASK_SEPARABLE(NAME)                                 \
+        blend_mask_composite_separable(dst, src, mask, opacity, w, h, \
+                                       mask_skip, base_skip, comp_##NAME)
+#endif
+
+static void blend_mask_luminosity_shine_sai(DP_Pixel15 *dst, DP_UPixel15 src,
+                                            const uint16_t *mask,
+                                            Fix15 opacity, int w, int h,
+                                            int mask_skip, int base_skip)
+{
+#ifdef DP_CPU_X64
+    for (int y = 0; y < h; ++y) {
+        int done = blend_mask_row_simd(
+            dst, src, mask, opacity, w,
+            blend_mask_pixels_luminosity_shine_sai_sse42,
+            blend_mask_pixels_luminosity_shine_sai_avx2);
+        blend_mask_composite_separable_with_opacity(
+            dst + done, src, mask + done, opacity, w - done, 1, 0, 0,
+            comp_luminosity_shine_sai);
+        dst += w + base_skip;
+        mask += w + mask_skip;
+    }
+#else
+    blend_mask_composite_separable_with_opacity(dst, src, mask, opacity, w, h,
+                                                mask_skip, base_skip,
+                                                comp_luminosity_shine_sai);
+#endif
+}
+
 void DP_blend_mask(DP_Pixel15 *dst, DP_UPixel15 src, int blend_mode,
                    const uint16_t *mask, uint16_t opacity, int w, int h,
                    int mask_skip, int base_skip)
@@ -1920,70 +2717,55 @@ void DP_blend_mask(DP_Pixel15 *dst, DP_UPixel15 src, int blend_mode,
         break;
     // Alpha-preserving separable blend modes (each channel handled separately)
     case DP_BLEND_MODE_MULTIPLY:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_multiply);
+        BLEND_MASK_SEPARABLE(multiply);
         break;
     case DP_BLEND_MODE_DIVIDE:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_divide);
+        BLEND_MASK_SEPARABLE(divide);
         break;
     case DP_BLEND_MODE_BURN:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_burn);
+        BLEND_MASK_SEPARABLE(burn);
         break;
     case DP_BLEND_MODE_DODGE:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_dodge);
+        BLEND_MASK_SEPARABLE(dodge);
         break;
     case DP_BLEND_MODE_DARKEN:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_darken);
+        BLEND_MASK_SEPARABLE(darken);
         break;
     case DP_BLEND_MODE_LIGHTEN:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_lighten);
+        BLEND_MASK_SEPARABLE(lighten);
         break;
     case DP_BLEND_MODE_SUBTRACT:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_subtract);
+        BLEND_MASK_SEPARABLE(subtract);
         break;
     case DP_BLEND_MODE_ADD:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_add);
+        BLEND_MASK_SEPARABLE(add);
         break;
     case DP_BLEND_MODE_RECOLOR:
         blend_mask_recolor(dst, src, mask, to_fix(opacity), w, h, mask_skip,
                            base_skip);
         break;
     case DP_BLEND_MODE_SCREEN:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_screen);
+        BLEND_MASK_SEPARABLE(screen);
         break;
     case DP_BLEND_MODE_OVERLAY:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_overlay);
+        BLEND_MASK_SEPARABLE(overlay);
         break;
     case DP_BLEND_MODE_HARD_LIGHT:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_hard_light);
+        BLEND_MASK_SEPARABLE(hard_light);
         break;
     case DP_BLEND_MODE_SOFT_LIGHT:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_soft_light);
+        BLEND_MASK_SEPARABLE(soft_light);
         break;
     case DP_BLEND_MODE_LINEAR_BURN:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_linear_burn);
+        BLEND_MASK_SEPARABLE(linear_burn);
         break;
     case DP_BLEND_MODE_LINEAR_LIGHT:
-        blend_mask_composite_separable(dst, src, mask, opacity, w, h, mask_skip,
-                                       base_skip, comp_linear_light);
+        BLEND_MASK_SEPARABLE(linear_light);
         break;
     // Alpha-preserving separable blend modes where the opacity affects blending
     case DP_BLEND_MODE_LUMINOSITY_SHINE_SAI:
-        blend_mask_composite_separable_with_opacity(dst, src, mask, opacity, w,
-                                                    h, mask_skip, base_skip,
-                                                    comp_luminosity_shine_sai);
+        blend_mask_luminosity_shine_sai(dst, src, mask, opacity, w, h,
+                                        mask_skip, base_skip);
         break;
     // Alpha-preserving non-separable blend modes (channels interact)
     case DP_BLEND_MODE_HUE:
@@ -2222,6 +3004,37 @@ void DP_blend_pixels(DP_Pixel15 *DP_RESTRICT dst,
     }
 }
 
+#ifdef DP_CPU_X64
+typedef void (*BlendTileFn)(DP_Pixel15 *DP_RESTRICT,
+                            const DP_Pixel15 *DP_RESTRICT, uint16_t);
+
+static bool blend_tile_simd(DP_Pixel15 *DP_RESTRICT dst,
+                            const DP_Pixel15 *DP_RESTRICT src, uint16_t opacity,
+                            BlendTileFn sse42_fn, BlendTileFn avx2_fn)
+{
+    if (DP_cpu_support >= DP_CPU_SUPPORT_AVX2) {
+        avx2_fn(dst, src, opacity);
+        return true;
+    }
+    else if (DP_cpu_support >= DP_CPU_SUPPORT_SSE42) {
+        sse42_fn(dst, src, opacity);
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+#    define BLEND_TILE_SIMD(NAME)                                        \
+        do {                                                             \
+            if (blend_tile_simd(aligned_dst, aligned_src, opacity,       \
+                                blend_tile_##NAME##_sse42,               \
+                                blend_tile_##NAME##_avx2)) {             \
+                return;                                                  \
+            }                                                            \
+        } while (0)
+#endif
+
 void DP_blend_tile(DP_Pixel15 *DP_RESTRICT dst,
                    const DP_Pixel15 *DP_RESTRICT src, uint16_t opacity,
                    int blend_mode)
@@ -2255,6 +3068,53 @@ void DP_blend_tile(DP_Pixel15 *DP_RESTRICT dst,
             break;
         }
         break;
+    // Alpha-preserving separable blend modes (each channel handled separately)
+    case DP_BLEND_MODE_MULTIPLY:
+        BLEND_TILE_SIMD(multiply);
+        break;
+    case DP_BLEND_MODE_DIVIDE:
+        BLEND_TILE_SIMD(divide);
+        break;
+    case DP_BLEND_MODE_BURN:
+        BLEND_TILE_SIMD(burn);
+        break;
+    case DP_BLEND_MODE_DODGE:
+        BLEND_TILE_SIMD(dodge);
+        break;
+    case DP_BLEND_MODE_DARKEN:
+        BLEND_TILE_SIMD(darken);
+        break;
+    case DP_BLEND_MODE_LIGHTEN:
+        BLEND_TILE_SIMD(lighten);
+        break;
+    case DP_BLEND_MODE_SUBTRACT:
+        BLEND_TILE_SIMD(subtract);
+        break;
+    case DP_BLEND_MODE_ADD:
+        BLEND_TILE_SIMD(add);
+        break;
+    case DP_BLEND_MODE_SCREEN:
+        BLEND_TILE_SIMD(screen);
+        break;
+    case DP_BLEND_MODE_OVERLAY:
+        BLEND_TILE_SIMD(overlay);
+        break;
+    case DP_BLEND_MODE_HARD_LIGHT:
+        BLEND_TILE_SIMD(hard_light);
+        break;
+    case DP_BLEND_MODE_SOFT_LIGHT:
+        BLEND_TILE_SIMD(soft_light);
+        break;
+    case DP_BLEND_MODE_LINEAR_BURN:
+        BLEND_TILE_SIMD(linear_burn);
+        break;
+    case DP_BLEND_MODE_LINEAR_LIGHT:
+        BLEND_TILE_SIMD(linear_light);
+        break;
+    // Alpha-preserving separable blend modes where the opacity affects blending
+    case DP_BLEND_MODE_LUMINOSITY_SHINE_SAI:
+        BLEND_TILE_SIMD(luminosity_shine_sai);
+        break;
     default:
         break;
     }
@@ -39,13 +39,17 @@
 #include "tile.h"
 #include "timeline.h"
 #include "track.h"
+#include <dpcommon/atomic.h>
 #include <dpcommon/binary.h>
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
 #include <dpcommon/input.h>
+#include <dpcommon/ordered_worker.h>
 #include <dpcommon/output.h>
 #include <dpcommon/perf.h>
+#include <dpcommon/threading.h>
 #include <dpcommon/vector.h>
+#include <dpcommon/worker.h>
 #include <dpmsg/acl.h>
 #include <dpmsg/binary_reader.h>
 #include <dpmsg/blend_mode.h>
@@ -58,13 +62,23 @@
 #define DP_PERF_CONTEXT "player"
 
 
-#define INDEX_EXTENSION       "dpidx"
-#define INDEX_MAGIC           "DPIDX"
-#define INDEX_MAGIC_LENGTH    6
-#define INDEX_VERSION         12
-#define INDEX_VERSION_LENGTH  2
-#define INDEX_HEADER_LENGTH   (INDEX_MAGIC_LENGTH + INDEX_VERSION_LENGTH + 12)
-#define INITAL_ENTRY_CAPACITY 64
+#define INDEX_EXTENSION           "dpidx"
+#define INDEX_MAGIC               "DPIDX"
+#define INDEX_MAGIC_LENGTH        6
+#define INDEX_VERSION             14
+#define INDEX_VERSION_LENGTH      2
+#define INDEX_FLAGS_OFFSET        (INDEX_MAGIC_LENGTH + INDEX_VERSION_LENGTH)
+#define INDEX_CHECKPOINT_OFFSET   (INDEX_FLAGS_OFFSET + 4)
+#define INDEX_HEADER_LENGTH       (INDEX_CHECKPOINT_OFFSET + 44)
+#define INDEX_FLAG_COMPLETE       0x1u
+#define INDEX_HASH_INITIAL        0xcbf29ce484222325u
+#define INDEX_HASH_PRIME          0x100000001b3u
+#define INDEX_HASH_BUFFER_SIZE    16384
+#define INDEX_CHUNK_HEADER_LENGTH (sizeof(uint64_t) + sizeof(uint32_t))
+#define INITAL_ENTRY_CAPACITY     64
+#define INDEX_TILE_WINDOW         16 // Tiles per thread compressed ahead.
+#define INDEX_TILE_MAX_THREADS    4  // Runs alongside the thumbnail workers.
+#define INDEX_SNAPSHOT_WINDOW     4  // Snapshots in flight while replaying.
 
 static_assert(INDEX_MAGIC_LENGTH < sizeof(DP_OutputBinaryEntry),
               "index header fits into output binary entry");
@@ -775,11 +789,10 @@ typedef struct DP_BuildIndexMaps {
 
 typedef struct DP_BuildIndexEntryContext {
     DP_Output *output;
-    DP_AclState *acls;
-    DP_LocalState *local_state;
-    DP_CanvasHistory *ch;
+    DP_Vector *messages;
     DP_CanvasState *cs;
     DP_DrawContext *dc;
+    DP_OrderedWorker *ow;
     DP_BuildIndexMaps current;
     DP_BuildIndexMaps *last;
     int message_count;
@@ -803,14 +816,58 @@ typedef struct DP_BuildIndexContext {
     DP_LocalState *local_state;
     DP_CanvasHistory *ch;
     DP_DrawContext *dc;
+    DP_OrderedWorker *ow;
     long long message_count;
+    long long last_entry_message_index;
+    // Recording offset right after the last command message handled.
+    size_t resume_offset;
     DP_Vector entries;
+    struct {
+        size_t offset;
+        size_t entry_count;
+        int count;
+    } chunks;
     DP_BuildIndexMaps last;
+    // The recording is hashed along with indexing it, so that resuming can
+    // tell if it was replaced or changed in the meantime.
+    struct {
+        DP_Input *input;
+        size_t offset;
+        uint64_t header_hash;
+        uint64_t hash;
+    } recording;
     DP_PlayerIndexShouldSnapshotFn should_snapshot_fn;
     DP_PlayerIndexProgressFn progress_fn;
     void *user;
+    // Snapshots are captured on the replay thread and then written out in
+    // order on the writer thread, with thumbnails rendered in parallel.
+    struct {
+        DP_Worker *writer;
+        DP_Worker *thumbnailer;
+        DP_DrawContext *writer_dc;
+        DP_DrawContext **thumbnail_dcs;
+        int thumbnail_thread_count;
+        DP_Semaphore *slots;
+        DP_Atomic failed;
+        char *error;
+    } pipeline;
 } DP_BuildIndexContext;
 
+typedef struct DP_BuildIndexSnapshotJob {
+    DP_BuildIndexContext *c;
+    long long message_index;
+    size_t message_offset;
+    long long message_count;
+    size_t resume_offset;
+    DP_CanvasState *cs;
+    DP_Vector messages;
+    DP_Semaphore *thumbnail_sem;
+    struct {
+        void *buffer;
+        size_t size;
+    } thumbnail;
+} DP_BuildIndexSnapshotJob;
+
 struct DP_BuildIndexLayerProps {
     uint16_t layer_id;
     uint16_t title_length;
@@ -826,12 +883,14 @@ struct DP_BuildIndexLayerProps {
     uint8_t group;
 };
 
+// Flags start out zero, so the index counts as incomplete until it's finished.
 static bool write_index_header(DP_BuildIndexContext *c)
 {
     return DP_OUTPUT_WRITE_LITTLEENDIAN(
         c->output, DP_OUTPUT_BYTES(INDEX_MAGIC, INDEX_MAGIC_LENGTH),
         DP_OUTPUT_UINT16(INDEX_VERSION), DP_OUTPUT_UINT32(0),
-        DP_OUTPUT_UINT64(0));
+        DP_OUTPUT_UINT32(0), DP_OUTPUT_UINT64(0), DP_OUTPUT_UINT64(0),
+        DP_OUTPUT_UINT64(0), DP_OUTPUT_UINT64(0), DP_OUTPUT_UINT64(0));
 }
 
 unsigned char *get_message_buffer(void *user, size_t length)
@@ -839,11 +898,10 @@ unsigned char *get_message_buffer(void *user, size_t length)
     return DP_draw_context_pool_require(user, length);
 }
 
-static bool write_index_history_message_dec(DP_BuildIndexEntryContext *e,
-                                            DP_Message *msg)
+static bool write_index_history_message(DP_BuildIndexEntryContext *e,
+                                        DP_Message *msg)
 {
     size_t length = DP_message_serialize(msg, false, get_message_buffer, e->dc);
-    DP_message_decref(msg);
     if (length == 0) {
         DP_error_set("Error serializing history message %d",
                      e->message_count + 1);
@@ -863,19 +921,6 @@ static bool write_index_history_message_dec(DP_BuildIndexEntryContext *e,
     }
 }
 
-static bool init_reset_image(void *user, DP_CanvasState *cs)
-{
-    DP_BuildIndexEntryContext *e = user;
-    e->cs = cs;
-    DP_Message *msg = DP_acl_state_msg_feature_access_all_new(0);
-    return write_index_history_message_dec(e, msg);
-}
-
-static bool write_reset_image_message(void *user, DP_Message *msg)
-{
-    return write_index_history_message_dec(user, msg);
-}
-
 static bool write_index_history(DP_BuildIndexEntryContext *e)
 {
     bool error;
@@ -884,21 +929,13 @@ static bool write_index_history(DP_BuildIndexEntryContext *e)
         return false;
     }
 
-    if (!DP_canvas_history_reset_image_new(e->ch, init_reset_image,
-                                           write_reset_image_message, e)) {
-        return false;
-    }
-
-    // The state of the permissions at this point.
-    if (!DP_acl_state_reset_image_build(
-            e->acls, 0, DP_ACL_STATE_RESET_IMAGE_RECORDING_FLAGS,
-            write_reset_image_message, e)) {
-        return false;
-    }
-    // Local changes (hidden layers, local canvas background).
-    if (!DP_local_state_reset_image_build(e->local_state, e->dc,
-                                          write_reset_image_message, e)) {
-        return false;
+    DP_Vector *messages = e->messages;
+    size_t count = messages->used;
+    for (size_t i = 0; i < count; ++i) {
+        DP_Message *msg = DP_VECTOR_AT_TYPE(messages, DP_Message *, i);
+        if (!write_index_history_message(e, msg)) {
+            return false;
+        }
     }
 
     e->offset.history = offset;
@@ -947,6 +984,7 @@ static unsigned char *get_compression_buffer(size_t size, void *user)
 static size_t write_index_tile(DP_BuildIndexEntryContext *e, DP_Tile *t)
 {
     size_t size = DP_tile_compress(t, DP_draw_context_tile8_buffer(e->dc),
+                                   DP_COMPRESS_PROFILE_MAX,
                                    get_compression_buffer, e->dc);
     if (size == 0) {
         return 0;
@@ -967,19 +1005,29 @@ static size_t write_index_tile(DP_BuildIndexEntryContext *e, DP_Tile *t)
     return offset;
 }
 
+static bool search_index_tile(DP_BuildIndexEntryContext *e, DP_Tile *t,
+                              size_t *out_offset)
+{
+    DP_BuildIndexTileMap *entry;
+    if ((entry = search_tile(e->current.tiles, t)) != NULL) {
+        *out_offset = entry->offset;
+        return true;
+    }
+    else if ((entry = search_tile(e->last->tiles, t)) != NULL) {
+        move_tile_offset(e, entry);
+        *out_offset = entry->offset;
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
 static bool maybe_write_index_tile(DP_BuildIndexEntryContext *e, DP_Tile *t,
                                    size_t *out_offset)
 {
     if (t) {
-        DP_BuildIndexTileMap *entry;
-        if ((entry = search_tile(e->current.tiles, t)) != NULL) {
-            *out_offset = entry->offset;
-        }
-        else if ((entry = search_tile(e->last->tiles, t)) != NULL) {
-            move_tile_offset(e, entry);
-            *out_offset = entry->offset;
-        }
-        else {
+        if (!search_index_tile(e, t, out_offset)) {
             size_t offset = write_index_tile(e, t);
             if (offset != 0) {
                 *out_offset = offset;
@@ -995,6 +1043,81 @@ static bool maybe_write_index_tile(DP_BuildIndexEntryContext *e, DP_Tile *t,
     return true;
 }
 
+struct DP_BuildIndexLayerTiles {
+    DP_BuildIndexEntryContext *e;
+    unsigned char *tile_buffer;
+    // Tiles that weren't written by a previous snapshot and their positions.
+    DP_Tile **tiles;
+    int *positions;
+};
+
+static DP_Tile *get_index_layer_tile(void *user, int index)
+{
+    struct DP_BuildIndexLayerTiles *bilt = user;
+    return bilt->tiles[index];
+}
+
+static bool write_index_layer_tile(void *user, int index,
+                                   const unsigned char *data, size_t size)
+{
+    if (!data) {
+        return false;
+    }
+
+    struct DP_BuildIndexLayerTiles *bilt = user;
+    DP_Output *output = bilt->e->output;
+    uint16_t length = DP_size_to_uint16(size);
+    bool error;
+    size_t offset = DP_output_tell(output, &error);
+    bool ok = !error
+           && DP_OUTPUT_WRITE_LITTLEENDIAN(output, DP_OUTPUT_UINT16(length))
+           && DP_output_write(output, data, size);
+    if (ok) {
+        size_t position = DP_int_to_size(bilt->positions[index]);
+        unsigned char *out = bilt->tile_buffer + position * sizeof(uint64_t);
+        DP_write_littleendian_uint64(offset, out);
+    }
+    return ok;
+}
+
+// Tiles not already in the index are compressed in parallel, but written in
+// the same order as they would be one by one, so the output is the same.
+static bool write_index_layer_tiles(DP_BuildIndexEntryContext *e,
+                                    DP_LayerContent *lc, int tile_total,
+                                    unsigned char *tile_buffer)
+{
+    size_t tile_total_size = DP_int_to_size(tile_total);
+    struct DP_BuildIndexLayerTiles bilt = {
+        e, tile_buffer, DP_malloc(sizeof(*bilt.tiles) * tile_total_size),
+        DP_malloc(sizeof(*bilt.positions) * tile_total_size)};
+
+    int width = DP_layer_content_width(lc);
+    int tile_count_x = DP_tile_count_round(width);
+    int count = 0;
+    for (int i = 0; i < tile_total; ++i) {
+        DP_Tile *t = DP_layer_content_tile_at_noinc(lc, i % tile_count_x,
+                                                    i / tile_count_x);
+        size_t tile_offset = 0;
+        if (t && !search_index_tile(e, t, &tile_offset)) {
+            bilt.tiles[count] = t;
+            bilt.positions[count] = i;
+            ++count;
+        }
+        else {
+            unsigned char *out =
+                tile_buffer + DP_int_to_size(i) * sizeof(uint64_t);
+            DP_write_littleendian_uint64(tile_offset, out);
+        }
+    }
+
+    bool ok = DP_tile_compress_ordered(e->ow, count, DP_COMPRESS_PROFILE_MAX,
+                                       get_index_layer_tile,
+                                       write_index_layer_tile, &bilt);
+    DP_free(bilt.positions);
+    DP_free(bilt.tiles);
+    return ok;
+}
+
 static size_t search_existing_layer(DP_BuildIndexEntryContext *e,
                                     DP_BuildIndexLayerKey *key)
 {
@@ -1121,21 +1244,11 @@ static size_t write_index_layer_content(DP_BuildIndexEntryContext *e,
     int tile_total = tile_counts.x * tile_counts.y;
     size_t tile_buffer_size = DP_int_to_size(tile_total) * sizeof(uint64_t);
     unsigned char *tile_buffer = DP_malloc(tile_buffer_size);
-    size_t written = 0;
-    for (int y = 0; y < tile_counts.y; ++y) {
-        for (int x = 0; x < tile_counts.x; ++x) {
-            DP_Tile *t = DP_layer_content_tile_at_noinc(lc, x, y);
-            size_t tile_offset;
-            if (!maybe_write_index_tile(e, t, &tile_offset)) {
-                DP_free(sub_buffer);
-                DP_free(tile_buffer);
-                return 0;
-            }
-            written += DP_write_littleendian_uint64(tile_offset,
-                                                    tile_buffer + written);
-        }
+    if (!write_index_layer_tiles(e, lc, tile_total, tile_buffer)) {
+        DP_free(sub_buffer);
+        DP_free(tile_buffer);
+        return 0;
     }
-    DP_ASSERT(written == tile_buffer_size);
 
     bool error;
     size_t offset = DP_output_tell(e->output, &error);
@@ -1482,62 +1595,25 @@ static bool write_index_snapshot(DP_BuildIndexEntryContext *e)
     return ok;
 }
 
-static bool write_index_thumbnail(DP_BuildIndexEntryContext *e)
+static bool write_index_thumbnail(DP_BuildIndexEntryContext *e,
+                                  DP_BuildIndexSnapshotJob *job)
 {
-    DP_Output *output = e->output;
-    bool error;
-    size_t thumbnail_offset = DP_output_tell(output, &error);
-    if (error) {
-        return false;
-    }
-
-    DP_Image *img = DP_canvas_state_to_flat_image(
-        e->cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
-    if (!img) {
-        DP_warn("Error creating index thumbnail: %s", DP_error());
+    void *buffer = job->thumbnail.buffer;
+    if (!buffer) {
         return true; // Keep going without a thumbnail.
     }
 
-    DP_Image *thumb;
-    if (DP_image_thumbnail(img, e->dc, 256, 256, &thumb)) {
-        if (thumb) {
-            DP_image_free(img);
-        }
-        else {
-            thumb = img;
-        }
-    }
-    else {
-        DP_image_free(img);
-        DP_warn("Error scaling index thumbnail: %s", DP_error());
-        return true; // Keep going without a thumbnail.
-    }
-
-    if (!DP_OUTPUT_WRITE_LITTLEENDIAN(output, DP_OUTPUT_UINT32(0))) {
-        return false;
-    }
-
-    bool write_ok = DP_image_write_png(thumb, output);
-    DP_image_free(thumb);
-    if (!write_ok) {
-        return false;
-    }
-
-    size_t end_offset = DP_output_tell(output, &error);
+    DP_Output *output = e->output;
+    bool error;
+    size_t thumbnail_offset = DP_output_tell(output, &error);
     if (error) {
         return false;
     }
 
-    if (!DP_output_seek(output, thumbnail_offset)) {
-        return false;
-    }
-
-    size_t size = end_offset - thumbnail_offset - 4;
-    if (!DP_OUTPUT_WRITE_LITTLEENDIAN(output, DP_OUTPUT_UINT32(size))) {
-        return false;
-    }
-
-    if (!DP_output_seek(output, end_offset)) {
+    size_t size = job->thumbnail.size;
+    bool ok = DP_OUTPUT_WRITE_LITTLEENDIAN(output, DP_OUTPUT_UINT32(size))
+           && DP_output_write(output, buffer, size);
+    if (!ok) {
         return false;
     }
 
@@ -1578,74 +1654,476 @@ static void dispose_index_maps(DP_BuildIndexMaps *maps)
     DP_timeline_decref_nullable(maps->timeline.tl);
 }
 
-static bool make_index_entry(DP_BuildIndexContext *c, long long message_index,
-                             size_t message_offset)
+static bool write_index_entry(DP_BuildIndexContext *c,
+                              DP_PlayerIndexEntry *entry)
+{
+    return DP_OUTPUT_WRITE_LITTLEENDIAN(
+        c->output, DP_OUTPUT_UINT32(entry->message_index),
+        DP_OUTPUT_UINT64(entry->message_offset),
+        DP_OUTPUT_UINT64(entry->snapshot_offset),
+        DP_OUTPUT_UINT64(entry->thumbnail_offset));
+}
+
+// Entries are written in chunks, each one pointing back at the one before it,
+// so that an index can be extended without rewriting the entries it has.
+static bool write_index_chunk(DP_BuildIndexContext *c, size_t start)
+{
+    DP_Output *output = c->output;
+    bool error;
+    size_t offset = DP_output_tell(output, &error);
+    if (error) {
+        return false;
+    }
+
+    size_t end = c->entries.used;
+    size_t previous_offset = start == 0 ? 0 : c->chunks.offset;
+    if (!DP_OUTPUT_WRITE_LITTLEENDIAN(output, DP_OUTPUT_UINT64(previous_offset),
+                                      DP_OUTPUT_UINT32(end - start))) {
+        return false;
+    }
+
+    for (size_t i = start; i < end; ++i) {
+        if (!write_index_entry(
+                c, &DP_VECTOR_AT_TYPE(&c->entries, DP_PlayerIndexEntry, i))) {
+            return false;
+        }
+    }
+
+    c->chunks.offset = offset;
+    c->chunks.entry_count = end;
+    c->chunks.count = start == 0 ? 1 : c->chunks.count + 1;
+    return true;
+}
+
+// 64 bit FNV-1a. Not meant to withstand anything malicious, just to notice
+// when the recording isn't the one the index was built from anymore.
+static uint64_t hash_index_bytes(uint64_t hash, const unsigned char *data,
+                                 size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * INDEX_HASH_PRIME;
+    }
+    return hash;
+}
+
+// Continues hashing the recording from where the last call left off.
+static bool hash_index_recording_to(DP_BuildIndexContext *c, size_t offset)
+{
+    DP_ASSERT(offset >= c->recording.offset);
+    unsigned char buffer[INDEX_HASH_BUFFER_SIZE];
+    while (c->recording.offset < offset) {
+        size_t size =
+            DP_min_size(sizeof(buffer), offset - c->recording.offset);
+        bool error;
+        size_t read = DP_input_read(c->recording.input, buffer, size, &error);
+        if (error) {
+            return false;
+        }
+        else if (read == 0) {
+            DP_error_set("Recording ends at %zu bytes, expected %zu",
+                         c->recording.offset, offset);
+            return false;
+        }
+        c->recording.hash = hash_index_bytes(c->recording.hash, buffer, read);
+        c->recording.offset += read;
+    }
+    return true;
+}
+
+// Opens the recording separately for hashing and hashes its header.
+static bool open_index_recording(DP_BuildIndexContext *c)
+{
+    DP_ASSERT(!c->recording.input);
+    c->recording.input =
+        DP_file_input_new_from_path(c->player->recording_path);
+    if (!c->recording.input) {
+        return false;
+    }
+
+    c->recording.offset = 0;
+    c->recording.hash = INDEX_HASH_INITIAL;
+    if (hash_index_recording_to(c, player_body_offset(c->player))) {
+        c->recording.header_hash = c->recording.hash;
+        return true;
+    }
+    else {
+        return false;
+    }
+}
+
+static void close_index_recording(DP_BuildIndexContext *c)
+{
+    DP_input_free(c->recording.input);
+    c->recording.input = NULL;
+}
+
+// The header only gets pointed at the new entries after they've been written,
+// so if indexing gets interrupted, the index is still valid up to the previous
+// checkpoint and can be resumed from there. Along with it goes the size of the
+// recording and hashes of its header and everything up to the resume offset,
+// so that resuming can check that it's still the same recording.
+static bool write_index_checkpoint(DP_BuildIndexContext *c, size_t start,
+                                   long long message_count,
+                                   size_t resume_offset)
+{
+    DP_Output *output = c->output;
+    if (!write_index_chunk(c, start)
+        || !hash_index_recording_to(c, resume_offset)) {
+        return false;
+    }
+
+    bool error;
+    size_t recording_size = DP_input_length(c->recording.input, &error);
+    if (error) {
+        return false;
+    }
+
+    size_t end_offset = DP_output_tell(output, &error);
+    if (error) {
+        return false;
+    }
+
+    return DP_output_flush(output)
+        && DP_output_seek(output, INDEX_CHECKPOINT_OFFSET)
+        && DP_OUTPUT_WRITE_LITTLEENDIAN(
+               output, DP_OUTPUT_UINT32(message_count),
+               DP_OUTPUT_UINT64(c->chunks.offset),
+               DP_OUTPUT_UINT64(resume_offset),
+               DP_OUTPUT_UINT64(recording_size),
+               DP_OUTPUT_UINT64(c->recording.header_hash),
+               DP_OUTPUT_UINT64(c->recording.hash))
+        && DP_output_flush(output) && DP_output_seek(output, end_offset);
+}
+
+static bool write_index_flags(DP_BuildIndexContext *c, uint32_t flags)
+{
+    DP_Output *output = c->output;
+    bool error;
+    size_t end_offset = DP_output_tell(output, &error);
+    if (error) {
+        return false;
+    }
+
+    return DP_output_flush(output)
+        && DP_output_seek(output, INDEX_FLAGS_OFFSET)
+        && DP_OUTPUT_WRITE_LITTLEENDIAN(output, DP_OUTPUT_UINT32(flags))
+        && DP_output_flush(output) && DP_output_seek(output, end_offset);
+}
+
+static bool capture_reset_image_message(void *user, DP_Message *msg)
+{
+    DP_BuildIndexSnapshotJob *job = user;
+    DP_VECTOR_PUSH_TYPE(&job->messages, DP_Message *, msg);
+    return true;
+}
+
+static bool capture_reset_image(void *user, DP_CanvasState *cs)
+{
+    DP_BuildIndexSnapshotJob *job = user;
+    job->cs = DP_canvas_state_incref(cs);
+    return capture_reset_image_message(
+        job, DP_acl_state_msg_feature_access_all_new(0));
+}
+
+static void dispose_index_history_message(void *element)
 {
+    DP_message_decref(*(DP_Message **)element);
+}
+
+static void free_index_snapshot_job(DP_BuildIndexSnapshotJob *job)
+{
+    DP_free(job->thumbnail.buffer);
+    DP_VECTOR_CLEAR_DISPOSE_TYPE(&job->messages, DP_Message *,
+                                 dispose_index_history_message);
+    DP_canvas_state_decref_nullable(job->cs);
+    DP_free(job);
+}
+
+// Runs on the replay thread. Only grabs references to the canvas state and the
+// messages to restore the history from, so it's cheap. Everything else happens
+// when the snapshot gets written.
+static DP_BuildIndexSnapshotJob *
+capture_index_snapshot(DP_BuildIndexContext *c, long long message_index,
+                       size_t message_offset)
+{
+    DP_BuildIndexSnapshotJob *job = DP_malloc(sizeof(*job));
+    *job = (DP_BuildIndexSnapshotJob){c,
+                                      message_index,
+                                      message_offset,
+                                      c->message_count,
+                                      c->resume_offset,
+                                      NULL,
+                                      DP_VECTOR_NULL,
+                                      NULL,
+                                      {NULL, 0}};
+    DP_VECTOR_INIT_TYPE(&job->messages, DP_Message *, 64);
+
+    bool ok =
+        DP_canvas_history_reset_image_new(c->ch, capture_reset_image,
+                                          capture_reset_image_message, job)
+        // The state of the permissions at this point.
+        && DP_acl_state_reset_image_build(
+            c->acls, 0, DP_ACL_STATE_RESET_IMAGE_RECORDING_FLAGS,
+            capture_reset_image_message, job)
+        // Local changes (hidden layers, local canvas background).
+        && DP_local_state_reset_image_build(c->local_state, c->dc,
+                                            capture_reset_image_message, job);
+    if (ok) {
+        return job;
+    }
+    else {
+        free_index_snapshot_job(job);
+        return NULL;
+    }
+}
+
+static void render_index_thumbnail(DP_BuildIndexSnapshotJob *job,
+                                   DP_DrawContext *dc)
+{
+    DP_Image *img = DP_canvas_state_to_flat_image(
+        job->cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
+    if (!img) {
+        DP_warn("Error creating index thumbnail: %s", DP_error());
+        return;
+    }
+
+    DP_Image *thumb;
+    if (DP_image_thumbnail(img, dc, 256, 256, &thumb)) {
+        if (thumb) {
+            DP_image_free(img);
+        }
+        else {
+            thumb = img;
+        }
+    }
+    else {
+        DP_image_free(img);
+        DP_warn("Error scaling index thumbnail: %s", DP_error());
+        return;
+    }
+
+    void **buffer_ptr;
+    size_t *size_ptr;
+    DP_Output *output = DP_mem_output_new(1024, false, &buffer_ptr, &size_ptr);
+    bool ok = DP_image_write_png(thumb, output);
+    void *buffer = *buffer_ptr;
+    size_t size = *size_ptr;
+    DP_output_free(output);
+    DP_image_free(thumb);
+
+    if (ok) {
+        job->thumbnail.buffer = buffer;
+        job->thumbnail.size = size;
+    }
+    else {
+        DP_free(buffer);
+        DP_warn("Error writing index thumbnail: %s", DP_error());
+    }
+}
+
+static bool write_index_snapshot_job(DP_BuildIndexSnapshotJob *job,
+                                     DP_DrawContext *dc)
+{
+    DP_BuildIndexContext *c = job->c;
     DP_BuildIndexEntryContext e = {c->output,
-                                   c->acls,
-                                   c->local_state,
-                                   c->ch,
-                                   NULL,
-                                   c->dc,
+                                   &job->messages,
+                                   job->cs,
+                                   dc,
+                                   c->ow,
                                    {NULL, NULL, NULL, {NULL, 0}, {NULL, 0}},
                                    &c->last,
                                    0,
                                    {0, 0, 0, 0, 0},
                                    {NULL, 0}};
-    bool ok = write_index_snapshot(&e) && write_index_thumbnail(&e);
+    bool ok = write_index_snapshot(&e) && write_index_thumbnail(&e, job);
     if (!ok) {
         dispose_index_maps(&e.current);
         return false;
     }
 
-    DP_PlayerIndexEntry entry = {message_index, message_offset,
+    DP_PlayerIndexEntry entry = {job->message_index, job->message_offset,
                                  e.offset.snapshot, e.offset.thumbnail};
     DP_VECTOR_PUSH_TYPE(&c->entries, DP_PlayerIndexEntry, entry);
 
     dispose_index_maps(&c->last);
     c->last = e.current;
 
-    return true;
+    return write_index_checkpoint(c, c->chunks.entry_count, job->message_count,
+                                  job->resume_offset);
+}
+
+static void run_index_thumbnail_job(void *element, int thread_index)
+{
+    DP_BuildIndexSnapshotJob *job = *(DP_BuildIndexSnapshotJob **)element;
+    render_index_thumbnail(job, job->c->pipeline.thumbnail_dcs[thread_index]);
+    DP_SEMAPHORE_MUST_POST(job->thumbnail_sem);
+}
+
+static void run_index_writer_job(void *element, DP_UNUSED int thread_index)
+{
+    DP_BuildIndexSnapshotJob *job = *(DP_BuildIndexSnapshotJob **)element;
+    DP_BuildIndexContext *c = job->c;
+    if (job->thumbnail_sem) {
+        DP_SEMAPHORE_MUST_WAIT(job->thumbnail_sem);
+        DP_semaphore_free(job->thumbnail_sem);
+    }
+    else {
+        render_index_thumbnail(job, c->pipeline.writer_dc);
+    }
+
+    // After a failure, the remaining snapshots just get thrown away. The
+    // error message is thread-local, so it has to be carried over.
+    if (!DP_atomic_get(&c->pipeline.failed)
+        && !write_index_snapshot_job(job, c->pipeline.writer_dc)) {
+        c->pipeline.error = DP_strdup(DP_error());
+        DP_atomic_set(&c->pipeline.failed, 1);
+    }
+
+    free_index_snapshot_job(job);
+    DP_SEMAPHORE_MUST_POST(c->pipeline.slots);
+}
+
+static void start_index_pipeline(DP_BuildIndexContext *c)
+{
+    int thumbnail_thread_count = DP_worker_cpu_count(INDEX_SNAPSHOT_WINDOW);
+    if (thumbnail_thread_count < 2) {
+        return; // Not worth it, just do everything on the replay thread.
+    }
+
+    c->pipeline.slots = DP_semaphore_new(INDEX_SNAPSHOT_WINDOW);
+    if (c->pipeline.slots) {
+        c->pipeline.writer = DP_worker_new(INDEX_SNAPSHOT_WINDOW,
+                                           sizeof(DP_BuildIndexSnapshotJob *),
+                                           1, run_index_writer_job);
+    }
+    if (!c->pipeline.writer) {
+        DP_warn("Index pipeline: %s, writing snapshots inline", DP_error());
+        return;
+    }
+    c->pipeline.writer_dc = DP_draw_context_new();
+
+    c->pipeline.thumbnail_dcs = DP_malloc(sizeof(*c->pipeline.thumbnail_dcs)
+                                          * (size_t)thumbnail_thread_count);
+    for (int i = 0; i < thumbnail_thread_count; ++i) {
+        c->pipeline.thumbnail_dcs[i] = DP_draw_context_new();
+    }
+    c->pipeline.thumbnail_thread_count = thumbnail_thread_count;
+    c->pipeline.thumbnailer = DP_worker_new(
+        INDEX_SNAPSHOT_WINDOW, sizeof(DP_BuildIndexSnapshotJob *),
+        thumbnail_thread_count, run_index_thumbnail_job);
+    if (!c->pipeline.thumbnailer) {
+        DP_warn("Index thumbnailer: %s, rendering thumbnails on writer",
+                DP_error());
+    }
+}
+
+// Waits for the snapshots still in flight to be written and tears down the
+// threads. Returns false if writing any of them failed.
+static bool finish_index_pipeline(DP_BuildIndexContext *c)
+{
+    // The writer waits on thumbnails, so it has to go first.
+    DP_worker_free_join(c->pipeline.writer);
+    DP_worker_free_join(c->pipeline.thumbnailer);
+    DP_draw_context_free(c->pipeline.writer_dc);
+    for (int i = 0; i < c->pipeline.thumbnail_thread_count; ++i) {
+        DP_draw_context_free(c->pipeline.thumbnail_dcs[i]);
+    }
+    DP_free(c->pipeline.thumbnail_dcs);
+    if (c->pipeline.slots) {
+        DP_semaphore_free(c->pipeline.slots);
+    }
+
+    char *error = c->pipeline.error;
+    if (error) {
+        DP_error_set("%s", error);
+        DP_free(error);
+        return false;
+    }
+    else {
+        return true;
+    }
+}
+
+static bool make_index_entry(DP_BuildIndexContext *c, long long message_index,
+                             size_t message_offset)
+{
+    DP_Worker *writer = c->pipeline.writer;
+    if (writer) {
+        // Blocks while too many snapshots are in flight, to cap memory use.
+        DP_SEMAPHORE_MUST_WAIT(c->pipeline.slots);
+        if (DP_atomic_get(&c->pipeline.failed)) {
+            return false;
+        }
+    }
+
+    DP_BuildIndexSnapshotJob *job =
+        capture_index_snapshot(c, message_index, message_offset);
+    if (!job) {
+        if (writer) {
+            DP_SEMAPHORE_MUST_POST(c->pipeline.slots);
+        }
+        return false;
+    }
+    c->last_entry_message_index = message_index;
+
+    if (writer) {
+        DP_Worker *thumbnailer = c->pipeline.thumbnailer;
+        if (thumbnailer && (job->thumbnail_sem = DP_semaphore_new(0))) {
+            DP_worker_push(thumbnailer, &job);
+        }
+        DP_worker_push(writer, &job);
+        return true;
+    }
+    else {
+        render_index_thumbnail(job, c->dc);
+        bool ok = write_index_snapshot_job(job, c->dc);
+        free_index_snapshot_job(job);
+        return ok;
+    }
+}
+
+// Returns whether the message was a command that went into the history.
+static bool handle_index_message(DP_BuildIndexContext *c, DP_Message *msg)
+{
+    bool filtered =
+        DP_acl_state_handle(c->acls, msg, false) & DP_ACL_STATE_FILTERED_BIT;
+    if (filtered) {
+        DP_debug("ACL filtered recorded %s message from user %u",
+                 DP_message_type_enum_name_unprefixed(DP_message_type(msg)),
+                 DP_message_context_id(msg));
+        return false;
+    }
+
+    DP_DrawContext *dc = c->dc;
+    DP_local_state_handle(c->local_state, dc, msg);
+    if (DP_message_type_command(DP_message_type(msg))) {
+        if (!DP_canvas_history_handle(c->ch, dc, msg)) {
+            DP_warn("Error handling message in index: %s", DP_error());
+        }
+        return true;
+    }
+    else {
+        return false;
+    }
 }
 
 static bool write_index_messages(DP_BuildIndexContext *c)
 {
     DP_Player *player = c->player;
-    DP_AclState *acls = c->acls;
-    DP_LocalState *ls = c->local_state;
-    DP_CanvasHistory *ch = c->ch;
-    DP_DrawContext *dc = c->dc;
     int last_percent = 0;
-    long long last_written_message_index = 0;
 
     while (true) {
         size_t message_offset = DP_player_tell(player);
         DP_Message *msg;
         DP_PlayerResult result = DP_player_step(player, &msg);
         if (result == DP_PLAYER_SUCCESS) {
-            bool filtered = DP_acl_state_handle(acls, msg, false)
-                          & DP_ACL_STATE_FILTERED_BIT;
-            if (filtered) {
-                DP_debug(
-                    "ACL filtered recorded %s message from user %u",
-                    DP_message_type_enum_name_unprefixed(DP_message_type(msg)),
-                    DP_message_context_id(msg));
-            }
-            else {
-                DP_local_state_handle(ls, dc, msg);
-                if (DP_message_type_command(DP_message_type(msg))) {
-                    if (!DP_canvas_history_handle(ch, dc, msg)) {
-                        DP_warn("Error handling message in index: %s",
-                                DP_error());
-                    }
-
-                    long long message_index = c->message_count++;
-                    if (c->should_snapshot_fn(c->user)) {
-                        if (!make_index_entry(c, message_index,
-                                              message_offset)) {
-                            return false;
-                        }
-                        last_written_message_index = message_index;
+            if (handle_index_message(c, msg)) {
+                long long message_index = c->message_count++;
+                c->resume_offset = DP_player_tell(player);
+                if (c->should_snapshot_fn(c->user)) {
+                    if (!make_index_entry(c, message_index, message_offset)) {
+                        DP_message_decref(msg);
+                        return false;
                     }
                 }
             }
@@ -1672,7 +2150,7 @@ static bool write_index_messages(DP_BuildIndexContext *c)
     }
 
     long long message_index = c->message_count - 1;
-    if (message_index >= 0 && message_index != last_written_message_index) {
+    if (message_index >= 0 && message_index != c->last_entry_message_index) {
         return make_index_entry(c, message_index, DP_player_tell(player));
     }
     else {
@@ -1680,47 +2158,34 @@ static bool write_index_messages(DP_BuildIndexContext *c)
     }
 }
 
-static bool write_index_entry(DP_BuildIndexContext *c,
-                              DP_PlayerIndexEntry *entry)
+
+static bool write_index_finish(DP_BuildIndexContext *c)
 {
-    return DP_OUTPUT_WRITE_LITTLEENDIAN(
-        c->output, DP_OUTPUT_UINT32(entry->message_index),
-        DP_OUTPUT_UINT64(entry->message_offset),
-        DP_OUTPUT_UINT64(entry->snapshot_offset),
-        DP_OUTPUT_UINT64(entry->thumbnail_offset));
+    // Every entry has already been checkpointed. Gather them into a single
+    // chunk at the end so that loading doesn't have to hop around the file,
+    // or write an empty one if there's no entries at all. Only then is the
+    // index marked as complete, so loading it doesn't see a partial one.
+    return (c->chunks.count == 1
+            || write_index_checkpoint(c, 0, c->message_count,
+                                      c->resume_offset))
+        && write_index_flags(c, INDEX_FLAG_COMPLETE);
 }
 
-static bool write_index_finish(DP_BuildIndexContext *c)
+static bool start_index(DP_BuildIndexContext *c, const char *path)
 {
-    DP_Output *output = c->output;
-    bool error;
-    size_t entries_offset = DP_output_tell(output, &error);
-    if (error) {
+    if (!open_index_recording(c)) {
         return false;
     }
-
-    size_t count = c->entries.used;
-    for (size_t i = 0; i < count; ++i) {
-        if (!write_index_entry(
-                c, &DP_VECTOR_AT_TYPE(&c->entries, DP_PlayerIndexEntry, i))) {
-            return false;
-        }
-    }
-
-    if (!DP_output_seek(output, INDEX_MAGIC_LENGTH + INDEX_VERSION_LENGTH)) {
+    c->output = DP_file_output_new_from_path(path);
+    if (!c->output) {
         return false;
     }
-
-    return DP_OUTPUT_WRITE_LITTLEENDIAN(output,
-                                        DP_OUTPUT_UINT32(c->message_count),
-                                        DP_OUTPUT_UINT64(entries_offset));
+    DP_VECTOR_INIT_TYPE(&c->entries, DP_PlayerIndexEntry,
+                        INITAL_ENTRY_CAPACITY);
+    return write_index_header(c);
 }
 
-static bool write_index(DP_BuildIndexContext *c)
-{
-    return write_index_header(c) && write_index_messages(c)
-        && write_index_finish(c) && DP_output_flush(c->output);
-}
+static bool resume_index(DP_BuildIndexContext *c, const char *path);
 
 bool DP_player_index_build(DP_Player *player, DP_DrawContext *dc,
                            DP_PlayerIndexShouldSnapshotFn should_snapshot_fn,
@@ -1740,7 +2205,7 @@ bool DP_player_index_build(DP_Player *player, DP_DrawContext *dc,
         return false;
     }
 
-    DP_Input *input = DP_file_input_new_from_path(recording_path);
+    DP_Input *input = DP_mmap_input_new_from_path(recording_path);
     if (!input) {
         return false;
     }
@@ -1750,43 +2215,54 @@ bool DP_player_index_build(DP_Player *player, DP_DrawContext *dc,
     if (!index_player) {
         return false;
     }
-    else if (!DP_player_compatible(player)) {
+    else if (!DP_player_compatible(index_player)) {
         DP_error_set("Incompatible recording");
-        DP_player_free(player);
-        return false;
-    }
-
-    const char *path = index_player->index_path;
-    DP_Output *output = DP_file_output_save_new_from_path(path);
-    if (!output) {
         DP_player_free(index_player);
         return false;
     }
 
+    const char *path = index_player->index_path;
     DP_PERF_BEGIN_DETAIL(fn, "index_build", "path=%s", path);
     DP_AclState *acls = DP_acl_state_new_playback();
     DP_LocalState *ls = DP_local_state_new(NULL, NULL, NULL);
     DP_CanvasHistory *ch = DP_canvas_history_new(NULL, NULL, false, NULL);
     DP_BuildIndexContext c = {index_player,
-                              output,
+                              NULL,
                               acls,
                               ls,
                               ch,
                               dc,
+                              DP_ordered_worker_new(
+                                  DP_worker_cpu_count(INDEX_TILE_MAX_THREADS),
+                                  INDEX_TILE_WINDOW),
+                              0,
+                              0,
                               0,
                               DP_VECTOR_NULL,
+                              {0, 0, 0},
                               {NULL, NULL, NULL, {NULL, 0}, {NULL, 0}},
+                              {NULL, 0, 0, 0},
                               should_snapshot_fn,
                               progress_fn,
-                              user};
-    DP_VECTOR_INIT_TYPE(&c.entries, DP_PlayerIndexEntry, INITAL_ENTRY_CAPACITY);
-    bool ok = write_index(&c);
+                              user,
+                              {NULL, NULL, NULL, NULL, 0, NULL, 0, NULL}};
+    // Pick up where a previous build left off if possible, otherwise start
+    // over from the beginning of the recording.
+    bool ok = resume_index(&c, path) || start_index(&c, path);
+    if (ok) {
+        start_index_pipeline(&c);
+        ok = write_index_messages(&c);
+        ok = finish_index_pipeline(&c) && ok;
+        ok = ok && write_index_finish(&c) && DP_output_flush(c.output);
+    }
+    DP_ordered_worker_free(c.ow);
     dispose_index_maps(&c.last);
     DP_vector_dispose(&c.entries);
     DP_canvas_history_free(ch);
     DP_local_state_free(ls);
     DP_acl_state_free(acls);
-    DP_output_free(output);
+    DP_output_free(c.output);
+    close_index_recording(&c);
     DP_player_free(index_player);
     DP_PERF_END(fn);
     return ok;
@@ -1795,11 +2271,23 @@ bool DP_player_index_build(DP_Player *player, DP_DrawContext *dc,
 
 typedef struct DP_ReadIndexContext {
     DP_BufferedInput input;
+    unsigned int flags;
     unsigned int message_count;
     size_t index_offset;
+    size_t resume_offset;
+    size_t recording_size;
+    uint64_t recording_header_hash;
+    uint64_t recording_hash;
+    size_t end_offset;
+    int chunk_count;
     DP_Vector entries;
 } DP_ReadIndexContext;
 
+typedef struct DP_ReadIndexChunk {
+    size_t offset;
+    size_t entry_count;
+} DP_ReadIndexChunk;
+
 static bool read_index_input(DP_BufferedInput *input, size_t size)
 {
     bool error;
@@ -1876,49 +2364,118 @@ static bool read_index_header(DP_ReadIndexContext *c)
 {
     DP_BufferedInput *input = &c->input;
     return check_index_magic(c) && check_index_version(c)
-        && READ_INDEX(input, uint32, c->message_count) && read_index_offset(c);
+        && READ_INDEX(input, uint32, c->flags)
+        && READ_INDEX(input, uint32, c->message_count) && read_index_offset(c)
+        && READ_INDEX_SIZE(input, c->resume_offset)
+        && READ_INDEX_SIZE(input, c->recording_size)
+        && READ_INDEX(input, uint64, c->recording_header_hash)
+        && READ_INDEX(input, uint64, c->recording_hash);
 }
 
-#define ENTRY_SIZE (sizeof(uint32_t) + sizeof(uint64_t) * (size_t)3)
-
-static bool read_index_entries(DP_ReadIndexContext *c)
+static bool check_index_complete(DP_ReadIndexContext *c)
 {
-    if (!DP_buffered_input_seek(&c->input, c->index_offset)) {
+    if (c->flags & INDEX_FLAG_COMPLETE) {
+        return true;
+    }
+    else {
+        DP_error_set("Index is incomplete, it's either still being built or "
+                     "building it was interrupted");
         return false;
     }
+}
 
-    DP_VECTOR_INIT_TYPE(&c->entries, DP_PlayerIndexEntry,
-                        INITAL_ENTRY_CAPACITY);
+#define ENTRY_SIZE (sizeof(uint32_t) + sizeof(uint64_t) * (size_t)3)
 
-    while (true) {
-        bool error;
-        size_t read = DP_buffered_input_read(&c->input, ENTRY_SIZE, &error);
-        if (error) {
+static bool read_index_chunk_header(DP_ReadIndexContext *c, size_t offset,
+                                    size_t *out_previous_offset,
+                                    size_t *out_entry_count)
+{
+    DP_BufferedInput *input = &c->input;
+    return DP_buffered_input_seek(input, offset)
+        && READ_INDEX_SIZE(input, *out_previous_offset)
+        && READ_INDEX(input, uint32, *out_entry_count);
+}
+
+static bool read_index_chunk_offsets(DP_ReadIndexContext *c, DP_Vector *chunks)
+{
+    size_t offset = c->index_offset;
+    while (offset != 0) {
+        size_t previous_offset, entry_count;
+        if (!read_index_chunk_header(c, offset, &previous_offset,
+                                     &entry_count)) {
             return false;
         }
-        else if (read == ENTRY_SIZE) {
-            DP_PlayerIndexEntry entry = {
-                DP_read_littleendian_uint32(c->input.buffer),
-                read_littleendian_size(c->input.buffer + 4),
-                read_littleendian_size(c->input.buffer + 12),
-                read_littleendian_size(c->input.buffer + 20),
-            };
-            DP_debug("Read index entry %zu with message index %lld, message "
-                     "offset %zu, snapshot offset %zu, thumbnail offset %zu",
-                     c->entries.used, entry.message_index, entry.message_offset,
-                     entry.snapshot_offset, entry.thumbnail_offset);
-            DP_VECTOR_PUSH_TYPE(&c->entries, DP_PlayerIndexEntry, entry);
-        }
-        else if (read == 0) {
-            DP_debug("Reached end of index entries");
-            return true;
+        else if (previous_offset >= offset
+                 || (previous_offset != 0
+                     && previous_offset < INDEX_HEADER_LENGTH)) {
+            DP_error_set("Index chunk at offset %zu has bad previous "
+                         "offset %zu",
+                         offset, previous_offset);
+            return false;
         }
-        else {
-            DP_error_set("Expected index entry of %zu bytes, but got %zu",
-                         ENTRY_SIZE, read);
+        DP_VECTOR_PUSH_TYPE(chunks, DP_ReadIndexChunk,
+                            ((DP_ReadIndexChunk){offset, entry_count}));
+        offset = previous_offset;
+    }
+    return true;
+}
+
+static bool read_index_chunk_entries(DP_ReadIndexContext *c,
+                                     DP_ReadIndexChunk chunk)
+{
+    DP_BufferedInput *input = &c->input;
+    if (!DP_buffered_input_seek(input,
+                                chunk.offset + INDEX_CHUNK_HEADER_LENGTH)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < chunk.entry_count; ++i) {
+        if (!read_index_input(input, ENTRY_SIZE)) {
             return false;
         }
+        DP_PlayerIndexEntry entry = {
+            DP_read_littleendian_uint32(input->buffer),
+            read_littleendian_size(input->buffer + 4),
+            read_littleendian_size(input->buffer + 12),
+            read_littleendian_size(input->buffer + 20),
+        };
+        DP_debug("Read index entry %zu with message index %lld, message "
+                 "offset %zu, snapshot offset %zu, thumbnail offset %zu",
+                 c->entries.used, entry.message_index, entry.message_offset,
+                 entry.snapshot_offset, entry.thumbnail_offset);
+        DP_VECTOR_PUSH_TYPE(&c->entries, DP_PlayerIndexEntry, entry);
     }
+    return true;
+}
+
+// The header points at the last chunk of entries, which points back to the
+// chunk before it and so on. They're read oldest first to keep entries sorted.
+static bool read_index_entries(DP_ReadIndexContext *c)
+{
+    DP_Vector chunks;
+    DP_VECTOR_INIT_TYPE(&chunks, DP_ReadIndexChunk, 4);
+    DP_VECTOR_INIT_TYPE(&c->entries, DP_PlayerIndexEntry,
+                        INITAL_ENTRY_CAPACITY);
+
+    bool ok = read_index_chunk_offsets(c, &chunks);
+    for (size_t i = chunks.used; ok && i > 0; --i) {
+        ok = read_index_chunk_entries(
+            c, DP_VECTOR_AT_TYPE(&chunks, DP_ReadIndexChunk, i - 1));
+    }
+
+    if (ok) {
+        DP_debug("Read %zu index entries from %zu chunk(s)", c->entries.used,
+                 chunks.used);
+        c->chunk_count = DP_size_to_int(chunks.used);
+        if (chunks.used != 0) {
+            DP_ReadIndexChunk last = DP_VECTOR_FIRST_TYPE(&chunks,
+                                                          DP_ReadIndexChunk);
+            c->end_offset = last.offset + INDEX_CHUNK_HEADER_LENGTH
+                          + last.entry_count * ENTRY_SIZE;
+        }
+    }
+    DP_vector_dispose(&chunks);
+    return ok;
 }
 
 bool DP_player_index_load(DP_Player *player)
@@ -1941,10 +2498,11 @@ bool DP_player_index_load(DP_Player *player)
     }
 
     DP_PERF_BEGIN_DETAIL(fn, "index_load", "path=%s", path);
-    DP_ReadIndexContext c = {DP_buffered_input_init(input), 0, 0,
-                             DP_VECTOR_NULL};
+    DP_ReadIndexContext c = {DP_buffered_input_init(input), 0, 0, 0, 0, 0, 0,
+                             0, 0, 0, DP_VECTOR_NULL};
 
-    bool ok = read_index_header(&c) && read_index_entries(&c);
+    bool ok = read_index_header(&c) && check_index_complete(&c)
+           && read_index_entries(&c);
     if (ok) {
         player_index_dispose(&player->index);
         player->index = (DP_PlayerIndex){c.input, c.message_count,
@@ -2523,11 +3081,29 @@ static bool read_index_snapshot(DP_ReadSnapshotContext *c)
         && read_index_history(c, history_offset, message_count);
 }
 
-DP_PlayerIndexEntrySnapshot *
-DP_player_index_entry_load(DP_Player *player, DP_DrawContext *dc,
-                           DP_PlayerIndexEntry entry)
+// Tiles read from the index get handed over to the tile map used for building
+// it if one is given, so that they don't get written again when resuming.
+static void keep_index_tile(DP_BuildIndexTileMap **tiles_or_null,
+                            DP_ReadTileMap *tile_entry)
+{
+    DP_Tile *t = tile_entry->t;
+    if (tiles_or_null && !search_tile(*tiles_or_null, t)) {
+        DP_BuildIndexTileMap *entry = DP_malloc(sizeof(*entry));
+        entry->t = t;
+        entry->offset = tile_entry->offset;
+        HASH_ADD_PTR(*tiles_or_null, t, entry);
+    }
+    else {
+        DP_tile_decref(t);
+    }
+    DP_free(tile_entry);
+}
+
+static DP_PlayerIndexEntrySnapshot *
+read_index_entry_snapshot(DP_BufferedInput *input, DP_DrawContext *dc,
+                          DP_PlayerIndexEntry entry,
+                          DP_BuildIndexTileMap **out_tiles_or_null)
 {
-    DP_ASSERT(player);
     size_t snapshot_offset = entry.snapshot_offset;
     DP_debug("Load snapshot from offset %zu", snapshot_offset);
     if (snapshot_offset == 0) {
@@ -2537,7 +3113,6 @@ DP_player_index_entry_load(DP_Player *player, DP_DrawContext *dc,
         return snapshot;
     }
 
-    DP_BufferedInput *input = &player->index.input;
     if (!DP_buffered_input_seek(input, snapshot_offset)) {
         return NULL;
     }
@@ -2549,8 +3124,7 @@ DP_player_index_entry_load(DP_Player *player, DP_DrawContext *dc,
     DP_ReadTileMap *tile_entry, *tile_tmp;
     HASH_ITER(hh, c.tiles, tile_entry, tile_tmp) {
         HASH_DEL(c.tiles, tile_entry);
-        DP_tile_decref(tile_entry->t);
-        DP_free(tile_entry);
+        keep_index_tile(ok ? out_tiles_or_null : NULL, tile_entry);
     }
 
     if (ok) {
@@ -2568,6 +3142,14 @@ DP_player_index_entry_load(DP_Player *player, DP_DrawContext *dc,
     return c.snapshot;
 }
 
+DP_PlayerIndexEntrySnapshot *
+DP_player_index_entry_load(DP_Player *player, DP_DrawContext *dc,
+                           DP_PlayerIndexEntry entry)
+{
+    DP_ASSERT(player);
+    return read_index_entry_snapshot(&player->index.input, dc, entry, NULL);
+}
+
 DP_CanvasState *DP_player_index_entry_snapshot_canvas_state_inc(
     DP_PlayerIndexEntrySnapshot *snapshot)
 {
@@ -2604,6 +3186,141 @@ void DP_player_index_entry_snapshot_free(DP_PlayerIndexEntrySnapshot *snapshot)
 }
 
 
+// Makes sure the recording is still the one the index was built from, at least
+// up to where the index left off. It may have grown since then, but not shrunk.
+// Leaves the hash ready to continue from the resume offset.
+static bool check_resume_recording(DP_BuildIndexContext *c,
+                                   DP_ReadIndexContext *rc)
+{
+    if (!open_index_recording(c)) {
+        return false;
+    }
+
+    bool error;
+    size_t recording_size = DP_input_length(c->recording.input, &error);
+    if (error) {
+        return false;
+    }
+    else if (recording_size < rc->recording_size) {
+        DP_error_set("Recording is %zu bytes, but was %zu when indexed",
+                     recording_size, rc->recording_size);
+        return false;
+    }
+    else if (c->recording.header_hash != rc->recording_header_hash) {
+        DP_error_set("Recording header doesn't match index");
+        return false;
+    }
+    else if (rc->resume_offset < c->recording.offset) {
+        DP_error_set("Resume offset %zu is inside the recording header",
+                     rc->resume_offset);
+        return false;
+    }
+    else if (!hash_index_recording_to(c, rc->resume_offset)) {
+        return false;
+    }
+    else if (c->recording.hash != rc->recording_hash) {
+        DP_error_set("Recording doesn't match index up to offset %zu",
+                     rc->resume_offset);
+        return false;
+    }
+    else {
+        return true;
+    }
+}
+
+static DP_PlayerIndexEntrySnapshot *
+read_resume_snapshot(DP_BuildIndexContext *c, DP_ReadIndexContext *rc)
+{
+    if (!read_index_header(rc) || !read_index_entries(rc)
+        || !check_resume_recording(c, rc)) {
+        return NULL;
+    }
+
+    if (rc->entries.used == 0 || rc->resume_offset == 0) {
+        DP_error_set("Index has no entries to resume from");
+        return NULL;
+    }
+
+    // Checkpoints are always written right after an entry, so the last entry
+    // should be the state of the canvas at the end of the indexed messages.
+    DP_PlayerIndexEntry last =
+        DP_VECTOR_LAST_TYPE(&rc->entries, DP_PlayerIndexEntry);
+    if (last.message_index + 1 != rc->message_count) {
+        DP_error_set("Last index entry at message %lld doesn't match message "
+                     "count %u",
+                     last.message_index, rc->message_count);
+        return NULL;
+    }
+
+    return read_index_entry_snapshot(&rc->input, c->dc, last, &c->last.tiles);
+}
+
+static void restore_resume_snapshot(DP_BuildIndexContext *c,
+                                    DP_PlayerIndexEntrySnapshot *snapshot)
+{
+    DP_canvas_history_reset_to_state_noinc(
+        c->ch, DP_player_index_entry_snapshot_canvas_state_inc(snapshot));
+    // The history messages restore the permissions and local state, same as
+    // they do when jumping to this entry during playback.
+    int count = DP_player_index_entry_snapshot_message_count(snapshot);
+    for (int i = 0; i < count; ++i) {
+        DP_Message *msg =
+            DP_player_index_entry_snapshot_message_at_inc(snapshot, i);
+        if (msg) {
+            handle_index_message(c, msg);
+            DP_message_decref(msg);
+        }
+    }
+}
+
+static bool resume_index(DP_BuildIndexContext *c, const char *path)
+{
+    DP_Input *input = DP_file_input_new_from_path(path);
+    if (!input) {
+        DP_debug("Not resuming index: %s", DP_error());
+        return false;
+    }
+
+    DP_ReadIndexContext rc = {DP_buffered_input_init(input), 0, 0, 0, 0, 0, 0,
+                              0, 0, 0, DP_VECTOR_NULL};
+    DP_PlayerIndexEntrySnapshot *snapshot = read_resume_snapshot(c, &rc);
+    DP_buffered_input_dispose(&rc.input);
+
+    // The index is marked as incomplete again until it's finished.
+    bool ok = snapshot
+           && DP_player_seek(c->player, rc.message_count, rc.resume_offset)
+           && (c->output = DP_file_output_update_new_from_path(path)) != NULL
+           && write_index_flags(c, 0)
+           && DP_output_seek(c->output, rc.end_offset);
+    if (ok) {
+        DP_debug("Resuming index at message %u, recording offset %zu",
+                 rc.message_count, rc.resume_offset);
+        restore_resume_snapshot(c, snapshot);
+        c->message_count = rc.message_count;
+        c->last_entry_message_index =
+            DP_VECTOR_LAST_TYPE(&rc.entries, DP_PlayerIndexEntry).message_index;
+        c->resume_offset = rc.resume_offset;
+        c->entries = rc.entries;
+        c->chunks.offset = rc.index_offset;
+        c->chunks.entry_count = rc.entries.used;
+        c->chunks.count = rc.chunk_count;
+    }
+    else {
+        DP_warn("Can't resume index, rebuilding it: %s", DP_error());
+        DP_output_free(c->output);
+        c->output = NULL;
+        close_index_recording(c);
+        dispose_index_maps(&c->last);
+        c->last = (DP_BuildIndexMaps){NULL, NULL, NULL, {NULL, 0}, {NULL, 0}};
+        DP_vector_dispose(&rc.entries);
+        DP_player_rewind(c->player);
+    }
+
+    DP_player_index_entry_snapshot_free(snapshot);
+    return ok;
+}
+
+
 unsigned int DP_player_index_message_count(DP_Player *player)
 {
     DP_ASSERT(player);
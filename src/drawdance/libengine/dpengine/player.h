@@ -106,6 +106,9 @@ bool DP_player_rewind(DP_Player *player);
 bool DP_player_seek_dump(DP_Player *player, long long position);
 
 
+// Picks up from the last checkpoint of an existing index if there is one, so
+// that a growing recording only needs the new part indexed. Otherwise, or if
+// the existing index can't be resumed, builds the index from scratch.
 bool DP_player_index_build(DP_Player *player, DP_DrawContext *dc,
                            DP_PlayerIndexShouldSnapshotFn should_snapshot_fn,
                            DP_PlayerIndexProgressFn progress_fn, void *user);
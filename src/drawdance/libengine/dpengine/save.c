@@ -44,9 +44,11 @@
 #include <dpcommon/conversions.h>
 #include <dpcommon/file.h>
 #include <dpcommon/geom.h>
+#include <dpcommon/ordered_worker.h>
 #include <dpcommon/output.h>
 #include <dpcommon/perf.h>
 #include <dpcommon/threading.h>
+#include <dpcommon/vector.h>
 #include <dpcommon/worker.h>
 #include <dpmsg/blend_mode.h>
 #include <ctype.h>
@@ -204,8 +206,8 @@ static bool ora_store_mimetype(DP_ZipWriter *zw)
                                   false, false);
 }
 
-static bool ora_store_png(DP_SaveOraContext *c, const char *name,
-                          bool (*write_png)(void *, DP_Output *), void *user)
+static void *ora_write_png_to_buffer(bool (*write_png)(void *, DP_Output *),
+                                     void *user, size_t *out_size)
 {
     void **buffer_ptr;
     size_t *size_ptr;
@@ -216,14 +218,24 @@ static bool ora_store_png(DP_SaveOraContext *c, const char *name,
     DP_output_free(output);
 
     if (ok) {
-        return DP_zip_writer_add_file(c->zw, name, buffer, size, false, true);
+        *out_size = size;
+        return buffer;
     }
     else {
         DP_free(buffer);
-        return false;
+        return NULL;
     }
 }
 
+static bool ora_store_png(DP_SaveOraContext *c, const char *name,
+                          bool (*write_png)(void *, DP_Output *), void *user)
+{
+    size_t size;
+    void *buffer = ora_write_png_to_buffer(write_png, user, &size);
+    return buffer
+        && DP_zip_writer_add_file(c->zw, name, buffer, size, false, true);
+}
+
 struct DP_OraWriteUpixelsParams {
     DP_UPixel8 *pixels;
     int width;
@@ -237,13 +249,19 @@ static bool ora_write_png_upixels(void *user, DP_Output *output)
                                               params->height, params->pixels);
 }
 
+static struct DP_OraWriteUpixelsParams
+ora_upixels_params(DP_UPixel8 *pixels, int width, int height)
+{
+    static DP_UPixel8 null_pixels[] = {{0}};
+    return pixels ? (struct DP_OraWriteUpixelsParams){pixels, width, height}
+                  : (struct DP_OraWriteUpixelsParams){null_pixels, 1, 1};
+}
+
 static bool ora_store_png_upixels(DP_SaveOraContext *c, DP_UPixel8 *pixels,
                                   int width, int height, const char *name)
 {
-    static DP_UPixel8 null_pixels[] = {{0}};
     struct DP_OraWriteUpixelsParams params =
-        pixels ? (struct DP_OraWriteUpixelsParams){pixels, width, height}
-               : (struct DP_OraWriteUpixelsParams){null_pixels, 1, 1};
+        ora_upixels_params(pixels, width, height);
     return ora_store_png(c, name, ora_write_png_upixels, &params);
 }
 
@@ -260,21 +278,14 @@ static bool ora_store_png_image(DP_SaveOraContext *c, DP_Image *img,
                : ora_store_png_upixels(c, NULL, 0, 0, name);
 }
 
-static bool ora_store_layer(DP_SaveOraContext *c, DP_LayerContent *lc,
-                            DP_SaveOraLayer *sol)
-{
-    int width, height;
-    DP_UPixel8 *pixels = DP_layer_content_to_upixels8_cropped(
-        lc, false, &sol->offset_x, &sol->offset_y, &width, &height);
-    const char *name =
-        save_ora_context_format(c, "data/layer-%04x.png", sol->layer_id);
-    bool ok = ora_store_png_upixels(c, pixels, width, height, name);
-    DP_free(pixels);
-    return ok;
-}
+struct DP_SaveOraLayerJob {
+    DP_LayerContent *lc;
+    DP_SaveOraLayer *sol;
+};
 
-static bool ora_store_layers(DP_SaveOraContext *c, int *next_index,
-                             DP_LayerList *ll, DP_LayerPropsList *lpl)
+static void ora_collect_layers(DP_SaveOraContext *c, int *next_index,
+                               DP_LayerList *ll, DP_LayerPropsList *lpl,
+                               DP_Vector *jobs)
 {
     int count = DP_layer_list_count(ll);
     DP_ASSERT(DP_layer_props_list_count(lpl) == count);
@@ -288,18 +299,73 @@ static bool ora_store_layers(DP_SaveOraContext *c, int *next_index,
             DP_LayerGroup *lg = DP_layer_list_entry_group_noinc(lle);
             DP_LayerList *child_ll = DP_layer_group_children_noinc(lg);
             DP_LayerPropsList *child_lpl = DP_layer_props_children_noinc(lp);
-            if (!ora_store_layers(c, next_index, child_ll, child_lpl)) {
-                return false;
-            }
+            ora_collect_layers(c, next_index, child_ll, child_lpl, jobs);
         }
         else {
             DP_LayerContent *lc = DP_layer_list_entry_content_noinc(lle);
-            if (!ora_store_layer(c, lc, sol)) {
-                return false;
-            }
+            DP_VECTOR_PUSH_TYPE(jobs, struct DP_SaveOraLayerJob,
+                                ((struct DP_SaveOraLayerJob){lc, sol}));
         }
     }
-    return true;
+}
+
+struct DP_SaveOraLayersParams {
+    DP_SaveOraContext *c;
+    DP_Vector *jobs;
+};
+
+static void *ora_encode_layer(void *user, int index,
+                              DP_UNUSED int thread_index, size_t *out_size)
+{
+    struct DP_SaveOraLayersParams *params = user;
+    struct DP_SaveOraLayerJob *job = &DP_VECTOR_AT_TYPE(
+        params->jobs, struct DP_SaveOraLayerJob, DP_int_to_size(index));
+    DP_SaveOraLayer *sol = job->sol;
+    int width, height;
+    DP_UPixel8 *pixels = DP_layer_content_to_upixels8_cropped(
+        job->lc, false, &sol->offset_x, &sol->offset_y, &width, &height);
+    struct DP_OraWriteUpixelsParams upixels_params =
+        ora_upixels_params(pixels, width, height);
+    void *buffer = ora_write_png_to_buffer(ora_write_png_upixels,
+                                           &upixels_params, out_size);
+    DP_free(pixels);
+    return buffer;
+}
+
+static bool ora_write_layer(void *user, int index, void *buffer, size_t size)
+{
+    if (!buffer) {
+        return false;
+    }
+    struct DP_SaveOraLayersParams *params = user;
+    DP_SaveOraContext *c = params->c;
+    struct DP_SaveOraLayerJob *job = &DP_VECTOR_AT_TYPE(
+        params->jobs, struct DP_SaveOraLayerJob, DP_int_to_size(index));
+    const char *name =
+        save_ora_context_format(c, "data/layer-%04x.png", job->sol->layer_id);
+    return DP_zip_writer_add_file(c->zw, name, buffer, size, false, true);
+}
+
+// Layers are turned into PNGs in parallel, but added to the archive in the
+// same order as they'd be one by one. Each layer in flight holds its entire
+// pixel data, so there's only ever one of them per thread.
+static bool ora_store_layers(DP_SaveOraContext *c, DP_LayerList *ll,
+                             DP_LayerPropsList *lpl)
+{
+    DP_Vector jobs;
+    DP_VECTOR_INIT_TYPE(&jobs, struct DP_SaveOraLayerJob, 16);
+    int next_index = 0;
+    ora_collect_layers(c, &next_index, ll, lpl, &jobs);
+
+    int count = DP_size_to_int(jobs.used);
+    DP_OrderedWorker *ow = DP_ordered_worker_new(
+        count > 1 ? DP_worker_cpu_count(count) : 1, 1);
+    struct DP_SaveOraLayersParams params = {c, &jobs};
+    bool ok = DP_ordered_worker_run(ow, count, ora_encode_layer,
+                                    ora_write_layer, &params);
+    DP_ordered_worker_free(ow);
+    DP_vector_dispose(&jobs);
+    return ok;
 }
 
 static bool ora_store_background(DP_SaveOraContext *c, DP_CanvasState *cs)
@@ -693,9 +759,8 @@ static DP_SaveResult save_ora(DP_CanvasState *cs, const char *path,
     }
 
     DP_SaveOraContext c = {zw, NULL, {0, NULL}};
-    int next_index = 0;
     bool content_ok =
-        ora_store_layers(&c, &next_index, DP_canvas_state_layers_noinc(cs),
+        ora_store_layers(&c, DP_canvas_state_layers_noinc(cs),
                          DP_canvas_state_layer_props_noinc(cs))
         && ora_store_background(&c, cs) && ora_store_merged(&c, cs, dc)
         && ora_store_xml(&c, cs);
@@ -1158,6 +1223,161 @@ static bool report_gif_progress(DP_SaveAnimationProgressFn progress_fn,
     return !progress_fn || progress_fn(user, part / total);
 }
 
+struct DP_SaveGifFrame {
+    int frame_index;
+    int instances;
+};
+
+struct DP_SaveGifContext {
+    DP_CanvasState *cs;
+    DP_Rect *crop;
+    DP_Output *output;
+    jo_gifx_t *gif;
+    size_t pixel_count;
+    struct DP_SaveGifFrame *frames;
+    DP_ViewModeBuffer *vmbs;
+    unsigned char **quantize_buffers;
+    DP_SaveAnimationProgressFn progress_fn;
+    void *user;
+    int start;
+    int frame_count;
+    double centiseconds_per_frame;
+    double delay_frac;
+    DP_SaveResult result;
+};
+
+static int collect_gif_frames(DP_CanvasState *cs, int start, int end_inclusive,
+                              struct DP_SaveGifFrame *frames)
+{
+    int count = 0;
+    for (int i = start; i <= end_inclusive; ++i) {
+        int instances = 1;
+        while (i < end_inclusive && DP_canvas_state_same_frame(cs, i, i + 1)) {
+            ++i;
+            ++instances;
+        }
+        frames[count++] = (struct DP_SaveGifFrame){i, instances};
+    }
+    return count;
+}
+
+static void *gif_encode_frame(void *user, int index, int thread_index,
+                              size_t *out_size)
+{
+    struct DP_SaveGifContext *c = user;
+    DP_CanvasState *cs = c->cs;
+    DP_ViewModeFilter vmf = DP_view_mode_filter_make_frame_render(
+        &c->vmbs[thread_index], cs, c->frames[index].frame_index);
+    DP_Image *img = DP_canvas_state_to_flat_image(
+        cs, DP_FLAT_IMAGE_RENDER_FLAGS, c->crop, &vmf);
+    if (!img) {
+        return NULL;
+    }
+
+    unsigned char **quantize_buffer = &c->quantize_buffers[thread_index];
+    if (!*quantize_buffer) {
+        *quantize_buffer =
+            DP_malloc(jo_gifx_frame_quantize_buffer_size(c->gif));
+    }
+
+    unsigned char *indexed_pixels = DP_malloc(c->pixel_count);
+    jo_gifx_frame_quantize(c->gif, (uint32_t *)DP_image_pixels(img),
+                           *quantize_buffer, indexed_pixels);
+    DP_image_free(img);
+    *out_size = c->pixel_count;
+    return indexed_pixels;
+}
+
+static bool gif_write_frame(void *user, int index, void *buffer,
+                            DP_UNUSED size_t size)
+{
+    struct DP_SaveGifContext *c = user;
+    if (!buffer) {
+        c->result = DP_SAVE_RESULT_INTERNAL_ERROR;
+        return false;
+    }
+
+    struct DP_SaveGifFrame *frame = &c->frames[index];
+    double delay =
+        c->centiseconds_per_frame * DP_int_to_double(frame->instances);
+    double delay_floored = floor(delay + c->delay_frac);
+    c->delay_frac = delay - delay_floored;
+    bool frame_ok = jo_gifx_frame_indexed(write_gif, c->output, c->gif,
+                                          buffer,
+                                          DP_double_to_uint16(delay_floored));
+    DP_free(buffer);
+    if (!frame_ok) {
+        c->result = DP_SAVE_RESULT_WRITE_ERROR;
+        return false;
+    }
+
+    if (!report_gif_progress(c->progress_fn, c->user,
+                             frame->frame_index - c->start + 1,
+                             c->frame_count)) {
+        c->result = DP_SAVE_RESULT_CANCEL;
+        return false;
+    }
+
+    return true;
+}
+
+// Frames are flattened and quantized in parallel, but handed to the GIF writer
+// in order, since each frame is encoded relative to the previous one. Runs of
+// identical frames are only rendered once and turned into a longer delay.
+static DP_SaveResult write_gif_frames(DP_CanvasState *cs, DP_Rect *crop,
+                                      DP_Output *output, jo_gifx_t *gif,
+                                      DP_SaveAnimationProgressFn progress_fn,
+                                      void *user, int width, int height,
+                                      int start, int end_inclusive,
+                                      int framerate)
+{
+    if (end_inclusive < start) {
+        return DP_SAVE_RESULT_SUCCESS;
+    }
+
+    int frame_count = count_frames(start, end_inclusive);
+    struct DP_SaveGifFrame *frames =
+        DP_malloc(sizeof(*frames) * DP_int_to_size(frame_count));
+    int count = collect_gif_frames(cs, start, end_inclusive, frames);
+
+    DP_OrderedWorker *ow = DP_ordered_worker_new(
+        count > 1 ? DP_worker_cpu_count(count) : 1, 2);
+    int thread_count = DP_ordered_worker_thread_count(ow);
+    size_t sthread_count = DP_int_to_size(thread_count);
+    struct DP_SaveGifContext c = {
+        cs,
+        crop,
+        output,
+        gif,
+        DP_int_to_size(width) * DP_int_to_size(height),
+        frames,
+        DP_malloc(sizeof(*c.vmbs) * sthread_count),
+        DP_malloc_zeroed(sizeof(*c.quantize_buffers) * sthread_count),
+        progress_fn,
+        user,
+        start,
+        frame_count,
+        get_gif_centiseconds_per_frame(framerate),
+        0.0,
+        DP_SAVE_RESULT_SUCCESS,
+    };
+    for (int i = 0; i < thread_count; ++i) {
+        DP_view_mode_buffer_init(&c.vmbs[i]);
+    }
+
+    DP_ordered_worker_run(ow, count, gif_encode_frame, gif_write_frame, &c);
+    DP_ordered_worker_free(ow);
+
+    for (int i = 0; i < thread_count; ++i) {
+        DP_free(c.quantize_buffers[i]);
+        DP_view_mode_buffer_dispose(&c.vmbs[i]);
+    }
+    DP_free(c.quantize_buffers);
+    DP_free(c.vmbs);
+    DP_free(frames);
+    return c.result;
+}
+
 static DP_SaveResult save_animation_gif(DP_CanvasState *cs, const char *path,
                                         DP_SaveAnimationProgressFn progress_fn,
                                         void *user, DP_Rect *crop, int start,
@@ -1186,44 +1406,14 @@ static DP_SaveResult save_animation_gif(DP_CanvasState *cs, const char *path,
         return DP_SAVE_RESULT_CANCEL;
     }
 
-    DP_ViewModeBuffer vmb;
-    DP_view_mode_buffer_init(&vmb);
-    double centiseconds_per_frame = get_gif_centiseconds_per_frame(framerate);
-    double delay_frac = 0.0;
-    for (int i = start; i <= end_inclusive; ++i) {
-        int instances = 1;
-        while (i < end_inclusive && DP_canvas_state_same_frame(cs, i, i + 1)) {
-            ++i;
-            ++instances;
-        }
-
-        DP_ViewModeFilter vmf =
-            DP_view_mode_filter_make_frame_render(&vmb, cs, i);
-        DP_Image *img = DP_canvas_state_to_flat_image(
-            cs, DP_FLAT_IMAGE_RENDER_FLAGS, crop, &vmf);
-        double delay = centiseconds_per_frame * DP_int_to_double(instances);
-        double delay_floored = floor(delay + delay_frac);
-        delay_frac = delay - delay_floored;
-        bool frame_ok = jo_gifx_frame(write_gif, output, gif,
-                                      (uint32_t *)DP_image_pixels(img),
-                                      DP_double_to_uint16(delay_floored));
-        DP_image_free(img);
-        if (!frame_ok) {
-            jo_gifx_abort(gif);
-            DP_output_free(output);
-            DP_view_mode_buffer_dispose(&vmb);
-            return DP_SAVE_RESULT_WRITE_ERROR;
-        }
-
-        if (!report_gif_progress(progress_fn, user, i - start + 1,
-                                 frame_count)) {
-            jo_gifx_abort(gif);
-            DP_output_free(output);
-            DP_view_mode_buffer_dispose(&vmb);
-            return DP_SAVE_RESULT_CANCEL;
-        }
+    DP_SaveResult result =
+        write_gif_frames(cs, crop, output, gif, progress_fn, user, width,
+                         height, start, end_inclusive, framerate);
+    if (result != DP_SAVE_RESULT_SUCCESS) {
+        jo_gifx_abort(gif);
+        DP_output_free(output);
+        return result;
     }
-    DP_view_mode_buffer_dispose(&vmb);
 
     if (!jo_gifx_end(write_gif, output, gif) || !DP_output_flush(output)) {
         DP_output_free(output);
@@ -32,8 +32,10 @@
 #include "track.h"
 #include <dpcommon/common.h>
 #include <dpcommon/conversions.h>
+#include <dpcommon/ordered_worker.h>
 #include <dpcommon/queue.h>
 #include <dpcommon/threading.h>
+#include <dpcommon/worker.h>
 #include <dpmsg/message.h>
 
 
@@ -215,13 +217,21 @@ void DP_snapshot_queue_get_with(DP_SnapshotQueue *sq, DP_SnapshotsGetFn get_fn,
 }
 
 
+// How many tiles per thread may be compressed ahead of the one being pushed.
+#define RESET_IMAGE_TILE_WINDOW 16
+// Several reset images can be in the works at once, e.g. for multiple clients
+// joining a session, and each gets its own threads, so keep them few.
+#define RESET_IMAGE_MAX_THREADS 4
+
 struct DP_ResetImageContext {
     unsigned int context_id;
+    DP_CompressProfile profile;
     void (*push_message)(void *, DP_Message *);
     void *push_message_user;
     DP_Pixel8 *pixel_buffer;
     size_t capacity;
     void *output_buffer;
+    DP_OrderedWorker *ow;
 };
 
 static void reset_image_push(struct DP_ResetImageContext *c, DP_Message *msg)
@@ -249,8 +259,9 @@ static size_t reset_image_maybe_compress_tile(struct DP_ResetImageContext *c,
                                               DP_Tile *tile_or_null)
 {
     if (tile_or_null) {
-        size_t size = DP_tile_compress(tile_or_null, c->pixel_buffer,
-                                       reset_image_get_output_buffer, c);
+        size_t size =
+            DP_tile_compress(tile_or_null, c->pixel_buffer, c->profile,
+                             reset_image_get_output_buffer, c);
         if (size == 0) {
             DP_warn("Reset image: error tile: %s", DP_error());
         }
@@ -305,6 +316,56 @@ static uint16_t layer_to_reset_image(struct DP_ResetImageContext *c,
     return layer_id;
 }
 
+struct DP_ResetImageTile {
+    DP_Tile *t;
+    uint16_t x, y;
+};
+
+struct DP_ResetImageTiles {
+    struct DP_ResetImageContext *c;
+    uint16_t layer_id;
+    uint8_t sublayer_id;
+    bool pushed;
+    struct DP_ResetImageTile *tiles;
+};
+
+static DP_Tile *reset_image_tile_get(void *user, int index)
+{
+    struct DP_ResetImageTiles *rit = user;
+    return rit->tiles[index].t;
+}
+
+static bool reset_image_tile_write(void *user, int index,
+                                   const unsigned char *data, size_t size)
+{
+    struct DP_ResetImageTiles *rit = user;
+    struct DP_ResetImageContext *c = rit->c;
+    if (data) {
+        struct DP_ResetImageTile *rt = &rit->tiles[index];
+        rit->pushed = true;
+        reset_image_push(c, DP_msg_put_tile_new(
+                                c->context_id, rit->layer_id, rit->sublayer_id,
+                                rt->x, rt->y, 0, set_tile_data, size,
+                                (void *)data));
+    }
+    else {
+        DP_warn("Reset image: error tile: %s", DP_error());
+    }
+    return true;
+}
+
+static DP_OrderedWorker *
+reset_image_ordered_worker(struct DP_ResetImageContext *c)
+{
+    // Only spin up threads once there's actually tiles to compress.
+    if (!c->ow) {
+        c->ow = DP_ordered_worker_new(
+            DP_worker_cpu_count(RESET_IMAGE_MAX_THREADS),
+            RESET_IMAGE_TILE_WINDOW);
+    }
+    return c->ow;
+}
+
 static bool tiles_to_reset_image(struct DP_ResetImageContext *c,
                                  DP_LayerContent *lc, uint16_t layer_id,
                                  uint8_t sublayer_id)
@@ -312,24 +373,29 @@ static bool tiles_to_reset_image(struct DP_ResetImageContext *c,
     // TODO: use tile runs and layer fill to optimize this.
     DP_TileCounts counts = DP_tile_counts_round(DP_layer_content_width(lc),
                                                 DP_layer_content_height(lc));
-    bool pushed = false;
+    struct DP_ResetImageTiles rit = {
+        c, layer_id, sublayer_id, false,
+        DP_malloc(sizeof(*rit.tiles) * DP_int_to_size(counts.x * counts.y))};
+
+    int count = 0;
     for (int y = 0; y < counts.y; ++y) {
         for (int x = 0; x < counts.x; ++x) {
             DP_Tile *t = DP_layer_content_tile_at_noinc(lc, x, y);
             if (t && !DP_tile_blank(t)) {
-                size_t size = reset_image_maybe_compress_tile(c, t);
-                if (size != 0) {
-                    pushed = true;
-                    reset_image_push(
-                        c, DP_msg_put_tile_new(
-                               c->context_id, layer_id, sublayer_id,
-                               DP_int_to_uint16(x), DP_int_to_uint16(y), 0,
-                               set_tile_data, size, c->output_buffer));
-                }
+                rit.tiles[count++] = (struct DP_ResetImageTile){
+                    t, DP_int_to_uint16(x), DP_int_to_uint16(y)};
             }
         }
     }
-    return pushed;
+
+    if (count != 0) {
+        DP_tile_compress_ordered(reset_image_ordered_worker(c), count,
+                                 c->profile, reset_image_tile_get,
+                                 reset_image_tile_write, &rit);
+    }
+
+    DP_free(rit.tiles);
+    return rit.pushed;
 }
 
 static void layer_content_to_reset_image(struct DP_ResetImageContext *c,
@@ -541,14 +607,15 @@ static void canvas_state_to_reset_image(struct DP_ResetImageContext *c,
 }
 
 void DP_reset_image_build(DP_CanvasState *cs, unsigned int context_id,
+                          DP_CompressProfile profile,
                           void (*push_message)(void *, DP_Message *),
                           void *user)
 {
     struct DP_ResetImageContext c = {
-        context_id, push_message,
-        user,       DP_malloc(sizeof(*c.pixel_buffer) * DP_TILE_LENGTH),
-        0,          NULL};
+        context_id, profile, push_message, user,
+        DP_malloc(sizeof(*c.pixel_buffer) * DP_TILE_LENGTH), 0, NULL, NULL};
     canvas_state_to_reset_image(&c, cs);
+    DP_ordered_worker_free(c.ow);
     DP_free(c.output_buffer);
     DP_free(c.pixel_buffer);
 }
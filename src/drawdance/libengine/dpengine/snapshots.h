@@ -16,6 +16,7 @@
  */
 #ifndef DPENGINE_SNAPSHOTS_H
 #define DPENGINE_SNAPSHOTS_H
+#include "compress.h"
 #include <dpcommon/common.h>
 
 typedef struct DP_CanvasHistory DP_CanvasHistory;
@@ -58,7 +59,10 @@ void DP_snapshot_queue_get_with(DP_SnapshotQueue *sq, DP_SnapshotsGetFn get_fn,
                                 void *user);
 
 
+// The profile is used for compressing tiles, pick something faster if the
+// reset image is going to be sent right away, rather than being saved.
 void DP_reset_image_build(DP_CanvasState *cs, unsigned int context_id,
+                          DP_CompressProfile profile,
                           void (*push_message)(void *, DP_Message *),
                           void *user);
 
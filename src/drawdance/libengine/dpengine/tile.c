@@ -36,6 +36,7 @@
 #include <dpcommon/conversions.h>
 #include <dpcommon/cpu.h>
 #include <dpcommon/memory_pool.h>
+#include <dpcommon/ordered_worker.h>
 #include <dpcommon/threading.h>
 #include <dpmsg/blend_mode.h>
 
@@ -45,6 +46,7 @@
 struct DP_Tile {
     DP_ALIGNAS_SIMD DP_Pixel15 pixels[DP_TILE_LENGTH];
     DP_Atomic refcount;
+    DP_AtomicPtr compressed;
     const bool transient;
     const bool maybe_blank;
     const unsigned int context_id;
@@ -53,6 +55,7 @@ struct DP_Tile {
 struct DP_TransientTile {
     DP_ALIGNAS_SIMD DP_Pixel15 pixels[DP_TILE_LENGTH];
     DP_Atomic refcount;
+    DP_AtomicPtr compressed;
     bool transient;
     bool maybe_blank;
     unsigned int context_id;
@@ -63,6 +66,7 @@ struct DP_TransientTile {
 struct DP_Tile {
     DP_ALIGNAS_SIMD DP_Pixel15 pixels[DP_TILE_LENGTH];
     DP_Atomic refcount;
+    DP_AtomicPtr compressed;
     bool transient;
     bool maybe_blank;
     unsigned int context_id;
@@ -86,27 +90,142 @@ const uint16_t *DP_tile_opaque_mask(void)
     return opaque_mask;
 }
 
+// Each thread keeps a small cache of free tiles in front of the global memory
+// pool. It only needs to take the pool lock when the cache runs empty or full
+// and then moves a whole batch of tiles at once, so threads allocating and
+// freeing tiles in parallel don't contend on the lock for every single tile.
+// When a thread exits, its cached tiles are returned to the global pool.
+#define TILE_CACHE_CAPACITY 64
+#define TILE_CACHE_BATCH    32
+
+typedef struct DP_TileCache {
+    // Only written by the owning thread, read by others for the statistics.
+    DP_Atomic count;
+    struct DP_TileCache *prev, *next;
+    void *tiles[TILE_CACHE_CAPACITY];
+} DP_TileCache;
+
 static DP_MemoryPool tile_memory_pool;
 static DP_Mutex *tile_memory_pool_lock = NULL;
+static DP_ThreadLocal *tile_cache_local;
+static DP_TileCache *tile_caches; // All thread caches, protected by the lock.
+
+// Persistent tiles never change, so the result of compressing one can be kept
+// around and reused for as long as the tile lives. This is opt-in, since it
+// costs memory on top of the tile itself. The compressed data hangs off of the
+// tile and is freed along with it. The byte counters are protected by the lock.
+typedef struct DP_TileCompressed {
+    DP_CompressProfile profile;
+    size_t size;
+    unsigned char data[];
+} DP_TileCompressed;
+
+static DP_Mutex *tile_compress_cache_lock;
+static DP_Atomic tile_compress_cache_enabled;
+static size_t tile_compress_cache_limit;
+static size_t tile_compress_cache_used;
+
+static void tile_cache_free(void *value)
+{
+    DP_TileCache *tc = value;
+    int count = DP_atomic_get(&tc->count);
 
-static void *alloc_tile(bool transient, bool maybe_blank,
-                        unsigned int context_id)
+    DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
+    for (int i = 0; i < count; ++i) {
+        DP_memory_pool_free_el(&tile_memory_pool, tc->tiles[i]);
+    }
+    if (tc->prev) {
+        tc->prev->next = tc->next;
+    }
+    else {
+        tile_caches = tc->next;
+    }
+    if (tc->next) {
+        tc->next->prev = tc->prev;
+    }
+    DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
+
+    DP_free(tc);
+}
+
+static DP_TileCache *tile_cache_get(void)
+{
+    DP_TileCache *tc = DP_thread_local_get(tile_cache_local);
+    if (!tc) {
+        tc = DP_malloc(sizeof(*tc));
+        DP_atomic_set(&tc->count, 0);
+        tc->prev = NULL;
+
+        DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
+        tc->next = tile_caches;
+        if (tile_caches) {
+            tile_caches->prev = tc;
+        }
+        tile_caches = tc;
+        DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
+
+        DP_thread_local_set(tile_cache_local, tc);
+    }
+    return tc;
+}
+
+static void *tile_cache_alloc(void)
+{
+    DP_TileCache *tc = tile_cache_get();
+    int count = DP_atomic_get(&tc->count);
+    if (count == 0) {
+        DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
+        for (int i = 0; i < TILE_CACHE_BATCH; ++i) {
+            tc->tiles[i] = DP_memory_pool_alloc_el(&tile_memory_pool);
+        }
+        DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
+        count = TILE_CACHE_BATCH;
+    }
+
+    void *tile = tc->tiles[--count];
+    DP_atomic_set(&tc->count, count);
+    return tile;
+}
+
+static void tile_cache_release(void *tile)
+{
+    DP_TileCache *tc = tile_cache_get();
+    int count = DP_atomic_get(&tc->count);
+    if (count == TILE_CACHE_CAPACITY) {
+        DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
+        for (int i = 0; i < TILE_CACHE_BATCH; ++i) {
+            DP_memory_pool_free_el(&tile_memory_pool, tc->tiles[--count]);
+        }
+        DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
+    }
+
+    tc->tiles[count++] = tile;
+    DP_atomic_set(&tc->count, count);
+}
+
+static void init_tile_memory(void)
 {
     DP_ATOMIC_DECLARE_STATIC_SPIN_LOCK(tile_memory_pool_spinlock);
     if (!tile_memory_pool_lock) {
         DP_atomic_lock(&tile_memory_pool_spinlock);
         if (!tile_memory_pool_lock) {
             tile_memory_pool = DP_memory_pool_new_type(DP_TransientTile, 1024);
+            tile_cache_local = DP_thread_local_new(tile_cache_free);
+            tile_compress_cache_lock = DP_mutex_new();
             tile_memory_pool_lock = DP_mutex_new();
         }
         DP_atomic_unlock(&tile_memory_pool_spinlock);
     }
+}
 
-    DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
-    DP_TransientTile *tt = DP_memory_pool_alloc_el(&tile_memory_pool);
-    DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
+static void *alloc_tile(bool transient, bool maybe_blank,
+                        unsigned int context_id)
+{
+    init_tile_memory();
+    DP_TransientTile *tt = tile_cache_alloc();
 
     DP_atomic_set(&tt->refcount, 1);
+    DP_atomic_ptr_set(&tt->compressed, NULL);
     tt->transient = transient;
     tt->maybe_blank = maybe_blank;
     tt->context_id = context_id;
@@ -121,6 +240,10 @@ DP_MemoryPoolStatistics DP_tile_memory_usage(void)
         DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
         DP_MemoryPoolStatistics mps =
             DP_memory_pool_statistics(&tile_memory_pool);
+        // Tiles sitting in thread caches are free too.
+        for (DP_TileCache *tc = tile_caches; tc; tc = tc->next) {
+            mps.el_free += DP_int_to_size(DP_atomic_get(&tc->count));
+        }
         DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
         return mps;
     }
@@ -278,9 +401,14 @@ void DP_tile_decref(DP_Tile *tile)
     DP_ASSERT(tile);
     DP_ASSERT(DP_atomic_get(&tile->refcount) > 0);
     if (DP_atomic_dec(&tile->refcount)) {
-        DP_MUTEX_MUST_LOCK(tile_memory_pool_lock);
-        DP_memory_pool_free_el(&tile_memory_pool, tile);
-        DP_MUTEX_MUST_UNLOCK(tile_memory_pool_lock);
+        DP_TileCompressed *tc = DP_atomic_ptr_get(&tile->compressed);
+        if (tc) {
+            DP_MUTEX_MUST_LOCK(tile_compress_cache_lock);
+            tile_compress_cache_used -= tc->size;
+            DP_MUTEX_MUST_UNLOCK(tile_compress_cache_lock);
+            DP_free(tc);
+        }
+        tile_cache_release(tile);
     }
 }
 
@@ -377,17 +505,175 @@ bool DP_tile_same_pixel(DP_Tile *tile_or_null, DP_Pixel15 *out_pixel)
 }
 
 
+struct DP_TileCompressArgs {
+    unsigned char *(*get_output_buffer)(size_t, void *);
+    void *user;
+    unsigned char *out;
+};
+
+static unsigned char *get_compress_output_buffer(size_t size, void *user)
+{
+    struct DP_TileCompressArgs *args = user;
+    args->out = args->get_output_buffer(size, args->user);
+    return args->out;
+}
+
+static void tile_compress_cache_store(DP_Tile *tile,
+                                      DP_CompressProfile profile,
+                                      const unsigned char *out, size_t size)
+{
+    DP_MUTEX_MUST_LOCK(tile_compress_cache_lock);
+    bool fits = tile_compress_cache_used + size <= tile_compress_cache_limit;
+    if (fits) {
+        tile_compress_cache_used += size;
+    }
+    DP_MUTEX_MUST_UNLOCK(tile_compress_cache_lock);
+
+    if (fits) {
+        DP_TileCompressed *tc = DP_malloc(sizeof(*tc) + size);
+        tc->profile = profile;
+        tc->size = size;
+        memcpy(tc->data, out, size);
+        // Another thread may have compressed the same tile in the meantime.
+        if (!DP_atomic_ptr_compare_exchange(&tile->compressed, NULL, tc)) {
+            DP_MUTEX_MUST_LOCK(tile_compress_cache_lock);
+            tile_compress_cache_used -= size;
+            DP_MUTEX_MUST_UNLOCK(tile_compress_cache_lock);
+            DP_free(tc);
+        }
+    }
+}
+
 size_t DP_tile_compress(DP_Tile *tile, DP_Pixel8 *pixel_buffer,
+                        DP_CompressProfile profile,
                         unsigned char *(*get_output_buffer)(size_t, void *),
                         void *user)
 {
     DP_ASSERT(tile);
     DP_ASSERT(DP_atomic_get(&tile->refcount) > 0);
     DP_ASSERT(pixel_buffer);
+
+    // Data compressed with a stronger profile is at least as good, but the
+    // cached data is never replaced, since other threads may be reading it.
+    DP_TileCompressed *tc = DP_atomic_ptr_get(&tile->compressed);
+    if (tc && tc->profile >= profile) {
+        unsigned char *out = get_output_buffer(tc->size, user);
+        if (!out) {
+            return 0;
+        }
+        memcpy(out, tc->data, tc->size);
+        return tc->size;
+    }
+
     DP_pixels15_to_8(pixel_buffer, tile->pixels, DP_TILE_LENGTH);
-    return DP_compress_deflate((const unsigned char *)pixel_buffer,
-                               DP_TILE_COMPRESSED_BYTES, get_output_buffer,
-                               user);
+    if (tc || tile->transient
+        || !DP_atomic_get(&tile_compress_cache_enabled)) {
+        return DP_compress_deflate_profile(
+            profile, (const unsigned char *)pixel_buffer,
+            DP_TILE_COMPRESSED_BYTES, get_output_buffer, user);
+    }
+
+    struct DP_TileCompressArgs args = {get_output_buffer, user, NULL};
+    size_t size = DP_compress_deflate_profile(
+        profile, (const unsigned char *)pixel_buffer, DP_TILE_COMPRESSED_BYTES,
+        get_compress_output_buffer, &args);
+    if (size != 0) {
+        tile_compress_cache_store(tile, profile, args.out, size);
+    }
+    return size;
+}
+
+void DP_tile_compress_cache_limit_set(size_t max_bytes)
+{
+    init_tile_memory();
+    DP_MUTEX_MUST_LOCK(tile_compress_cache_lock);
+    tile_compress_cache_limit = max_bytes;
+    DP_atomic_set(&tile_compress_cache_enabled, max_bytes != 0);
+    DP_MUTEX_MUST_UNLOCK(tile_compress_cache_lock);
+}
+
+size_t DP_tile_compress_cache_used(void)
+{
+    if (tile_compress_cache_lock) {
+        DP_MUTEX_MUST_LOCK(tile_compress_cache_lock);
+        size_t used = tile_compress_cache_used;
+        DP_MUTEX_MUST_UNLOCK(tile_compress_cache_lock);
+        return used;
+    }
+    else {
+        return 0;
+    }
+}
+
+struct DP_TileCompressOrderedArgs {
+    DP_CompressProfile profile;
+    DP_TileCompressGetFn get_fn;
+    DP_TileCompressWriteFn write_fn;
+    void *user;
+    // One conversion buffer per thread, allocated on first use.
+    DP_Pixel8 **pixel_buffers;
+};
+
+static unsigned char *get_malloc_output_buffer(size_t size, void *user)
+{
+    unsigned char **out_buffer = user;
+    *out_buffer = DP_malloc(size);
+    return *out_buffer;
+}
+
+static void *compress_ordered_encode(void *user, int index, int thread_index,
+                                     size_t *out_size)
+{
+    struct DP_TileCompressOrderedArgs *args = user;
+    DP_Pixel8 *pixel_buffer = args->pixel_buffers[thread_index];
+    if (!pixel_buffer) {
+        pixel_buffer = DP_malloc(sizeof(*pixel_buffer) * DP_TILE_LENGTH);
+        args->pixel_buffers[thread_index] = pixel_buffer;
+    }
+
+    unsigned char *buffer = NULL;
+    size_t size = DP_tile_compress(args->get_fn(args->user, index),
+                                   pixel_buffer, args->profile,
+                                   get_malloc_output_buffer, &buffer);
+    if (size == 0) {
+        DP_free(buffer);
+        return NULL;
+    }
+    else {
+        *out_size = size;
+        return buffer;
+    }
+}
+
+static bool compress_ordered_write(void *user, int index, void *buffer,
+                                   size_t size)
+{
+    struct DP_TileCompressOrderedArgs *args = user;
+    bool ok = args->write_fn(args->user, index, buffer, size);
+    DP_free(buffer);
+    return ok;
+}
+
+bool DP_tile_compress_ordered(DP_OrderedWorker *ow, int count,
+                              DP_CompressProfile profile,
+                              DP_TileCompressGetFn get_fn,
+                              DP_TileCompressWriteFn write_fn, void *user)
+{
+    DP_ASSERT(ow);
+    DP_ASSERT(get_fn);
+    DP_ASSERT(write_fn);
+    int thread_count = DP_ordered_worker_thread_count(ow);
+    struct DP_TileCompressOrderedArgs args = {
+        profile, get_fn, write_fn, user,
+        DP_malloc_zeroed(sizeof(*args.pixel_buffers)
+                         * DP_int_to_size(thread_count))};
+    bool ok = DP_ordered_worker_run(ow, count, compress_ordered_encode,
+                                    compress_ordered_write, &args);
+    for (int i = 0; i < thread_count; ++i) {
+        DP_free(args.pixel_buffers[i]);
+    }
+    DP_free(args.pixel_buffers);
+    return ok;
 }
 
 
@@ -21,12 +21,14 @@
  */
 #ifndef DPENGINE_TILE_H
 #define DPENGINE_TILE_H
+#include "compress.h"
 #include "pixels.h"
 #include <dpcommon/common.h>
 #include <dpcommon/memory_pool.h>
 
 typedef struct DP_DrawContext DP_DrawContext;
 typedef struct DP_Image DP_Image;
+typedef struct DP_OrderedWorker DP_OrderedWorker;
 
 #define DP_TILE_BYTES            (DP_TILE_LENGTH * sizeof(DP_Pixel15))
 #define DP_TILE_COMPRESSED_BYTES (DP_TILE_LENGTH * sizeof(DP_Pixel8))
@@ -138,9 +140,35 @@ bool DP_tile_same_pixel(DP_Tile *tile_or_null, DP_Pixel15 *out_pixel);
 
 
 size_t DP_tile_compress(DP_Tile *tile, DP_Pixel8 *pixel_buffer,
+                        DP_CompressProfile profile,
                         unsigned char *(*get_output_buffer)(size_t, void *),
                         void *user);
 
+// Opt-in cache for compressed tile data. While the limit is non-zero,
+// DP_tile_compress keeps the compressed bytes of persistent tiles around, up to
+// the given total size, and just copies them out when the same tile gets
+// compressed again, such as when building the next reset image or index.
+// Cached data is only handed out if it was compressed with at least the
+// requested profile and is never replaced by a stronger one afterwards. The
+// cached data is freed along with its tile. Setting the limit to zero stops
+// the cache from growing, data already cached stays until its tile is freed.
+void DP_tile_compress_cache_limit_set(size_t max_bytes);
+
+size_t DP_tile_compress_cache_used(void);
+
+typedef DP_Tile *(*DP_TileCompressGetFn)(void *user, int index);
+typedef bool (*DP_TileCompressWriteFn)(void *user, int index,
+                                       const unsigned char *data, size_t size);
+
+// Compresses the given number of tiles across the ordered worker's threads.
+// The write function is called on the calling thread in order of the indexes,
+// with NULL data and DP_error set if compressing a tile failed. Returns false
+// if a write function returned false.
+bool DP_tile_compress_ordered(DP_OrderedWorker *ow, int count,
+                              DP_CompressProfile profile,
+                              DP_TileCompressGetFn get_fn,
+                              DP_TileCompressWriteFn write_fn, void *user);
+
 
 void DP_tile_copy_to_image(DP_Tile *tile_or_null, DP_Image *img, int x, int y);
 
@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpengine/pixels.h>
+#include <dpmsg/blend_mode.h>
+#include <dptest_engine.h>
+
+
+// Separable blend modes use vector instructions if available. These tests
+// check that they come out bit-exact compared to the scalar implementation.
+// Set the DP_CPU_SUPPORT environment variable to switch which one to use.
+
+static const int separable_blend_modes[] = {
+    DP_BLEND_MODE_MULTIPLY,     DP_BLEND_MODE_DIVIDE,
+    DP_BLEND_MODE_BURN,         DP_BLEND_MODE_DODGE,
+    DP_BLEND_MODE_DARKEN,       DP_BLEND_MODE_LIGHTEN,
+    DP_BLEND_MODE_SUBTRACT,     DP_BLEND_MODE_ADD,
+    DP_BLEND_MODE_SCREEN,       DP_BLEND_MODE_OVERLAY,
+    DP_BLEND_MODE_HARD_LIGHT,   DP_BLEND_MODE_SOFT_LIGHT,
+    DP_BLEND_MODE_LINEAR_BURN,  DP_BLEND_MODE_LINEAR_LIGHT,
+    DP_BLEND_MODE_LUMINOSITY_SHINE_SAI,
+};
+
+// Odd width so that every row goes through AVX2, SSE and scalar code.
+#define MASK_WIDTH  77
+#define MASK_HEIGHT 13
+#define MASK_SKIP   3
+#define BASE_SKIP   5
+#define BASE_STRIDE (MASK_WIDTH + BASE_SKIP)
+#define MASK_STRIDE (MASK_WIDTH + MASK_SKIP)
+
+static uint32_t next_random(uint32_t *state)
+{
+    // xorshift32, good enough for generating test pixels.
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static uint16_t random_channel(uint32_t *state, uint16_t max)
+{
+    // Bias towards the extremes, since that's where rounding goes wrong.
+    uint32_t r = next_random(state);
+    switch (r % 8) {
+    case 0:
+        return 0;
+    case 1:
+        return max;
+    default:
+        return DP_uint32_to_uint16((r >> 3) % ((uint32_t)max + 1));
+    }
+}
+
+static DP_Pixel15 random_pixel(uint32_t *state)
+{
+    uint16_t a = random_channel(state, DP_BIT15);
+    return (DP_Pixel15){
+        .b = random_channel(state, a),
+        .g = random_channel(state, a),
+        .r = random_channel(state, a),
+        .a = a,
+    };
+}
+
+static DP_UPixel15 random_upixel(uint32_t *state)
+{
+    return (DP_UPixel15){
+        .b = random_channel(state, DP_BIT15),
+        .g = random_channel(state, DP_BIT15),
+        .r = random_channel(state, DP_BIT15),
+        .a = DP_BIT15,
+    };
+}
+
+static bool pixels_equal(TEST_PARAMS, const DP_Pixel15 *actual,
+                         const DP_Pixel15 *expected, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        DP_Pixel15 a = actual[i];
+        DP_Pixel15 e = expected[i];
+        if (!DP_pixel15_equal(a, e)) {
+            DIAG("pixel %d: actual (%u, %u, %u, %u), "
+                 "expected (%u, %u, %u, %u)",
+                 i, a.b, a.g, a.r, a.a, e.b, e.g, e.r, e.a);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static void blend_mask_separable(TEST_PARAMS)
+{
+    int base_count = BASE_STRIDE * MASK_HEIGHT;
+    int mask_count = MASK_STRIDE * MASK_HEIGHT;
+    size_t base_size = DP_int_to_size(base_count) * sizeof(DP_Pixel15);
+    DP_Pixel15 *base = DP_malloc(base_size);
+    DP_Pixel15 *actual = DP_malloc(base_size);
+    DP_Pixel15 *expected = DP_malloc(base_size);
+    uint16_t *mask = DP_malloc(DP_int_to_size(mask_count) * sizeof(*mask));
+
+    uint32_t state = 0xdeadbeef;
+    for (int i = 0; i < base_count; ++i) {
+        base[i] = random_pixel(&state);
+    }
+    for (int i = 0; i < mask_count; ++i) {
+        mask[i] = random_channel(&state, DP_BIT15);
+    }
+
+    for (size_t i = 0; i < DP_ARRAY_LENGTH(separable_blend_modes); ++i) {
+        int blend_mode = separable_blend_modes[i];
+        bool equal = true;
+        for (int j = 0; equal && j < 16; ++j) {
+            DP_UPixel15 src = random_upixel(&state);
+            uint16_t opacity = random_channel(&state, DP_BIT15);
+
+            memcpy(actual, base, base_size);
+            DP_blend_mask(actual, src, blend_mode, mask, opacity, MASK_WIDTH,
+                          MASK_HEIGHT, MASK_SKIP, BASE_SKIP);
+
+            // Blending single pixels always takes the scalar path.
+            memcpy(expected, base, base_size);
+            for (int y = 0; y < MASK_HEIGHT; ++y) {
+                for (int x = 0; x < MASK_WIDTH; ++x) {
+                    DP_blend_mask(&expected[y * BASE_STRIDE + x], src,
+                                  blend_mode, &mask[y * MASK_STRIDE + x],
+                                  opacity, 1, 1, 0, 0);
+                }
+            }
+
+            equal = pixels_equal(TEST_ARGS, actual, expected, base_count);
+        }
+        OK(equal, "blend_mask %s bit-exact",
+           DP_blend_mode_enum_name(blend_mode));
+    }
+
+    DP_free(mask);
+    DP_free(expected);
+    DP_free(actual);
+    DP_free(base);
+}
+
+
+static void blend_tile_separable(TEST_PARAMS)
+{
+    size_t tile_size = DP_TILE_LENGTH * sizeof(DP_Pixel15);
+    DP_Pixel15 *src = DP_malloc_simd(tile_size);
+    DP_Pixel15 *base = DP_malloc_simd(tile_size);
+    DP_Pixel15 *actual = DP_malloc_simd(tile_size);
+    DP_Pixel15 *expected = DP_malloc_simd(tile_size);
+
+    uint32_t state = 0xcafebabe;
+    for (size_t i = 0; i < DP_ARRAY_LENGTH(separable_blend_modes); ++i) {
+        int blend_mode = separable_blend_modes[i];
+        bool equal = true;
+        for (int j = 0; equal && j < 4; ++j) {
+            for (int k = 0; k < DP_TILE_LENGTH; ++k) {
+                src[k] = random_pixel(&state);
+                base[k] = random_pixel(&state);
+            }
+            uint16_t opacity = random_channel(&state, DP_BIT15);
+
+            memcpy(actual, base, tile_size);
+            DP_blend_tile(actual, src, opacity, blend_mode);
+
+            memcpy(expected, base, tile_size);
+            DP_blend_pixels(expected, src, DP_TILE_LENGTH, opacity,
+                            blend_mode);
+
+            equal = pixels_equal(TEST_ARGS, actual, expected, DP_TILE_LENGTH);
+        }
+        OK(equal, "blend_tile %s bit-exact",
+           DP_blend_mode_enum_name(blend_mode));
+    }
+
+    DP_free_simd(expected);
+    DP_free_simd(actual);
+    DP_free_simd(base);
+    DP_free_simd(src);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(blend_mask_separable);
+    REGISTER_TEST(blend_tile_separable);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpengine/layer_content.h>
+#include <dpengine/pixels.h>
+#include <dpengine/tile.h>
+#include <dptest_engine.h>
+
+#define ITERATIONS 200
+
+
+// Cropping via the uncropped conversion and a full scan of the pixels.
+static void crop_oracle(DP_UPixel8 *full, int width, int height,
+                        int *out_min_x, int *out_min_y, int *out_max_x,
+                        int *out_max_y)
+{
+    *out_min_x = width;
+    *out_min_y = height;
+    *out_max_x = -1;
+    *out_max_y = -1;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            if (full[y * width + x].a != 0) {
+                *out_min_x = DP_min_int(*out_min_x, x);
+                *out_min_y = DP_min_int(*out_min_y, y);
+                *out_max_x = DP_max_int(*out_max_x, x);
+                *out_max_y = DP_max_int(*out_max_y, y);
+            }
+        }
+    }
+}
+
+static void check_cropped(TEST_PARAMS, DP_LayerContent *lc, int iteration)
+{
+    int width = DP_layer_content_width(lc);
+    int height = DP_layer_content_height(lc);
+    DP_UPixel8 *full = DP_layer_content_to_upixels8(lc, 0, 0, width, height);
+    int min_x, min_y, max_x, max_y;
+    crop_oracle(full, width, height, &min_x, &min_y, &max_x, &max_y);
+
+    int x, y, w, h;
+    DP_UPixel8 *cropped =
+        DP_layer_content_to_upixels8_cropped(lc, false, &x, &y, &w, &h);
+    if (max_x == -1) {
+        NULL_OK(cropped, "iteration %d is blank", iteration);
+    }
+    else if (NOT_NULL_OK(cropped, "iteration %d is not blank", iteration)) {
+        INT_EQ_OK(x, min_x, "iteration %d x", iteration);
+        INT_EQ_OK(y, min_y, "iteration %d y", iteration);
+        INT_EQ_OK(w, max_x - min_x + 1, "iteration %d width", iteration);
+        INT_EQ_OK(h, max_y - min_y + 1, "iteration %d height", iteration);
+        int mismatches = 0;
+        for (int py = 0; py < h && py + y < height; ++py) {
+            for (int px = 0; px < w && px + x < width; ++px) {
+                if (cropped[py * w + px].color
+                    != full[(py + y) * width + px + x].color) {
+                    ++mismatches;
+                }
+            }
+        }
+        INT_EQ_OK(mismatches, 0, "iteration %d pixels", iteration);
+    }
+
+    DP_free(cropped);
+    DP_free(full);
+}
+
+static void crop_random_layers(TEST_PARAMS)
+{
+    unsigned int seed = 1;
+    for (int i = 0; i < ITERATIONS; ++i) {
+        int width = DP_TILE_SIZE * (1 + DP_test_random_int(&seed, 5));
+        int height = DP_TILE_SIZE * (1 + DP_test_random_int(&seed, 5));
+        DP_TransientLayerContent *tlc =
+            DP_transient_layer_content_new_init(width, height, NULL);
+        int count = DP_test_random_int(&seed, 6);
+        for (int j = 0; j < count; ++j) {
+            // Some pixels are so transparent that they vanish in 8 bits.
+            uint16_t a =
+                DP_test_random_int(&seed, 3) == 0
+                    ? 20
+                    : DP_int_to_uint16(DP_test_random_int(&seed, DP_BIT15 + 1));
+            int x = DP_test_random_int(&seed, width);
+            int y = DP_test_random_int(&seed, height);
+            DP_transient_layer_content_pixel_at_set(
+                tlc, 0, x, y, (DP_Pixel15){a / 2, a / 3, a, a});
+        }
+        DP_LayerContent *lc = DP_transient_layer_content_persist(tlc);
+        check_cropped(TEST_ARGS, lc, i);
+        DP_layer_content_decref(lc);
+    }
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(crop_random_layers);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
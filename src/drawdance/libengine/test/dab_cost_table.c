@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/cpu.h>
+#include <dpengine/dab_cost.h>
+#include <dpengine/dab_cost_table.h>
+#include <dpengine/draw_context.h>
+#include <dpmsg/blend_mode.h>
+#include <dptest_engine.h>
+
+
+static bool blend_modes_match(const DP_DabCostTable *table,
+                              double (*get_table_cost)(const DP_DabCostTable *,
+                                                       bool, int),
+                              double (*get_cost)(bool, int))
+{
+    if (get_table_cost(table, true, DP_BLEND_MODE_NORMAL)
+        != get_cost(true, DP_BLEND_MODE_NORMAL)) {
+        return false;
+    }
+    for (int i = 0; i < DP_BLEND_MODE_COUNT; ++i) {
+        if (DP_blend_mode_valid_for_brush(i)
+            && get_table_cost(table, false, i) != get_cost(false, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void dab_cost_table_defaults(TEST_PARAMS)
+{
+    DP_DabCostTable table;
+    DP_dab_cost_table_init(&table);
+    OK(blend_modes_match(&table, DP_dab_cost_table_pixel, DP_dab_cost_pixel),
+       "pixel costs match static table");
+    OK(blend_modes_match(&table, DP_dab_cost_table_pixel_square,
+                         DP_dab_cost_pixel_square),
+       "pixel square costs match static table");
+    OK(blend_modes_match(&table, DP_dab_cost_table_classic,
+                         DP_dab_cost_classic),
+       "classic costs match static table");
+
+    bool mypaint_ok = true;
+    for (int i = 0; i < 16; ++i) {
+        bool indirect = i & 1;
+        uint8_t lock_alpha = i & 2 ? UINT8_MAX : 0;
+        uint8_t colorize = i & 4 ? UINT8_MAX : 0;
+        uint8_t posterize = i & 8 ? 127 : 0;
+        double expected = DP_dab_cost_mypaint(indirect, lock_alpha, colorize,
+                                              posterize);
+        double actual = DP_dab_cost_table_mypaint(&table, indirect, lock_alpha,
+                                                  colorize, posterize);
+        mypaint_ok = mypaint_ok && expected == actual;
+    }
+    OK(mypaint_ok, "mypaint costs match static table");
+}
+
+static bool blend_modes_calibrated(const DP_DabCostBlendModes *bm)
+{
+    if (!(bm->indirect > 0.0) || bm->fallback < bm->indirect) {
+        return false;
+    }
+    for (int i = 0; i < DP_BLEND_MODE_COUNT; ++i) {
+        if (!(bm->direct[i] > 0.0) || bm->direct[i] > bm->fallback) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void dab_cost_table_calibrate(TEST_PARAMS)
+{
+    DP_cpu_support_init();
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_DabCostTable table = {0};
+    DP_dab_cost_table_calibrate(&table, dc);
+    DP_draw_context_free(dc);
+
+    OK(blend_modes_calibrated(&table.pixel), "pixel costs calibrated");
+    OK(blend_modes_calibrated(&table.pixel_square),
+       "pixel square costs calibrated");
+    OK(blend_modes_calibrated(&table.classic), "classic costs calibrated");
+    OK(table.mypaint.indirect > 0.0 && table.mypaint.lock_alpha > 0.0
+           && table.mypaint.colorize > 0.0 && table.mypaint.posterize > 0.0
+           && table.mypaint.normal > 0.0,
+       "mypaint costs calibrated");
+    OK(DP_dab_cost_table_pixel(&table, false, -1) == table.pixel.fallback
+           && DP_dab_cost_table_pixel(&table, false, DP_BLEND_MODE_COUNT)
+                  == table.pixel.fallback,
+       "out of range blend modes use fallback cost");
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(dab_cost_table_defaults);
+    REGISTER_TEST(dab_cost_table_calibrate);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
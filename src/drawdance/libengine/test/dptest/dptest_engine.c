@@ -20,6 +20,7 @@
  * SOFTWARE.
  */
 #include "dptest_engine.h"
+#include <dpcommon/conversions.h>
 #include <dpcommon/input.h>
 #include <dpengine/image.h>
 #include <dptest.h>
@@ -142,3 +143,15 @@ bool DP_test_image_file_eq_ok(DP_TestContext *T, const char *file, int line,
     }
     return result;
 }
+
+
+unsigned int DP_test_random_next(unsigned int *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (*seed >> 8u) & 0xffffffu;
+}
+
+int DP_test_random_int(unsigned int *seed, int max)
+{
+    return DP_uint_to_int(DP_test_random_next(seed) % DP_int_to_uint(max));
+}
@@ -35,6 +35,13 @@ bool DP_test_image_file_eq_ok(DP_TestContext *T, const char *file, int line,
                               const char *b, const char *fmt, ...)
     DP_FORMAT(8, 9);
 
+// Simple deterministic generator, so that failures can be reproduced. Returns
+// 24 random bits and advances the seed.
+unsigned int DP_test_random_next(unsigned int *seed);
+
+// Random number from 0 up to, but not including, max.
+int DP_test_random_int(unsigned int *seed, int max);
+
 
 #define IMAGE_EQ_OK(A, B, ...)                                           \
     DP_test_image_eq_ok(TEST_ARGS, __FILE__, __LINE__, #A, #B, (A), (B), \
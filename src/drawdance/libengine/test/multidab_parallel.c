@@ -0,0 +1,361 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/cpu.h>
+#include <dpcommon/geom.h>
+#include <dpengine/brush.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/layer_content.h>
+#include <dpengine/layer_list.h>
+#include <dpengine/layer_props.h>
+#include <dpengine/layer_props_list.h>
+#include <dpengine/multidab_worker.h>
+#include <dpengine/paint.h>
+#include <dpengine/pixels.h>
+#include <dpengine/tile.h>
+#include <dpengine/user_cursors.h>
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+#include <dptest_engine.h>
+
+#define CANVAS_SIZE   512
+#define LAYER_COUNT   3
+#define USER_COUNT    6
+#define MESSAGE_COUNT 120
+#define DAB_COUNT     16
+
+
+static int8_t random_step(unsigned int *seed)
+{
+    return DP_int_to_int8(DP_test_random_int(seed, 9) - 4);
+}
+
+struct DP_RandomDabs {
+    unsigned int *seed;
+    int max_size;
+};
+
+static void set_classic_dabs(int count, DP_ClassicDab *cds, void *user)
+{
+    struct DP_RandomDabs *rd = user;
+    for (int i = 0; i < count; ++i) {
+        DP_classic_dab_init(
+            cds, i, random_step(rd->seed), random_step(rd->seed),
+            DP_int_to_uint16(
+                DP_test_random_int(rd->seed, rd->max_size * 256) + 1),
+            DP_int_to_uint8(DP_test_random_int(rd->seed, 256)),
+            DP_int_to_uint8(DP_test_random_int(rd->seed, 255) + 1));
+    }
+}
+
+static void set_pixel_dabs(int count, DP_PixelDab *pds, void *user)
+{
+    struct DP_RandomDabs *rd = user;
+    for (int i = 0; i < count; ++i) {
+        DP_pixel_dab_init(
+            pds, i, random_step(rd->seed), random_step(rd->seed),
+            DP_int_to_uint8(DP_test_random_int(rd->seed, rd->max_size)),
+            DP_int_to_uint8(DP_test_random_int(rd->seed, 255) + 1));
+    }
+}
+
+static void set_mypaint_dabs(int count, DP_MyPaintDab *mpds, void *user)
+{
+    struct DP_RandomDabs *rd = user;
+    for (int i = 0; i < count; ++i) {
+        DP_mypaint_dab_init(
+            mpds, i, random_step(rd->seed), random_step(rd->seed),
+            DP_int_to_uint16(
+                DP_test_random_int(rd->seed, rd->max_size * 256) + 1),
+            DP_int_to_uint8(DP_test_random_int(rd->seed, 256)),
+            DP_int_to_uint8(DP_test_random_int(rd->seed, 255) + 1),
+            DP_int_to_uint8(DP_test_random_int(rd->seed, 256)),
+            DP_int_to_uint8(DP_test_random_int(rd->seed, 256)));
+    }
+}
+
+static DP_Message *make_random_message(unsigned int *seed,
+                                       unsigned int context_id, int layer_id,
+                                       int x, int y, int max_size)
+{
+    struct DP_RandomDabs rd = {seed, max_size};
+    uint16_t layer = DP_int_to_uint16(layer_id);
+    // Colors with alpha are drawn indirectly, onto a sublayer.
+    uint32_t color = (DP_test_random_int(seed, 2) == 0 ? 0xff000000u : 0u)
+                   | DP_int_to_uint32(DP_test_random_int(seed, 0x1000000));
+    switch (DP_test_random_int(seed, 4)) {
+    case 0:
+        return DP_msg_draw_dabs_classic_new(context_id, layer, x * 4, y * 4,
+                                            color, DP_BLEND_MODE_NORMAL,
+                                            set_classic_dabs, DAB_COUNT, &rd);
+    case 1:
+        return DP_msg_draw_dabs_pixel_new(context_id, layer, x, y, color,
+                                          DP_BLEND_MODE_NORMAL, set_pixel_dabs,
+                                          DAB_COUNT, &rd);
+    case 2:
+        return DP_msg_draw_dabs_pixel_square_new(
+            context_id, layer, x, y, color, DP_BLEND_MODE_BEHIND,
+            set_pixel_dabs, DAB_COUNT, &rd);
+    default:
+        return DP_msg_draw_dabs_mypaint_new(
+            context_id, layer, x * 4, y * 4, color | 0xff000000u, 0,
+            DP_int_to_uint8(DP_test_random_int(seed, 2) * UINT8_MAX), 0,
+            DP_test_random_int(seed, 2) == 0
+                ? 0
+                : DP_MYPAINT_BRUSH_MODE_FLAG | DP_MYPAINT_BRUSH_MODE_NORMAL,
+            set_mypaint_dabs, DAB_COUNT, &rd);
+    }
+}
+
+
+static DP_CanvasState *make_canvas_state(DP_DrawContext *dc)
+{
+    DP_TransientCanvasState *tcs = DP_transient_canvas_state_new_init();
+    DP_transient_canvas_state_width_set(tcs, CANVAS_SIZE);
+    DP_transient_canvas_state_height_set(tcs, CANVAS_SIZE);
+
+    DP_TransientLayerList *tll =
+        DP_transient_canvas_state_transient_layers(tcs, LAYER_COUNT);
+    DP_TransientLayerPropsList *tlpl =
+        DP_transient_canvas_state_transient_layer_props(tcs, LAYER_COUNT);
+
+    for (int i = 0; i < LAYER_COUNT; ++i) {
+        // Leave the first layer blank, fill the others.
+        DP_Tile *t = i == 0 ? NULL
+                            : DP_tile_new_from_bgra(
+                                  0, 0xff808080u + DP_int_to_uint(i << 4));
+        DP_TransientLayerContent *tlc =
+            DP_transient_layer_content_new_init(CANVAS_SIZE, CANVAS_SIZE, t);
+        DP_tile_decref_nullable(t);
+        DP_TransientLayerProps *tlp =
+            DP_transient_layer_props_new_init(0x101 + i, false);
+        DP_transient_layer_list_insert_transient_content_noinc(tll, tlc, i);
+        DP_transient_layer_props_list_insert_transient_noinc(tlpl, tlp, i);
+    }
+
+    DP_transient_canvas_state_layer_routes_reindex(tcs, dc);
+    return DP_transient_canvas_state_persist(tcs);
+}
+
+// Mostly keeps each user to their own layer and area of the canvas, so that
+// the batch splits up, with some strays thrown in that force merges.
+static void make_messages(unsigned int seed, DP_Message **msgs)
+{
+    int area = CANVAS_SIZE / USER_COUNT;
+    for (int i = 0; i < MESSAGE_COUNT; ++i) {
+        unsigned int context_id =
+            DP_int_to_uint(DP_test_random_int(&seed, 6) + 1);
+        bool stray = DP_test_random_int(&seed, 20) == 0;
+        int layer_id = stray ? 0x101 + DP_test_random_int(&seed, LAYER_COUNT)
+                             : 0x101 + DP_uint_to_int(context_id) % LAYER_COUNT;
+        int x = stray ? DP_test_random_int(&seed, CANVAS_SIZE)
+                      : DP_uint_to_int(context_id - 1) * area
+                            + DP_test_random_int(&seed, area);
+        int y = DP_test_random_int(&seed, CANVAS_SIZE);
+        msgs[i] = make_random_message(&seed, context_id, layer_id, x, y, 48);
+    }
+}
+
+static bool tiles_equal(DP_Tile *a, DP_Tile *b)
+{
+    if (a && b) {
+        return memcmp(DP_tile_pixels(a), DP_tile_pixels(b), DP_TILE_BYTES) == 0;
+    }
+    else {
+        return !a && !b;
+    }
+}
+
+// Compares the full 15 bit pixels, not just what survives conversion to 8.
+static bool layer_contents_equal(DP_LayerContent *a, DP_LayerContent *b)
+{
+    DP_TileCounts tile_counts = DP_tile_counts_round(
+        DP_layer_content_width(a), DP_layer_content_height(a));
+    bool equal = true;
+    for (int y = 0; equal && y < tile_counts.y; ++y) {
+        for (int x = 0; equal && x < tile_counts.x; ++x) {
+            equal = tiles_equal(DP_layer_content_tile_at_noinc(a, x, y),
+                                DP_layer_content_tile_at_noinc(b, x, y));
+        }
+    }
+
+    DP_LayerList *sub_a = DP_layer_content_sub_contents_noinc(a);
+    DP_LayerList *sub_b = DP_layer_content_sub_contents_noinc(b);
+    int count = DP_layer_list_count(sub_a);
+    if (count != DP_layer_list_count(sub_b)) {
+        return false;
+    }
+    for (int i = 0; equal && i < count; ++i) {
+        equal = layer_contents_equal(
+            DP_layer_list_entry_content_noinc(DP_layer_list_at_noinc(sub_a, i)),
+            DP_layer_list_entry_content_noinc(
+                DP_layer_list_at_noinc(sub_b, i)));
+    }
+    return equal;
+}
+
+static bool canvas_states_equal(DP_CanvasState *a, DP_CanvasState *b)
+{
+    DP_LayerList *lla = DP_canvas_state_layers_noinc(a);
+    DP_LayerList *llb = DP_canvas_state_layers_noinc(b);
+    for (int i = 0; i < LAYER_COUNT; ++i) {
+        DP_LayerListEntry *lle_a = DP_layer_list_at_noinc(lla, i);
+        DP_LayerListEntry *lle_b = DP_layer_list_at_noinc(llb, i);
+        if (!layer_contents_equal(DP_layer_list_entry_content_noinc(lle_a),
+                                  DP_layer_list_entry_content_noinc(lle_b))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool user_cursors_equal(DP_UserCursors *a, DP_UserCursors *b)
+{
+    if (a->count != b->count
+        || memcmp(a->user_ids, b->user_ids, sizeof(a->user_ids)) != 0) {
+        return false;
+    }
+    for (int i = 0; i < a->count; ++i) {
+        DP_UserCursorState *sa = &a->states[a->user_ids[i]];
+        DP_UserCursorState *sb = &b->states[b->user_ids[i]];
+        if (sa->flags != sb->flags || sa->layer_id != sb->layer_id
+            || sa->smooth_count != sb->smooth_count
+            || sa->xs[0] != sb->xs[0] || sa->ys[0] != sb->ys[0]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void multidab_parallel_matches_serial(TEST_PARAMS)
+{
+    DP_cpu_support_init();
+    DP_DrawContext *dc = DP_draw_context_new();
+    // More threads than cores is fine, that just makes for more interleaving.
+    DP_MultidabWorker *mw = DP_multidab_worker_new(3);
+
+    DP_CanvasState *cs = make_canvas_state(dc);
+    for (unsigned int seed = 1; seed <= 10; ++seed) {
+        DP_Message *msgs[MESSAGE_COUNT];
+        make_messages(seed, msgs);
+
+        DP_UserCursors serial_ucs, parallel_ucs;
+        DP_user_cursors_init(&serial_ucs);
+        DP_user_cursors_init(&parallel_ucs);
+        DP_CanvasState *serial = DP_canvas_state_handle_multidab(
+            cs, dc, NULL, &serial_ucs, MESSAGE_COUNT, msgs);
+        DP_CanvasState *parallel = DP_canvas_state_handle_multidab(
+            cs, dc, mw, &parallel_ucs, MESSAGE_COUNT, msgs);
+
+        OK(canvas_states_equal(serial, parallel),
+           "seed %u parallel pixels match serial", seed);
+        OK(user_cursors_equal(&serial_ucs, &parallel_ucs),
+           "seed %u parallel cursors match serial", seed);
+
+        DP_canvas_state_decref(parallel);
+        DP_canvas_state_decref(serial);
+        for (int i = 0; i < MESSAGE_COUNT; ++i) {
+            DP_message_decref(msgs[i]);
+        }
+    }
+
+    DP_canvas_state_decref(cs);
+    DP_multidab_worker_free_join(mw);
+    DP_draw_context_free(dc);
+}
+
+
+static DP_PaintDrawDabsParams get_params(DP_Message *msg)
+{
+    DP_PaintDrawDabsParams params = {0};
+    params.type = (int)DP_message_type(msg);
+    params.context_id = 1;
+    params.blend_mode = DP_BLEND_MODE_NORMAL;
+    if (params.type == DP_MSG_DRAW_DABS_CLASSIC) {
+        DP_MsgDrawDabsClassic *mddc = DP_message_internal(msg);
+        params.origin_x = DP_msg_draw_dabs_classic_x(mddc);
+        params.origin_y = DP_msg_draw_dabs_classic_y(mddc);
+        params.color = DP_msg_draw_dabs_classic_color(mddc);
+        params.classic.dabs =
+            DP_msg_draw_dabs_classic_dabs(mddc, &params.dab_count);
+    }
+    else if (params.type == DP_MSG_DRAW_DABS_MYPAINT) {
+        DP_MsgDrawDabsMyPaint *mddmp = DP_message_internal(msg);
+        params.blend_mode = DP_BLEND_MODE_NORMAL_AND_ERASER;
+        params.origin_x = DP_msg_draw_dabs_mypaint_x(mddmp);
+        params.origin_y = DP_msg_draw_dabs_mypaint_y(mddmp);
+        params.color = DP_msg_draw_dabs_mypaint_color(mddmp);
+        params.mypaint.dabs =
+            DP_msg_draw_dabs_mypaint_dabs(mddmp, &params.dab_count);
+    }
+    else {
+        DP_MsgDrawDabsPixel *mddp = DP_message_internal(msg);
+        params.origin_x = DP_msg_draw_dabs_pixel_x(mddp);
+        params.origin_y = DP_msg_draw_dabs_pixel_y(mddp);
+        params.color = DP_msg_draw_dabs_pixel_color(mddp);
+        params.pixel.dabs =
+            DP_msg_draw_dabs_pixel_dabs(mddp, &params.dab_count);
+    }
+    // Fully opaque so that every touched pixel shows up.
+    params.color |= 0xff000000u;
+    return params;
+}
+
+static int count_pixels_outside(DP_LayerContent *lc, DP_Rect bounds)
+{
+    DP_UPixel8 *pixels =
+        DP_layer_content_to_upixels8(lc, 0, 0, CANVAS_SIZE, CANVAS_SIZE);
+    int outside = 0;
+    for (int y = 0; y < CANVAS_SIZE; ++y) {
+        for (int x = 0; x < CANVAS_SIZE; ++x) {
+            if (pixels[y * CANVAS_SIZE + x].a != 0
+                && !DP_rect_contains(bounds, x, y)) {
+                ++outside;
+            }
+        }
+    }
+    DP_free(pixels);
+    return outside;
+}
+
+static void draw_dabs_bounds_cover_drawn_pixels(TEST_PARAMS)
+{
+    DP_cpu_support_init();
+    DP_DrawContext *dc = DP_draw_context_new();
+    unsigned int seed = 1;
+    for (int i = 0; i < 200; ++i) {
+        // Small dabs hit the special cases for tiny brushes more often.
+        int max_size = DP_test_random_int(&seed, 2) == 0 ? 4 : 120;
+        int center = CANVAS_SIZE / 2;
+        DP_Message *msg = make_random_message(
+            &seed, 1, 0x101, center + DP_test_random_int(&seed, 4),
+            center + DP_test_random_int(&seed, 4), max_size);
+        DP_PaintDrawDabsParams params = get_params(msg);
+
+        DP_TransientLayerContent *tlc =
+            DP_transient_layer_content_new_init(CANVAS_SIZE, CANVAS_SIZE, NULL);
+        DP_paint_draw_dabs(dc, NULL, &params, tlc);
+        DP_LayerContent *lc = DP_transient_layer_content_persist(tlc);
+
+        INT_EQ_OK(count_pixels_outside(lc, DP_paint_draw_dabs_bounds(&params)),
+                  0, "iteration %d type %d pixels within bounds", i,
+                  params.type);
+
+        DP_layer_content_decref(lc);
+        DP_message_decref(msg);
+    }
+    DP_draw_context_free(dc);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(multidab_parallel_matches_serial);
+    REGISTER_TEST(draw_dabs_bounds_cover_drawn_pixels);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/input.h>
+#include <dpcommon/output.h>
+#include <dpengine/canvas_history.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/image.h>
+#include <dpengine/player.h>
+#include <dpengine/recorder.h>
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+#include <dptest_engine.h>
+#include <stdio.h>
+
+#define RECORDING_PATH     "test/tmp/player_index.dprec"
+#define INDEX_PATH         "test/tmp/player_index.dpidx"
+#define SETUP_MESSAGES     3
+#define SNAPSHOT_INTERVAL  4
+#define INDEX_FLAGS_OFFSET 8
+
+
+static void push(DP_Recorder *r, DP_Message *msg)
+{
+    DP_recorder_message_push_noinc(r, msg);
+}
+
+// A recording with the given number of rectangles in it. Recordings with the
+// same color have the same bytes up to the shorter one's length.
+static void write_recording(int rect_count, uint32_t color)
+{
+    DP_Output *output = DP_file_output_new_from_path(RECORDING_PATH);
+    DP_Recorder *r =
+        DP_recorder_new_inc(DP_RECORDER_TYPE_BINARY,
+                            DP_recorder_header_new(NULL), NULL, NULL, NULL,
+                            output);
+    push(r, DP_msg_undo_point_new(1));
+    push(r, DP_msg_canvas_resize_new(1, 0, 200, 150, 0));
+    push(r, DP_msg_layer_tree_create_new(1, 0x101, 0, 0, 0, 0, "", 0));
+    for (int i = 0; i < rect_count; ++i) {
+        push(r, DP_msg_fill_rect_new(
+                    1, 0x101, DP_BLEND_MODE_NORMAL, DP_int_to_uint32(i * 7),
+                    DP_int_to_uint32(i * 5), 30, 20,
+                    color + DP_int_to_uint32(i)));
+    }
+    DP_recorder_free_join(r, NULL);
+}
+
+static DP_Player *open_player(void)
+{
+    DP_Input *input = DP_file_input_new_from_path(RECORDING_PATH);
+    return input ? DP_player_new(DP_PLAYER_TYPE_BINARY, RECORDING_PATH, input,
+                                 NULL)
+                 : NULL;
+}
+
+typedef struct DP_IndexTestCounts {
+    int messages;
+} DP_IndexTestCounts;
+
+static bool count_and_snapshot(void *user)
+{
+    DP_IndexTestCounts *counts = user;
+    return ++counts->messages % SNAPSHOT_INTERVAL == 0;
+}
+
+// Builds the index and returns how many messages had to be indexed for it.
+static int build_index(TEST_PARAMS, DP_DrawContext *dc)
+{
+    DP_IndexTestCounts counts = {0};
+    DP_Player *player = open_player();
+    if (NOT_NULL_OK(player, "player opened")) {
+        OK(DP_player_index_build(player, dc, count_and_snapshot, NULL,
+                                 &counts),
+           "index built");
+        DP_player_free(player);
+    }
+    return counts.messages;
+}
+
+static DP_Player *open_indexed_player(TEST_PARAMS)
+{
+    DP_Player *player = open_player();
+    if (NOT_NULL_OK(player, "player opened")) {
+        if (OK(DP_player_index_load(player), "index loaded")) {
+            return player;
+        }
+        DP_player_free(player);
+    }
+    return NULL;
+}
+
+// Renders the canvas at the last index entry. Like playback does when jumping
+// to it, the snapshot's history messages get replayed on top of its state.
+static DP_Image *last_snapshot_image(DP_Player *player, DP_DrawContext *dc)
+{
+    if (DP_player_index_entry_count(player) == 0) {
+        return NULL;
+    }
+
+    DP_PlayerIndexEntry entry = DP_player_index_entry_search(
+        player, DP_player_index_message_count(player), false);
+    DP_PlayerIndexEntrySnapshot *snapshot =
+        DP_player_index_entry_load(player, dc, entry);
+    if (!snapshot) {
+        return NULL;
+    }
+
+    DP_CanvasState *snapshot_cs =
+        DP_player_index_entry_snapshot_canvas_state_inc(snapshot);
+    DP_CanvasHistory *ch =
+        DP_canvas_history_new_inc(snapshot_cs, NULL, NULL, false, NULL);
+    DP_canvas_state_decref(snapshot_cs);
+    int count = DP_player_index_entry_snapshot_message_count(snapshot);
+    for (int i = 0; i < count; ++i) {
+        DP_Message *msg =
+            DP_player_index_entry_snapshot_message_at_inc(snapshot, i);
+        if (msg) {
+            if (DP_message_type_command(DP_message_type(msg))) {
+                DP_canvas_history_handle(ch, dc, msg);
+            }
+            DP_message_decref(msg);
+        }
+    }
+    DP_player_index_entry_snapshot_free(snapshot);
+
+    DP_CanvasState *cs = DP_canvas_history_get(ch);
+    DP_Image *img = DP_canvas_state_to_flat_image(
+        cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
+    DP_canvas_state_decref(cs);
+    DP_canvas_history_free(ch);
+    return img;
+}
+
+// Checks the index against one built from scratch for the same recording.
+static void check_index_like_rebuilt(TEST_PARAMS, DP_DrawContext *dc)
+{
+    DP_Player *player = open_indexed_player(TEST_ARGS);
+    if (!player) {
+        return;
+    }
+    unsigned int message_count = DP_player_index_message_count(player);
+    DP_Image *img = last_snapshot_image(player, dc);
+    DP_player_free(player);
+
+    remove(INDEX_PATH);
+    build_index(TEST_ARGS, dc);
+    DP_Player *rebuilt = open_indexed_player(TEST_ARGS);
+    if (rebuilt) {
+        UINT_EQ_OK(message_count, DP_player_index_message_count(rebuilt),
+                   "message count matches rebuilt index");
+        DP_Image *expected = last_snapshot_image(rebuilt, dc);
+        if (NOT_NULL_OK(img, "got last snapshot")
+            && NOT_NULL_OK(expected, "got last rebuilt snapshot")) {
+            IMAGE_EQ_OK(img, expected, "last snapshot matches rebuilt index");
+        }
+        DP_image_free(expected);
+        DP_player_free(rebuilt);
+    }
+    DP_image_free(img);
+}
+
+static void set_index_flags(uint32_t flags)
+{
+    FILE *fp = fopen(INDEX_PATH, "r+b");
+    if (fp) {
+        unsigned char buffer[4] = {
+            DP_uint32_to_uint8(flags & 0xffu),
+            DP_uint32_to_uint8((flags >> 8u) & 0xffu),
+            DP_uint32_to_uint8((flags >> 16u) & 0xffu),
+            DP_uint32_to_uint8((flags >> 24u) & 0xffu),
+        };
+        fseek(fp, INDEX_FLAGS_OFFSET, SEEK_SET);
+        fwrite(buffer, 1, sizeof(buffer), fp);
+        fclose(fp);
+    }
+}
+
+
+static void index_build_and_load(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    remove(INDEX_PATH);
+    write_recording(20, 0xff336699u);
+
+    INT_EQ_OK(build_index(TEST_ARGS, dc), SETUP_MESSAGES + 20,
+              "all messages indexed");
+    DP_Player *player = open_indexed_player(TEST_ARGS);
+    if (player) {
+        UINT_EQ_OK(DP_player_index_message_count(player), SETUP_MESSAGES + 20,
+                   "index message count");
+        OK(DP_player_index_entry_count(player) > 0, "index has entries");
+        DP_player_free(player);
+    }
+
+    DP_draw_context_free(dc);
+}
+
+static void index_resume_grown_recording(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    remove(INDEX_PATH);
+    write_recording(20, 0xff336699u);
+    build_index(TEST_ARGS, dc);
+
+    write_recording(30, 0xff336699u);
+    INT_EQ_OK(build_index(TEST_ARGS, dc), 10,
+              "only new messages indexed when resuming");
+    check_index_like_rebuilt(TEST_ARGS, dc);
+
+    DP_draw_context_free(dc);
+}
+
+static void index_resume_interrupted_build(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    remove(INDEX_PATH);
+    write_recording(20, 0xff336699u);
+    build_index(TEST_ARGS, dc);
+
+    // An interrupted build leaves the index valid up to the last checkpoint,
+    // but never gets to marking it as complete.
+    set_index_flags(0);
+    DP_Player *player = open_player();
+    if (NOT_NULL_OK(player, "player opened")) {
+        NOK(DP_player_index_load(player), "incomplete index not loaded");
+        DP_player_free(player);
+    }
+
+    write_recording(25, 0xff336699u);
+    INT_EQ_OK(build_index(TEST_ARGS, dc), 5,
+              "interrupted index resumed from last checkpoint");
+    check_index_like_rebuilt(TEST_ARGS, dc);
+
+    DP_draw_context_free(dc);
+}
+
+static void index_not_resumed_for_other_recording(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    remove(INDEX_PATH);
+    write_recording(20, 0xff336699u);
+    build_index(TEST_ARGS, dc);
+
+    // Same length and header, but different contents.
+    write_recording(20, 0xffcc8844u);
+    INT_EQ_OK(build_index(TEST_ARGS, dc), SETUP_MESSAGES + 20,
+              "index for changed recording rebuilt from scratch");
+    check_index_like_rebuilt(TEST_ARGS, dc);
+
+    // Same contents as far as they go, but shorter than when indexed.
+    write_recording(10, 0xffcc8844u);
+    INT_EQ_OK(build_index(TEST_ARGS, dc), SETUP_MESSAGES + 10,
+              "index for truncated recording rebuilt from scratch");
+    check_index_like_rebuilt(TEST_ARGS, dc);
+
+    DP_draw_context_free(dc);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(index_build_and_load);
+    REGISTER_TEST(index_resume_grown_recording);
+    REGISTER_TEST(index_resume_interrupted_build);
+    REGISTER_TEST(index_not_resumed_for_other_recording);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpcommon/output.h>
+#include <dpengine/canvas_history.h>
+#include <dpengine/canvas_state.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/image.h>
+#include <dpengine/save.h>
+#include <dpengine/view_mode.h>
+#include <dpmsg/blend_mode.h>
+#include <dpmsg/message.h>
+#include <dptest_engine.h>
+#include <jo_gifx.h>
+#include <math.h>
+
+#define CANVAS_WIDTH  67
+#define CANVAS_HEIGHT 45
+#define FRAME_COUNT   12
+#define FRAMERATE     7
+
+
+static void handle(DP_CanvasHistory *ch, DP_DrawContext *dc, DP_Message *msg)
+{
+    DP_canvas_history_handle(ch, dc, msg);
+    DP_message_decref(msg);
+}
+
+// Four differently colored layers on a track, with key frames spaced out so
+// that some frames repeat and have to be merged into longer delays.
+static DP_CanvasState *make_animation(DP_DrawContext *dc)
+{
+    DP_CanvasHistory *ch = DP_canvas_history_new(NULL, NULL, false, NULL);
+    handle(ch, dc, DP_msg_undo_point_new(1));
+    handle(ch, dc,
+           DP_msg_canvas_resize_new(1, 0, CANVAS_WIDTH, CANVAS_HEIGHT, 0));
+
+    static const uint32_t fills[] = {0xff336699u, 0xffcc8844u, 0xff22aa55u,
+                                     0xff9933ccu};
+    unsigned int seed = 1;
+    for (int i = 0; i < 4; ++i) {
+        uint16_t layer_id = DP_int_to_uint16(0x101 + i);
+        handle(ch, dc,
+               DP_msg_layer_tree_create_new(1, layer_id, 0, 0, fills[i], 0,
+                                            "", 0));
+        // Some rectangles in other colors, so that there's dithering to do.
+        for (int j = 0; j < 8; ++j) {
+            unsigned int r = DP_test_random_next(&seed);
+            uint32_t x = r % CANVAS_WIDTH;
+            uint32_t y = (r >> 8u) % CANVAS_HEIGHT;
+            handle(ch, dc,
+                   DP_msg_fill_rect_new(1, layer_id, DP_BLEND_MODE_NORMAL, x, y,
+                                        17, 13, 0xff000000u | r));
+        }
+    }
+
+    handle(ch, dc,
+           DP_msg_set_metadata_int_new(
+               1, DP_MSG_SET_METADATA_INT_FIELD_FRAME_COUNT, FRAME_COUNT));
+    handle(ch, dc, DP_msg_track_create_new(1, 1, 0, 0, "", 0));
+    static const int key_frames[] = {0, 4, 5, 9};
+    for (int i = 0; i < 4; ++i) {
+        handle(ch, dc,
+               DP_msg_key_frame_set_new(1, 1, DP_int_to_uint16(key_frames[i]),
+                                        DP_int_to_uint16(0x101 + i), 0,
+                                        DP_MSG_KEY_FRAME_SET_SOURCE_LAYER));
+    }
+
+    DP_CanvasState *cs = DP_canvas_history_compare_and_get(ch, NULL, NULL);
+    DP_canvas_history_free(ch);
+    return cs;
+}
+
+static bool write_gif(void *user, const void *buffer, size_t size)
+{
+    return DP_output_write(user, buffer, size);
+}
+
+// Writes the frames one by one with jo_gifx_frame, the way the export worked
+// before it was parallelized.
+static bool save_animation_gif_serial(DP_CanvasState *cs, const char *path)
+{
+    DP_Output *output = DP_file_output_new_from_path(path);
+    if (!output) {
+        return false;
+    }
+
+    DP_Image *img = DP_canvas_state_to_flat_image(
+        cs, DP_FLAT_IMAGE_RENDER_FLAGS, NULL, NULL);
+    jo_gifx_t *gif = jo_gifx_start(write_gif, output, CANVAS_WIDTH,
+                                   CANVAS_HEIGHT, 0, 255,
+                                   (uint32_t *)DP_image_pixels(img));
+    DP_image_free(img);
+
+    DP_ViewModeBuffer vmb;
+    DP_view_mode_buffer_init(&vmb);
+    double centiseconds_per_frame = 100.0 / FRAMERATE;
+    double delay_frac = 0.0;
+    bool ok = true;
+    for (int i = 0; ok && i < FRAME_COUNT; ++i) {
+        int instances = 1;
+        while (i < FRAME_COUNT - 1
+               && DP_canvas_state_same_frame(cs, i, i + 1)) {
+            ++i;
+            ++instances;
+        }
+        DP_ViewModeFilter vmf =
+            DP_view_mode_filter_make_frame_render(&vmb, cs, i);
+        img = DP_canvas_state_to_flat_image(cs, DP_FLAT_IMAGE_RENDER_FLAGS,
+                                            NULL, &vmf);
+        double delay = centiseconds_per_frame * DP_int_to_double(instances);
+        double delay_floored = floor(delay + delay_frac);
+        delay_frac = delay - delay_floored;
+        ok = jo_gifx_frame(write_gif, output, gif,
+                           (uint32_t *)DP_image_pixels(img),
+                           DP_double_to_uint16(delay_floored));
+        DP_image_free(img);
+    }
+    DP_view_mode_buffer_dispose(&vmb);
+
+    ok = jo_gifx_end(write_gif, output, gif) && ok;
+    DP_output_free(output);
+    return ok;
+}
+
+static void save_animation_gif_matches_serial(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_CanvasState *cs = make_animation(dc);
+
+    const char *expected_path = "test/tmp/save_animation_gif_serial.gif";
+    const char *actual_path = "test/tmp/save_animation_gif.gif";
+    OK(save_animation_gif_serial(cs, expected_path), "serial gif written");
+    INT_EQ_OK(DP_save_animation_gif(cs, actual_path, NULL, 0, -1, FRAMERATE,
+                                    NULL, NULL),
+              DP_SAVE_RESULT_SUCCESS, "gif saved");
+    FILE_EQ_OK(actual_path, expected_path, "gif matches serial output");
+
+    DP_canvas_state_decref(cs);
+    DP_draw_context_free(dc);
+}
+
+
+static bool cancel_after_two(void *user, DP_UNUSED double progress)
+{
+    int *calls = user;
+    return ++*calls <= 2;
+}
+
+static void save_animation_gif_cancel(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_CanvasState *cs = make_animation(dc);
+
+    int calls = 0;
+    INT_EQ_OK(DP_save_animation_gif(
+                  cs, "test/tmp/save_animation_gif_cancel.gif", NULL, 0, -1,
+                  FRAMERATE, cancel_after_two, &calls),
+              DP_SAVE_RESULT_CANCEL, "gif export cancelled");
+    INT_EQ_OK(calls, 3, "no progress reported after cancelling");
+
+    DP_canvas_state_decref(cs);
+    DP_draw_context_free(dc);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(save_animation_gif_matches_serial);
+    REGISTER_TEST(save_animation_gif_cancel);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: MIT
+#include <dpcommon/common.h>
+#include <dpcommon/conversions.h>
+#include <dpengine/compress.h>
+#include <dpengine/draw_context.h>
+#include <dpengine/pixels.h>
+#include <dpengine/tile.h>
+#include <dptest_engine.h>
+#include <string.h>
+
+
+static const char *profile_names[] = {"fast", "balanced", "max"};
+
+static_assert(DP_ARRAY_LENGTH(profile_names) == DP_COMPRESS_PROFILE_COUNT,
+              "every profile has a name");
+
+// Opaque pixels with enough structure that the profiles compress differently.
+static void make_pixels(DP_Pixel8 *pixels, unsigned int variant)
+{
+    for (int y = 0; y < DP_TILE_SIZE; ++y) {
+        for (int x = 0; x < DP_TILE_SIZE; ++x) {
+            unsigned int ux = DP_int_to_uint(x);
+            unsigned int uy = DP_int_to_uint(y);
+            pixels[y * DP_TILE_SIZE + x] = (DP_Pixel8){
+                .b = DP_uint_to_uint8((ux * ux + uy * variant) & 0xffu),
+                .g = DP_uint_to_uint8(((ux ^ uy) * 4u) & 0xffu),
+                .r = DP_uint_to_uint8((ux * uy + variant) & 0xffu),
+                .a = 255,
+            };
+        }
+    }
+}
+
+static DP_Tile *make_tile(unsigned int variant)
+{
+    DP_Pixel8 pixels[DP_TILE_LENGTH];
+    make_pixels(pixels, variant);
+    return DP_tile_new_from_pixels8(0, pixels);
+}
+
+static unsigned char *get_malloc_buffer(size_t size, void *user)
+{
+    unsigned char **out = user;
+    *out = DP_malloc(size);
+    return *out;
+}
+
+static size_t compress_tile(DP_Tile *t, DP_CompressProfile profile,
+                            unsigned char **out)
+{
+    DP_Pixel8 pixel_buffer[DP_TILE_LENGTH];
+    return DP_tile_compress(t, pixel_buffer, profile, get_malloc_buffer, out);
+}
+
+// What compressing the tile's pixels directly gives, bypassing any cache.
+static size_t compress_pixels(DP_Tile *t, DP_CompressProfile profile,
+                              unsigned char **out)
+{
+    DP_Pixel8 pixels[DP_TILE_LENGTH];
+    DP_pixels15_to_8(pixels, DP_tile_pixels(t), DP_TILE_LENGTH);
+    return DP_compress_deflate_profile(profile, (const unsigned char *)pixels,
+                                       DP_TILE_COMPRESSED_BYTES,
+                                       get_malloc_buffer, out);
+}
+
+static bool bytes_eq(const unsigned char *a, size_t a_size,
+                     const unsigned char *b, size_t b_size)
+{
+    return a_size == b_size && memcmp(a, b, a_size) == 0;
+}
+
+
+static void compress_profiles_roundtrip(TEST_PARAMS)
+{
+    DP_DrawContext *dc = DP_draw_context_new();
+    DP_Tile *t = make_tile(7);
+
+    for (int i = 0; i < DP_COMPRESS_PROFILE_COUNT; ++i) {
+        const char *name = profile_names[i];
+        unsigned char *data = NULL;
+        size_t size = compress_tile(t, (DP_CompressProfile)i, &data);
+        if (OK(size != 0, "%s profile compressed", name)) {
+            DP_Tile *decompressed = DP_tile_new_from_compressed(dc, 0, data,
+                                                                size);
+            if (NOT_NULL_OK(decompressed, "%s profile decompressed", name)) {
+                OK(memcmp(DP_tile_pixels(decompressed), DP_tile_pixels(t),
+                          DP_TILE_BYTES)
+                       == 0,
+                   "%s profile roundtrip gives the same pixels", name);
+                DP_tile_decref(decompressed);
+            }
+        }
+        DP_free(data);
+    }
+
+    DP_tile_decref(t);
+    DP_draw_context_free(dc);
+}
+
+static void compress_cache_hit(TEST_PARAMS)
+{
+    DP_tile_compress_cache_limit_set(1024 * 1024);
+    DP_Tile *t = make_tile(3);
+
+    unsigned char *first = NULL;
+    size_t first_size = compress_tile(t, DP_COMPRESS_PROFILE_MAX, &first);
+    size_t used = DP_tile_compress_cache_used();
+    UINT_EQ_OK(used, first_size, "compressed data got cached");
+
+    unsigned char *second = NULL;
+    size_t second_size = compress_tile(t, DP_COMPRESS_PROFILE_MAX, &second);
+    OK(bytes_eq(first, first_size, second, second_size),
+       "compressing again gives the same data");
+    UINT_EQ_OK(DP_tile_compress_cache_used(), used,
+               "compressing again doesn't cache anything new");
+
+    // A weaker profile would give different bytes if it compressed anew.
+    unsigned char *fast = NULL;
+    size_t fast_size = compress_tile(t, DP_COMPRESS_PROFILE_FAST, &fast);
+    OK(bytes_eq(first, first_size, fast, fast_size),
+       "max cache is served for the fast profile");
+
+    DP_free(fast);
+    DP_free(second);
+    DP_free(first);
+    DP_tile_decref(t);
+    UINT_EQ_OK(DP_tile_compress_cache_used(), 0, "cache empty after free");
+    DP_tile_compress_cache_limit_set(0);
+}
+
+static void compress_cache_freed_with_last_reference(TEST_PARAMS)
+{
+    DP_tile_compress_cache_limit_set(1024 * 1024);
+    DP_Tile *t = make_tile(5);
+
+    unsigned char *data = NULL;
+    size_t size = compress_tile(t, DP_COMPRESS_PROFILE_MAX, &data);
+    DP_free(data);
+    UINT_EQ_OK(DP_tile_compress_cache_used(), size, "compressed data cached");
+
+    DP_tile_incref(t);
+    DP_tile_decref(t);
+    UINT_EQ_OK(DP_tile_compress_cache_used(), size,
+               "cache kept while the tile is still referenced");
+
+    DP_tile_decref(t);
+    UINT_EQ_OK(DP_tile_compress_cache_used(), 0,
+               "cache freed along with the last reference");
+    DP_tile_compress_cache_limit_set(0);
+}
+
+static void compress_cache_limit(TEST_PARAMS)
+{
+    DP_Tile *a = make_tile(13);
+    DP_Tile *b = make_tile(17);
+    DP_Tile *c = make_tile(19);
+
+    // Figure out the compressed sizes without the cache involved.
+    unsigned char *data = NULL;
+    size_t a_size = compress_pixels(a, DP_COMPRESS_PROFILE_MAX, &data);
+    DP_free(data);
+    size_t b_size = compress_pixels(b, DP_COMPRESS_PROFILE_MAX, &data);
+    DP_free(data);
+
+    // Room for the first tile, but not for the second one on top of it.
+    DP_tile_compress_cache_limit_set(a_size + b_size - 1);
+    compress_tile(a, DP_COMPRESS_PROFILE_MAX, &data);
+    DP_free(data);
+    UINT_EQ_OK(DP_tile_compress_cache_used(), a_size, "first tile cached");
+    compress_tile(b, DP_COMPRESS_PROFILE_MAX, &data);
+    DP_free(data);
+    UINT_EQ_OK(DP_tile_compress_cache_used(), a_size,
+               "second tile not cached beyond the limit");
+
+    // Freeing the first tile makes room for the second one.
+    DP_tile_decref(a);
+    UINT_EQ_OK(DP_tile_compress_cache_used(), 0,
+               "freeing the cached tile frees its data");
+    compress_tile(b, DP_COMPRESS_PROFILE_MAX, &data);
+    DP_free(data);
+    UINT_EQ_OK(DP_tile_compress_cache_used(), b_size,
+               "second tile cached once there's room");
+
+    // A zero limit stops the cache from growing, but keeps what's there.
+    DP_tile_compress_cache_limit_set(0);
+    compress_tile(c, DP_COMPRESS_PROFILE_MAX, &data);
+    DP_free(data);
+    UINT_EQ_OK(DP_tile_compress_cache_used(), b_size,
+               "nothing cached with the cache disabled");
+
+    DP_tile_decref(c);
+    DP_tile_decref(b);
+    UINT_EQ_OK(DP_tile_compress_cache_used(), 0, "cache empty after free");
+}
+
+static void compress_cache_not_served_for_stronger_profile(TEST_PARAMS)
+{
+    DP_tile_compress_cache_limit_set(1024 * 1024);
+    DP_Tile *t = make_tile(11);
+
+    unsigned char *fast = NULL;
+    size_t fast_size = compress_tile(t, DP_COMPRESS_PROFILE_FAST, &fast);
+    size_t used = DP_tile_compress_cache_used();
+    UINT_EQ_OK(used, fast_size, "fast compression got cached");
+
+    unsigned char *expected = NULL;
+    size_t expected_size =
+        compress_pixels(t, DP_COMPRESS_PROFILE_MAX, &expected);
+    NOK(bytes_eq(fast, fast_size, expected, expected_size),
+        "fast and max profiles give different results");
+
+    unsigned char *max = NULL;
+    size_t max_size = compress_tile(t, DP_COMPRESS_PROFILE_MAX, &max);
+    OK(bytes_eq(max, max_size, expected, expected_size),
+       "max profile compresses anew instead of using the fast cache");
+    UINT_EQ_OK(DP_tile_compress_cache_used(), used,
+               "fast cache is not replaced by max result");
+
+    DP_free(max);
+    DP_free(expected);
+    DP_free(fast);
+    DP_tile_decref(t);
+    DP_tile_compress_cache_limit_set(0);
+}
+
+
+static void register_tests(REGISTER_PARAMS)
+{
+    REGISTER_TEST(compress_profiles_roundtrip);
+    REGISTER_TEST(compress_cache_hit);
+    REGISTER_TEST(compress_cache_freed_with_last_reference);
+    REGISTER_TEST(compress_cache_limit);
+    REGISTER_TEST(compress_cache_not_served_for_stronger_profile);
+}
+
+int main(int argc, char **argv)
+{
+    DP_test_main(argc, argv, register_tests, NULL);
+}
@@ -244,9 +244,10 @@ double DP_binary_reader_progress(DP_BinaryReader *reader)
 static void ensure_buffer_size(DP_BinaryReader *reader, size_t required_size)
 {
     if (reader->buffer_size < required_size) {
-        reader->buffer = DP_realloc(
-            reader->buffer,
-            required_size < MIN_BUFFER_SIZE ? MIN_BUFFER_SIZE : required_size);
+        size_t size =
+            required_size < MIN_BUFFER_SIZE ? MIN_BUFFER_SIZE : required_size;
+        reader->buffer = DP_realloc(reader->buffer, size);
+        reader->buffer_size = size;
     }
 }
 
@@ -282,13 +283,10 @@ static DP_BinaryReaderResult read_message_header(DP_BinaryReader *reader,
     }
 }
 
-DP_BinaryReaderResult DP_binary_reader_read_message(DP_BinaryReader *reader,
-                                                    bool decode_opaque,
-                                                    DP_Message **out_msg)
+static DP_BinaryReaderResult read_message(DP_BinaryReader *reader,
+                                          const unsigned char **out_buffer,
+                                          size_t *out_length)
 {
-    DP_ASSERT(reader);
-    DP_ASSERT(out_msg);
-
     size_t body_length;
     DP_BinaryReaderResult result = read_message_header(reader, &body_length);
     if (result != DP_BINARY_READER_SUCCESS) {
@@ -307,8 +305,78 @@ DP_BinaryReaderResult DP_binary_reader_read_message(DP_BinaryReader *reader,
         return DP_BINARY_READER_ERROR_INPUT;
     }
 
-    DP_Message *msg = DP_message_deserialize(
-        reader->buffer, DP_MESSAGE_HEADER_LENGTH + body_length, decode_opaque);
+    *out_buffer = reader->buffer;
+    *out_length = DP_MESSAGE_HEADER_LENGTH + body_length;
+    return DP_BINARY_READER_SUCCESS;
+}
+
+// Mapped inputs can give us the message in place, no need to copy it.
+static DP_BinaryReaderResult view_message(DP_BinaryReader *reader,
+                                          const unsigned char *view,
+                                          size_t available,
+                                          const unsigned char **out_buffer,
+                                          size_t *out_length)
+{
+    if (available == 0) {
+        return DP_BINARY_READER_INPUT_END;
+    }
+    else if (available < DP_MESSAGE_HEADER_LENGTH) {
+        DP_error_set("Tried to read message header of %d bytes, but got %zu",
+                     DP_MESSAGE_HEADER_LENGTH, available);
+        return DP_BINARY_READER_ERROR_INPUT;
+    }
+
+    size_t body_length = DP_read_bigendian_uint16(view);
+    size_t length = DP_MESSAGE_HEADER_LENGTH + body_length;
+    if (available < length) {
+        DP_error_set("Tried to read message body of %zu bytes, but got %zu",
+                     body_length, available - DP_MESSAGE_HEADER_LENGTH);
+        return DP_BINARY_READER_ERROR_INPUT;
+    }
+    else if (!DP_input_seek_by(reader->input, length)) {
+        return DP_BINARY_READER_ERROR_INPUT;
+    }
+
+    reader->input_offset += length;
+    *out_buffer = view;
+    *out_length = length;
+    return DP_BINARY_READER_SUCCESS;
+}
+
+DP_BinaryReaderResult
+DP_binary_reader_view_message(DP_BinaryReader *reader,
+                              const unsigned char **out_buffer,
+                              size_t *out_length)
+{
+    DP_ASSERT(reader);
+    DP_ASSERT(out_buffer);
+    DP_ASSERT(out_length);
+    size_t available;
+    const unsigned char *view = DP_input_view(reader->input, &available);
+    if (view) {
+        return view_message(reader, view, available, out_buffer, out_length);
+    }
+    else {
+        return read_message(reader, out_buffer, out_length);
+    }
+}
+
+DP_BinaryReaderResult DP_binary_reader_read_message(DP_BinaryReader *reader,
+                                                    bool decode_opaque,
+                                                    DP_Message **out_msg)
+{
+    DP_ASSERT(reader);
+    DP_ASSERT(out_msg);
+
+    const unsigned char *buffer;
+    size_t length;
+    DP_BinaryReaderResult result =
+        DP_binary_reader_view_message(reader, &buffer, &length);
+    if (result != DP_BINARY_READER_SUCCESS) {
+        return result;
+    }
+
+    DP_Message *msg = DP_message_deserialize(buffer, length, decode_opaque);
     if (msg) {
         *out_msg = msg;
         return DP_BINARY_READER_SUCCESS;
@@ -323,22 +391,35 @@ int DP_binary_reader_skip_message(DP_BinaryReader *reader, uint8_t *out_type,
 {
     DP_ASSERT(reader);
 
-    size_t body_length;
-    DP_BinaryReaderResult result = read_message_header(reader, &body_length);
-    if (result != DP_BINARY_READER_SUCCESS) {
-        return -1;
+    const unsigned char *buffer;
+    size_t length;
+    size_t available;
+    const unsigned char *view = DP_input_view(reader->input, &available);
+    if (view) {
+        DP_BinaryReaderResult result =
+            view_message(reader, view, available, &buffer, &length);
+        if (result != DP_BINARY_READER_SUCCESS) {
+            return -1;
+        }
     }
-
-    DP_Input *input = reader->input;
-    if (!DP_input_seek_by(input, body_length)) {
-        return -1;
+    else {
+        size_t body_length;
+        DP_BinaryReaderResult result =
+            read_message_header(reader, &body_length);
+        if (result != DP_BINARY_READER_SUCCESS
+            || !DP_input_seek_by(reader->input, body_length)) {
+            return -1;
+        }
+        reader->input_offset += body_length;
+        buffer = reader->buffer;
+        length = DP_MESSAGE_HEADER_LENGTH + body_length;
     }
 
     if (out_type) {
-        *out_type = reader->buffer[2];
+        *out_type = buffer[2];
     }
     if (out_context_id) {
-        *out_context_id = reader->buffer[3];
+        *out_context_id = buffer[3];
     }
-    return DP_size_to_int(DP_MESSAGE_HEADER_LENGTH + body_length);
+    return DP_size_to_int(length);
 }
@@ -57,6 +57,14 @@ bool DP_binary_reader_seek(DP_BinaryReader *reader, size_t offset);
 
 double DP_binary_reader_progress(DP_BinaryReader *reader);
 
+// Gives the serialized message, header included, without deserializing it. If
+// the input supports DP_input_view, the buffer points straight into it and
+// nothing is copied. Either way, it's only valid until the next read.
+DP_BinaryReaderResult
+DP_binary_reader_view_message(DP_BinaryReader *reader,
+                              const unsigned char **out_buffer,
+                              size_t *out_length);
+
 DP_BinaryReaderResult DP_binary_reader_read_message(DP_BinaryReader *reader,
                                                     bool decode_opaque,
                                                     DP_Message **out_msg);
@@ -33,12 +33,26 @@ typedef DP_Message *(*DP_MessageDeserializeFn)(unsigned int context_id,
                                                const unsigned char *buffer,
                                                size_t length);
 
+// Wire encoding of a message, cached so that a message broadcast to many
+// clients only gets serialized once. Uses the framing with the body length in
+// front, the WebSocket framing is the same thing minus those first two bytes.
+// It only sticks around while someone holds it, messages can live for a long
+// time in session history and a second copy of each would add up.
+typedef struct DP_MessageSerialized {
+    size_t length;
+    unsigned char data[];
+} DP_MessageSerialized;
+
 struct DP_Message {
     DP_Atomic refcount;
     uint8_t type;
     uint8_t flags;
     unsigned int context_id;
     const DP_MessageMethods *methods;
+    // Guards the serialized fields below.
+    DP_Atomic serialized_lock;
+    int serialized_holds;
+    DP_MessageSerialized *serialized;
     alignas(DP_max_align_t) unsigned char internal[];
 };
 
@@ -62,6 +76,9 @@ DP_Message *DP_message_new(DP_MessageType type, unsigned int context_id,
     msg->flags = FLAG_NONE;
     msg->context_id = context_id;
     msg->methods = methods;
+    DP_atomic_set(&msg->serialized_lock, 0);
+    msg->serialized_holds = 0;
+    msg->serialized = NULL;
     return msg;
 }
 
@@ -122,6 +139,9 @@ DP_Message *DP_message_new_opaque(DP_MessageType type, unsigned int context_id,
     msg->flags = FLAG_OPAQUE;
     msg->context_id = context_id;
     msg->methods = &opaque_methods;
+    DP_atomic_set(&msg->serialized_lock, 0);
+    msg->serialized_holds = 0;
+    msg->serialized = NULL;
     DP_OpaqueMessage *om = (void *)msg->internal;
     om->length = length;
     if (length != 0) {
@@ -148,6 +168,7 @@ void DP_message_decref(DP_Message *msg)
     DP_ASSERT(msg);
     DP_ASSERT(DP_atomic_get(&msg->refcount) > 0);
     if (DP_atomic_dec(&msg->refcount)) {
+        DP_free(msg->serialized);
         DP_free(msg);
     }
 }
@@ -198,7 +219,16 @@ void DP_message_context_id_set(DP_Message *msg, unsigned int context_id)
 {
     DP_ASSERT(msg);
     DP_ASSERT(DP_atomic_get(&msg->refcount) > 0);
-    msg->context_id = context_id;
+    if (msg->context_id != context_id) {
+        msg->context_id = context_id;
+        // The context id is part of the header, so the cached encoding is
+        // stale now. Modifying a message that's shared would be a bug anyway.
+        DP_atomic_lock(&msg->serialized_lock);
+        DP_MessageSerialized *ms = msg->serialized;
+        msg->serialized = NULL;
+        DP_atomic_unlock(&msg->serialized_lock);
+        DP_free(ms);
+    }
 }
 
 void *DP_message_internal(DP_Message *msg)
@@ -291,6 +321,107 @@ size_t DP_message_serialize(DP_Message *msg, bool write_body_length,
     return written;
 }
 
+static unsigned char *get_serialized_buffer(void *user, size_t length)
+{
+    DP_MessageSerialized **ms = user;
+    *ms = DP_malloc(DP_FLEX_SIZEOF(DP_MessageSerialized, data, length));
+    (*ms)->length = length;
+    return (*ms)->data;
+}
+
+void DP_message_serialized_hold(DP_Message *msg)
+{
+    DP_ASSERT(msg);
+    DP_ASSERT(DP_atomic_get(&msg->refcount) > 0);
+    DP_atomic_lock(&msg->serialized_lock);
+    ++msg->serialized_holds;
+    DP_atomic_unlock(&msg->serialized_lock);
+}
+
+void DP_message_serialized_release(DP_Message *msg)
+{
+    DP_ASSERT(msg);
+    DP_ASSERT(DP_atomic_get(&msg->refcount) > 0);
+    DP_MessageSerialized *ms = NULL;
+    DP_atomic_lock(&msg->serialized_lock);
+    DP_ASSERT(msg->serialized_holds > 0);
+    if (--msg->serialized_holds == 0) {
+        ms = msg->serialized;
+        msg->serialized = NULL;
+    }
+    DP_atomic_unlock(&msg->serialized_lock);
+    DP_free(ms);
+}
+
+bool DP_message_serialized_cached(DP_Message *msg)
+{
+    DP_ASSERT(msg);
+    DP_ASSERT(DP_atomic_get(&msg->refcount) > 0);
+    DP_atomic_lock(&msg->serialized_lock);
+    bool cached = msg->serialized != NULL;
+    DP_atomic_unlock(&msg->serialized_lock);
+    return cached;
+}
+
+static DP_MessageSerialized *get_serialized(DP_Message *msg)
+{
+    DP_ASSERT(msg);
+    DP_ASSERT(DP_atomic_get(&msg->refcount) > 0);
+    DP_atomic_lock(&msg->serialized_lock);
+    DP_ASSERT(msg->serialized_holds > 0);
+    DP_MessageSerialized *ms = msg->serialized;
+    DP_atomic_unlock(&msg->serialized_lock);
+
+    if (!ms) {
+        // Serialize without holding the lock, it's only there to protect
+        // the fields, not to keep other threads waiting.
+        if (DP_message_serialize(msg, true, get_serialized_buffer, &ms) == 0) {
+            DP_free(ms);
+            return NULL;
+        }
+        // If another thread got here first, use its result instead.
+        DP_atomic_lock(&msg->serialized_lock);
+        if (msg->serialized) {
+            DP_free(ms);
+            ms = msg->serialized;
+        }
+        else {
+            msg->serialized = ms;
+        }
+        DP_atomic_unlock(&msg->serialized_lock);
+    }
+    return ms;
+}
+
+const unsigned char *DP_message_serialized(DP_Message *msg,
+                                           size_t *out_length)
+{
+    DP_ASSERT(out_length);
+    DP_MessageSerialized *ms = get_serialized(msg);
+    if (ms) {
+        *out_length = ms->length;
+        return ms->data;
+    }
+    else {
+        return NULL;
+    }
+}
+
+const unsigned char *DP_message_serialized_ws(DP_Message *msg,
+                                              size_t *out_length)
+{
+    DP_ASSERT(out_length);
+    DP_MessageSerialized *ms = get_serialized(msg);
+    if (ms) {
+        size_t offset = DP_MESSAGE_HEADER_LENGTH - DP_MESSAGE_WS_HEADER_LENGTH;
+        *out_length = ms->length - offset;
+        return ms->data + offset;
+    }
+    else {
+        return NULL;
+    }
+}
+
 bool DP_message_write_text(DP_Message *msg, DP_TextWriter *writer)
 {
     DP_ASSERT(msg);
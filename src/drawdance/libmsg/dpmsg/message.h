@@ -81,6 +81,29 @@ size_t DP_message_serialize(DP_Message *msg, bool write_body_length,
                             DP_GetMessageBufferFn get_buffer,
                             void *user) DP_MUST_CHECK;
 
+// Holding a message keeps its serialized form below cached, releasing the
+// last hold frees it again. Senders hold a message from when it's queued until
+// it's written out, so that the encoding is shared between all the clients the
+// message is sent to, without keeping it around for as long as the message.
+void DP_message_serialized_hold(DP_Message *msg);
+void DP_message_serialized_release(DP_Message *msg);
+
+// Whether the serialized form is currently cached. Only really useful to check
+// that a message isn't serialized more than once.
+bool DP_message_serialized_cached(DP_Message *msg);
+
+// Returns the message serialized with the body length in front, as sent over
+// TCP. The result is cached in the message and shared by every caller, so a
+// message sent to many clients is only serialized once. The caller must hold
+// the message, the buffer is valid until that hold is released or the
+// message's context id changes. Returns NULL on error.
+const unsigned char *DP_message_serialized(DP_Message *msg,
+                                           size_t *out_length);
+
+// Same as above, but with WebSocket framing, which omits the body length.
+const unsigned char *DP_message_serialized_ws(DP_Message *msg,
+                                              size_t *out_length);
+
 bool DP_message_write_text(DP_Message *msg,
                            DP_TextWriter *writer) DP_MUST_CHECK;
 
@@ -51,9 +51,11 @@ static DP_TextWriter *open_text_writer(TEST_PARAMS, const char *path)
     return tw;
 }
 
-static DP_BinaryReader *open_binary_reader(TEST_PARAMS, const char *path)
+static DP_BinaryReader *open_binary_reader(TEST_PARAMS, const char *path,
+                                           bool mapped)
 {
-    DP_Input *bi = DP_file_input_new_from_path(path);
+    DP_Input *bi = mapped ? DP_mmap_input_new_from_path(path)
+                          : DP_file_input_new_from_path(path);
     FATAL(NOT_NULL_OK(bi, "got binary input for %s", path));
     DP_BinaryReader *br = DP_binary_reader_new(bi, 0);
     FATAL(NOT_NULL_OK(br, "got binary reader for %s", path));
@@ -100,6 +102,43 @@ static void write_message_text(TEST_PARAMS, DP_Message *msg, DP_TextWriter *tw)
 }
 
 
+static unsigned char *get_serialize_buffer(void *user, size_t length)
+{
+    unsigned char **buffer = user;
+    *buffer = DP_malloc(length);
+    return *buffer;
+}
+
+static void check_serialized(TEST_PARAMS, DP_Message *msg, bool ws)
+{
+    unsigned char *expected = NULL;
+    size_t expected_length =
+        DP_message_serialize(msg, !ws, get_serialize_buffer, &expected);
+    size_t length;
+    DP_message_serialized_hold(msg);
+    const unsigned char *data = ws ? DP_message_serialized_ws(msg, &length)
+                                   : DP_message_serialized(msg, &length);
+    OK(data && length == expected_length
+           && memcmp(data, expected, length) == 0,
+       "cached %s serialization matches", ws ? "websocket" : "tcp");
+    // Further holds share the same cached buffer.
+    DP_message_serialized_hold(msg);
+    size_t held_length;
+    OK(data
+           == (ws ? DP_message_serialized_ws(msg, &held_length)
+                  : DP_message_serialized(msg, &held_length)),
+       "cached %s serialization is shared", ws ? "websocket" : "tcp");
+    DP_message_serialized_release(msg);
+    OK(DP_message_serialized_cached(msg),
+       "cached %s serialization kept while still held",
+       ws ? "websocket" : "tcp");
+    DP_message_serialized_release(msg);
+    NOK(DP_message_serialized_cached(msg),
+        "cached %s serialization freed with the last hold",
+        ws ? "websocket" : "tcp");
+    DP_free(expected);
+}
+
 static bool random_bool(void)
 {
     return rand() % 2 == 0;
@@ -889,14 +928,14 @@ static void write_initial_messages(TEST_PARAMS)
     DP_text_writer_free(tw);
 }
 
-static void read_binary_messages(TEST_PARAMS)
+static void read_binary_messages(TEST_PARAMS, bool mapped,
+                                 const char *binary_path,
+                                 const char *text_path)
 {
     DP_BinaryReader *br =
-        open_binary_reader(TEST_ARGS, "test/tmp/roundtrip_base.dprec");
-    DP_BinaryWriter *bw =
-        open_binary_writer(TEST_ARGS, "test/tmp/roundtrip_from_dprec.dprec");
-    DP_TextWriter *tw =
-        open_text_writer(TEST_ARGS, "test/tmp/roundtrip_from_dprec.dptxt");
+        open_binary_reader(TEST_ARGS, "test/tmp/roundtrip_base.dprec", mapped);
+    DP_BinaryWriter *bw = open_binary_writer(TEST_ARGS, binary_path);
+    DP_TextWriter *tw = open_text_writer(TEST_ARGS, text_path);
 
     write_header(TEST_ARGS, bw, tw,
                  json_value_get_object(DP_binary_reader_header(br)));
@@ -911,6 +950,8 @@ static void read_binary_messages(TEST_PARAMS)
         if (result == DP_BINARY_READER_SUCCESS) {
             write_message_binary(TEST_ARGS, msg, bw);
             write_message_text(TEST_ARGS, msg, tw);
+            check_serialized(TEST_ARGS, msg, false);
+            check_serialized(TEST_ARGS, msg, true);
             DP_message_decref(msg);
         }
         else if (result == DP_BINARY_READER_INPUT_END) {
@@ -1008,7 +1049,12 @@ static void read_text_messages(TEST_PARAMS)
 static void read_write_roundtrip(TEST_PARAMS)
 {
     write_initial_messages(TEST_ARGS);
-    read_binary_messages(TEST_ARGS);
+    read_binary_messages(TEST_ARGS, false,
+                         "test/tmp/roundtrip_from_dprec.dprec",
+                         "test/tmp/roundtrip_from_dprec.dptxt");
+    read_binary_messages(TEST_ARGS, true,
+                         "test/tmp/roundtrip_from_mapped_dprec.dprec",
+                         "test/tmp/roundtrip_from_mapped_dprec.dptxt");
     read_text_messages(TEST_ARGS);
     FILE_EQ_OK("test/tmp/roundtrip_from_dprec.dprec",
                "test/tmp/roundtrip_base.dprec",
@@ -1016,6 +1062,12 @@ static void read_write_roundtrip(TEST_PARAMS)
     FILE_EQ_OK("test/tmp/roundtrip_from_dprec.dptxt",
                "test/tmp/roundtrip_base.dptxt",
                "roundtrip from dprec to dptxt");
+    FILE_EQ_OK("test/tmp/roundtrip_from_mapped_dprec.dprec",
+               "test/tmp/roundtrip_base.dprec",
+               "roundtrip from mapped dprec to dprec");
+    FILE_EQ_OK("test/tmp/roundtrip_from_mapped_dprec.dptxt",
+               "test/tmp/roundtrip_base.dptxt",
+               "roundtrip from mapped dprec to dptxt");
     FILE_EQ_OK("test/tmp/roundtrip_from_dptxt.dprec",
                "test/tmp/roundtrip_base.dprec",
                "roundtrip from dptxt to dprec");
@@ -416,6 +416,12 @@ pub struct DP_InputMethods {
         unsafe extern "C" fn(internal: *mut ::std::os::raw::c_void) -> *mut QIODevice,
     >,
     pub dispose: ::std::option::Option<unsafe extern "C" fn(internal: *mut ::std::os::raw::c_void)>,
+    pub view: ::std::option::Option<
+        unsafe extern "C" fn(
+            internal: *mut ::std::os::raw::c_void,
+            out_size: *mut usize,
+        ) -> *const ::std::os::raw::c_uchar,
+    >,
 }
 #[test]
 fn bindgen_test_layout_DP_InputMethods() {
@@ -423,7 +429,7 @@ fn bindgen_test_layout_DP_InputMethods() {
     let ptr = UNINIT.as_ptr();
     assert_eq!(
         ::std::mem::size_of::<DP_InputMethods>(),
-        64usize,
+        72usize,
         concat!("Size of: ", stringify!(DP_InputMethods))
     );
     assert_eq!(
@@ -511,6 +517,16 @@ fn bindgen_test_layout_DP_InputMethods() {
             stringify!(dispose)
         )
     );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).view) as usize - ptr as usize },
+        64usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(DP_InputMethods),
+            "::",
+            stringify!(view)
+        )
+    );
 }
 pub type DP_InputInitFn = ::std::option::Option<
     unsafe extern "C" fn(
@@ -554,6 +570,12 @@ extern "C" {
 extern "C" {
     pub fn DP_input_qiodevice(input: *mut DP_Input) -> *mut QIODevice;
 }
+extern "C" {
+    pub fn DP_input_view(
+        input: *mut DP_Input,
+        out_size: *mut usize,
+    ) -> *const ::std::os::raw::c_uchar;
+}
 extern "C" {
     pub fn DP_file_input_new_from_stdin(close: bool) -> *mut DP_Input;
 }
@@ -587,6 +609,9 @@ extern "C" {
         size: usize,
     ) -> *mut DP_Input;
 }
+extern "C" {
+    pub fn DP_mmap_input_new_from_path(path: *const ::std::os::raw::c_char) -> *mut DP_Input;
+}
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
 pub struct DP_BufferedInput {
@@ -1572,6 +1597,11 @@ pub struct DP_Message {
 }
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
+pub struct DP_MultidabWorker {
+    _unused: [u8; 0],
+}
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
 pub struct DP_Tile {
     _unused: [u8; 0],
 }
@@ -1680,6 +1710,7 @@ extern "C" {
     pub fn DP_canvas_state_handle_multidab(
         cs: *mut DP_CanvasState,
         dc: *mut DP_DrawContext,
+        mw_or_null: *mut DP_MultidabWorker,
         ucs_or_null: *mut DP_UserCursors,
         count: ::std::os::raw::c_int,
         msgs: *mut *mut DP_Message,
@@ -4756,6 +4787,12 @@ extern "C" {
 extern "C" {
     pub fn DP_canvas_history_want_dump_set(ch: *mut DP_CanvasHistory, want_dump: bool);
 }
+extern "C" {
+    pub fn DP_canvas_history_multidab_worker_set(
+        ch: *mut DP_CanvasHistory,
+        mw_or_null: *mut DP_MultidabWorker,
+    );
+}
 extern "C" {
     pub fn DP_canvas_history_get(ch: *mut DP_CanvasHistory) -> *mut DP_CanvasState;
 }
@@ -6462,6 +6499,9 @@ extern "C" {
         want_canvas_history_dump: bool,
     );
 }
+extern "C" {
+    pub fn DP_paint_engine_dab_costs_calibrate(pe: *mut DP_PaintEngine);
+}
 extern "C" {
     pub fn DP_paint_engine_local_state_reset_image_build(
         pe: *mut DP_PaintEngine,
@@ -7099,10 +7139,15 @@ extern "C" {
 extern "C" {
     pub fn DP_tile_same_pixel(tile_or_null: *mut DP_Tile, out_pixel: *mut DP_Pixel15) -> bool;
 }
+pub const DP_COMPRESS_PROFILE_FAST: DP_CompressProfile = 0;
+pub const DP_COMPRESS_PROFILE_BALANCED: DP_CompressProfile = 1;
+pub const DP_COMPRESS_PROFILE_MAX: DP_CompressProfile = 2;
+pub type DP_CompressProfile = ::std::os::raw::c_uint;
 extern "C" {
     pub fn DP_tile_compress(
         tile: *mut DP_Tile,
         pixel_buffer: *mut DP_Pixel8,
+        profile: DP_CompressProfile,
         get_output_buffer: ::std::option::Option<
             unsafe extern "C" fn(
                 arg1: usize,
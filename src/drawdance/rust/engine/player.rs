@@ -1,8 +1,8 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 use crate::{
     dp_error_anyhow, json_object_get_string, json_value_get_object, msg::Message, DP_Input,
-    DP_Message, DP_Player, DP_PlayerCompatibility, DP_PlayerType, DP_file_input_new_from_path,
-    DP_file_input_new_from_stdin, DP_player_acl_override_set, DP_player_compatibility,
+    DP_Message, DP_Player, DP_PlayerCompatibility, DP_PlayerType, DP_file_input_new_from_stdin,
+    DP_mmap_input_new_from_path, DP_player_acl_override_set, DP_player_compatibility,
     DP_player_compatible, DP_player_free, DP_player_header, DP_player_new, DP_player_step,
     DP_player_type, JSON_Value, DP_PLAYER_RECORDING_END, DP_PLAYER_SUCCESS,
 };
@@ -27,7 +27,7 @@ impl Player {
 
     pub fn new_from_path(ptype: DP_PlayerType, path: String) -> Result<Self> {
         let cpath = CString::new(path)?;
-        let input = unsafe { DP_file_input_new_from_path(cpath.as_ptr()) };
+        let input = unsafe { DP_mmap_input_new_from_path(cpath.as_ptr()) };
         if input.is_null() {
             return Err(dp_error_anyhow());
         }
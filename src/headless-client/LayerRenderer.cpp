@@ -67,6 +67,101 @@ ParsedTitle parse_layer_title(std::string_view title)
 	return ret;
 }
 
+struct LayerContentDiff {
+	DP_LayerContent *lc;
+	DP_LayerContent *prev;
+	int xtiles;
+};
+
+static bool layerContentTileDiffers(void *data, int tileIndex)
+{
+	auto *lcd = static_cast<LayerContentDiff *>(data);
+	int x = tileIndex % lcd->xtiles;
+	int y = tileIndex / lcd->xtiles;
+	return DP_layer_content_tile_at_noinc(lcd->lc, x, y) !=
+		   DP_layer_content_tile_at_noinc(lcd->prev, x, y);
+}
+
+static bool layerPropsSameForRender(DP_LayerProps *lp, DP_LayerProps *prevLp)
+{
+	if(lp == prevLp)
+		return true;
+	size_t len, prevLen;
+	const char *title = DP_layer_props_title(lp, &len);
+	const char *prevTitle = DP_layer_props_title(prevLp, &prevLen);
+	return DP_layer_props_id(lp) == DP_layer_props_id(prevLp) &&
+		   DP_layer_props_opacity(lp) == DP_layer_props_opacity(prevLp) &&
+		   DP_layer_props_blend_mode(lp) == DP_layer_props_blend_mode(prevLp) &&
+		   std::string_view(title, len) == std::string_view(prevTitle, prevLen);
+}
+
+// Returns false if the layer structure or any properties that the renderer
+// looks at changed, in which case every tile has to be considered changed.
+static bool diffLayersForRender(
+	DP_LayerList *ll, DP_LayerPropsList *lpl, DP_LayerList *prevLl,
+	DP_LayerPropsList *prevLpl, DP_CanvasDiff *diff, int xtiles)
+{
+	if(ll == prevLl && lpl == prevLpl)
+		return true;
+
+	int count = DP_layer_list_count(ll);
+	if(count != DP_layer_list_count(prevLl))
+		return false;
+
+	for(int i = 0; i < count; ++i) {
+		DP_LayerListEntry *lle = DP_layer_list_at_noinc(ll, i);
+		DP_LayerListEntry *prevLle = DP_layer_list_at_noinc(prevLl, i);
+		DP_LayerProps *lp = DP_layer_props_list_at_noinc(lpl, i);
+		DP_LayerProps *prevLp = DP_layer_props_list_at_noinc(prevLpl, i);
+		bool group = DP_layer_list_entry_is_group(lle);
+		if(group != DP_layer_list_entry_is_group(prevLle) ||
+		   !layerPropsSameForRender(lp, prevLp))
+			return false;
+
+		size_t len;
+		const char *title = DP_layer_props_title(lp, &len);
+		if(lle == prevLle ||
+		   parse_layer_title(std::string_view(title, len)).shouldSkip())
+			continue;
+
+		if(group) {
+			if(!diffLayersForRender(
+				   DP_layer_group_children_noinc(
+					   DP_layer_list_entry_group_noinc(lle)),
+				   DP_layer_props_children_noinc(lp),
+				   DP_layer_group_children_noinc(
+					   DP_layer_list_entry_group_noinc(prevLle)),
+				   DP_layer_props_children_noinc(prevLp), diff, xtiles))
+				return false;
+		} else {
+			LayerContentDiff lcd{
+				DP_layer_list_entry_content_noinc(lle),
+				DP_layer_list_entry_content_noinc(prevLle), xtiles};
+			DP_canvas_diff_check(diff, layerContentTileDiffers, &lcd);
+		}
+	}
+	return true;
+}
+
+void diffForRender(
+	const drawdance::CanvasState &cs, const drawdance::CanvasState &prev,
+	DP_CanvasDiff *diff)
+{
+	int width = cs.width();
+	int height = cs.height();
+	// Differing sizes mark every tile as changed already.
+	DP_canvas_diff_begin(
+		diff, prev.width(), prev.height(), width, height, false);
+	if(width == prev.width() && height == prev.height() &&
+	   !diffLayersForRender(
+		   DP_canvas_state_layers_noinc(cs.get()),
+		   DP_canvas_state_layer_props_noinc(cs.get()),
+		   DP_canvas_state_layers_noinc(prev.get()),
+		   DP_canvas_state_layer_props_noinc(prev.get()), diff,
+		   DP_tile_size_round_up(width)))
+		DP_canvas_diff_check_all(diff);
+}
+
 std::vector<Layer>
 Layer::fromLayerList(DP_LayerList *ll, DP_LayerPropsList *lpl)
 {
@@ -91,40 +186,6 @@ Layer::fromLayerList(DP_LayerList *ll, DP_LayerPropsList *lpl)
 	return ret;
 }
 
-void BGRA8OffsetImage::crop(DP_UPixel8 trimColor)
-{
-	int x1 = width + 1, x2 = -1, y1 = height + 1, y2 = -1;
-	for(int yp = 0; yp < height; ++yp)
-		for(int xp = 0; xp < width; ++xp)
-			if(pixels[yp * width + xp] != trimColor) {
-				x1 = std::min(x1, xp);
-				x2 = std::max(x2, xp);
-				y1 = std::min(y1, yp);
-				y2 = std::max(y2, yp);
-			}
-	if(x2 == -1) {
-		// Couldn't find any non-trimmed pixels. Delete the entire image.
-		DP_free(pixels);
-		pixels = nullptr;
-		x = y = width = height = 0;
-		return;
-	}
-	int newWidth = (x2 - x1) + 1;
-	int newHeight = (y2 - y1) + 1;
-	DP_UPixel8 *newPixels =
-		(DP_UPixel8 *)DP_malloc(newWidth * newHeight * sizeof(DP_UPixel8));
-	for(int yp = 0; yp < newHeight; ++yp)
-		for(int xp = 0; xp < newWidth; ++xp)
-			newPixels[yp * newWidth + xp] =
-				pixels[(yp + y1) * width + (xp + x1)];
-	DP_free(pixels);
-	pixels = newPixels;
-	x = x1;
-	y = y1;
-	width = newWidth;
-	height = newHeight;
-}
-
 void BGRA8OffsetImage::copyFrom(
 	const BGRA8OffsetImage &other, int offsetX, int offsetY)
 {
@@ -163,8 +224,80 @@ std::vector<char> BGRA8OffsetImage::toPng() const
 	return ret;
 }
 
-LayerRenderer::LayerRenderer(drawdance::CanvasState cs)
+LayerRenderCache::~LayerRenderCache()
+{
+	for(Entry &entry : m_entries)
+		freeEntry(entry);
+}
+
+bool LayerRenderCache::restore(Layer &layer)
+{
+	DP_LayerGroup *lg = layer.isGroup() ? layer.group() : nullptr;
+	for(Entry &entry : m_entries) {
+		if(entry.lc == layer.m_lc && entry.lg == lg && entry.lp == layer.m_lp) {
+			entry.used = true;
+			// Clipping copies tiles before changing them, so these can share
+			// their tiles with the cached output.
+			if(entry.rendered)
+				layer.m_renderedLayer =
+					DP_transient_layer_content_new(entry.rendered);
+			if(entry.exclusion)
+				layer.m_exclusionMask =
+					DP_transient_layer_content_new(entry.exclusion);
+			return true;
+		}
+	}
+	return false;
+}
+
+static DP_LayerContent *persistShared(DP_TransientLayerContent *&tlc)
+{
+	if(!tlc)
+		return nullptr;
+	DP_LayerContent *lc = DP_transient_layer_content_persist(tlc);
+	tlc = DP_transient_layer_content_new(lc);
+	return lc;
+}
+
+void LayerRenderCache::store(Layer &layer)
+{
+	bool group = layer.isGroup();
+	m_entries.push_back({
+		group ? nullptr : DP_layer_content_incref(layer.m_lc),
+		group ? DP_layer_group_incref(layer.group()) : nullptr,
+		DP_layer_props_incref(layer.m_lp),
+		persistShared(layer.m_renderedLayer),
+		persistShared(layer.m_exclusionMask),
+		true,
+	});
+}
+
+void LayerRenderCache::evictUnused()
+{
+	std::erase_if(m_entries, [](Entry &entry) {
+		if(entry.used) {
+			entry.used = false;
+			return false;
+		} else {
+			freeEntry(entry);
+			return true;
+		}
+	});
+}
+
+void LayerRenderCache::freeEntry(Entry &entry)
+{
+	DP_layer_content_decref_nullable(entry.lc);
+	DP_layer_group_decref_nullable(entry.lg);
+	DP_layer_props_decref(entry.lp);
+	DP_layer_content_decref_nullable(entry.rendered);
+	DP_layer_content_decref_nullable(entry.exclusion);
+}
+
+LayerRenderer::LayerRenderer(
+	drawdance::CanvasState cs, LayerRenderCache *cache)
 	: m_associatedCanvasState(std::move(cs))
+	, m_cache(cache)
 {
 	width = m_associatedCanvasState.width();
 	height = m_associatedCanvasState.height();
@@ -188,15 +321,28 @@ void LayerRenderer::clipLayer(
 	if(!layer || !mask)
 		return;
 	for(auto tile : ActiveTileView(mask)) {
-		DP_TransientTile *tt =
+		DP_Tile *t =
 			DP_transient_layer_content_tile_at_noinc(layer, tile.x(), tile.y());
-		if(!tt)
+		if(!t)
 			continue;
-		DP_Pixel15 *mask_pixels = DP_transient_tile_pixels(tile.get());
-		DP_Pixel15 *layer_pixels = DP_transient_tile_pixels(tt);
+		// Tiles may be shared with the render cache or an exclusion snapshot,
+		// so only get a copy to write to if something actually gets clipped.
+		const DP_Pixel15 *mask_pixels = DP_tile_pixels(tile.get());
+		const DP_Pixel15 *pixels = DP_tile_pixels(t);
+		DP_Pixel15 *layer_pixels = nullptr;
 		for(int i = 0; i < DP_TILE_LENGTH; ++i) {
-			if(mask_pixels[i].a > DP_BIT15 / 2)
+			if(mask_pixels[i].a > DP_BIT15 / 2 &&
+			   !DP_pixel15_equal(pixels[i], DP_pixel15_zero())) {
+				if(!layer_pixels) {
+					if(!DP_tile_transient(t)) {
+						t = DP_transient_tile_new(t, 0);
+						DP_transient_layer_content_transient_tile_at_set_noinc(
+							layer, tile.x(), tile.y(), t);
+					}
+					layer_pixels = DP_transient_tile_pixels(t);
+				}
 				layer_pixels[i] = DP_pixel15_zero();
+			}
 		}
 	}
 }
@@ -247,22 +393,73 @@ void LayerRenderer::renderTopLevelLayer(Layer &layer)
 		thresholdAlpha(layer.m_exclusionMask, DP_BIT15 / 2);
 }
 
-void LayerRenderer::clipPrevious(int upTo, DP_TransientLayerContent *mask)
+void LayerRenderer::renderTopLevelLayerCached(Layer &layer)
 {
-	for(int i = 0; i <= upTo; ++i) {
-		if(!m_rootLayers[i].m_renderedLayer)
-			continue;
+	if(!m_cache) {
+		renderTopLevelLayer(layer);
+	} else if(!m_cache->restore(layer)) {
+		renderTopLevelLayer(layer);
+		m_cache->store(layer);
+	}
+}
+
+DP_LayerContent *LayerRenderer::snapshotFullExclusion()
+{
+	// Persisting shares the tiles, they only get copied when changed later.
+	return persistShared(m_fullImage.m_exclusionMask);
+}
+
+void LayerRenderer::clipRootLayers(
+	std::span<DP_LayerContent *> exclusionSnapshots)
+{
+	// Each root layer gets clipped by the full exclusion mask as it was after
+	// rendering the layer itself and every one after it. Instead of clipping
+	// all previous layers at every step, which is quadratic in the number of
+	// layers, build the union of those masks going backwards and clip once.
+	// Tiles that are the same as in the snapshot after are already included.
+	DP_TransientLayerContent *mask =
+		DP_transient_layer_content_new_init(width, height, nullptr);
+	int xtiles = DP_tile_size_round_up(width);
+	int ytiles = DP_tile_size_round_up(height);
+	for(size_t i = exclusionSnapshots.size(); i-- > 0;) {
+		DP_LayerContent *snapshot = exclusionSnapshots[i];
+		DP_LayerContent *after = i + 1 < exclusionSnapshots.size()
+									 ? exclusionSnapshots[i + 1]
+									 : nullptr;
+		for(int y = 0; y < ytiles; ++y) {
+			for(int x = 0; x < xtiles; ++x) {
+				DP_Tile *t = DP_layer_content_tile_at_noinc(snapshot, x, y);
+				if(!t || (after && DP_layer_content_tile_at_noinc(
+									   after, x, y) == t))
+					continue;
+				DP_TransientTile *mtt =
+					DP_transient_layer_content_tile_at_noinc(mask, x, y);
+				if(!mtt) {
+					mtt = DP_transient_tile_new_blank(0);
+					DP_transient_layer_content_transient_tile_at_set_noinc(
+						mask, x, y, mtt);
+				}
+				const DP_Pixel15 *pixels = DP_tile_pixels(t);
+				DP_Pixel15 *mask_pixels = DP_transient_tile_pixels(mtt);
+				for(int j = 0; j < DP_TILE_LENGTH; ++j) {
+					if(pixels[j].a > DP_BIT15 / 2)
+						mask_pixels[j] = pixels[j];
+				}
+			}
+		}
 		clipLayer(m_rootLayers[i].m_renderedLayer, mask);
 	}
+	DP_transient_layer_content_decref(mask);
 }
 
 void LayerRenderer::render()
 {
 	m_fullImage.getOrCreateRenderedTLC(width, height);
 	m_fullImage.getOrCreateExclusionTLC(width, height);
-	int i = 0;
+	std::vector<DP_LayerContent *> exclusionSnapshots;
+	exclusionSnapshots.reserve(m_rootLayers.size());
 	for(auto &layer : m_rootLayers) {
-		renderTopLevelLayer(layer);
+		renderTopLevelLayerCached(layer);
 		if(layer.parsedTitle().is_exported) {
 			if(layer.m_renderedLayer)
 				DP_transient_layer_content_merge(
@@ -276,17 +473,20 @@ void LayerRenderer::render()
 				clipLayer(
 					m_fullImage.m_renderedLayer, m_fullImage.m_exclusionMask);
 			}
-			clipPrevious(i, m_fullImage.m_exclusionMask);
 		} else {
 			if(layer.m_exclusionMask)
 				DP_transient_layer_content_merge(
 					m_fullImage.m_exclusionMask, 0, layer.m_exclusionMask,
 					DP_BIT15, DP_BLEND_MODE_NORMAL, false);
 			clipLayer(m_fullImage.m_renderedLayer, m_fullImage.m_exclusionMask);
-			clipPrevious(i, m_fullImage.m_exclusionMask);
 		}
-		++i;
+		exclusionSnapshots.push_back(snapshotFullExclusion());
 	}
+	clipRootLayers(exclusionSnapshots);
+	for(DP_LayerContent *snapshot : exclusionSnapshots)
+		DP_layer_content_decref(snapshot);
+	if(m_cache)
+		m_cache->evictUnused();
 }
 
 BGRA8OffsetImage LayerRenderer::toPixels(
@@ -307,3 +507,26 @@ BGRA8OffsetImage LayerRenderer::toPixels(
 		::palettize(std::span<DP_UPixel8>(pixels, w * h), palette);
 	return {pixels, x, y, w, h};
 }
+
+std::vector<DP_UPixel8> LayerRenderer::tilesToPixels(
+	DP_TransientLayerContent *tlc, std::span<const int> tileIndexes,
+	std::span<DP_UPixel8> palette) const
+{
+	// Convert everything first so that palettizing happens in one go.
+	std::vector<DP_UPixel8> pixels(tileIndexes.size() * DP_TILE_LENGTH);
+	int xtiles = DP_tile_size_round_up(width);
+	DP_UPixel8 *dst = pixels.data();
+	for(int tileIndex : tileIndexes) {
+		DP_Tile *t = DP_transient_layer_content_tile_at_noinc(
+			tlc, tileIndex % xtiles, tileIndex / xtiles);
+		if(t) {
+			const DP_Pixel15 *src = DP_tile_pixels(t);
+			for(int i = 0; i < DP_TILE_LENGTH; ++i)
+				dst[i] = DP_upixel15_to_8(DP_pixel15_unpremultiply(src[i]));
+		}
+		dst += DP_TILE_LENGTH;
+	}
+	if(!palette.empty())
+		::palettize(pixels, palette);
+	return pixels;
+}
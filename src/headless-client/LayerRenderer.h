@@ -8,6 +8,7 @@
 #include <string>
 #include <vector>
 extern "C" {
+#include <dpengine/canvas_diff.h>
 #include <dpengine/layer_group.h>
 #include <dpengine/layer_list.h>
 #include <dpengine/layer_props.h>
@@ -29,6 +30,13 @@ struct ParsedTitle {
 
 ParsedTitle parse_layer_title(std::string_view title);
 
+/// Marks the tiles whose rendered result may differ between the two canvas
+/// states in `diff`. Unlike `DP_canvas_state_diff`, this also looks at hidden
+/// layers and layer titles, since the renderer pays attention to those.
+void diffForRender(
+	const drawdance::CanvasState &cs, const drawdance::CanvasState &prev,
+	DP_CanvasDiff *diff);
+
 struct Layer {
 	Layer() = default;
 
@@ -99,6 +107,11 @@ struct Layer {
 
 	bool isGroup() const { return DP_layer_list_entry_is_group(m_lle); }
 
+	DP_LayerGroup *group() const
+	{
+		return DP_layer_list_entry_group_noinc(m_lle);
+	}
+
 	uint16_t opacity() const { return DP_layer_props_opacity(m_lp); }
 
 	int blendMode() const { return DP_layer_props_blend_mode(m_lp); }
@@ -185,7 +198,6 @@ struct BGRA8OffsetImage {
 	size_t sizeInPixels() const { return width * height; }
 	size_t sizeInBytes() const { return sizeInPixels() * sizeof(DP_UPixel8); }
 
-	void crop(DP_UPixel8 trimColor);
 	void
 	copyFrom(const BGRA8OffsetImage &other, int offsetX = 0, int offsetY = 0);
 	std::vector<char> toPng() const;
@@ -197,8 +209,42 @@ struct BGRA8OffsetImage {
 	int height = 0;
 };
 
+/// Keeps the thresholded output of top-level layers around between renders.
+/// Layer contents, groups and props are immutable, so a layer made up of the
+/// same objects as in the previous render has the same output. Entries that a
+/// render doesn't use are dropped at the end of it.
+class LayerRenderCache {
+public:
+	LayerRenderCache() = default;
+	LayerRenderCache(const LayerRenderCache &) = delete;
+	LayerRenderCache &operator=(const LayerRenderCache &) = delete;
+	~LayerRenderCache();
+
+private:
+	friend struct LayerRenderer;
+
+	struct Entry {
+		// The key, holding a reference so that the pointers stay unique.
+		DP_LayerContent *lc;
+		DP_LayerGroup *lg;
+		DP_LayerProps *lp;
+		// Rendered output, either may be null.
+		DP_LayerContent *rendered;
+		DP_LayerContent *exclusion;
+		bool used;
+	};
+
+	bool restore(Layer &layer);
+	void store(Layer &layer);
+	void evictUnused();
+	static void freeEntry(Entry &entry);
+
+	std::vector<Entry> m_entries;
+};
+
 struct LayerRenderer {
-	explicit LayerRenderer(drawdance::CanvasState cs);
+	explicit LayerRenderer(
+		drawdance::CanvasState cs, LayerRenderCache *cache = nullptr);
 	LayerRenderer(LayerRenderer &&) noexcept = default;
 	LayerRenderer(const LayerRenderer &) = delete;
 	LayerRenderer &operator=(LayerRenderer &&) noexcept = default;
@@ -213,7 +259,11 @@ struct LayerRenderer {
 
 	void renderTopLevelLayer(Layer &layer);
 
-	void clipPrevious(int upTo, DP_TransientLayerContent *mask);
+	void renderTopLevelLayerCached(Layer &layer);
+
+	DP_LayerContent *snapshotFullExclusion();
+
+	void clipRootLayers(std::span<DP_LayerContent *> exclusionSnapshots);
 
 	void render();
 
@@ -221,8 +271,16 @@ struct LayerRenderer {
 		DP_TransientLayerContent *tlc, bool crop,
 		std::span<DP_UPixel8> palette) const;
 
+	/// Like `toPixels`, but only for the given tiles. The pixels of each tile
+	/// are returned one tile after another. Pixels of tiles on the edge of the
+	/// canvas that lie outside of it are meaningless and should be ignored.
+	std::vector<DP_UPixel8> tilesToPixels(
+		DP_TransientLayerContent *tlc, std::span<const int> tileIndexes,
+		std::span<DP_UPixel8> palette) const;
+
 	/// Keep the layer objects associated with this CanvasState live.
 	drawdance::CanvasState m_associatedCanvasState;
+	LayerRenderCache *m_cache;
 	int width;
 	int height;
 	std::vector<Layer> m_rootLayers;
@@ -15,8 +15,8 @@ PaintEngine::PaintEngine()
 	: m_snapshotQueue(20, 2000)
 	, m_paintEngine(
 		  m_aclState, m_snapshotQueue, false, false, QColor(), QColor(),
-		  PaintEngine::onRenderTile, PaintEngine::onRenderUnlock,
-		  PaintEngine::onRenderResize, this, nullptr, this,
+		  // No renderer, we only need the canvas state, not pixels.
+		  nullptr, nullptr, nullptr, nullptr, nullptr, this,
 		  PaintEngine::onPlayback, PaintEngine::onDumpPlayback, this,
 		  drawdance::CanvasState::null(), PaintEngine::onSyncCanvasState, this)
 {
@@ -68,12 +68,6 @@ void PaintEngine::onSyncCanvasState(void *user, DP_CanvasState *cs)
 	fn(drawdance::CanvasState::noinc(cs));
 }
 
-void PaintEngine::onRenderTile(void *, int, int, DP_Pixel8 *) {}
-
-void PaintEngine::onRenderUnlock(void *) {}
-
-void PaintEngine::onRenderResize(void *, int, int, int, int, int, int) {}
-
 void PaintEngine::onPlayback(void *, long long int) {}
 
 void PaintEngine::onDumpPlayback(
@@ -22,12 +22,6 @@ public:
 
 	// These are not actually used, but need to exist to pass to the underlying
 	// drawdance paint engine.
-	static void
-	onRenderTile(void *user, int tileX, int tileY, DP_Pixel8 *pixels);
-	static void onRenderUnlock(void *user);
-	static void onRenderResize(
-		void *user, int width, int height, int prevWidth, int prevHeight,
-		int offsetX, int offsetY);
 	static void onPlayback(void *user, long long position);
 	static void onDumpPlayback(
 		void *user, long long position, DP_CanvasHistorySnapshot *chs);
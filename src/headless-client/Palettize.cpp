@@ -1,8 +1,14 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "Palettize.h"
+#include <QtConcurrent/QtConcurrent>
 #include <algorithm>
-#include <execution>
+#include <array>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 struct Lab {
@@ -22,16 +28,21 @@ float sRgbGamaToLinear(float c)
 	return .04045f < c ? powf((c + .055f) / 1.055f, 2.4f) : c / 12.92f;
 }
 
-RGB sRgbGamaToLinear(RGB p)
+// Channels only ever come in as bytes, so the linearization can be looked up
+// instead of calling powf three times for every color.
+static const std::array<float, 256> &sRgbGamaToLinearTable()
 {
-	return {
-		sRgbGamaToLinear(p.r), sRgbGamaToLinear(p.g), sRgbGamaToLinear(p.b)};
+	static const std::array<float, 256> table = [] {
+		std::array<float, 256> t;
+		for(int i = 0; i < 256; ++i)
+			t[i] = sRgbGamaToLinear(i / 255.f);
+		return t;
+	}();
+	return table;
 }
 
-Lab srgbToOklab(RGB c)
+Lab linearToOklab(RGB c)
 {
-	c = sRgbGamaToLinear(c);
-
 	float l = 0.4122214708f * c.r + 0.5363325363f * c.g + 0.0514459929f * c.b;
 	float m = 0.2119034982f * c.r + 0.6806995451f * c.g + 0.1073969566f * c.b;
 	float s = 0.0883024619f * c.r + 0.2817188376f * c.g + 0.6299787005f * c.b;
@@ -47,9 +58,11 @@ Lab srgbToOklab(RGB c)
 	};
 }
 
-RGB DP_UPixel8ToRGB(DP_UPixel8 c)
+Lab DP_UPixel8ToOklab(DP_UPixel8 c)
 {
-	return {c.bytes.r / 255.f, c.bytes.g / 255.f, c.bytes.b / 255.f};
+	const std::array<float, 256> &table = sRgbGamaToLinearTable();
+	return linearToOklab(
+		{table[c.bytes.r], table[c.bytes.g], table[c.bytes.b]});
 }
 
 DP_UPixel8 makeDP_UPixel8(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
@@ -57,50 +70,197 @@ DP_UPixel8 makeDP_UPixel8(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 	return DP_UPixel8{.bytes = {.b = b, .g = g, .r = r, .a = a}};
 }
 
-// This reduces the contribution of luminance because generally hue matters a
-// lot more for pixel art. This is enough to get a greyscale gradient to only
-// use greyscale colors in the 2023 r/place palette.
-float squaredAdjustedDist(Lab a, Lab b)
+namespace {
+
+// Palette in Oklab, stored as separate arrays so that the distance loop over
+// the entries can be vectorized by the compiler.
+struct PaletteOklab {
+	explicit PaletteOklab(std::span<DP_UPixel8> palette)
+	{
+		for(const auto &paletteEntry : palette) {
+			// Oklab handles (0, 0, 0) poorly, considering it much farther away
+			// from nearby greyscale colors. Here we pretend that it's (1, 1, 1)
+			// instead, which largely fixes this issue.
+			Lab lab = paletteEntry == makeDP_UPixel8(0, 0, 0, 255)
+						  ? DP_UPixel8ToOklab(makeDP_UPixel8(1, 1, 1, 255))
+						  : DP_UPixel8ToOklab(paletteEntry);
+			L.push_back(lab.L);
+			a.push_back(lab.a);
+			b.push_back(lab.b);
+		}
+		dist.resize(L.size());
+	}
+
+	// This reduces the contribution of luminance because generally hue matters
+	// a lot more for pixel art. This is enough to get a greyscale gradient to
+	// only use greyscale colors in the 2023 r/place palette.
+	size_t nearest(Lab okl)
+	{
+		size_t count = dist.size();
+		for(size_t i = 0; i < count; ++i) {
+			float dL = (okl.L - L[i]) / 1.25f;
+			float da = okl.a - a[i];
+			float db = okl.b - b[i];
+			dist[i] = dL * dL + da * da + db * db;
+		}
+		float best = std::numeric_limits<float>::max();
+		size_t bestIndex = 0;
+		for(size_t i = 0; i < count; ++i) {
+			if(dist[i] < best) {
+				best = dist[i];
+				bestIndex = i;
+			}
+		}
+		return bestIndex;
+	}
+
+	std::vector<float> L;
+	std::vector<float> a;
+	std::vector<float> b;
+	std::vector<float> dist;
+};
+
+using ColorMap = std::unordered_map<uint32_t, uint32_t>;
+
+// Colors already mapped to the palette, kept between calls since the same
+// palette gets used for every render. Replaced rather than modified, so that
+// lookups don't need to lock.
+struct PaletteMemo {
+	std::vector<DP_UPixel8> palette;
+	ColorMap colors;
+};
+
+constexpr size_t MAX_MEMO_SIZE = 1 << 20;
+constexpr size_t PIXELS_PER_CHUNK = 1 << 16;
+constexpr size_t COLORS_PER_CHUNK = 1 << 10;
+
+std::mutex memoMutex;
+std::shared_ptr<const PaletteMemo> memo;
+
+std::shared_ptr<const PaletteMemo> getMemo(std::span<DP_UPixel8> palette)
+{
+	std::lock_guard<std::mutex> lock(memoMutex);
+	if(!memo || !std::ranges::equal(memo->palette, palette)) {
+		memo = std::make_shared<const PaletteMemo>(PaletteMemo{
+			std::vector<DP_UPixel8>(palette.begin(), palette.end()), {}});
+	}
+	return memo;
+}
+
+void putMemo(std::shared_ptr<const PaletteMemo> newMemo)
 {
-	return std::powf((a.L - b.L) / 1.25f, 2) + std::powf(a.a - b.a, 2) +
-		   std::powf(a.b - b.b, 2);
+	std::lock_guard<std::mutex> lock(memoMutex);
+	if(!memo || memo->palette == newMemo->palette)
+		memo = std::move(newMemo);
+}
+
+// Runs the function for each chunk of the given size on the global thread
+// pool, the last chunk may be smaller.
+template <class Func>
+void forEachChunk(size_t count, size_t chunkSize, Func f)
+{
+	std::vector<size_t> starts;
+	for(size_t start = 0; start < count; start += chunkSize)
+		starts.push_back(start);
+	QtConcurrent::blockingMap(starts, [&](size_t start) {
+		f(start, std::min(count, start + chunkSize));
+	});
+}
+
+bool isTransparent(DP_UPixel8 pixel)
+{
+	return pixel.bytes.a <= 127;
+}
+
 }
 
 void palettize(std::span<DP_UPixel8> pixels, std::span<DP_UPixel8> palette)
 {
-	std::vector<Lab> paletteOklab;
-	for(const auto &paletteEntry : palette) {
-		// Oklab handles (0, 0, 0) poorly, considering it much farther away from
-		// nearby greyscale colors. Here we pretend that it's (1, 1, 1) instead,
-		// which largely fixes this issue.
-		if(paletteEntry == makeDP_UPixel8(0, 0, 0, 255))
-			paletteOklab.push_back(
-				srgbToOklab(DP_UPixel8ToRGB(makeDP_UPixel8(1, 1, 1, 255))));
-		else
-			paletteOklab.push_back(srgbToOklab(DP_UPixel8ToRGB(paletteEntry)));
-	}
+	if(pixels.empty() || palette.empty())
+		return;
+
+	std::shared_ptr<const PaletteMemo> currentMemo = getMemo(palette);
+	const ColorMap &known = currentMemo->colors;
 
-	// TODO: Not all standard libraries have a parallel implementation of the
-	//       parallel algorithms yet. This should use something else if the
-	//       perf starts to matter.
-	std::transform(
-		std::execution::par_unseq, pixels.begin(), pixels.end(), pixels.begin(),
-		[&](DP_UPixel8 pixel) noexcept {
-			if(pixel.bytes.a <= 127)
-				return DP_UPixel8{.color = 0};
-			for(auto paletteEntry : palette)
-				if(pixel == paletteEntry)
-					return pixel;
-			Lab okl = srgbToOklab(DP_UPixel8ToRGB(pixel));
-			float best = std::numeric_limits<float>::max();
-			size_t bestIndex = 0;
-			for(size_t i = 0; i < paletteOklab.size(); ++i) {
-				float dist = squaredAdjustedDist(okl, paletteOklab[i]);
-				if(dist < best) {
-					best = dist;
-					bestIndex = i;
+	// Find the colors that haven't been mapped yet. Canvases usually have few
+	// distinct colors and long runs of the same one, so this is quick.
+	size_t pixelCount = pixels.size();
+	std::vector<std::unordered_set<uint32_t>> chunkMisses(
+		(pixelCount + PIXELS_PER_CHUNK - 1) / PIXELS_PER_CHUNK);
+	auto findMisses = [&](size_t start, size_t end) {
+		std::unordered_set<uint32_t> &misses =
+			chunkMisses[start / PIXELS_PER_CHUNK];
+		uint32_t last = 0;
+		for(size_t i = start; i < end; ++i) {
+			DP_UPixel8 pixel = pixels[i];
+			if(isTransparent(pixel) || (i != start && pixel.color == last))
+				continue;
+			last = pixel.color;
+			if(!known.contains(pixel.color))
+				misses.insert(pixel.color);
+		}
+	};
+	forEachChunk(pixelCount, PIXELS_PER_CHUNK, findMisses);
+
+	std::unordered_set<uint32_t> missSet;
+	for(auto &misses : chunkMisses)
+		missSet.merge(misses);
+
+	if(!missSet.empty()) {
+		std::vector<uint32_t> missing(missSet.begin(), missSet.end());
+		std::vector<uint32_t> mapped(missing.size());
+		PaletteOklab paletteOklab(palette);
+		auto mapMisses = [&](size_t start, size_t end) {
+			PaletteOklab chunkPaletteOklab = paletteOklab;
+			for(size_t i = start; i < end; ++i) {
+				DP_UPixel8 pixel{.color = missing[i]};
+				if(std::ranges::find(palette, pixel) == palette.end()) {
+					Lab okl = DP_UPixel8ToOklab(pixel);
+					mapped[i] = palette[chunkPaletteOklab.nearest(okl)].color;
+				} else {
+					mapped[i] = pixel.color;
 				}
 			}
-			return palette[bestIndex];
-		});
+		};
+		forEachChunk(missing.size(), COLORS_PER_CHUNK, mapMisses);
+
+		// This image needs all of its colors mapped, no matter how many.
+		auto newMemo = std::make_shared<PaletteMemo>();
+		newMemo->palette = currentMemo->palette;
+		newMemo->colors = known;
+		for(size_t i = 0; i < missing.size(); ++i)
+			newMemo->colors.emplace(missing[i], mapped[i]);
+
+		// Only the memo kept for the next image is limited. If it would grow
+		// too large, start over with just the colors of this one.
+		if(newMemo->colors.size() <= MAX_MEMO_SIZE) {
+			putMemo(newMemo);
+		} else if(missing.size() <= MAX_MEMO_SIZE) {
+			auto nextMemo = std::make_shared<PaletteMemo>();
+			nextMemo->palette = newMemo->palette;
+			for(size_t i = 0; i < missing.size(); ++i)
+				nextMemo->colors.emplace(missing[i], mapped[i]);
+			putMemo(std::move(nextMemo));
+		}
+		currentMemo = std::move(newMemo);
+	}
+
+	const ColorMap &colors = currentMemo->colors;
+	auto mapPixels = [&](size_t start, size_t end) {
+		uint32_t lastIn = 0;
+		uint32_t lastOut = 0;
+		for(size_t i = start; i < end; ++i) {
+			DP_UPixel8 &pixel = pixels[i];
+			if(isTransparent(pixel)) {
+				pixel.color = 0;
+			} else if(i != start && pixel.color == lastIn) {
+				pixel.color = lastOut;
+			} else {
+				lastIn = pixel.color;
+				lastOut = colors.at(pixel.color);
+				pixel.color = lastOut;
+			}
+		}
+	};
+	forEachChunk(pixelCount, PIXELS_PER_CHUNK, mapPixels);
 }
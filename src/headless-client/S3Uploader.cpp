@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "S3Uploader.h"
+#include <QCoroSignal>
+#include <QCoroTimer>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QMessageAuthenticationCode>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <chrono>
+#include <iostream>
+#include <memory>
+
+static QByteArray sha256Hex(const QByteArray &data)
+{
+	return QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+}
+
+static QByteArray hmacSha256(const QByteArray &key, const QByteArray &message)
+{
+	return QMessageAuthenticationCode::hash(
+		message, key, QCryptographicHash::Sha256);
+}
+
+S3Uploader::S3Uploader(
+	const QUrl &url, QString bucket, QString region, int maxConcurrentUploads,
+	QObject *parent)
+	: QObject(parent)
+	, m_nam(new QNetworkAccessManager(this))
+	, m_endpoint(url.adjusted(QUrl::RemoveUserInfo | QUrl::RemovePath))
+	, m_pathPrefix(url.path(QUrl::FullyEncoded).toUtf8())
+	, m_accessKeyId(url.userName().toUtf8())
+	, m_secretAccessKey(url.password().toUtf8())
+	, m_bucket(std::move(bucket))
+	, m_region(std::move(region))
+	, m_maxConcurrentUploads(maxConcurrentUploads)
+{
+	Q_ASSERT(m_maxConcurrentUploads > 0);
+	while(m_pathPrefix.endsWith('/'))
+		m_pathPrefix.chop(1);
+}
+
+QCoro::Task<bool>
+S3Uploader::put(QString key, QByteArray body, QString contentType)
+{
+	while(m_uploadsInFlight >= m_maxConcurrentUploads)
+		co_await qCoro(this, &S3Uploader::uploadSlotFreed);
+
+	++m_uploadsInFlight;
+	// Like rclone's --checksum, don't upload objects that haven't changed.
+	QByteArray md5Hex =
+		QCryptographicHash::hash(body, QCryptographicHash::Md5).toHex();
+	bool ok = co_await isUpToDate(key, md5Hex);
+	for(int attempt = 1; attempt <= MAX_ATTEMPTS && !ok; ++attempt) {
+		if(attempt > 1) {
+			std::cerr << "Retrying upload of " << key.toStdString()
+					  << ", attempt " << attempt << std::endl;
+			co_await QCoro::sleepFor(std::chrono::milliseconds(
+				500 * (1 << (attempt - 2))));
+		}
+		ok = co_await tryPut(key, body, contentType);
+	}
+	--m_uploadsInFlight;
+	emit uploadSlotFreed();
+	co_return ok;
+}
+
+QNetworkRequest S3Uploader::makeRequest(
+	const QByteArray &method, const QString &key, const QByteArray &payloadHash,
+	const QString &contentType) const
+{
+	QDateTime now = QDateTime::currentDateTimeUtc();
+	QByteArray amzDate = now.toString("yyyyMMdd'T'HHmmss'Z'").toLatin1();
+	QByteArray date = amzDate.left(8);
+
+	QByteArray canonicalUri =
+		m_pathPrefix + '/' + QUrl::toPercentEncoding(m_bucket) + '/' +
+		QUrl::toPercentEncoding(key, QByteArrayLiteral("/"));
+	QByteArray host = m_endpoint.host().toUtf8();
+	int port = m_endpoint.port();
+	bool https = m_endpoint.scheme() == QStringLiteral("https");
+	if(port != -1 && port != (https ? 443 : 80))
+		host += ':' + QByteArray::number(port);
+
+	// See the AWS documentation on signature version 4 for what goes in here.
+	QByteArray canonicalHeaders;
+	QByteArray signedHeaders;
+	if(!contentType.isEmpty()) {
+		canonicalHeaders += "content-type:" + contentType.toUtf8() + '\n';
+		signedHeaders += QByteArrayLiteral("content-type;");
+	}
+	canonicalHeaders += "host:" + host + '\n' +
+						"x-amz-content-sha256:" + payloadHash + '\n' +
+						"x-amz-date:" + amzDate + '\n';
+	signedHeaders += QByteArrayLiteral("host;x-amz-content-sha256;x-amz-date");
+	QByteArray canonicalRequest = method + '\n' + canonicalUri + "\n\n" +
+								  canonicalHeaders + '\n' + signedHeaders +
+								  '\n' + payloadHash;
+	QByteArray scope =
+		date + '/' + m_region.toUtf8() + QByteArrayLiteral("/s3/aws4_request");
+	QByteArray stringToSign = QByteArrayLiteral("AWS4-HMAC-SHA256\n") +
+							  amzDate + '\n' + scope + '\n' +
+							  sha256Hex(canonicalRequest);
+	QByteArray signingKey = hmacSha256(
+		hmacSha256(
+			hmacSha256(
+				hmacSha256("AWS4" + m_secretAccessKey, date),
+				m_region.toUtf8()),
+			QByteArrayLiteral("s3")),
+		QByteArrayLiteral("aws4_request"));
+	QByteArray signature = hmacSha256(signingKey, stringToSign).toHex();
+
+	QUrl url = m_endpoint;
+	url.setPath(QString::fromLatin1(canonicalUri), QUrl::TolerantMode);
+	QNetworkRequest req(url);
+	if(!contentType.isEmpty())
+		req.setHeader(QNetworkRequest::ContentTypeHeader, contentType);
+	req.setRawHeader("Host", host);
+	req.setRawHeader("x-amz-content-sha256", payloadHash);
+	req.setRawHeader("x-amz-date", amzDate);
+	req.setRawHeader(
+		"Authorization", QByteArrayLiteral("AWS4-HMAC-SHA256 Credential=") +
+							 m_accessKeyId + '/' + scope +
+							 QByteArrayLiteral(", SignedHeaders=") +
+							 signedHeaders + QByteArrayLiteral(", Signature=") +
+							 signature);
+	return req;
+}
+
+QCoro::Task<bool>
+S3Uploader::isUpToDate(const QString &key, const QByteArray &md5Hex)
+{
+	// For objects uploaded in a single PUT, the ETag is the MD5 of the content.
+	// Anything else, including the object not existing, means uploading it.
+	std::unique_ptr<QNetworkReply> reply(m_nam->head(
+		makeRequest("HEAD", key, sha256Hex(QByteArray()), QString())));
+	co_await qCoro(reply.get(), &QNetworkReply::finished);
+	if(reply->error() != QNetworkReply::NoError)
+		co_return false;
+
+	QByteArray etag = reply->rawHeader("ETag").trimmed().toLower();
+	if(etag.size() >= 2 && etag.startsWith('"') && etag.endsWith('"'))
+		etag = etag.mid(1, etag.size() - 2);
+	co_return etag == md5Hex;
+}
+
+QCoro::Task<bool> S3Uploader::tryPut(
+	const QString &key, const QByteArray &body, const QString &contentType)
+{
+	QNetworkRequest req =
+		makeRequest("PUT", key, sha256Hex(body), contentType);
+	std::unique_ptr<QNetworkReply> reply(m_nam->put(req, body));
+	co_await qCoro(reply.get(), &QNetworkReply::finished);
+	if(reply->error() == QNetworkReply::NoError)
+		co_return true;
+
+	std::cerr << "Upload of " << key.toStdString()
+			  << " failed: " << reply->errorString().toStdString() << '\n'
+			  << reply->readAll().toStdString() << std::endl;
+	co_return false;
+}
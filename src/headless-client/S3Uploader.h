@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef HEADLESS_CLIENT_S3_UPLOADER_H
+#define HEADLESS_CLIENT_S3_UPLOADER_H
+
+#include <QByteArray>
+#include <QCoroTask>
+#include <QObject>
+#include <QString>
+#include <QUrl>
+
+class QNetworkAccessManager;
+class QNetworkRequest;
+
+// Uploads objects to an S3 compatible store, like MinIO, with plain PUT
+// requests signed with AWS signature version 4. Uploads run concurrently up to
+// a limit, the rest wait for a free slot. Failed uploads are retried a few
+// times before giving up. Objects that are already in the store with the same
+// content are skipped, by comparing their ETag to the MD5 of the new content.
+class S3Uploader : public QObject {
+	Q_OBJECT
+public:
+	// The url is the endpoint of the store, with the access key id as the user
+	// name and the secret access key as the password. Objects are stored with
+	// path-style addressing in the given bucket, below the url's path if it
+	// has one, such as when the store is behind a reverse proxy.
+	S3Uploader(
+		const QUrl &url, QString bucket, QString region,
+		int maxConcurrentUploads, QObject *parent = nullptr);
+
+	// Returns whether the object made it to the store. Errors are printed.
+	QCoro::Task<bool> put(QString key, QByteArray body, QString contentType);
+
+signals:
+	void uploadSlotFreed();
+
+private:
+	static constexpr int MAX_ATTEMPTS = 3;
+
+	QNetworkRequest makeRequest(
+		const QByteArray &method, const QString &key,
+		const QByteArray &payloadHash, const QString &contentType) const;
+
+	QCoro::Task<bool> isUpToDate(const QString &key, const QByteArray &md5Hex);
+
+	QCoro::Task<bool> tryPut(
+		const QString &key, const QByteArray &body, const QString &contentType);
+
+	QNetworkAccessManager *m_nam;
+	QUrl m_endpoint;
+	QByteArray m_pathPrefix;
+	QByteArray m_accessKeyId;
+	QByteArray m_secretAccessKey;
+	QString m_bucket;
+	QString m_region;
+	int m_maxConcurrentUploads;
+	int m_uploadsInFlight = 0;
+};
+
+#endif // HEADLESS_CLIENT_S3_UPLOADER_H
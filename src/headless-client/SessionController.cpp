@@ -10,8 +10,8 @@
 
 #include "QCoroOnceFuture.h"
 #include <QCoroFuture>
-#include <QCoroProcess>
 #include <QCoroTimer>
+#include <QFile>
 #include <QtConcurrent/QtConcurrent>
 #include <QtMqtt/QtMqtt>
 
@@ -21,8 +21,8 @@
 #include <utility>
 
 extern "C" {
-#include <dpcommon/output.h>
-#include <dpengine/image.h>
+#include <dpengine/canvas_diff.h>
+#include <dpengine/tile.h>
 }
 
 SessionController::SessionController(SessionSettings settings, QObject *parent)
@@ -122,17 +122,9 @@ void SessionController::onSessionStart(int myUserId)
 	}
 	// TODO: Wait for mqtt to fully connect before processing commits
 
-	m_rcloneEnv = QStringList()
-				  << "RCLONE_CONFIG_MINIO_TYPE=s3"
-				  << "RCLONE_CONFIG_MINIO_PROVIDER=Minio"
-				  << QString("RCLONE_CONFIG_MINIO_ACCESS_KEY_ID=%1")
-						 .arg(m_settings.s3Url.userName())
-				  << QString("RCLONE_CONFIG_MINIO_SECRET_ACCESS_KEY=%1")
-						 .arg(m_settings.s3Url.password())
-				  << QString("RCLONE_CONFIG_MINIO_ENDPOINT=%1")
-						 .arg(m_settings.s3Url.toString(
-							 QUrl::RemoveUserInfo | QUrl::RemovePassword))
-				  << "RCLONE_CONFIG_MINIO_REGION=us-east-1";
+	m_uploader = new S3Uploader(
+		m_settings.s3Url, "templates", "us-east-1", MAX_CONCURRENT_UPLOADS,
+		this);
 }
 
 void SessionController::onSessionEnd()
@@ -474,6 +466,9 @@ QCoro::Task<> SessionController::handleCommit(
 	if(!caughtUp) {
 		m_previousCommit = std::move(cs);
 		m_previousPalette = m_palette;
+		// The image gets rendered from the previous commit once we're caught
+		// up, so that the two are guaranteed to match when diffing tiles.
+		m_previousImage = {};
 		co_return;
 	}
 
@@ -512,22 +507,15 @@ QCoro::Task<> SessionController::handleCommit(
 			QString::fromStdString(name),
 			QString("endu/%1.png").arg(QString::fromStdString(name))));
 	}
-	// TODO: This palettizes each top level layer twice, maybe we should
-	//       palettize once at each top level layer in transient layer space?
-	BGRA8OffsetImage fullImg = renderer.toPixels(
-		renderer.m_fullImage.m_renderedLayer, false, m_palette);
-	QCoro::Task<> fullUploadTask =
-		pushLayerToCDN(fullImg, "full", QString("full/%1.png").arg(commitId));
-
-	if(m_previousImage.pixels == nullptr && !m_previousCommit.isNull()) {
-		// We just rejoined a session with existing history. Render the previous
-		// image now.
-		LayerRenderer prevRenderer = co_await QCoro::detail::QCoroOnceFuture(
-			asyncGetLayers(m_previousCommit));
-		m_previousImage = prevRenderer.toPixels(
-			prevRenderer.m_fullImage.m_renderedLayer, false, m_previousPalette);
-	} else if(m_previousCommit.isNull()) {
+	if(m_previousCommit.isNull()) {
 		// This is the first commit after a reset, send a special message.
+		// TODO: This palettizes each top level layer twice, maybe we should
+		//       palettize once at each top level layer in transient layer
+		//       space?
+		BGRA8OffsetImage fullImg = renderer.toPixels(
+			renderer.m_fullImage.m_renderedLayer, false, m_palette);
+		QCoro::Task<> fullUploadTask = pushLayerToCDN(
+			fullImg, "full", QString("full/%1.png").arg(commitId));
 		QJsonObject obj(
 			{{"type", "full"},
 			 {"id", commitId},
@@ -539,96 +527,168 @@ QCoro::Task<> SessionController::handleCommit(
 		m_previousCommit = std::move(cs);
 		m_previousCommitId = commitId;
 		m_previousImage = std::move(fullImg);
+		m_previousPalette = m_palette;
 		sendChatMessage(QString::fromStdString(std::format(
 			"%committed {} from full image: {}", commitId, commitMessage)));
 		co_return;
 	}
 
-	// TODO: Investigate using canvas diffing for this. Drawdance supports
-	//       efficient diffing of different canvas states.
-	if(!m_previousCommit.isNull()) {
-		bool resized = false;
-		if(fullImg.width != m_previousImage.width ||
-		   fullImg.height != m_previousImage.height) {
-			resized = true;
-			BGRA8OffsetImage resizedImage(fullImg.width, fullImg.height);
-			resizedImage.copyFrom(
-				m_previousImage, m_previousResize.left, m_previousResize.top);
-			m_previousImage = std::move(resizedImage);
-		}
-		DP_UPixel8 *oldImg = m_previousImage.pixels;
-		DP_UPixel8 *newImg = fullImg.pixels;
-		auto *diffImg = (DP_UPixel8 *)DP_malloc(fullImg.sizeInBytes());
-		for(int i = 0; i < fullImg.sizeInPixels(); ++i) {
-			if(oldImg[i] == newImg[i])
-				diffImg[i] = {.bytes = {.b = 255, .g = 255, .r = 0, .a = 254}};
-			else
-				diffImg[i] = newImg[i];
-		}
-		BGRA8OffsetImage diff{diffImg, 0, 0, fullImg.width, fullImg.height};
-		diff.crop({.bytes = {.b = 255, .g = 255, .r = 0, .a = 254}});
-		if(diff.sizeInPixels() == 0 && !resized) {
-			// No diff in this commit, but we still need to send a committed
-			// message. The canvas state is close enough to what it was before
-			// that saving a new canvas state is ok on reload.
-			sendChatMessage(
-				"%commit-ignored no change from previous template.");
-			// Still update the previous commit so that we match the behavior on
-			// reload.
-			m_previousCommit = std::move(cs);
-			co_return;
+	if(m_previousImage.pixels == nullptr) {
+		// We just rejoined a session with existing history. Render the previous
+		// image now.
+		LayerRenderer prevRenderer = co_await QCoro::detail::QCoroOnceFuture(
+			asyncGetLayers(m_previousCommit));
+		m_previousImage = prevRenderer.toPixels(
+			prevRenderer.m_fullImage.m_renderedLayer, false, m_previousPalette);
+	}
+
+	bool resized = false;
+	if(renderer.width != m_previousImage.width ||
+	   renderer.height != m_previousImage.height) {
+		resized = true;
+		BGRA8OffsetImage resizedImage(renderer.width, renderer.height);
+		resizedImage.copyFrom(
+			m_previousImage, m_previousResize.left, m_previousResize.top);
+		m_previousImage = std::move(resizedImage);
+	}
+
+	// Only the tiles that changed since the previous commit need to be
+	// converted, palettized and compared, the rest of the full image is the
+	// same as before. A resize or palette change touches everything.
+	DP_CanvasDiff *canvasDiff = DP_canvas_diff_new();
+	diffForRender(cs, m_previousCommit, canvasDiff);
+	if(m_palette != m_previousPalette)
+		DP_canvas_diff_check_all(canvasDiff);
+	std::vector<int> changedTiles;
+	DP_canvas_diff_each_index(
+		canvasDiff,
+		[](void *data, int tileIndex) {
+			static_cast<std::vector<int> *>(data)->push_back(tileIndex);
+		},
+		&changedTiles);
+	DP_canvas_diff_free(canvasDiff);
+
+	BGRA8OffsetImage fullImg(
+		static_cast<DP_UPixel8 *>(DP_malloc(m_previousImage.sizeInBytes())),
+		0, 0, m_previousImage.width, m_previousImage.height);
+	std::memcpy(fullImg.pixels, m_previousImage.pixels, fullImg.sizeInBytes());
+	BGRA8OffsetImage diff = applyChangedTiles(
+		fullImg, changedTiles,
+		renderer.tilesToPixels(
+			renderer.m_fullImage.m_renderedLayer, changedTiles, m_palette),
+		{.bytes = {.b = 255, .g = 255, .r = 0, .a = 254}});
+	QCoro::Task<> fullUploadTask = pushLayerToCDN(
+		fullImg, "full", QString("full/%1.png").arg(commitId));
+
+	if(diff.sizeInPixels() == 0 && !resized) {
+		// No diff in this commit, but we still need to send a committed
+		// message. The canvas state is close enough to what it was before
+		// that saving a new canvas state is ok on reload.
+		sendChatMessage("%commit-ignored no change from previous template.");
+		// Still update the previous commit so that we match the behavior on
+		// reload.
+		m_previousCommit = std::move(cs);
+		co_return;
+	}
+
+	QJsonObject obj(
+		{{"type", "diff"},
+		 {"previous_id", m_previousCommitId},
+		 {"id", commitId},
+		 {"x", diff.x},
+		 {"y", diff.y},
+		 {"message", QString::fromStdString(commitMessage)}});
+	if(diff.sizeInBytes() != 0) {
+		std::vector<char> pngBytes = diff.toPng();
+		QByteArray imageBytes(
+			pngBytes.data(), static_cast<int>(pngBytes.size()));
+		QByteArray diffString("data:image/png;base64,");
+		diffString += imageBytes.toBase64();
+		obj["diff"] = QString(diffString);
+	}
+	if(resized) {
+		QJsonObject resizeObj;
+		if(m_previousResize.top != 0)
+			resizeObj["top"] = m_previousResize.top;
+		if(m_previousResize.bottom != 0)
+			resizeObj["bottom"] = m_previousResize.bottom;
+		if(m_previousResize.left != 0)
+			resizeObj["left"] = m_previousResize.left;
+		if(m_previousResize.right != 0)
+			resizeObj["right"] = m_previousResize.right;
+		obj["resize"] = std::move(resizeObj);
+	}
+	QByteArray mqttUpdate = QJsonDocument(obj).toJson();
+	pushLayerToCDN(diff, "diff", QString());
+	co_await fullUploadTask;
+	m_mqttClient->publish(m_mqttTopicUpdates, mqttUpdate, 1, true);
+	// TODO: Don't fully confirm commits until we get a
+	//       QMqttClient::messageSent signal that says the broker got it.
+	co_await awaitPendingTasks();
+	m_previousCommitId = commitId;
+	m_previousImage = std::move(fullImg);
+	m_previousPalette = m_palette;
+	m_previousCommit = std::move(cs);
+	std::string msg = std::format(
+		"%committed {} from diff offsetX: {} offsetY: {} width: {} height: "
+		"{} message: {}",
+		commitId, diff.x, diff.y, diff.width, diff.height, commitMessage);
+	sendChatMessage(QString::fromStdString(msg));
+}
+
+BGRA8OffsetImage SessionController::applyChangedTiles(
+	BGRA8OffsetImage &img, std::span<const int> tileIndexes,
+	std::span<const DP_UPixel8> tilePixels, DP_UPixel8 unchanged)
+{
+	int xtiles = DP_tile_size_round_up(img.width);
+	auto eachPixel = [&](auto fn) {
+		const DP_UPixel8 *src = tilePixels.data();
+		for(int tileIndex : tileIndexes) {
+			int tileX = (tileIndex % xtiles) * DP_TILE_SIZE;
+			int tileY = (tileIndex / xtiles) * DP_TILE_SIZE;
+			int w = std::min(DP_TILE_SIZE, img.width - tileX);
+			int h = std::min(DP_TILE_SIZE, img.height - tileY);
+			for(int yp = 0; yp < h; ++yp)
+				for(int xp = 0; xp < w; ++xp)
+					fn(tileX + xp, tileY + yp, src[yp * DP_TILE_SIZE + xp]);
+			src += DP_TILE_LENGTH;
 		}
+	};
 
-		QJsonObject obj(
-			{{"type", "diff"},
-			 {"previous_id", m_previousCommitId},
-			 {"id", commitId},
-			 {"x", diff.x},
-			 {"y", diff.y},
-			 {"message", QString::fromStdString(commitMessage)}});
-		if(diff.sizeInBytes() != 0) {
-			std::vector<char> pngBytes = diff.toPng();
-			QByteArray imageBytes(
-				pngBytes.data(), static_cast<int>(pngBytes.size()));
-			QByteArray diffString("data:image/png;base64,");
-			diffString += imageBytes.toBase64();
-			obj["diff"] = QString(diffString);
+	int x1 = img.width, x2 = -1, y1 = img.height, y2 = -1;
+	eachPixel([&](int x, int y, DP_UPixel8 pixel) {
+		if(img.pixels[y * img.width + x] != pixel) {
+			x1 = std::min(x1, x);
+			x2 = std::max(x2, x);
+			y1 = std::min(y1, y);
+			y2 = std::max(y2, y);
 		}
-		if(resized) {
-			QJsonObject resizeObj;
-			if(m_previousResize.top != 0)
-				resizeObj["top"] = m_previousResize.top;
-			if(m_previousResize.bottom != 0)
-				resizeObj["bottom"] = m_previousResize.bottom;
-			if(m_previousResize.left != 0)
-				resizeObj["left"] = m_previousResize.left;
-			if(m_previousResize.right != 0)
-				resizeObj["right"] = m_previousResize.right;
-			obj["resize"] = std::move(resizeObj);
+	});
+	if(x2 == -1)
+		return {};
+
+	int width = (x2 - x1) + 1;
+	int height = (y2 - y1) + 1;
+	BGRA8OffsetImage diff(
+		static_cast<DP_UPixel8 *>(
+			DP_malloc(size_t(width) * size_t(height) * sizeof(DP_UPixel8))),
+		x1, y1, width, height);
+	std::fill_n(diff.pixels, diff.sizeInPixels(), unchanged);
+	eachPixel([&](int x, int y, DP_UPixel8 pixel) {
+		DP_UPixel8 &dst = img.pixels[y * img.width + x];
+		if(dst != pixel) {
+			diff.pixels[(y - y1) * width + (x - x1)] = pixel;
+			dst = pixel;
 		}
-		QByteArray mqttUpdate = QJsonDocument(obj).toJson();
-		pushLayerToCDN(diff, "diff", QString());
-		co_await fullUploadTask;
-		m_mqttClient->publish(m_mqttTopicUpdates, mqttUpdate, 1, true);
-		// TODO: Don't fully confirm commits until we get a
-		//       QMqttClient::messageSent signal that says the broker got it.
-		co_await awaitPendingTasks();
-		m_previousCommitId = commitId;
-		m_previousImage = std::move(fullImg);
-		m_previousCommit = std::move(cs);
-		std::string msg = std::format(
-			"%committed {} from diff offsetX: {} offsetY: {} width: {} height: "
-			"{} message: {}",
-			commitId, diff.x, diff.y, diff.width, diff.height, commitMessage);
-		sendChatMessage(QString::fromStdString(msg));
-	}
+	});
+	return diff;
 }
 
 QFuture<LayerRenderer>
 SessionController::asyncGetLayers(drawdance::CanvasState cs)
 {
 	return QtConcurrent::run([this, cs = std::move(cs)]() mutable {
-		LayerRenderer renderer(std::move(cs));
+		LayerRenderer renderer(std::move(cs), &m_renderCache);
 		renderer.render();
 		return renderer;
 	});
@@ -637,40 +697,31 @@ SessionController::asyncGetLayers(drawdance::CanvasState cs)
 QCoro::Task<> SessionController::pushLayerToCDN(
 	const BGRA8OffsetImage &image, QString name, QString cdnPath)
 {
-	DP_UPixel8 *pixels = image.pixels;
-	if(!pixels)
+	if(!image.pixels)
 		co_return;
 
-	std::string where = std::format(
-		"{}/{}.png", m_settings.outputPath.toStdString(), name.toStdString());
-	DP_Image *img = DP_image_new(image.width, image.height);
-	DP_Output *out = DP_file_output_new_from_path(where.c_str());
-	if(!out) {
-		std::cerr << "Bad output path: " << where.c_str() << std::endl;
-		co_return;
-	}
-	memcpy(DP_image_pixels(img), pixels, image.sizeInBytes());
-	DP_image_write_png(img, out);
-	DP_output_free(out);
-	DP_image_free(img);
+	// Callers may pass a temporary, so take a copy before suspending. Encoding
+	// happens on the thread pool, so that multiple layers encode in parallel.
+	auto copy = std::make_shared<BGRA8OffsetImage>(
+		static_cast<DP_UPixel8 *>(DP_malloc(image.sizeInBytes())), image.x,
+		image.y, image.width, image.height);
+	std::memcpy(copy->pixels, image.pixels, image.sizeInBytes());
+	QString where = QString("%1/%2.png").arg(m_settings.outputPath, name);
+	QByteArray png = co_await QtConcurrent::run([copy, where] {
+		std::vector<char> bytes = copy->toPng();
+		QByteArray png(bytes.data(), qsizetype(bytes.size()));
+		QFile file(where);
+		if(!file.open(QIODevice::WriteOnly) || file.write(png) != png.size())
+			std::cerr << "Bad output path: " << where.toStdString()
+					  << std::endl;
+		return png;
+	});
 
 	if(cdnPath.isEmpty())
 		co_return;
 
-	QProcess rclone;
-	rclone.setEnvironment(m_rcloneEnv);
-	rclone.start(
-		"rclone", QStringList()
-					  << "copyto" << "-c" << QString::fromStdString(where)
-					  << QString("minio:templates/%1/%2")
-							 .arg(m_settings.faction, cdnPath));
-	connect(
-		&rclone, &QProcess::errorOccurred, this,
-		[](QProcess::ProcessError error) {
-			std::cerr << QtEnumToString(error) << std::endl;
-		});
-	co_await qCoro(rclone).waitForFinished();
-	if(rclone.exitCode() != 0)
-		std::cerr << rclone.readAllStandardError().toStdString() << std::endl;
 	// TODO: Handle upload failure.
+	co_await m_uploader->put(
+		QString("%1/%2").arg(m_settings.faction, cdnPath), std::move(png),
+		"image/png");
 }
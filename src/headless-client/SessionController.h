@@ -3,6 +3,7 @@
 #define HEADLESS_CLIENT_SESSION_CONTROLLER_H
 
 #include "PaintEngine.h"
+#include "S3Uploader.h"
 #include "libclient/canvas/userlist.h"
 #include "libclient/net/message.h"
 #include <QCoroTask>
@@ -50,6 +51,8 @@ signals:
 	void sendMessage(const net::Message &msg);
 
 private:
+	static constexpr int MAX_CONCURRENT_UPLOADS = 8;
+
 	// These functions are all called as part of `onMessagesReceived`. We need
 	// to be able to inject messages into the messages that get sent to the
 	// paint engine, so the message queue is kept track of as class state, and
@@ -69,6 +72,11 @@ private:
 	QCoro::Task<> handleCommit(
 		drawdance::CanvasState cs, std::string commitMessage, bool caughtUp);
 	QFuture<LayerRenderer> asyncGetLayers(drawdance::CanvasState cs);
+	// Writes the changed tiles into `img`. Returns the changed pixels cropped
+	// to their bounds, with unchanged pixels in there set to `unchanged`.
+	static BGRA8OffsetImage applyChangedTiles(
+		BGRA8OffsetImage &img, std::span<const int> tileIndexes,
+		std::span<const DP_UPixel8> tilePixels, DP_UPixel8 unchanged);
 
 	// TODO: Make it clearer which of these variables only makes sense in canvas
 	//       sync order, and which are only used during `onMessagesReceived`.
@@ -76,7 +84,7 @@ private:
 	canvas::UserListModel *m_userList;
 	QMqttClient *m_mqttClient = nullptr;
 	QMqttTopicName m_mqttTopicUpdates;
-	QStringList m_rcloneEnv;
+	S3Uploader *m_uploader = nullptr;
 	std::unique_ptr<PaintEngine> m_paintEngine;
 	int m_myUserId = -1;
 	int m_catchUpKey = -1;
@@ -97,6 +105,8 @@ private:
 	bool m_isPreviousCommitConfirmed = true;
 	drawdance::CanvasState m_previousCommit;
 	std::vector<DP_UPixel8> m_previousPalette;
+	// Only touched by one render at a time, commits are handled in sequence.
+	LayerRenderCache m_renderCache;
 	BGRA8OffsetImage m_previousImage{nullptr, 0, 0, 0, 0};
 	int64_t m_previousCommitId = 0;
 	struct {
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "Palettize.h"
+
+#include <QtTest/QtTest>
+#include <algorithm>
+#include <vector>
+
+class TestPalettize final : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testPaletteColorsKept()
+	{
+		std::vector<DP_UPixel8> palette = makePalette();
+		std::vector<DP_UPixel8> pixels = palette;
+		palettize(pixels, palette);
+		QVERIFY(pixels == palette);
+	}
+
+	void testTransparentPixelsCleared()
+	{
+		std::vector<DP_UPixel8> palette = makePalette();
+		std::vector<DP_UPixel8> pixels = {{.color = 0x7fffffffu}};
+		palettize(pixels, palette);
+		QCOMPARE(pixels[0].color, 0u);
+	}
+
+	void testMemoOverflow()
+	{
+		// The memo holds about a million colors. The second image shares half
+		// of its colors with the first and brings enough new ones that they
+		// don't all fit into the memo anymore. The shared ones must still get
+		// mapped for it, only the memo kept for the next image is trimmed.
+		std::vector<DP_UPixel8> palette = makePalette();
+		struct Range {
+			uint32_t firstColor;
+			uint32_t colorCount;
+		};
+		for(Range range : {Range{0, 600000}, Range{300000, 800000},
+						   Range{0, 600000}}) {
+			std::vector<DP_UPixel8> pixels =
+				makeImage(range.firstColor, range.colorCount);
+			palettize(pixels, palette);
+			QVERIFY(std::ranges::all_of(pixels, [&](DP_UPixel8 pixel) {
+				return std::ranges::find(palette, pixel) != palette.end();
+			}));
+
+			// Doing it again, now with the memo, gives the same result.
+			std::vector<DP_UPixel8> again =
+				makeImage(range.firstColor, range.colorCount);
+			palettize(again, palette);
+			QVERIFY(again == pixels);
+		}
+	}
+
+private:
+	static std::vector<DP_UPixel8> makePalette()
+	{
+		return {
+			{.color = 0xff000000u}, {.color = 0xffffffffu},
+			{.color = 0xffff0000u}, {.color = 0xff00ff00u},
+			{.color = 0xff0000ffu},
+		};
+	}
+
+	static std::vector<DP_UPixel8>
+	makeImage(uint32_t firstColor, uint32_t colorCount)
+	{
+		std::vector<DP_UPixel8> pixels(colorCount);
+		for(uint32_t i = 0; i < colorCount; ++i)
+			pixels[i].color = 0xff000000u | (firstColor + i);
+		return pixels;
+	}
+};
+
+QTEST_MAIN(TestPalettize)
+#include "palettize.moc"
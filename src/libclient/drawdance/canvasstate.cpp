@@ -219,7 +219,11 @@ QImage CanvasState::layerToFlatImage(int layerId, const QRect &rect) const
 
 void CanvasState::toResetImage(net::MessageList &msgs, uint8_t contextId) const
 {
-	DP_reset_image_build(m_data, contextId, &CanvasState::pushMessage, &msgs);
+	// Reset images end up in the session history and get sent to everyone who
+	// joins, so they're worth compressing as small as possible.
+	DP_reset_image_build(
+		m_data, contextId, DP_COMPRESS_PROFILE_MAX,
+		&CanvasState::pushMessage, &msgs);
 }
 
 net::Message CanvasState::makeLayerOrder(
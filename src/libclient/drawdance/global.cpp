@@ -4,6 +4,7 @@ extern "C" {
 #include <dpcommon/common.h>
 #include <dpcommon/cpu.h>
 #include <dpengine/draw_context.h>
+#include <dpengine/tile.h>
 }
 
 #include "libclient/drawdance/global.h"
@@ -67,6 +68,11 @@ void initCpuSupport()
     DP_cpu_support_init();
 }
 
+void setTileCompressionCacheLimit(size_t maxBytes)
+{
+	DP_tile_compress_cache_limit_set(maxBytes);
+}
+
 
 DrawContext::DrawContext(DrawContext &&other)
 	: DrawContext{other.m_dc, other.m_pool}
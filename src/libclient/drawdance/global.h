@@ -15,6 +15,10 @@ void initLogging();
 
 void initCpuSupport();
 
+// Keeps up to the given number of bytes of compressed tile data around, so that
+// reset images don't have to compress unchanged tiles again. Zero disables it.
+void setTileCompressionCacheLimit(size_t maxBytes);
+
 
 class DrawContextPool;
 
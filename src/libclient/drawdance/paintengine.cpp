@@ -37,6 +37,7 @@ PaintEngine::PaintEngine(
 		  nullptr, playbackFn, dumpPlaybackFn, playbackUser, syncCanvasStateFn,
 		  syncCanvasStateUser))
 {
+	DP_paint_engine_dab_costs_calibrate(m_data);
 }
 
 PaintEngine::~PaintEngine()
@@ -75,6 +76,7 @@ net::MessageList PaintEngine::reset(
 		sq.get(), softResetFn, softResetUser, wantCanvasHistoryDump,
 		getDumpDir().toUtf8().constData(), &PaintEngine::getTimeMs, nullptr,
 		player, playbackFn, dumpPlaybackFn, playbackUser, nullptr, nullptr);
+	DP_paint_engine_dab_costs_calibrate(m_data);
 	return localResetImage;
 }
 
@@ -1,8 +1,6 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
-#include <QBuffer>
 #include <QDebug>
-#include <QImage>
 
 #include "libclient/export/ffmpegexporter.h"
 #include "libshared/util/qtcompat.h"
@@ -16,24 +14,26 @@ FfmpegExporter::FfmpegExporter(
 	, m_filename{filename}
 	, m_customArguments{customArguments}
 	, m_encoder{nullptr}
+	, m_frameBytes{0}
+	, m_encoderStarted{false}
+	, m_awaitingReady{false}
+	, m_finishing{false}
 {
 }
 
-QStringList FfmpegExporter::getCommonArguments(int fps)
+QStringList FfmpegExporter::getCommonArguments(
+	int fps, const QString &frameSize)
 {
 	QStringList args;
 
-	// Image input (via pipe)
+	// Raw pixel input (via pipe) at the given framerate
 	args << "-f"
-		 << "image2pipe"
-		 << "-c:v"
-		 << "bmp"
-		 << "-i"
+		 << "rawvideo"
+		 << "-pix_fmt"
+		 << "rgb32"
+		 << "-s:v" << frameSize << "-r" << QString::number(fps) << "-i"
 		 << "-";
 
-	// Framerate
-	args << "-r" << QString::number(fps);
-
 	return args;
 }
 
@@ -118,11 +118,22 @@ static inline QStringList splitCommand(QStringView command)
 #endif
 
 void FfmpegExporter::initExporter()
+{
+	Q_ASSERT(m_encoder == nullptr);
+	// The encoder gets started with the first frame, since it needs to know
+	// the frame size beforehand.
+	emit exporterReady();
+}
+
+void FfmpegExporter::startEncoder(const QSize &frameSize)
 {
 	Q_ASSERT(m_encoder == nullptr);
 
 	QStringList args;
-	args.append(getCommonArguments(fps()));
+	args.append(getCommonArguments(
+		fps(), QStringLiteral("%1x%2")
+				   .arg(frameSize.width())
+				   .arg(frameSize.height())));
 
 	if(m_format == FFMPEG_MP4) {
 		args.append(getDefaultMp4Arguments());
@@ -145,7 +156,7 @@ void FfmpegExporter::initExporter()
 		m_encoder, &QProcess::bytesWritten, this,
 		&FfmpegExporter::bytesWritten);
 	connect(
-		m_encoder, &QProcess::started, this, &FfmpegExporter::exporterReady);
+		m_encoder, &QProcess::started, this, &FfmpegExporter::processStarted);
 	connect(
 		m_encoder,
 		QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this,
@@ -156,6 +167,12 @@ void FfmpegExporter::initExporter()
 	m_encoder->start(m_ffmpegPath, args);
 }
 
+void FfmpegExporter::processStarted()
+{
+	m_encoderStarted = true;
+	writeQueuedFrames();
+}
+
 void FfmpegExporter::processError(QProcess::ProcessError error)
 {
 	qWarning() << "Ffmpeg error:" << error;
@@ -180,24 +197,35 @@ void FfmpegExporter::processError(QProcess::ProcessError error)
 void FfmpegExporter::writeFrame(const QImage &image, int repeat)
 {
 	qInfo("Writing frame (repeat %d)", repeat);
-	if(!m_writebuffer.isEmpty()) {
+	if(m_awaitingReady) {
 		qWarning(
 			"FfmpegExporter: tried to write frame while not yet ready! (%lld "
-			"of %lld of buffered bytes written",
-			m_written, compat::cast<long long>(m_writebuffer.length()));
+			"frames queued)",
+			compat::cast<long long>(m_frames.size()));
 		return;
 	}
 
-	{
-		QBuffer buf(&m_writebuffer);
-		buf.open(QIODevice::ReadWrite);
-		image.save(&buf, "BMP");
+	// The encoder takes native-endian 0xAARRGGBB pixels, so an RGB32 image
+	// can be piped as-is.
+	QImage frameImage = image.format() == QImage::Format_RGB32
+							? image
+							: image.convertToFormat(QImage::Format_RGB32);
+	qint64 frameBytes = qint64(frameImage.bytesPerLine()) * frameImage.height();
+
+	if(!m_encoder) {
+		m_frameBytes = frameBytes;
+		startEncoder(frameImage.size());
+	} else if(frameBytes != m_frameBytes) {
+		qWarning(
+			"FfmpegExporter: frame size changed from %lld to %lld bytes",
+			m_frameBytes, frameBytes);
+		return;
 	}
 
-	m_written = 0;
-	m_repeats = repeat;
-
-	bytesWritten(0);
+	// Repeats are written from the same image, not converted again.
+	m_frames.enqueue({frameImage, repeat});
+	m_awaitingReady = true;
+	writeQueuedFrames();
 }
 
 void FfmpegExporter::bytesWritten(qint64 bytes)
@@ -206,30 +234,41 @@ void FfmpegExporter::bytesWritten(qint64 bytes)
 		qWarning("FfmpegExporter: write error occurred!");
 		return;
 	}
+	writeQueuedFrames();
+}
 
-	if(m_encoder->bytesToWrite() > 0) {
-		// Wait until the QProcess has finished emptying its buffer
-		// before writing more.
+void FfmpegExporter::writeQueuedFrames()
+{
+	if(!m_encoderStarted) {
 		return;
 	}
 
-	const qint64 bufsize = m_writebuffer.size();
-	Q_ASSERT(m_written <= bufsize);
-
-	if(m_written == bufsize) {
-		--m_repeats;
-		m_written = 0;
-
-		if(m_repeats <= 0) {
-			m_writebuffer.clear();
-			emit exporterReady();
-		} else {
-			bytesWritten(0);
+	// Keep about a frame's worth buffered in the process, so that the pipe
+	// never runs dry, but don't pile up more than the encoder can take.
+	while(!m_frames.isEmpty() && m_encoder->bytesToWrite() < m_frameBytes) {
+		Frame &frame = m_frames.head();
+		qint64 written = m_encoder->write(
+			reinterpret_cast<const char *>(frame.image.constBits()),
+			m_frameBytes);
+		if(written != m_frameBytes) {
+			qWarning("FfmpegExporter: write error occurred!");
+			return;
+		}
+		if(--frame.repeats <= 0) {
+			m_frames.dequeue();
 		}
+	}
 
-	} else {
-		m_written += m_encoder->write(
-			m_writebuffer.constData() + m_written, bufsize - m_written);
+	// Once the last frame is the only one left to write, the next one can
+	// be rendered while this one is still being encoded.
+	if(m_awaitingReady && m_frames.size() <= 1) {
+		m_awaitingReady = false;
+		emit exporterReady();
+	}
+
+	if(m_finishing && m_frames.isEmpty()) {
+		m_finishing = false;
+		m_encoder->closeWriteChannel();
 	}
 }
 
@@ -243,5 +282,10 @@ void FfmpegExporter::processFinished(
 
 void FfmpegExporter::shutdownExporter()
 {
-	m_encoder->closeWriteChannel();
+	if(m_encoder) {
+		m_finishing = true;
+		writeQueuedFrames();
+	} else {
+		emit exporterFinished(false);
+	}
 }
@@ -3,8 +3,9 @@
 #ifndef FFMPEGEXPORTER_H
 #define FFMPEGEXPORTER_H
 
+#include <QImage>
 #include <QProcess>
-#include <QByteArray>
+#include <QQueue>
 
 #include "libclient/export/videoexporter.h"
 
@@ -16,8 +17,13 @@ public:
 		Format format, const QString &ffmpegPath, const QString &filename,
 		const QString &customArguments, QObject *parent = nullptr);
 
-	//! Get the arguments that are always given to the encoder process
-	static QStringList getCommonArguments(int fps);
+	/**
+	 * @brief Get the arguments that are always given to the encoder process
+	 *
+	 * Frames are piped to the encoder as raw pixels, so it needs to be told
+	 * their size up front, formatted as WIDTHxHEIGHT.
+	 */
+	static QStringList getCommonArguments(int fps, const QString &frameSize);
 	static QStringList getDefaultMp4Arguments();
 	static QStringList getDefaultWebmArguments();
 
@@ -25,6 +31,7 @@ public:
 	static QString getFfmpegInstallNote();
 
 private slots:
+	void processStarted();
 	void processError(QProcess::ProcessError error);
 	void bytesWritten(qint64 bytes);
 	void processFinished(int exitCode, QProcess::ExitStatus exitStatus);
@@ -35,15 +42,25 @@ protected:
 	void shutdownExporter() override;
 
 private:
+	struct Frame {
+		QImage image;
+		int repeats;
+	};
+
+	void startEncoder(const QSize &frameSize);
+	void writeQueuedFrames();
+
 	Format m_format;
 	QString m_ffmpegPath;
 	QString m_filename;
 	QString m_customArguments;
 
 	QProcess *m_encoder;
-	QByteArray m_writebuffer;
-	qint64 m_written;
-	int m_repeats;
+	QQueue<Frame> m_frames;
+	qint64 m_frameBytes;
+	bool m_encoderStarted;
+	bool m_awaitingReady;
+	bool m_finishing;
 };
 
 #endif // FFMPEGEXPORTER_H
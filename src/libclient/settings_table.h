@@ -24,6 +24,7 @@ SETTING(parentalControlsTags        , ParentalControlsTags        , "pc/tagwords
 SETTING(engineFrameRate             , EngineFrameRate             , "settings/paintengine/fps"              , 60)
 SETTING(engineSnapshotCount         , EngineSnapshotCount         , "settings/paintengine/snapshotcount"    , SNAPSHOT_COUNT_DEFAULT)
 SETTING(engineSnapshotInterval      , EngineSnapshotInterval      , "settings/paintengine/snapshotinterval" , 10)
+SETTING(engineTileCacheSize         , EngineTileCacheSize         , "settings/paintengine/tilecachesize"    , 0)
 SETTING(engineUndoDepth             , EngineUndoDepth             , "settings/paintengine/undodepthlimit"   , DP_UNDO_DEPTH_DEFAULT)
 SETTING(listServers                 , ListServers                 , "listservers"                           , QVector<QVariantMap>())
 SETTING(serverAutoReset             , ServerAutoReset             , "settings/server/autoreset"             , true)
@@ -6,6 +6,7 @@
 #include "libserver/serverconfig.h"
 #include "libserver/serverlog.h"
 
+#include <QMutexLocker>
 #include <QTimerEvent>
 
 namespace sessionlisting {
@@ -40,14 +41,17 @@ void Announcements::announceSession(Announcable *session, const QUrl &listServer
 		return;
 
 	// Make announcement
-	m_announcements << Listing {
-		listServer,
-		session,
-		Announcement {},
-		QElapsedTimer(),
-		false,
-		{},
-	};
+	{
+		QMutexLocker locker(&m_mutex);
+		m_announcements << Listing {
+			listServer,
+			session,
+			Announcement {},
+			QElapsedTimer(),
+			false,
+			{},
+		};
+	}
 
 	server::Log()
 		.about(server::Log::Level::Info, server::Log::Topic::PubList)
@@ -96,11 +100,14 @@ void Announcements::announceSession(Announcable *session, const QUrl &listServer
 		}
 		listing->session->sendListserverMessage(successMessage);
 
-		listing->announcement = result.value<sessionlisting::Announcement>();
-		Q_ASSERT(listing->announcement.apiUrl == listing->listServer);
-		listing->finishedListing = true;
-		listing->description = description;
-		listing->refreshTimer.start();
+		{
+			QMutexLocker locker(&m_mutex);
+			listing->announcement = result.value<sessionlisting::Announcement>();
+			Q_ASSERT(listing->announcement.apiUrl == listing->listServer);
+			listing->finishedListing = true;
+			listing->description = description;
+			listing->refreshTimer.start();
+		}
 
 		emit announcementsChanged(listing->session);
 
@@ -113,6 +120,7 @@ void Announcements::announceSession(Announcable *session, const QUrl &listServer
 
 void Announcements::unlistSession(Announcable *session, const QUrl &listServer, bool delist)
 {
+	QMutexLocker locker(&m_mutex);
 	QMutableVectorIterator<Listing> i(m_announcements);
 	QSet<Announcable*> changes;
 
@@ -139,6 +147,7 @@ void Announcements::unlistSession(Announcable *session, const QUrl &listServer,
 			i.remove();
 		}
 	}
+	locker.unlock();
 
 	for(const auto *changedSession : changes)
 		emit announcementsChanged(changedSession);
@@ -289,6 +298,7 @@ void Announcements::refreshListings()
 
 QVector<Announcement> Announcements::getAnnouncements(const Announcable *session) const
 {
+	QMutexLocker locker(&m_mutex);
 	QVector<Announcement> list;
 	for(const auto &listing : m_announcements) {
 		if(listing.finishedListing && listing.session == session)
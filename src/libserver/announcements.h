@@ -6,6 +6,7 @@
 #include "libshared/listings/announcementapi.h"
 
 #include <QObject>
+#include <QMutex>
 #include <QVector>
 #include <QElapsedTimer>
 
@@ -48,6 +49,9 @@ public:
 
 	/**
 	 * @brief Return all active announcements for the given session
+	 *
+	 * Unlike the other functions, this may be called from any thread.
+	 *
 	 * @param session
 	 * @return
 	 */
@@ -77,6 +81,9 @@ private:
 
 	void refreshListings();
 
+	// The list is only changed from this object's thread, but sessions in
+	// other threads read it through getAnnouncements.
+	mutable QMutex m_mutex;
 	QVector<Listing> m_announcements;
 	server::ServerConfig *m_config;
 
@@ -8,12 +8,14 @@ extern "C" {
 #include <dpmsg/binary_writer.h>
 }
 #include "libserver/filedhistory.h"
+#include "libserver/filedhistoryloader.h"
 #include "libshared/util/filename.h"
 #include "libshared/util/passwordhash.h"
 #include <QDebug>
 #include <QFile>
 #include <QScopedPointer>
 #include <QSet>
+#include <QThreadPool>
 #include <QTimerEvent>
 #include <QVarLengthArray>
 
@@ -38,6 +40,8 @@ FiledHistory::FiledHistory(
 	, m_maxUsers(254)
 	, m_flags()
 	, m_nextCatchupKey(INITIAL_CATCHUP_KEY)
+	, m_heldIndex(0)
+	, m_loadGeneration(0)
 	, m_fileCount(0)
 	, m_archive(false)
 {
@@ -57,6 +61,7 @@ FiledHistory::FiledHistory(
 
 FiledHistory::~FiledHistory()
 {
+	releaseAllSerialized();
 	DP_binary_writer_free(m_writer);
 	DP_binary_reader_free(m_reader);
 }
@@ -182,7 +187,7 @@ bool FiledHistory::initRecording()
 
 	m_blocks << Block{
 		m_recording->pos(), firstIndex(), 0, m_recording->pos(),
-		net::MessageList()};
+		net::MessageList(), false};
 
 	return true;
 }
@@ -433,7 +438,7 @@ bool FiledHistory::scanBlocks()
 
 	m_blocks << Block{
 		m_recording->pos(), firstIndex(), 0, m_recording->pos(),
-		net::MessageList()};
+		net::MessageList(), false};
 
 	QSet<uint8_t> users;
 
@@ -457,7 +462,7 @@ bool FiledHistory::scanBlocks()
 		if(b.endOffset - b.startOffset >= MAX_BLOCK_SIZE) {
 			m_blocks << Block{
 				b.endOffset, b.startIndex + b.count, 0, b.endOffset,
-				net::MessageList()};
+				net::MessageList(), false};
 		}
 
 		switch(msgType) {
@@ -516,7 +521,7 @@ void FiledHistory::closeBlock()
 	// Mark last block as closed and start a new one
 	m_blocks << Block{
 		b.endOffset, b.startIndex + b.count, 0, b.endOffset,
-		net::MessageList()};
+		net::MessageList(), false};
 }
 
 void FiledHistory::setPasswordHash(const QByteArray &password)
@@ -622,7 +627,7 @@ void FiledHistory::joinUser(uint8_t id, const QString &name)
 	m_journal->flush();
 }
 
-std::tuple<net::MessageList, int> FiledHistory::getBatch(int after) const
+int FiledHistory::blockIndexAfter(int after) const
 {
 	// Find the block that contains the index *after*
 	int i = m_blocks.size() - 1;
@@ -631,17 +636,73 @@ std::tuple<net::MessageList, int> FiledHistory::getBatch(int after) const
 		if(b.startIndex + b.count - 1 <= after)
 			break;
 	}
+	return i;
+}
+
+bool FiledHistory::prepareBatch(int after)
+{
+	int i = blockIndexAfter(after);
+	Block &b = m_blocks[i];
+	if(b.isLoaded() || after - b.startIndex + 1 >= b.count) {
+		return true;
+	}
+
+	if(!b.loading) {
+		// Any messages written so far must be on disk for the loader to see.
+		m_recording->flush();
+		qDebug() << m_recording->fileName() << "loading block" << i
+				 << "in background";
+		b.loading = true;
+		FiledHistoryLoader *loader = new FiledHistoryLoader(
+			m_recording->fileName(), m_loadGeneration, i, b.startOffset,
+			b.endOffset - b.startOffset, b.count);
+		connect(
+			loader, &FiledHistoryLoader::blockLoaded, this,
+			&FiledHistory::onBlockLoaded, Qt::QueuedConnection);
+		QThreadPool::globalInstance()->start(loader);
+	}
+	return false;
+}
+
+void FiledHistory::onBlockLoaded(
+	int generation, int block, const net::MessageList &msgs)
+{
+	// The recording may have been reset in the meantime, or the block may
+	// have been loaded synchronously by getBatch already.
+	if(generation != m_loadGeneration || block >= m_blocks.size() ||
+	   !m_blocks[block].loading) {
+		return;
+	}
+
+	Block &b = m_blocks[block];
+	b.loading = false;
+	if(msgs.isEmpty()) {
+		// Loading failed, getBatch will try again and report the error.
+		b.messages.clear();
+	} else {
+		// Messages added while loading were collected in the cache already.
+		b.messages = msgs + b.messages;
+		Q_ASSERT(b.isLoaded());
+	}
+	emit batchPrepared();
+}
 
+std::tuple<net::MessageList, int> FiledHistory::getBatch(int after) const
+{
+	int i = blockIndexAfter(after);
 	Block &b = m_blocks[i];
 	int idxOffset = qMax(0, after - b.startIndex + 1);
 	if(idxOffset >= b.count) {
 		return std::make_tuple(net::MessageList(), b.startIndex + b.count - 1);
 	}
 
-	if(b.messages.isEmpty() && b.count > 0) {
-		// Load the block worth of messages to memory if not already loaded
+	if(!b.isLoaded()) {
+		// Load the block worth of messages to memory if not already loaded.
+		// If a background load is still underway, its result gets discarded.
 		const qint64 prevPos = m_recording->pos();
 		qDebug() << m_recording->fileName() << "loading block" << i;
+		b.loading = false;
+		b.messages.clear();
 		m_recording->seek(b.startOffset);
 		for(int m = 0; m < b.count; ++m) {
 			DP_Message *msg;
@@ -670,9 +731,15 @@ void FiledHistory::historyAdd(const net::Message &msg)
 	b.count++;
 	b.endOffset += len;
 
+	if(m_held.isEmpty())
+		m_heldIndex = b.startIndex + b.count - 1;
+	msg.holdSerialized();
+	m_held.append(msg);
+
 	// Add message to cache, if already active (if cache is empty, it will be
-	// loaded from disk when needed)
-	if(!b.messages.isEmpty())
+	// loaded from disk when needed). While the block is being loaded in the
+	// background, the cache collects the messages that come after it.
+	if(b.loading || !b.messages.isEmpty())
 		b.messages.append(msg);
 
 	if(b.endOffset - b.startOffset > MAX_BLOCK_SIZE)
@@ -681,6 +748,8 @@ void FiledHistory::historyAdd(const net::Message &msg)
 
 void FiledHistory::historyReset(const net::MessageList &newHistory)
 {
+	releaseAllSerialized();
+
 	QFile *oldRecording = m_recording;
 	oldRecording->close();
 
@@ -690,6 +759,7 @@ void FiledHistory::historyReset(const net::MessageList &newHistory)
 	DP_binary_writer_free(m_writer);
 	m_writer = nullptr;
 	m_blocks.clear();
+	++m_loadGeneration;
 	initRecording();
 
 	// Remove old recording after the new one has been created so
@@ -710,12 +780,31 @@ void FiledHistory::cleanupBatches(int before)
 	for(Block &b : m_blocks) {
 		if(b.startIndex + b.count >= before)
 			break;
-		if(!b.messages.isEmpty()) {
+		if(!b.loading && !b.messages.isEmpty()) {
 			qDebug() << "releasing history block cache from" << b.startIndex
 					 << "to" << b.startIndex + b.count - 1;
 			b.messages = net::MessageList();
 		}
 	}
+
+	// Everything up to the given index has been queued to all clients, so
+	// there's no more sharing to be had from the serialized form.
+	releaseSerialized(before);
+}
+
+void FiledHistory::releaseSerialized(int last)
+{
+	const int count = qBound(0, last - m_heldIndex + 1, int(m_held.size()));
+	for(int i = 0; i < count; ++i) {
+		m_held.at(i).releaseSerialized();
+	}
+	m_held.remove(0, count);
+	m_heldIndex += count;
+}
+
+void FiledHistory::releaseAllSerialized()
+{
+	releaseSerialized(m_heldIndex + int(m_held.size()) - 1);
 }
 
 void FiledHistory::historyAddBan(
@@ -81,6 +81,7 @@ public:
 
 	void terminate() override;
 	void cleanupBatches(int before) override;
+	bool prepareBatch(int after) override;
 	std::tuple<net::MessageList, int> getBatch(int after) const override;
 
 	void addAnnouncement(const QString &) override;
@@ -119,14 +120,22 @@ private:
 		int count;
 		qint64 endOffset;
 		net::MessageList messages;
+		bool loading;
+
+		bool isLoaded() const { return !loading && messages.size() == count; }
 	};
 
+	int blockIndexAfter(int after) const;
+	void onBlockLoaded(int generation, int block, const net::MessageList &msgs);
+
 	void discardWriterOnError(const QString &context, const QString &filename);
 
 	bool create();
 	bool load();
 	bool scanBlocks();
 	bool initRecording();
+	void releaseSerialized(int last);
+	void releaseAllSerialized();
 
 	QDir m_dir;
 	QFile *m_journal;
@@ -148,6 +157,11 @@ private:
 	QStringList m_announcements;
 
 	mutable QVector<Block> m_blocks;
+	// Messages that haven't been sent to every client yet and are held to
+	// share their serialized form between them, starting at m_heldIndex.
+	net::MessageList m_held;
+	int m_heldIndex;
+	int m_loadGeneration;
 	int m_fileCount;
 	bool m_archive;
 };
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+extern "C" {
+#include <dpcommon/input.h>
+#include <dpcommon/input_qt.h>
+#include <dpmsg/binary_reader.h>
+}
+#include "libserver/filedhistoryloader.h"
+#include <QDebug>
+#include <QFile>
+
+namespace server {
+
+FiledHistoryLoader::FiledHistoryLoader(
+	const QString &path, int generation, int block, qint64 offset,
+	qint64 length, int count)
+	: m_path(path)
+	, m_generation(generation)
+	, m_block(block)
+	, m_offset(offset)
+	, m_length(length)
+	, m_count(count)
+{
+	qRegisterMetaType<net::MessageList>("net::MessageList");
+}
+
+void FiledHistoryLoader::run()
+{
+	net::MessageList msgs;
+	QFile file(m_path);
+	if(!file.open(QFile::ReadOnly) || !file.seek(m_offset)) {
+		qWarning() << m_path << "can't open for loading:" << file.errorString();
+		emit blockLoaded(m_generation, m_block, msgs);
+		return;
+	}
+
+	// The mapping goes away with the file, after the reader is done with it.
+	uchar *data = m_length > 0 ? file.map(m_offset, m_length) : nullptr;
+	DP_Input *input =
+		data ? DP_mem_input_new_keep_on_close(data, size_t(m_length))
+			 : DP_qfile_input_new(&file, false, DP_input_new);
+	DP_BinaryReader *reader = DP_binary_reader_new(
+		input,
+		DP_BINARY_READER_FLAG_NO_LENGTH | DP_BINARY_READER_FLAG_NO_HEADER);
+
+	msgs.reserve(m_count);
+	for(int m = 0; m < m_count; ++m) {
+		DP_Message *msg;
+		DP_BinaryReaderResult result =
+			DP_binary_reader_read_message(reader, false, &msg);
+		if(result != DP_BINARY_READER_SUCCESS) {
+			qWarning() << m_path << "read error in block" << m_block;
+			msgs.clear();
+			break;
+		}
+		msgs.append(net::Message::noinc(msg));
+	}
+
+	DP_binary_reader_free(reader);
+	emit blockLoaded(m_generation, m_block, msgs);
+}
+
+}
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DP_SERVER_FILEDHISTORYLOADER_H
+#define DP_SERVER_FILEDHISTORYLOADER_H
+#include "libshared/net/message.h"
+#include <QObject>
+#include <QRunnable>
+#include <QString>
+
+namespace server {
+
+/**
+ * @brief Reads a block of a history recording on a background thread
+ *
+ * The loader opens the recording file separately, so it doesn't interfere
+ * with the session writing to it at the same time. The blockLoaded signal is
+ * emitted from the thread pool, so connect to it with a queued connection.
+ * The block is already on disk in full, so it gets mapped into memory and its
+ * messages deserialized from there if possible.
+ */
+class FiledHistoryLoader final : public QObject, public QRunnable {
+	Q_OBJECT
+public:
+	FiledHistoryLoader(
+		const QString &path, int generation, int block, qint64 offset,
+		qint64 length, int count);
+
+	void run() override;
+
+signals:
+	/**
+	 * @brief The block has been read
+	 *
+	 * On error, the message list is empty.
+	 */
+	void blockLoaded(int generation, int block, const net::MessageList &msgs);
+
+private:
+	QString m_path;
+	int m_generation;
+	int m_block;
+	qint64 m_offset;
+	qint64 m_length;
+	int m_count;
+};
+
+}
+
+#endif
@@ -12,6 +12,7 @@ InMemoryHistory::InMemoryHistory(
 	, m_alias(alias)
 	, m_founder(founder)
 	, m_version(version)
+	, m_heldOffset(0)
 	, m_maxUsers(254)
 	, m_autoReset(0)
 	, m_flags()
@@ -19,6 +20,11 @@ InMemoryHistory::InMemoryHistory(
 {
 }
 
+InMemoryHistory::~InMemoryHistory()
+{
+	releaseSerialized(int(m_history.size()));
+}
+
 int InMemoryHistory::nextCatchupKey()
 {
 	return incrementNextCatchupKey(m_nextCatchupKey);
@@ -35,14 +41,34 @@ std::tuple<net::MessageList, int> InMemoryHistory::getBatch(int after) const
 	return std::make_tuple(m_history.mid(offset), lastIndex());
 }
 
+void InMemoryHistory::cleanupBatches(int before)
+{
+	// Everything up to the given index has been queued to all clients, so
+	// there's no more sharing to be had from the serialized form.
+	releaseSerialized(qMin(before - firstIndex() + 1, int(m_history.size())));
+}
+
 void InMemoryHistory::historyAdd(const net::Message &msg)
 {
+	msg.holdSerialized();
 	m_history.append(msg);
 }
 
 void InMemoryHistory::historyReset(const net::MessageList &newHistory)
 {
+	releaseSerialized(int(m_history.size()));
 	m_history = newHistory;
+	m_heldOffset = 0;
+	for(const net::Message &msg : m_history) {
+		msg.holdSerialized();
+	}
+}
+
+void InMemoryHistory::releaseSerialized(int end)
+{
+	for(; m_heldOffset < end; ++m_heldOffset) {
+		m_history.at(m_heldOffset).releaseSerialized();
+	}
 }
 
 }
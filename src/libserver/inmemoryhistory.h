@@ -17,6 +17,7 @@ public:
 		const QString &id, const QString &alias,
 		const protocol::ProtocolVersion &version, const QString &founder,
 		QObject *parent = nullptr);
+	~InMemoryHistory() override;
 
 	std::tuple<net::MessageList, int> getBatch(int after) const override;
 
@@ -25,10 +26,7 @@ public:
 		// nothing to do
 	}
 
-	void cleanupBatches(int) override
-	{
-		// no caching, nothing to do
-	}
+	void cleanupBatches(int before) override;
 
 	QString idAlias() const override { return m_alias; }
 	QString founderName() const override { return m_founder; }
@@ -85,7 +83,12 @@ protected:
 	}
 
 private:
+	void releaseSerialized(int end);
+
 	net::MessageList m_history;
+	// Messages from this offset onward haven't been sent to every client yet
+	// and are held to share their serialized form between them.
+	int m_heldOffset;
 	QSet<QString> m_announcements;
 	QString m_alias;
 	QString m_founder;
@@ -20,19 +20,44 @@ namespace server {
 
 Sessions::~Sessions() {}
 
+void Sessions::runInSession(Session *, const std::function<void()> &fn)
+{
+	fn();
+}
+
+void Sessions::joinSession(
+	Session *session, Client *client, bool host,
+	const std::function<void()> &afterJoin)
+{
+	session->joinUser(client, host);
+	afterJoin();
+}
+
 class LoginHandler::ClientInfoLogGuard {
 public:
 	ClientInfoLogGuard(LoginHandler *loginHandler, const QJsonObject &info)
 		: m_loginHandler(loginHandler)
 		, m_info(info)
+		, m_logged(false)
 	{
 	}
 
-	~ClientInfoLogGuard() { m_loginHandler->logClientInfo(m_info); }
+	~ClientInfoLogGuard() { logNow(); }
+
+	// Once the client has joined, this must be called from the session's
+	// thread, since the log entry goes through the session.
+	void logNow()
+	{
+		if(!m_logged) {
+			m_logged = true;
+			m_loginHandler->logClientInfo(m_info);
+		}
+	}
 
 private:
 	LoginHandler *m_loginHandler;
 	QJsonObject m_info;
+	bool m_logged;
 };
 
 LoginHandler::LoginHandler(
@@ -300,8 +325,12 @@ void LoginHandler::handleLookupMessage(const net::ServerCommand &cmd)
 				return;
 			}
 			m_lookup = session->id();
+			QJsonObject description;
+			m_sessions->runInSession(session, [&] {
+				description = session->getDescription();
+			});
 			msg = net::ServerReply::makeResultJoinLookup(
-				QStringLiteral("Join lookup OK!"), session->getDescription());
+				QStringLiteral("Join lookup OK!"), description);
 		}
 
 	} else {
@@ -886,9 +915,7 @@ void LoginHandler::handleHostMessage(const net::ServerCommand &cmd)
 	checkClientCapabilities(cmd);
 
 	m_complete = true;
-	session->joinUser(m_client, true);
-
-	deleteLater();
+	joinSession(session, true, clientInfoLogGuard);
 }
 
 void LoginHandler::handleJoinMessage(const net::ServerCommand &cmd)
@@ -924,76 +951,108 @@ void LoginHandler::handleJoinMessage(const net::ServerCommand &cmd)
 		return;
 	}
 
-	if(m_client->isWebSocket() &&
-	   !session->history()->hasFlag(SessionHistory::AllowWeb)) {
+	// The session may live in another thread, so its state is only looked at
+	// from within runInSession. Replies are sent from out here though, since
+	// the client is still in this thread until it joins.
+	protocol::ProtocolVersion protocolVersion;
+	bool allowWeb = false;
+	m_sessions->runInSession(session, [&] {
+		protocolVersion = session->history()->protocolVersion();
+		allowWeb = session->history()->hasFlag(SessionHistory::AllowWeb);
+	});
+
+	if(m_client->isWebSocket() && !allowWeb) {
 		sendError(
 			QStringLiteral("noWebJoin"),
 			QStringLiteral("This session does not allow joining from the web"));
 		return;
 	}
 
-	if(!verifySystemId(cmd, session->history()->protocolVersion())) {
+	if(!verifySystemId(cmd, protocolVersion)) {
 		return;
 	}
 
-	if(!m_client->isModerator()) {
-		// Non-moderators have to obey access restrictions
-		int banId = session->history()->banlist().isBanned(
-			m_client->username(), m_client->peerAddress(), m_client->authId(),
-			m_client->sid());
-		if(banId != 0) {
-			session->log(
-				Log()
-					.about(Log::Level::Info, Log::Topic::Ban)
-					.user(
-						m_client->id(), m_client->peerAddress(),
-						m_client->username())
-					.message(
-						QStringLiteral("Join prevented by ban %1").arg(banId)));
-			sendError(
-				"banned", QStringLiteral(
-							  "You have been banned from this session (ban %1)")
-							  .arg(banId));
-			return;
-		}
-		if(session->isClosed()) {
-			sendError("closed", "This session is closed");
-			return;
-		}
-		if(session->history()->hasFlag(SessionHistory::AuthOnly) &&
-		   !m_client->isAuthenticated()) {
-			sendError("authOnly", "This session does not allow guest logins");
-			return;
+	QString errorCode;
+	QString errorMessage;
+	bool badPassword = false;
+	int existingClientId = 0;
+	m_sessions->runInSession(session, [&] {
+		if(!m_client->isModerator()) {
+			// Non-moderators have to obey access restrictions
+			int banId = session->history()->banlist().isBanned(
+				m_client->username(), m_client->peerAddress(),
+				m_client->authId(), m_client->sid());
+			if(banId != 0) {
+				session->log(
+					Log()
+						.about(Log::Level::Info, Log::Topic::Ban)
+						.user(
+							m_client->id(), m_client->peerAddress(),
+							m_client->username())
+						.message(QStringLiteral("Join prevented by ban %1")
+									 .arg(banId)));
+				errorCode = QStringLiteral("banned");
+				errorMessage =
+					QStringLiteral(
+						"You have been banned from this session (ban %1)")
+						.arg(banId);
+				return;
+			}
+			if(session->isClosed()) {
+				errorCode = QStringLiteral("closed");
+				errorMessage = QStringLiteral("This session is closed");
+				return;
+			}
+			if(session->history()->hasFlag(SessionHistory::AuthOnly) &&
+			   !m_client->isAuthenticated()) {
+				errorCode = QStringLiteral("authOnly");
+				errorMessage =
+					QStringLiteral("This session does not allow guest logins");
+				return;
+			}
+			if(!session->history()->checkPassword(
+				   cmd.kwargs.value("password").toString())) {
+				badPassword = true;
+				return;
+			}
 		}
 
-		if(!session->history()->checkPassword(
-			   cmd.kwargs.value("password").toString())) {
-			++m_sessionPasswordAttempts;
-			m_client->log(
-				Log()
-					.about(Log::Level::Warn, Log::Topic::RuleBreak)
-					.message(
-						QStringLiteral(
-							"Incorrect password for session %1 (attempt %2/%3)")
-							.arg(session->id())
-							.arg(m_sessionPasswordAttempts)
-							.arg(MAX_PASSWORD_ATTEMPTS)));
-			sendError(
-				"badPassword", "Incorrect password",
-				m_sessionPasswordAttempts >= MAX_PASSWORD_ATTEMPTS);
-			return;
+		Client *existingClient =
+			session->getClientByUsername(m_client->username());
+		if(existingClient) {
+			bool shouldReplace = m_client->isAuthenticated() &&
+								 existingClient->isAuthenticated() &&
+								 m_client->authId() == existingClient->authId();
+			if(!shouldReplace) {
+				errorCode = QStringLiteral("nameInuse");
+				errorMessage =
+					QStringLiteral("This username is already in use");
+				return;
+			}
+			existingClientId = existingClient->id();
 		}
+	});
+
+	if(badPassword) {
+		++m_sessionPasswordAttempts;
+		m_client->log(
+			Log()
+				.about(Log::Level::Warn, Log::Topic::RuleBreak)
+				.message(
+					QStringLiteral(
+						"Incorrect password for session %1 (attempt %2/%3)")
+						.arg(session->id())
+						.arg(m_sessionPasswordAttempts)
+						.arg(MAX_PASSWORD_ATTEMPTS)));
+		sendError(
+			"badPassword", "Incorrect password",
+			m_sessionPasswordAttempts >= MAX_PASSWORD_ATTEMPTS);
+		return;
 	}
 
-	Client *existingClient = session->getClientByUsername(m_client->username());
-	if(existingClient) {
-		bool shouldReplace = m_client->isAuthenticated() &&
-							 existingClient->isAuthenticated() &&
-							 m_client->authId() == existingClient->authId();
-		if(!shouldReplace) {
-			sendError("nameInuse", "This username is already in use");
-			return;
-		}
+	if(!errorCode.isEmpty()) {
+		sendError(errorCode, errorMessage);
+		return;
 	}
 
 	if(m_client->triggerBan(false)) {
@@ -1001,24 +1060,40 @@ void LoginHandler::handleJoinMessage(const net::ServerCommand &cmd)
 		return;
 	}
 
-	if(existingClient) {
-		m_client->setId(existingClient->id());
-	} else {
-		session->assignId(m_client);
-	}
+	QString aliasOrId;
+	QJsonArray flags;
+	m_sessions->runInSession(session, [&] {
+		if(existingClientId != 0) {
+			m_client->setId(existingClientId);
+		} else {
+			session->assignId(m_client);
+		}
+		aliasOrId = session->aliasOrId();
+		flags = sessionFlags(session);
+	});
 
 	send(net::ServerReply::makeResultJoinHost(
 		QStringLiteral("Joining a session!"), QStringLiteral("join"),
-		{{QStringLiteral("id"), session->aliasOrId()},
+		{{QStringLiteral("id"), aliasOrId},
 		 {QStringLiteral("user"), m_client->id()},
-		 {QStringLiteral("flags"), sessionFlags(session)},
+		 {QStringLiteral("flags"), flags},
 		 {QStringLiteral("authId"), m_client->authId()}}));
 
 	checkClientCapabilities(cmd);
 
 	m_complete = true;
-	session->joinUser(m_client, false);
+	joinSession(session, false, clientInfoLogGuard);
+}
 
+void LoginHandler::joinSession(
+	Session *session, bool host, ClientInfoLogGuard &clientInfoLogGuard)
+{
+	// The client may be moved to the session's thread, which would drag us
+	// along with it if we stayed its child. We're done at this point anyway.
+	setParent(nullptr);
+	m_sessions->joinSession(session, m_client, host, [&] {
+		clientInfoLogGuard.logNow();
+	});
 	deleteLater();
 }
 
@@ -1089,7 +1164,10 @@ void LoginHandler::handleAbuseReport(const net::ServerCommand &cmd)
 		Session *s =
 			m_sessions->getSessionById(cmd.kwargs["session"].toString(), false);
 		if(s) {
-			s->sendAbuseReport(m_client, 0, cmd.kwargs["reason"].toString());
+			const QString reason = cmd.kwargs["reason"].toString();
+			m_sessions->runInSession(s, [&] {
+				s->sendAbuseReport(m_client, 0, reason);
+			});
 		}
 	}
 }
@@ -101,6 +101,8 @@ private:
 	void handleIdentMessage(const net::ServerCommand &cmd);
 	void handleHostMessage(const net::ServerCommand &cmd);
 	void handleJoinMessage(const net::ServerCommand &cmd);
+	void joinSession(
+		Session *session, bool host, ClientInfoLogGuard &clientInfoLogGuard);
 	void checkClientCapabilities(const net::ServerCommand &cmd);
 	QJsonObject extractClientInfo(const net::ServerCommand &cmd);
 	void logClientInfo(const QJsonObject &info);
@@ -4,13 +4,18 @@
 
 #include <QRegularExpression>
 #include <QJsonObject>
+#include <QMutexLocker>
 
 namespace server {
 
 QString ServerConfig::getConfigString(ConfigKey key) const
 {
 	bool found = false;
-	const QString val = getConfigValue(key, found);
+	QString val;
+	{
+		QMutexLocker locker(&m_configMutex);
+		val = getConfigValue(key, found);
+	}
 	if(!found) {
 		return key.defaultValue;
 	}
@@ -93,7 +98,10 @@ bool ServerConfig::setConfigString(ConfigKey key, const QString &value)
 
 	// TODO key specific validation
 
-	setConfigValue(key, value);
+	{
+		QMutexLocker locker(&m_configMutex);
+		setConfigValue(key, value);
+	}
 	emit configValueChanged(key);
 	return true;
 }
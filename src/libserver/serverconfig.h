@@ -3,6 +3,7 @@
 #ifndef SERVERCONFIG_H
 #define SERVERCONFIG_H
 
+#include <QMutex>
 #include <QObject>
 #include <QString>
 #include <QHash>
@@ -192,6 +193,10 @@ struct ExtBan {
  * These are the configuration settings that can be changed at runtime.
  * The default storage implementation is a simple in-memory key/value map.
  * Deriving classes can implement persistent storage of settings.
+ *
+ * The configuration value getters may be called from any thread, since
+ * sessions can run on threads of their own. Access to the storage is
+ * serialized, so implementations don't need to do their own locking.
  */
 class ServerConfig : public QObject
 {
@@ -334,6 +339,7 @@ private:
 
 	static QJsonArray banUsersToJson(const QVector<BanUser> &users);
 
+	mutable QMutex m_configMutex;
 	InternalConfig m_internalCfg;
 	QVector<ExtBan> m_extBans;
 	QSet<int> m_disabledExtBanIds;
@@ -70,6 +70,7 @@ void ServerLog::logMessage(const Log &entry)
 		case Log::Level::Debug: logger.debug("%s", qPrintable(entry.toString())); break;
 		}
 	}
+	QMutexLocker locker(&m_mutex);
 	storeMessage(entry);
 }
 
@@ -5,6 +5,7 @@
 
 #include <QDateTime>
 #include <QHostAddress>
+#include <QMutex>
 
 #include "libshared/util/ulid.h"
 
@@ -146,9 +147,13 @@ private:
 
 /**
  * @brief Abstract base class for server logger implementations
+ *
+ * Messages may be logged and queried from any thread. Calls to the storage
+ * functions are serialized, so implementations don't need to lock themselves.
  */
 class ServerLog
 {
+	friend class ServerLogQuery;
 public:
 	ServerLog() : m_silent(false) { }
 	virtual ~ServerLog() = default;
@@ -181,14 +186,25 @@ public:
 	 */
 	ServerLogQuery query() const { return ServerLogQuery(*this); }
 
+	/**
+	 * @brief Wait until all logged messages can be queried
+	 *
+	 * Queries call this before taking the lock, so implementations that store
+	 * messages in the background don't hold up logging while they wait.
+	 */
+	virtual void flush() const { }
+
 protected:
 	virtual void storeMessage(const Log &entry) = 0;
 
 private:
+	mutable QMutex m_mutex;
 	bool m_silent;
 };
 
 inline QList<Log> ServerLogQuery::get() const {
+	m_log.flush();
+	QMutexLocker locker(&m_log.m_mutex);
 	return m_log.getLogEntries(m_session, m_after, m_atleast, m_omitSensitive, m_offset, m_limit);
 }
 
@@ -9,13 +9,17 @@ extern "C" {
 #include "libserver/serverconfig.h"
 #include "libserver/serverlog.h"
 #include "libserver/session.h"
+#include "libserver/sessionthreads.h"
 #include "libshared/net/servercmd.h"
 #include "libshared/util/filename.h"
 #include "libshared/util/networkaccess.h"
 #include "libshared/util/passwordhash.h"
 #include "libshared/util/qtcompat.h"
+#include <QMetaMethod>
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QPointer>
+#include <QThread>
 #include <QTimer>
 
 namespace server {
@@ -1172,7 +1176,14 @@ void Session::killSession(const QString &message, bool terminate)
 	if(terminate)
 		m_history->terminate();
 
-	this->deleteLater();
+	// If there's a session manager listening, it takes care of deleting us.
+	// It needs to forget about this session first, which may happen in a
+	// different thread.
+	if(isSignalConnected(QMetaMethod::fromSignal(&Session::sessionKilled))) {
+		emit sessionKilled(this);
+	} else {
+		this->deleteLater();
+	}
 }
 
 void Session::directToAll(const net::Message &msg)
@@ -1331,13 +1342,26 @@ QStringList Session::userNames() const
 void Session::makeAnnouncement(const QUrl &url)
 {
 	Q_ASSERT(m_announcements);
-	m_announcements->announceSession(this, url);
+	// The announcements may live in a different thread than this session, so
+	// this session may already be gone by the time the call gets there.
+	sessionlisting::Announcements *announcements = m_announcements;
+	QPointer<Session> session(this);
+	QMetaObject::invokeMethod(announcements, [announcements, session, url] {
+		if(session)
+			announcements->announceSession(session, url);
+	});
 }
 
 void Session::unlistAnnouncement(const QUrl &url, bool terminate)
 {
 	Q_ASSERT(m_announcements);
-	m_announcements->unlistSession(this, url);
+	// If the session is gone, removing it already took its listings with it.
+	sessionlisting::Announcements *announcements = m_announcements;
+	QPointer<Session> session(this);
+	QMetaObject::invokeMethod(announcements, [announcements, session, url] {
+		if(session)
+			announcements->unlistSession(session, url);
+	});
 
 	if(terminate)
 		m_history->removeAnnouncement(url.toString());
@@ -1345,6 +1369,14 @@ void Session::unlistAnnouncement(const QUrl &url, bool terminate)
 
 sessionlisting::Session Session::getSessionAnnouncement() const
 {
+	if(thread() != QThread::currentThread()) {
+		sessionlisting::Session description;
+		SessionThreads::run(const_cast<Session *>(this), [&] {
+			description = getSessionAnnouncement();
+		});
+		return description;
+	}
+
 	const bool privateUserList =
 		m_config->getConfigBool(config::PrivateUserList);
 
@@ -1372,6 +1404,14 @@ sessionlisting::Session Session::getSessionAnnouncement() const
 bool Session::hasUrgentAnnouncementChange(
 	const sessionlisting::Session &description) const
 {
+	if(thread() != QThread::currentThread()) {
+		bool urgent = false;
+		SessionThreads::run(const_cast<Session *>(this), [&] {
+			urgent = hasUrgentAnnouncementChange(description);
+		});
+		return urgent;
+	}
+
 	return description.title != m_history->title() ||
 		   description.nsfm != m_history->hasFlag(SessionHistory::Nsfm) ||
 		   description.password != !m_history->passwordHash().isEmpty() ||
@@ -1381,6 +1421,15 @@ bool Session::hasUrgentAnnouncementChange(
 		   description.allowWeb != m_history->hasFlag(SessionHistory::AllowWeb);
 }
 
+void Session::sendListserverMessage(const QString &message)
+{
+	// Queued with this session as the context, so it's dropped if the session
+	// gets deleted before it runs.
+	QMetaObject::invokeMethod(this, [this, message] {
+		messageAll(message, false);
+	});
+}
+
 
 void Session::onAnnouncementsChanged(const sessionlisting::Announcable *session)
 {
@@ -259,10 +259,7 @@ public:
 	bool hasUrgentAnnouncementChange(
 		const sessionlisting::Session &description) const override;
 
-	void sendListserverMessage(const QString &message) override
-	{
-		messageAll(message, false);
-	}
+	void sendListserverMessage(const QString &message) override;
 
 	//! Get the session state
 	State state() const { return m_state; }
@@ -374,6 +371,14 @@ signals:
 	 */
 	void sessionAttributeChanged(Session *thisSession);
 
+	/**
+	 * @brief The session has been shut down
+	 *
+	 * If anything is connected to this, the receiver is responsible for
+	 * deleting the session. Otherwise, the session deletes itself.
+	 */
+	void sessionKilled(Session *thisSession);
+
 	void sessionDestroyed(Session *thisSession);
 
 private slots:
@@ -163,6 +163,20 @@ public:
 	 */
 	bool reset(const net::MessageList &newHistory);
 
+	/**
+	 * @brief Make sure the batch following the given index can be fetched
+	 *
+	 * Storage backends that keep messages on disk may load them on a
+	 * background thread. If this returns false, the batch isn't ready yet and
+	 * the signal batchPrepared() will be emitted once it is. Calling getBatch
+	 * before that is allowed, but will load the messages synchronously.
+	 */
+	virtual bool prepareBatch(int after)
+	{
+		Q_UNUSED(after);
+		return true;
+	}
+
 	/**
 	 * @brief Get a batch of messages
 	 *
@@ -340,6 +354,13 @@ signals:
 	 */
 	void newMessagesAvailable();
 
+	/**
+	 * @brief A batch requested via prepareBatch() has been loaded
+	 *
+	 * Clients waiting for it should try sending their next batch again.
+	 */
+	void batchPrepared();
+
 protected:
 	static constexpr int MIN_CATCHUP_KEY = 1;
 	static constexpr int MAX_CATCHUP_KEY = 999999999;
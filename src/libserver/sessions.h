@@ -3,6 +3,7 @@
 #ifndef SESSIONS_INTERFACE_H
 #define SESSIONS_INTERFACE_H
 
+#include <functional>
 #include <tuple>
 
 class QJsonArray;
@@ -14,6 +15,7 @@ namespace protocol {
 
 namespace server {
 
+class Client;
 class Session;
 
 /**
@@ -54,6 +56,24 @@ public:
 	 * @return session, error string pair: if session is null, error string contains the error code
 	 */
 	virtual std::tuple<Session*, QString> createSession(const QString &id, const QString &alias, const protocol::ProtocolVersion &protocolVersion, const QString &founder) = 0;
+
+	/**
+	 * Call a function in the session's thread and wait for it to finish
+	 *
+	 * The session's state must only be touched from within such a function.
+	 * The default implementation calls the function directly.
+	 */
+	virtual void runInSession(Session *session, const std::function<void()> &fn);
+
+	/**
+	 * Add a logged in client to a session
+	 *
+	 * The afterJoin function is called right after the client has joined, in
+	 * the same thread as the session. The default implementation does both
+	 * directly, an implementation with multiple threads may move the session
+	 * and the client to another thread first.
+	 */
+	virtual void joinSession(Session *session, Client *client, bool host, const std::function<void()> &afterJoin);
 };
 
 }
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "libserver/sessionserver.h"
+#include "libserver/sessionthreads.h"
 #include "libserver/thinsession.h"
 #include "libserver/thinserverclient.h"
 #include "libserver/loginhandler.h"
@@ -12,6 +13,7 @@
 #include "libserver/announcements.h"
 
 #include <QTimer>
+#include <QThread>
 #include <QJsonArray>
 #include <QJsonDocument>
 
@@ -21,7 +23,9 @@ SessionServer::SessionServer(ServerConfig *config, QObject *parent)
 	: QObject(parent),
 	m_config(config),
 	m_tpls(nullptr),
-	m_useFiledSessions(false)
+	m_useFiledSessions(false),
+	m_threads(nullptr),
+	m_handedOffClients(0)
 {
 	m_announcements = new sessionlisting::Announcements(config, this);
 
@@ -31,6 +35,30 @@ SessionServer::SessionServer(ServerConfig *config, QObject *parent)
 	cleanupTimer->start(cleanupTimer->interval());
 }
 
+SessionServer::~SessionServer()
+{
+	// Sessions that were handed off to another thread aren't our children
+	// anymore. Stopping the threads deletes them, which has to happen before
+	// the announcements and other shared state go away.
+	for(Session *s : m_sessions) {
+		if(s->thread() != thread())
+			s->deleteLater();
+	}
+	delete m_threads;
+}
+
+void SessionServer::setSessionThreads(int count)
+{
+	Q_ASSERT(m_clients.isEmpty() && m_handedOffClients == 0);
+	delete m_threads;
+	m_threads = count > 0 ? new SessionThreads(count, this) : nullptr;
+}
+
+int SessionServer::sessionThreadCount() const
+{
+	return m_threads ? m_threads->threads().size() : 0;
+}
+
 void SessionServer::setSessionDir(const QDir &dir)
 {
 	if(dir.isReadable()) {
@@ -67,8 +95,10 @@ QJsonArray SessionServer::sessionDescriptions() const
 	QJsonArray descs;
 	QStringList aliases;
 
-	for(const Session *s : m_sessions) {
-		descs.append(s->getDescription());
+	for(Session *s : m_sessions) {
+		SessionThreads::run(s, [&] {
+			descs.append(s->getDescription());
+		});
 		if(!s->idAlias().isEmpty())
 			aliases << s->idAlias();
 	}
@@ -163,8 +193,9 @@ void SessionServer::initSession(Session *session)
 {
 	m_sessions.append(session);
 
+	// Sessions may run in another thread, so these are queued in that case.
 	connect(session, &Session::sessionAttributeChanged, this, &SessionServer::onSessionAttributeChanged);
-	connect(session, &Session::sessionDestroyed, this, &SessionServer::removeSession, Qt::DirectConnection);
+	connect(session, &Session::sessionKilled, this, &SessionServer::removeSession);
 
 	emit sessionCreated(session);
 	emit sessionChanged(session->getDescription());
@@ -175,6 +206,7 @@ void SessionServer::removeSession(Session *session)
 	m_sessions.removeOne(session);
 	m_announcements->unlistSession(session); // just to be safe
 	emit sessionEnded(session->id());
+	session->deleteLater();
 }
 
 Session *SessionServer::getSessionById(const QString &id, bool load)
@@ -191,6 +223,59 @@ Session *SessionServer::getSessionById(const QString &id, bool load)
 	return nullptr;
 }
 
+void SessionServer::runInSession(Session *session, const std::function<void()> &fn)
+{
+	SessionThreads::run(session, fn);
+}
+
+void SessionServer::joinSession(Session *session, Client *client, bool host, const std::function<void()> &afterJoin)
+{
+	if(!m_threads) {
+		Sessions::joinSession(session, client, host, afterJoin);
+		return;
+	}
+
+	// From here on, the client belongs to the session's thread
+	ThinServerClient *thinClient = static_cast<ThinServerClient*>(client);
+	m_clients.removeOne(thinClient);
+	++m_handedOffClients;
+	disconnect(thinClient, &ThinServerClient::thinServerClientDestroyed, this, &SessionServer::removeClient);
+	connect(thinClient, &ThinServerClient::thinServerClientDestroyed, this, &SessionServer::removeHandedOffClient);
+	thinClient->setParent(nullptr);
+
+	QObjectList objects = {thinClient};
+	QThread *target = session->thread();
+	if(target == thread()) {
+		// First one to join, the session moves along with the client
+		target = pickSessionThread();
+		session->setParent(nullptr);
+		objects.prepend(session);
+	}
+
+	m_threads->handOff(target, objects, [&] {
+		session->joinUser(client, host);
+		afterJoin();
+	});
+}
+
+QThread *SessionServer::pickSessionThread() const
+{
+	const QVector<QThread*> &threads = m_threads->threads();
+	QVector<int> counts(threads.size(), 0);
+	for(const Session *s : m_sessions) {
+		int i = threads.indexOf(s->thread());
+		if(i != -1)
+			++counts[i];
+	}
+
+	int best = 0;
+	for(int i = 1; i < counts.size(); ++i) {
+		if(counts[i] < counts[best])
+			best = i;
+	}
+	return threads[best];
+}
+
 void SessionServer::stopAll()
 {
 	for(ThinServerClient *c : m_clients) {
@@ -201,14 +286,21 @@ void SessionServer::stopAll()
 			QStringLiteral("SessionServer::stopAll"));
 	}
 
-	for(Session *s : m_sessions)
-		s->killSession(QStringLiteral("Server shutting down"), false);
+	// Killing a session may remove it from the list right away
+	const QList<Session*> sessions = m_sessions;
+	for(Session *s : sessions) {
+		runInSession(s, [s] {
+			s->killSession(QStringLiteral("Server shutting down"), false);
+		});
+	}
 }
 
 void SessionServer::messageAll(const QString &message, bool alert)
 {
 	for(Session *s : m_sessions) {
-		s->messageAll(message, alert);
+		runInSession(s, [&] {
+			s->messageAll(message, alert);
+		});
 	}
 }
 
@@ -222,7 +314,7 @@ void SessionServer::addClient(ThinServerClient *client)
 		client, &ThinServerClient::thinServerClientDestroyed, this,
 		&SessionServer::removeClient, Qt::DirectConnection);
 
-	emit userCountChanged(m_clients.size());
+	emit userCountChanged(totalUsers());
 
 	auto *login = new LoginHandler(client, this, m_config);
 	connect(this, &SessionServer::sessionChanged, login, &LoginHandler::announceSession);
@@ -233,7 +325,13 @@ void SessionServer::addClient(ThinServerClient *client)
 void SessionServer::removeClient(ThinServerClient *client)
 {
 	m_clients.removeOne(client);
-	emit userCountChanged(m_clients.size());
+	emit userCountChanged(totalUsers());
+}
+
+void SessionServer::removeHandedOffClient()
+{
+	--m_handedOffClients;
+	emit userCountChanged(totalUsers());
 }
 
 /**
@@ -247,23 +345,34 @@ void SessionServer::onSessionAttributeChanged(Session *session)
 {
 	Q_ASSERT(session);
 
+	// The signal may have been queued from a session thread and the session
+	// could have been shut down in the meantime.
+	if(!m_sessions.contains(session))
+		return;
+
 	bool delSession = false;
+	QJsonObject description;
 
-	if(session->userCount()==0 && session->state() != Session::State::Shutdown) {
-		session->log(Log().about(Log::Level::Info, Log::Topic::Status).message("Last user left."));
+	runInSession(session, [&] {
+		if(session->userCount()==0 && session->state() != Session::State::Shutdown) {
+			session->log(Log().about(Log::Level::Info, Log::Topic::Status).message("Last user left."));
 
-		// A non-persistent session is deleted when the last user leaves
-		// A persistent session can also be deleted if it doesn't contain a snapshot point.
-		if(!session->history()->hasFlag(SessionHistory::Persistent)) {
-			session->log(Log().about(Log::Level::Info, Log::Topic::Status).message("Closing non-persistent session."));
-			delSession = true;
+			// A non-persistent session is deleted when the last user leaves
+			// A persistent session can also be deleted if it doesn't contain a snapshot point.
+			if(!session->history()->hasFlag(SessionHistory::Persistent)) {
+				session->log(Log().about(Log::Level::Info, Log::Topic::Status).message("Closing non-persistent session."));
+				delSession = true;
+			}
 		}
-	}
 
-	if(delSession)
-		session->killSession(QStringLiteral("Session terminated due to being empty"));
-	else
-		emit sessionChanged(session->getDescription());
+		if(delSession)
+			session->killSession(QStringLiteral("Session terminated due to being empty"));
+		else
+			description = session->getDescription();
+	});
+
+	if(!delSession)
+		emit sessionChanged(description);
 }
 
 void SessionServer::cleanupSessions()
@@ -272,15 +381,18 @@ void SessionServer::cleanupSessions()
 	bool allowIdleOverride = m_config->getConfigBool(config::AllowIdleOverride);
 
 	if(expirationTime>0) {
-		for(Session *s : m_sessions) {
-			bool isExpired =
-				s->lastEventTime() > expirationTime &&
-				(!allowIdleOverride ||
-				 !s->history()->hasFlag(SessionHistory::IdleOverride));
-			if(isExpired) {
-				s->log(Log().about(Log::Level::Info, Log::Topic::Status).message("Idle session expired."));
-				s->killSession(QStringLiteral("Session terminated due to being idle too long"));
-			}
+		const QList<Session*> sessions = m_sessions;
+		for(Session *s : sessions) {
+			runInSession(s, [&] {
+				bool isExpired =
+					s->lastEventTime() > expirationTime &&
+					(!allowIdleOverride ||
+					 !s->history()->hasFlag(SessionHistory::IdleOverride));
+				if(isExpired) {
+					s->log(Log().about(Log::Level::Info, Log::Topic::Status).message("Idle session expired."));
+					s->killSession(QStringLiteral("Session terminated due to being idle too long"));
+				}
+			});
 		}
 	}
 }
@@ -293,10 +405,15 @@ JsonApiResult SessionServer::callSessionJsonApi(JsonApiMethod method, const QStr
 
 	if(!head.isEmpty()) {
 		Session *s = getSessionById(head, false);
-		if(s)
-			return s->callJsonApi(method, tail, request);
-		else
+		if(s) {
+			JsonApiResult result = JsonApiNotFound();
+			runInSession(s, [&] {
+				result = s->callJsonApi(method, tail, request);
+			});
+			return result;
+		} else {
 			return JsonApiNotFound();
+		}
 	}
 
 	if(method == JsonApiMethod::Get) {
@@ -329,12 +446,24 @@ JsonApiResult SessionServer::callUserJsonApi(JsonApiMethod method, const QString
 			for(const ThinServerClient *c : m_clients) {
 				userlist.append(c->description());
 			}
+			for(Session *s : m_sessions) {
+				if(s->thread() != thread()) {
+					runInSession(s, [&] {
+						for(const Client *c : s->clients()) {
+							userlist.append(c->description());
+						}
+					});
+				}
+			}
 			return {JsonApiResult::Ok, QJsonDocument(userlist)};
 		}
 		case 1: {
-			ThinServerClient *c = searchClientByPathUid(path[0]);
-			if(c) {
-				return {JsonApiResult::Ok, QJsonDocument(c->description())};
+			QJsonObject description;
+			bool found = withClientByPathUid(path[0], [&](Client *c) {
+				description = c->description();
+			});
+			if(found) {
+				return {JsonApiResult::Ok, QJsonDocument(description)};
 			} else {
 				return JsonApiNotFound();
 			}
@@ -345,11 +474,12 @@ JsonApiResult SessionServer::callUserJsonApi(JsonApiMethod method, const QString
 
 	} else if(method == JsonApiMethod::Delete) {
 		if(path.size() == 1) {
-			ThinServerClient *c = searchClientByPathUid(path[0]);
-			if(c) {
-				return c->jsonApiKick(
-					request[QStringLiteral("message")].toString());
-			}
+			const QString message = request[QStringLiteral("message")].toString();
+			JsonApiResult result = JsonApiNotFound();
+			withClientByPathUid(path[0], [&](Client *c) {
+				result = c->jsonApiKick(message);
+			});
+			return result;
 		}
 		return JsonApiNotFound();
 
@@ -358,14 +488,33 @@ JsonApiResult SessionServer::callUserJsonApi(JsonApiMethod method, const QString
 	}
 }
 
-ThinServerClient *SessionServer::searchClientByPathUid(const QString &uid)
+bool SessionServer::withClientByPathUid(const QString &uid, const std::function<void(Client*)> &fn)
 {
 	for(ThinServerClient *c : m_clients) {
 		if(uid == c->uid()) {
-			return c;
+			fn(c);
+			return true;
 		}
 	}
-	return nullptr;
+
+	// Clients that were handed off can only be looked at from their thread
+	for(Session *s : m_sessions) {
+		if(s->thread() != thread()) {
+			bool found = false;
+			runInSession(s, [&] {
+				for(Client *c : s->clients()) {
+					if(uid == c->uid()) {
+						fn(c);
+						found = true;
+						break;
+					}
+				}
+			});
+			if(found)
+				return true;
+		}
+	}
+	return false;
 }
 
 }
@@ -15,6 +15,7 @@ namespace server {
 
 class Session;
 class SessionHistory;
+class SessionThreads;
 class ThinServerClient;
 class ServerConfig;
 class TemplateLoader;
@@ -27,6 +28,7 @@ class SessionServer final : public QObject, public Sessions {
 Q_OBJECT
 public:
 	SessionServer(ServerConfig *config, QObject *parent=nullptr);
+	~SessionServer() override;
 
 	/**
 	 * @brief Enable file backed sessions
@@ -34,6 +36,19 @@ public:
 	 */
 	void setSessionDir(const QDir &dir);
 
+	/**
+	 * @brief Run sessions on a pool of threads
+	 *
+	 * Each session is handed off to the least busy thread along with its
+	 * clients when a user joins it. If the count is zero, which is the
+	 * default, everything runs on the server's thread. This must be called
+	 * before any clients are added.
+	 *
+	 * @param count number of threads
+	 */
+	void setSessionThreads(int count);
+	int sessionThreadCount() const;
+
 	/**
 	 * @brief Set the template loader to use
 	 */
@@ -94,10 +109,14 @@ public:
 	 */
 	Session *getSessionById(const QString &id, bool load) override;
 
+	void runInSession(Session *session, const std::function<void()> &fn) override;
+
+	void joinSession(Session *session, Client *client, bool host, const std::function<void()> &afterJoin) override;
+
 	/**
 	 * @brief Get the total number of connected users
 	 */
-	int totalUsers() const { return m_clients.size(); }
+	int totalUsers() const { return m_clients.size() + m_handedOffClients; }
 
 	/**
 	 * @brief Get the number of active sessions
@@ -165,6 +184,7 @@ signals:
 private slots:
 	void removeSession(Session *session);
 	void removeClient(ThinServerClient *client);
+	void removeHandedOffClient();
 	void onSessionAttributeChanged(Session *session);
 	void cleanupSessions();
 
@@ -172,7 +192,8 @@ private:
 	SessionHistory *initHistory(const QString &id, const QString alias, const protocol::ProtocolVersion &protocolVersion, const QString &founder);
 	void initSession(Session *session);
 
-	ThinServerClient *searchClientByPathUid(const QString &uid);
+	bool withClientByPathUid(const QString &uid, const std::function<void(Client*)> &fn);
+	QThread *pickSessionThread() const;
 
 	sessionlisting::Announcements *m_announcements;
 	ServerConfig *m_config;
@@ -180,8 +201,15 @@ private:
 	QDir m_sessiondir;
 	bool m_useFiledSessions;
 
+	SessionThreads *m_threads;
+
 	QList<Session*> m_sessions;
+
+	// Clients that haven't joined a session yet, or that joined one that
+	// runs on this thread. Clients that were handed off to a session thread
+	// are only counted, since they must not be touched from here.
 	QList<ThinServerClient*> m_clients;
+	int m_handedOffClients;
 };
 
 }
@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "libserver/sessionthreads.h"
+#include "libserver/announcable.h"
+#include "libserver/serverconfig.h"
+#include <QMetaType>
+#include <QSemaphore>
+#include <QThread>
+
+namespace server {
+
+SessionThreads::SessionThreads(int count, QObject *parent)
+	: QObject(parent)
+{
+	Q_ASSERT(count > 0);
+	// Sessions receive these from the server thread through queued
+	// connections once they live in a thread of their own.
+	qRegisterMetaType<ConfigKey>("ConfigKey");
+	qRegisterMetaType<const sessionlisting::Announcable *>(
+		"const sessionlisting::Announcable*");
+	qRegisterMetaType<const sessionlisting::Announcable *>(
+		"const Announcable*");
+
+	for(int i = 0; i < count; ++i) {
+		QThread *thread = new QThread(this);
+		thread->setObjectName(QStringLiteral("session-%1").arg(i));
+		QObject *context = new QObject;
+		context->moveToThread(thread);
+		connect(thread, &QThread::finished, context, &QObject::deleteLater);
+		m_threads.append(thread);
+		m_contexts.insert(thread, context);
+		thread->start();
+	}
+}
+
+SessionThreads::~SessionThreads()
+{
+	for(QThread *thread : m_threads) {
+		thread->quit();
+	}
+	for(QThread *thread : m_threads) {
+		thread->wait();
+	}
+}
+
+void SessionThreads::handOff(
+	QThread *thread, const QObjectList &objects,
+	const std::function<void()> &fn)
+{
+	QObject *context = m_contexts.value(thread);
+	Q_ASSERT(context);
+
+	QSemaphore parked, moved, done;
+	QMetaObject::invokeMethod(
+		context,
+		[&] {
+			parked.release();
+			moved.acquire();
+			fn();
+			done.release();
+		},
+		Qt::QueuedConnection);
+
+	parked.acquire();
+	for(QObject *object : objects) {
+		Q_ASSERT(!object->parent());
+		object->moveToThread(thread);
+	}
+	moved.release();
+	done.acquire();
+}
+
+void SessionThreads::run(QObject *context, const std::function<void()> &fn)
+{
+	if(context->thread() == QThread::currentThread()) {
+		fn();
+	} else {
+		QMetaObject::invokeMethod(context, fn, Qt::BlockingQueuedConnection);
+	}
+}
+
+}
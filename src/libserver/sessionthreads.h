@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+#ifndef DP_SERVER_SESSIONTHREADS_H
+#define DP_SERVER_SESSIONTHREADS_H
+#include <QHash>
+#include <QObject>
+#include <QVector>
+#include <functional>
+
+class QThread;
+
+namespace server {
+
+/**
+ * @brief A fixed set of event loop threads that sessions can run on
+ *
+ * Sessions and their clients start out on the server's thread. When a client
+ * joins, the session server hands both of them off to one of these threads,
+ * where they stay until they're deleted.
+ *
+ * Only the server thread may block waiting for a session thread, never the
+ * other way around. Sessions talk back to the server thread through queued
+ * signals, so that this can't deadlock.
+ */
+class SessionThreads final : public QObject {
+	Q_OBJECT
+public:
+	SessionThreads(int count, QObject *parent = nullptr);
+	~SessionThreads() override;
+
+	const QVector<QThread *> &threads() const { return m_threads; }
+
+	/**
+	 * @brief Move objects to the given thread and call a function there
+	 *
+	 * The target thread is parked while the objects are moved, so the
+	 * function is the first thing that runs for them in their new thread.
+	 * The objects must not have a parent. Blocks until the function returns.
+	 */
+	void handOff(
+		QThread *thread, const QObjectList &objects,
+		const std::function<void()> &fn);
+
+	/**
+	 * @brief Call a function in the thread of the given object
+	 *
+	 * If the object lives in the calling thread, the function is called
+	 * directly. Otherwise, this blocks until the object's thread has run it.
+	 */
+	static void run(QObject *context, const std::function<void()> &fn);
+
+private:
+	QVector<QThread *> m_threads;
+	QHash<QThread *, QObject *> m_contexts;
+};
+
+}
+
+#endif
@@ -1,9 +1,12 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "libserver/filedhistory.h"
+#include "libshared/net/tcpmessagequeue.h"
 #include "libshared/util/passwordhash.h"
 #include "libshared/util/qtcompat.h"
 #include "libshared/util/ulid.h"
 #include <QDir>
+#include <QTcpServer>
+#include <QTcpSocket>
 #include <QTemporaryDir>
 #include <QtTest/QtTest>
 #include <memory>
@@ -331,6 +334,45 @@ private slots:
 		QCOMPARE(lastIdx, 5);
 	}
 
+	void testPrepareBatch()
+	{
+		QString file = makeTestRecording();
+		std::unique_ptr<FiledHistory> fh{
+			FiledHistory::load(m_dir.absoluteFilePath(file))};
+		fh->closeBlock();
+		fh->addMessage(net::makeChatMessage(1, 0, 0, QByteArray("test0")));
+
+		QSignalSpy spy(fh.get(), &SessionHistory::batchPrepared);
+
+		// Nothing is cached after loading, so the first block gets read on a
+		// background thread
+		QVERIFY(!fh->prepareBatch(-1));
+		QVERIFY(spy.wait());
+		QVERIFY(fh->prepareBatch(-1));
+
+		net::MessageList msgs;
+		int lastIdx;
+		std::tie(msgs, lastIdx) = fh->getBatch(-1);
+		QCOMPARE(msgs.size(), 3);
+		QCOMPARE(lastIdx, 2);
+		QCOMPARE(getChatMessage(msgs.last()), QString("test3"));
+
+		// Messages added while a block is loading must not get lost
+		QVERIFY(!fh->prepareBatch(lastIdx));
+		fh->addMessage(net::makeChatMessage(1, 0, 0, QByteArray("test4")));
+		QVERIFY(spy.wait());
+		QVERIFY(fh->prepareBatch(lastIdx));
+
+		std::tie(msgs, lastIdx) = fh->getBatch(lastIdx);
+		QCOMPARE(msgs.size(), 2);
+		QCOMPARE(lastIdx, 4);
+		QCOMPARE(getChatMessage(msgs.first()), QString("test0"));
+		QCOMPARE(getChatMessage(msgs.last()), QString("test4"));
+
+		// There's nothing to load past the end
+		QVERIFY(fh->prepareBatch(lastIdx));
+	}
+
 	void testUserLeave()
 	{
 		auto id = Ulid::make().toString();
@@ -364,6 +406,63 @@ private slots:
 		}
 	}
 
+	// A message sent to several clients is only serialized once, even if the
+	// first client's queue is done with it before the next one gets it.
+	void testSerializedOnceForAllClients()
+	{
+		std::unique_ptr<FiledHistory> fh{FiledHistory::startNew(
+			m_dir, Ulid::make().toString(), QString(),
+			protocol::ProtocolVersion::current(), "test")};
+		QVERIFY(fh.get());
+
+		QTcpServer server;
+		QVERIFY(server.listen(QHostAddress::LocalHost));
+
+		net::Message msg =
+			net::makeChatMessage(1, 0, 0, QStringLiteral("broadcast"));
+		QVERIFY(fh->addMessage(msg));
+		QVERIFY(!msg.isSerializedCached());
+
+		const char *serializedData = nullptr;
+		for(int i = 0; i < 2; ++i) {
+			QTcpSocket client;
+			client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+			QVERIFY(client.waitForConnected());
+			QVERIFY(server.waitForNewConnection(3000));
+			std::unique_ptr<QTcpSocket> peer{server.nextPendingConnection()};
+			QVERIFY(peer);
+
+			// The socket is idle, so the queue writes the message right away
+			// and lets go of it. The history still holds on to it though.
+			net::TcpMessageQueue mq(&client, true);
+			mq.send(msg);
+			QVERIFY(msg.isSerializedCached());
+
+			msg.holdSerialized();
+			const QByteArray serialized = msg.serialized();
+			if(i == 0) {
+				serializedData = serialized.constData();
+			} else {
+				QVERIFY(serialized.constData() == serializedData);
+			}
+			const QByteArray expected(
+				serialized.constData(), serialized.size());
+			msg.releaseSerialized();
+
+			client.flush();
+			QByteArray received;
+			while(received.size() < expected.size() &&
+				  (peer->bytesAvailable() > 0 || peer->waitForReadyRead(3000))) {
+				received += peer->readAll();
+			}
+			QCOMPARE(received, expected);
+		}
+
+		// Once every client has been sent it, the encoding is let go.
+		fh->cleanupBatches(fh->lastIndex());
+		QVERIFY(!msg.isSerializedCached());
+	}
+
 private:
 	// Generate a test recording containing three messages.
 	QString makeTestRecording()
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "libserver/sessionthreads.h"
+
+#include <QThread>
+#include <QtTest/QtTest>
+
+using server::SessionThreads;
+
+class TestSessionThreads final : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testHandOff()
+	{
+		SessionThreads threads(2);
+		QCOMPARE(threads.threads().size(), 2);
+
+		QThread *target = threads.threads().at(1);
+		QObject *obj = new QObject;
+		QThread *ranOn = nullptr;
+		QThread *objThread = nullptr;
+		threads.handOff(target, {obj}, [&] {
+			ranOn = QThread::currentThread();
+			objThread = obj->thread();
+		});
+		QCOMPARE(ranOn, target);
+		QCOMPARE(objThread, target);
+		QCOMPARE(obj->thread(), target);
+
+		ranOn = nullptr;
+		SessionThreads::run(obj, [&] {
+			ranOn = QThread::currentThread();
+		});
+		QCOMPARE(ranOn, target);
+
+		obj->deleteLater();
+	}
+
+	void testRunLocal()
+	{
+		QObject obj;
+		QThread *ranOn = nullptr;
+		SessionThreads::run(&obj, [&] {
+			ranOn = QThread::currentThread();
+		});
+		QCOMPARE(ranOn, QThread::currentThread());
+	}
+};
+
+
+QTEST_MAIN(TestSessionThreads)
+#include "sessionthreads.moc"
@@ -38,14 +38,22 @@ void ThinServerClient::sendNextHistoryBatch()
 	   session()->state() != Session::State::Running)
 		return;
 
+	// If the batch has to be loaded from disk first, that happens in the
+	// background. We'll get a batchPrepared signal when it's done.
+	SessionHistory *history = session()->history();
+	if(!history->prepareBatch(m_historyPosition))
+		return;
+
 	net::MessageList batch;
 	int batchLast;
-	std::tie(batch, batchLast) =
-		session()->history()->getBatch(m_historyPosition);
+	std::tie(batch, batchLast) = history->getBatch(m_historyPosition);
 	m_historyPosition = batchLast;
 	messageQueue()->sendMultiple(batch.size(), batch.constData());
 
 	static_cast<ThinSession *>(session())->cleanupHistoryCache();
+
+	// Read ahead the following batch while this one is being sent.
+	history->prepareBatch(m_historyPosition);
 }
 
 void ThinServerClient::connectSendNextHistoryBatch()
@@ -180,6 +180,10 @@ void ThinSession::onClientJoin(Client *client, bool host)
 		history(), &SessionHistory::newMessagesAvailable,
 		static_cast<ThinServerClient *>(client),
 		&ThinServerClient::sendNextHistoryBatch);
+	connect(
+		history(), &SessionHistory::batchPrepared,
+		static_cast<ThinServerClient *>(client),
+		&ThinServerClient::sendNextHistoryBatch);
 
 	if(!host) {
 		// Notify the client how many messages to expect (at least)
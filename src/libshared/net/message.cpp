@@ -295,6 +295,41 @@ bool Message::serializeWs(QByteArray &buffer) const
 		   0;
 }
 
+void Message::holdSerialized() const
+{
+	DP_message_serialized_hold(m_data);
+}
+
+void Message::releaseSerialized() const
+{
+	DP_message_serialized_release(m_data);
+}
+
+bool Message::isSerializedCached() const
+{
+	return DP_message_serialized_cached(m_data);
+}
+
+QByteArray Message::serialized() const
+{
+	size_t length;
+	const unsigned char *data = DP_message_serialized(m_data, &length);
+	return data ? QByteArray::fromRawData(
+					  reinterpret_cast<const char *>(data),
+					  compat::castSize(length))
+				: QByteArray();
+}
+
+QByteArray Message::serializedWs() const
+{
+	size_t length;
+	const unsigned char *data = DP_message_serialized_ws(m_data, &length);
+	return data ? QByteArray::fromRawData(
+					  reinterpret_cast<const char *>(data),
+					  compat::castSize(length))
+				: QByteArray();
+}
+
 bool Message::shouldSmoothe() const
 {
 	switch(type()) {
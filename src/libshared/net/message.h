@@ -84,6 +84,17 @@ public:
 	bool serialize(QByteArray &buffer) const;
 	bool serializeWs(QByteArray &buffer) const;
 
+	// Wire encoding cached inside of the message while it's held, so that it's
+	// only serialized once no matter how many clients it gets sent to. The
+	// message must be held while calling these. The returned byte array
+	// doesn't own its data, it's only valid until the hold is released or the
+	// context id changes. A null byte array is returned on error.
+	void holdSerialized() const;
+	void releaseSerialized() const;
+	bool isSerializedCached() const;
+	QByteArray serialized() const;
+	QByteArray serializedWs() const;
+
 	bool shouldSmoothe() const;
 
 	static void setUchars(size_t size, unsigned char *out, void *user);
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #include "libshared/net/tcpmessagequeue.h"
 #include "libshared/util/qtcompat.h"
+#include <QAtomicInteger>
 #include <QDateTime>
 #include <QTcpSocket>
 #include <QTimer>
@@ -8,6 +9,10 @@
 
 namespace net {
 
+static QAtomicInteger<quint64> totalWrites;
+static QAtomicInteger<quint64> totalWriteMessages;
+static QAtomicInteger<quint64> totalWriteBytes;
+
 TcpMessageQueue::TcpMessageQueue(
 	QTcpSocket *socket, bool decodeOpaque, QObject *parent)
 	: MessageQueue(decodeOpaque, parent)
@@ -16,6 +21,7 @@ TcpMessageQueue::TcpMessageQueue(
 	m_recvbuffer = new char[MAX_BUF_LEN];
 	m_recvbytes = 0;
 	m_sentbytes = 0;
+	m_sendcount = 0;
 
 	connect(socket, &QTcpSocket::readyRead, this, &TcpMessageQueue::readData);
 	connect(
@@ -29,6 +35,19 @@ TcpMessageQueue::TcpMessageQueue(
 TcpMessageQueue::~TcpMessageQueue()
 {
 	delete[] m_recvbuffer;
+	if(!m_sendmsg.isNull()) {
+		m_sendmsg.releaseSerialized();
+	}
+	for(const net::Message &msg : m_outbox) {
+		msg.releaseSerialized();
+	}
+}
+
+TcpMessageQueue::WriteStats TcpMessageQueue::writeStats()
+{
+	return {
+		totalWrites.loadAcquire(), totalWriteMessages.loadAcquire(),
+		totalWriteBytes.loadAcquire()};
 }
 
 int TcpMessageQueue::uploadQueueBytes() const
@@ -49,7 +68,10 @@ bool TcpMessageQueue::isUploading() const
 
 void TcpMessageQueue::enqueueMessages(int count, const net::Message *msgs)
 {
+	// Queued messages are held so that if they're broadcast to many clients,
+	// the encoding made by the first one that writes it is shared by the rest.
 	for(int i = 0; i < count; ++i) {
+		msgs[i].holdSerialized();
 		m_outbox.enqueue(msgs[i]);
 	}
 	if(m_sendbuffer.isEmpty()) {
@@ -255,16 +277,15 @@ void TcpMessageQueue::writeData()
 	bool sendMore = true;
 	int sentBatch = 0;
 
-	while(sendMore && sentBatch < 1024 * 64) {
+	while(sendMore && sentBatch < MAX_BATCH_LEN) {
 		sendMore = false;
 		if(m_sendbuffer.isEmpty() && messagesInOutbox()) {
-			// Upload buffer is empty, but there are messages in the outbox
-			Q_ASSERT(m_sentbytes == 0);
-			if(!dequeueFromOutbox().serialize(m_sendbuffer)) {
-				qWarning("Error serializing message: %s", DP_error());
-				sendMore = messagesInOutbox();
+			fillSendBuffer(MAX_BATCH_LEN - sentBatch);
+			if(m_sendbuffer.isEmpty()) {
+				// Nothing could be serialized.
 				continue;
 			}
+			totalWriteMessages.fetchAndAddRelaxed(quint64(m_sendcount));
 		}
 
 		if(m_sentbytes < m_sendbuffer.length()) {
@@ -277,19 +298,59 @@ void TcpMessageQueue::writeData()
 			}
 			m_sentbytes += sent;
 			sentBatch += sent;
+			totalWrites.fetchAndAddRelaxed(1);
+			totalWriteBytes.fetchAndAddRelaxed(quint64(sent));
 
 			Q_ASSERT(m_sentbytes <= m_sendbuffer.length());
 
 			if(m_sentbytes >= m_sendbuffer.length()) {
-				// Complete envelope sent
+				// Complete batch of envelopes sent
 				m_sendbuffer.clear();
+				if(!m_sendmsg.isNull()) {
+					m_sendmsg.releaseSerialized();
+					m_sendmsg = net::Message::null();
+				}
 				m_sentbytes = 0;
+				m_sendcount = 0;
 				sendMore = messagesInOutbox();
 			}
 		}
 	}
 }
 
+void TcpMessageQueue::fillSendBuffer(int budget)
+{
+	// Draw dabs come in streams of lots of tiny messages, so rather than going
+	// through the socket for each one, they're collected into a contiguous
+	// buffer that gets written in one go. Messages cache their serialized
+	// form, so a single message is written straight from there, holding on to
+	// it until it's sent. Only batches need a buffer of their own, which the
+	// first append allocates, after which the messages can be let go.
+	Q_ASSERT(m_sendbuffer.isEmpty());
+	Q_ASSERT(m_sentbytes == 0);
+	Q_ASSERT(m_sendcount == 0);
+	while(messagesInOutbox() &&
+		  (m_sendcount == 0 || m_sendbuffer.length() < budget)) {
+		net::Message msg = dequeueFromOutbox();
+		QByteArray serialized = msg.serialized();
+		if(serialized.isNull()) {
+			qWarning("Error serializing message: %s", DP_error());
+			msg.releaseSerialized();
+		} else if(m_sendcount++ == 0) {
+			m_sendmsg = msg;
+			m_sendbuffer = serialized;
+		} else {
+			if(!m_sendmsg.isNull()) {
+				m_sendbuffer.detach();
+				m_sendmsg.releaseSerialized();
+				m_sendmsg = net::Message::null();
+			}
+			m_sendbuffer.append(serialized);
+			msg.releaseSerialized();
+		}
+	}
+}
+
 bool TcpMessageQueue::messagesInOutbox() const
 {
 	return !m_outbox.isEmpty() || !m_pings.isEmpty();
@@ -297,10 +358,13 @@ bool TcpMessageQueue::messagesInOutbox() const
 
 net::Message TcpMessageQueue::dequeueFromOutbox()
 {
+	// Returns the message held, like the ones queued in the outbox.
 	if(m_pings.isEmpty()) {
 		return m_outbox.dequeue();
 	} else {
-		return net::makePingMessage(0, m_pings.dequeue());
+		net::Message msg = net::makePingMessage(0, m_pings.dequeue());
+		msg.holdSerialized();
+		return msg;
 	}
 }
 
@@ -16,6 +16,16 @@ public:
 
 	~TcpMessageQueue() override;
 
+	// Process-wide totals of socket writes, for figuring out how well small
+	// messages get coalesced into larger writes.
+	struct WriteStats {
+		quint64 writes;
+		quint64 messages;
+		quint64 bytes;
+	};
+
+	static WriteStats writeStats();
+
 	int uploadQueueBytes() const override;
 	bool isUploading() const override;
 
@@ -33,21 +43,25 @@ private slots:
 
 private:
 	static constexpr int MAX_BUF_LEN = 0xffff + DP_MESSAGE_HEADER_LENGTH;
+	static constexpr int MAX_BATCH_LEN = 1024 * 64;
 
 	void afterDisconnectSent() override;
 
 	int haveWholeMessageToRead();
 
 	void writeData();
+	void fillSendBuffer(int budget);
 
 	bool messagesInOutbox() const;
 	net::Message dequeueFromOutbox();
 
 	QTcpSocket *m_socket;
-	char *m_recvbuffer;		 // raw message reception buffer
-	QByteArray m_sendbuffer; // raw message upload buffer
-	int m_recvbytes;		 // number of bytes in reception buffer
-	int m_sentbytes;		 // number of bytes in upload buffer already sent
+	char *m_recvbuffer;		  // raw message reception buffer
+	net::Message m_sendmsg;	  // first message in the upload buffer
+	QByteArray m_sendbuffer;  // raw message upload buffer
+	int m_recvbytes;		  // number of bytes in reception buffer
+	int m_sentbytes;		  // number of bytes in upload buffer already sent
+	int m_sendcount;		  // number of messages in upload buffer
 	QQueue<net::Message> m_outbox; // messages to be sent
 	QQueue<bool> m_pings;		   // pings and pongs to be sent
 };
@@ -44,15 +44,23 @@ bool WebSocketMessageQueue::isUploading() const
 void WebSocketMessageQueue::enqueueMessages(int count, const net::Message *msgs)
 {
 	for(int i = 0; i < count; ++i) {
-		if(msgs[i].serializeWs(m_serializationBuffer)) {
-			qint64 sent = m_socket->sendBinaryMessage(m_serializationBuffer);
-			if(sent != qint64(m_serializationBuffer.size())) {
-				emit writeError();
-				break;
-			}
+		// The socket copies the data into its frame, so the message only needs
+		// to be held for the duration of the send.
+		const net::Message &msg = msgs[i];
+		msg.holdSerialized();
+		QByteArray serialized = msg.serializedWs();
+		bool ok = true;
+		if(!serialized.isNull()) {
+			qint64 sent = m_socket->sendBinaryMessage(serialized);
+			ok = sent == qint64(serialized.size());
 		} else {
 			qWarning("Error serializing message: %s", DP_error());
 		}
+		msg.releaseSerialized();
+		if(!ok) {
+			emit writeError();
+			break;
+		}
 	}
 }
 
@@ -32,7 +32,6 @@ private:
 	void afterDisconnectSent() override;
 
 	QWebSocket *m_socket;
-    QByteArray m_serializationBuffer;
 };
 
 }
@@ -10,6 +10,7 @@
 #include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QThread>
 
 Q_LOGGING_CATEGORY(lcDpDatabase, "net.drawpile.database", QtWarningMsg)
 
@@ -203,5 +204,84 @@ bool tx(QSqlDatabase &db, std::function<bool()> fn)
 	}
 }
 
+struct ThreadConnections::Connection {
+	QString name;
+
+	~Connection()
+	{
+		// Runs when the owning thread exits.
+		QSqlDatabase::database(name, false).close();
+		QSqlDatabase::removeDatabase(name);
+	}
+};
+
+ThreadConnections::ThreadConnections()
+	: m_connectionName(QStringLiteral("dbconnection%1").arg(quintptr(this)))
+	, m_inMemory(false)
+	, m_thread(nullptr)
+	, m_nextConnectionId(0)
+{
+}
+
+ThreadConnections::~ThreadConnections()
+{
+	// Connections of threads that are still running get cleaned up when they
+	// exit, they're independent of this object.
+	if(m_db.isValid()) {
+		m_db.close();
+		m_db = QSqlDatabase();
+		QSqlDatabase::removeDatabase(m_connectionName);
+	}
+}
+
+bool ThreadConnections::open(const QString &path)
+{
+	Q_ASSERT(!m_db.isValid());
+	m_path = path;
+	m_thread = QThread::currentThread();
+	m_inMemory = path.isEmpty() || path == QStringLiteral(":memory:");
+	if(m_inMemory) {
+		// A private in-memory database exists only for the connection that
+		// created it, a named shared cache one can be opened again.
+		m_databaseName = QStringLiteral("file:%1?mode=memory&cache=shared")
+							 .arg(m_connectionName);
+		m_connectOptions = QStringLiteral("QSQLITE_OPEN_URI");
+	} else {
+		m_databaseName = path;
+	}
+
+	m_db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), m_connectionName);
+	m_db.setDatabaseName(m_databaseName);
+	m_db.setConnectOptions(m_connectOptions);
+	return m_db.open();
+}
+
+QSqlDatabase ThreadConnections::get() const
+{
+	if(QThread::currentThread() == m_thread) {
+		return m_db;
+	}
+
+	Connection *connection = m_connections.localData();
+	if(!connection) {
+		connection = new Connection{QStringLiteral("%1-%2").arg(
+			m_connectionName,
+			QString::number(m_nextConnectionId.fetchAndAddRelaxed(1)))};
+		m_connections.setLocalData(connection);
+
+		QSqlDatabase db =
+			QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connection->name);
+		db.setDatabaseName(m_databaseName);
+		db.setConnectOptions(m_connectOptions);
+		if(!db.open()) {
+			qCWarning(
+				lcDpDatabase, "Can't open thread connection to '%s': %s",
+				qUtf8Printable(m_path), qUtf8Printable(db.lastError().text()));
+		}
+		return db;
+	}
+	return QSqlDatabase::database(connection->name, false);
+}
+
 }
 }
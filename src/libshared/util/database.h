@@ -3,12 +3,15 @@
 #ifndef LIBSHARED_UTILS_DATABASE_H
 #define LIBSHARED_UTILS_DATABASE_H
 
+#include <QAtomicInteger>
+#include <QSqlDatabase>
 #include <QString>
+#include <QThreadStorage>
 #include <QVariantList>
 #include <functional>
 
-class QSqlDatabase;
 class QSqlQuery;
+class QThread;
 
 namespace utils {
 namespace db {
@@ -28,6 +31,48 @@ bool exec(
 
 bool tx(QSqlDatabase &db, std::function<bool()> fn);
 
+/**
+ * @brief Connections to one SQLite database for every thread that uses it
+ *
+ * Qt SQL connections may only be used from the thread that created them. The
+ * thread that opens the database uses that connection, any other thread gets
+ * its own one opened the first time it asks and closed when the thread exits.
+ * In-memory databases are opened in shared cache mode so that all connections
+ * see the same data.
+ */
+class ThreadConnections final {
+public:
+	ThreadConnections();
+	~ThreadConnections();
+
+	ThreadConnections(const ThreadConnections &) = delete;
+	ThreadConnections &operator=(const ThreadConnections &) = delete;
+
+	//! Open the database on the calling thread
+	bool open(const QString &path);
+
+	//! Path the database was opened with
+	const QString &path() const { return m_path; }
+
+	bool isInMemory() const { return m_inMemory; }
+
+	//! Get the connection for the calling thread
+	QSqlDatabase get() const;
+
+private:
+	struct Connection;
+
+	QString m_connectionName;
+	QString m_path;
+	QString m_databaseName;
+	QString m_connectOptions;
+	bool m_inMemory;
+	QThread *m_thread;
+	QSqlDatabase m_db;
+	mutable QThreadStorage<Connection *> m_connections;
+	mutable QAtomicInteger<int> m_nextConnectionId;
+};
+
 }
 }
 
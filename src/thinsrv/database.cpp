@@ -24,7 +24,8 @@
 namespace server {
 
 struct Database::Private {
-	QSqlDatabase db;
+	// Session threads look up configuration values and bans too.
+	utils::db::ThreadConnections connections;
 	ServerLog *logger;
 };
 
@@ -120,19 +121,17 @@ Database::~Database()
 
 bool Database::openFile(const QString &path)
 {
-	d->db = QSqlDatabase::addDatabase("QSQLITE");
-	d->db.setDatabaseName(path);
-	if(!d->db.open()) {
+	if(!d->connections.open(path)) {
 		qCritical("Unable to open database: %s", qPrintable(path));
 		return false;
 	}
 
-	if(!initDatabase(d->db)) {
+	if(!initDatabase(d->connections.get())) {
 		qCritical("Database initialization failed: %s", qPrintable(path));
 		return false;
 	}
 
-	DbLog *dblog = new DbLog(d->db);
+	DbLog *dblog = new DbLog(d->connections);
 	if(!dblog->initDb()) {
 		qWarning("Couldn't initialize database log!");
 		delete dblog;
@@ -152,7 +151,7 @@ bool Database::openFile(const QString &path)
 void Database::loadExternalIpBans(ExtBans *extBans)
 {
 	extBans->loadFromCache();
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	if(utils::db::exec(q, QStringLiteral("SELECT id FROM disabledextbans"))) {
 		while(q.next()) {
 			ServerConfig::setExternalBanEnabled(q.value(0).toInt(), false);
@@ -162,7 +161,7 @@ void Database::loadExternalIpBans(ExtBans *extBans)
 
 bool Database::setExternalBanEnabled(int id, bool enabled)
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	QString sql =
 		enabled ? QStringLiteral("DELETE FROM disabledextbans WHERE id = ?")
 				: QStringLiteral(
@@ -178,7 +177,7 @@ void Database::setConfigValue(ConfigKey key, const QString &value)
 
 void Database::setConfigValueByName(const QString &name, const QString &value)
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	q.prepare("INSERT OR REPLACE INTO settings VALUES (?, ?)");
 	q.bindValue(0, name);
 	q.bindValue(1, value);
@@ -192,7 +191,7 @@ QString Database::getConfigValue(const ConfigKey key, bool &found) const
 
 QString Database::getConfigValueByName(const QString &name, bool &found) const
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	q.prepare("SELECT value FROM settings WHERE key=?");
 	q.bindValue(0, name);
 	q.exec();
@@ -216,7 +215,7 @@ bool Database::isAllowedAnnouncementUrl(const QUrl &url) const
 
 	const QString urlStr = url.toString();
 
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	q.exec("SELECT url FROM listingservers");
 	while(q.next()) {
 		const QString serverUrl = q.value(0).toString();
@@ -235,7 +234,7 @@ bool Database::isAllowedAnnouncementUrl(const QUrl &url) const
 QStringList Database::listServerWhitelist() const
 {
 	QStringList list;
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	q.exec("SELECT url FROM listingservers");
 	while(q.next()) {
 		list << q.value(0).toString();
@@ -245,7 +244,7 @@ QStringList Database::listServerWhitelist() const
 
 void Database::updateListServerWhitelist(const QStringList &whitelist)
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	q.exec("BEGIN TRANSACTION");
 	q.exec("DELETE FROM listingservers");
 	if(!whitelist.isEmpty()) {
@@ -262,7 +261,7 @@ void Database::updateListServerWhitelist(const QStringList &whitelist)
 
 BanResult Database::isAddressBanned(const QHostAddress &addr) const
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	bool ok = utils::db::exec(q, QStringLiteral(
 		"SELECT rowid, ip, subnet, expires FROM ipbans\n"
 		"WHERE expires > datetime('now')"));
@@ -288,7 +287,7 @@ BanResult Database::isAddressBanned(const QHostAddress &addr) const
 
 BanResult Database::isSystemBanned(const QString &sid) const
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	bool ok = utils::db::exec(
 		q,
 		QStringLiteral("SELECT id, reaction, expires, reason FROM systembans\n"
@@ -315,7 +314,7 @@ BanResult Database::isSystemBanned(const QString &sid) const
 
 BanResult Database::isUserBanned(long long userId) const
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	bool ok = utils::db::exec(
 		q,
 		QStringLiteral("SELECT id, reaction, expires, reason FROM userbans\n"
@@ -343,7 +342,7 @@ BanResult Database::isUserBanned(long long userId) const
 QJsonArray Database::getIpBanlist() const
 {
 	QJsonArray result;
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	q.exec("SELECT rowid, ip, subnet, expires, comment, added FROM ipbans");
 
 	while(q.next()) {
@@ -355,7 +354,7 @@ QJsonArray Database::getIpBanlist() const
 QJsonArray Database::getSystemBanlist() const
 {
 	QJsonArray result;
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	bool ok = utils::db::exec(
 		q, QStringLiteral("SELECT id, sid, expires, reaction, reason, comment, "
 						  "added FROM systembans ORDER BY id ASC"));
@@ -368,7 +367,7 @@ QJsonArray Database::getSystemBanlist() const
 QJsonArray Database::getUserBanlist() const
 {
 	QJsonArray result;
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	bool ok = utils::db::exec(
 		q, QStringLiteral("SELECT id, userid, expires, reaction, reason, "
 						  "comment, added FROM userbans ORDER BY id ASC"));
@@ -380,7 +379,7 @@ QJsonArray Database::getUserBanlist() const
 
 QJsonObject Database::addIpBan(const QHostAddress &ip, int subnet, const QDateTime &expiration, const QString &comment)
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	q.prepare("SELECT rowid, ip, subnet, expires, comment, added FROM ipbans WHERE ip=? AND subnet=?");
 	q.bindValue(0, ip.toString());
 	q.bindValue(1, subnet);
@@ -415,7 +414,7 @@ QJsonObject Database::addSystemBan(
 	const QString &sid, const QDateTime &expires, BanReaction reaction,
 	const QString &reason, const QString &comment)
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	QString expiresString = formatDateTime(expires);
 	QString addedString = formatDateTime(QDateTime::currentDateTime());
 	QString reactionString = reactionToString(reaction);
@@ -445,7 +444,7 @@ QJsonObject Database::addUserBan(
 	long long userId, const QDateTime &expires, BanReaction reaction,
 	const QString &reason, const QString &comment)
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	QString expiresString = formatDateTime(expires);
 	QString addedString = formatDateTime(QDateTime::currentDateTime());
 	QString reactionString = reactionToString(reaction);
@@ -473,7 +472,7 @@ QJsonObject Database::addUserBan(
 
 bool Database::deleteIpBan(int entryId)
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	q.prepare("DELETE FROM ipbans WHERE rowid=?");
 	q.bindValue(0, entryId);
 	q.exec();
@@ -482,7 +481,7 @@ bool Database::deleteIpBan(int entryId)
 
 bool Database::deleteSystemBan(int entryId)
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	return utils::db::exec(
 			   q, QStringLiteral("DELETE FROM systembans WHERE id = ?"),
 			   {entryId}) &&
@@ -491,7 +490,7 @@ bool Database::deleteSystemBan(int entryId)
 
 bool Database::deleteUserBan(int entryId)
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	return utils::db::exec(
 			   q, QStringLiteral("DELETE FROM userbans WHERE id = ?"),
 			   {entryId}) &&
@@ -543,7 +542,7 @@ ServerLog *Database::logger() const
 
 RegisteredUser Database::getUserAccount(const QString &username, const QString &password) const
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	q.prepare("SELECT rowid, password, locked, flags FROM users WHERE username=?");
 	q.bindValue(0, username);
 	q.exec();
@@ -589,7 +588,7 @@ RegisteredUser Database::getUserAccount(const QString &username, const QString &
 
 bool Database::hasAnyUserAccounts() const
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	return utils::db::exec(q, QStringLiteral("SELECT 1 FROM users LIMIT 1")) &&
 		   q.next();
 }
@@ -607,7 +606,7 @@ static QJsonObject userQueryToJson(const QSqlQuery &q)
 QJsonArray Database::getAccountList() const
 {
 	QJsonArray list;
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	q.exec("SELECT rowid, username, locked, flags FROM users");
 	while(q.next()) {
 		list << userQueryToJson(q);
@@ -620,7 +619,7 @@ QJsonObject Database::addAccount(const QString &username, const QString &passwor
 	if(!validateUsername(username))
 		return QJsonObject();
 
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	q.prepare("INSERT INTO users (username, password, locked, flags) VALUES (?, ?, ?, ?)");
 	q.bindValue(0, username);
 	q.bindValue(1, passwordhash::hash(password));
@@ -660,7 +659,7 @@ QJsonObject Database::updateAccount(int id, const QJsonObject &update)
 		params << update["flags"].toString();
 	}
 
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 
 	if(!updates.isEmpty()) {
 		QString sql = QString("UPDATE users SET %1 WHERE rowid=?").arg(updates.join(','));
@@ -683,7 +682,7 @@ QJsonObject Database::updateAccount(int id, const QJsonObject &update)
 
 bool Database::deleteAccount(int userId)
 {
-	QSqlQuery q(d->db);
+	QSqlQuery q(d->connections.get());
 	q.prepare("DELETE FROM users WHERE rowid=?");
 	q.bindValue(0, userId);
 	q.exec();
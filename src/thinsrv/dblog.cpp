@@ -1,26 +1,254 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "thinsrv/dblog.h"
+#include "libshared/util/database.h"
 
 #include <QSqlQuery>
 #include <QMetaEnum>
+#include <QMutex>
 #include <QSqlError>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
 
 namespace server {
 
-DbLog::DbLog(const QSqlDatabase &db)
-	: m_db(db)
+// Entries beyond this are dropped while the writer is busy.
+static constexpr int QUEUE_LIMIT = 10000;
+
+static const QString INSERT_SQL = QStringLiteral(
+	"INSERT INTO serverlog (timestamp, level, topic, user, session, message) VALUES (?, ?, ?, ?, ?, ?)");
+
+static void bindLogEntry(QSqlQuery &q, const Log &entry)
 {
+	q.bindValue(0, entry.timestamp().toString(Qt::ISODate));
+	q.bindValue(1, int(entry.level()));
+	q.bindValue(2, QMetaEnum::fromType<Log::Topic>().valueToKey(int(entry.topic())));
+	q.bindValue(3, entry.user());
+	q.bindValue(4, entry.session());
+	q.bindValue(5, entry.message());
+}
+
+class DbLog::Writer final : public QThread
+{
+public:
+	explicit Writer(const QString &path)
+		: m_path(path)
+		, m_connectionName(QStringLiteral("dblogwriter%1").arg(quintptr(this)))
+	{
+	}
+
+	// Starts the thread and waits until it has its connection open.
+	bool startWriting()
+	{
+		start();
+		QMutexLocker locker(&m_mutex);
+		while(m_state == State::Starting)
+			m_idleCondition.wait(&m_mutex);
+		return m_state == State::Running;
+	}
+
+	// Writes out everything that's still queued and then ends the thread.
+	void stop()
+	{
+		{
+			QMutexLocker locker(&m_mutex);
+			m_stopping = true;
+			m_pendingCondition.wakeAll();
+		}
+		wait();
+	}
+
+	void enqueue(const Log &entry)
+	{
+		QMutexLocker locker(&m_mutex);
+		if(m_pending.size() < QUEUE_LIMIT) {
+			m_pending.append(entry);
+			m_pendingCondition.wakeOne();
+		} else {
+			++m_dropped;
+			++m_droppedUnreported;
+		}
+	}
+
+	void flush()
+	{
+		QMutexLocker locker(&m_mutex);
+		while(m_state == State::Running && (!m_pending.isEmpty() || m_writing))
+			m_idleCondition.wait(&m_mutex);
+	}
+
+	void getStats(WriteStats &stats)
+	{
+		QMutexLocker locker(&m_mutex);
+		stats.queued = m_pending.size();
+		stats.written = m_written;
+		stats.dropped = m_dropped;
+	}
+
+protected:
+	void run() override
+	{
+		{
+			QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), m_connectionName);
+			db.setDatabaseName(m_path);
+			bool ok = db.open();
+			if(ok) {
+				// Log entries are fine to lose on a power cut, so don't wait
+				// for a sync on every commit. With WAL this is still safe.
+				QSqlQuery q(db);
+				q.exec(QStringLiteral("PRAGMA synchronous=NORMAL"));
+			} else {
+				qWarning("Couldn't open database log writer connection: %s", qPrintable(db.lastError().text()));
+			}
+
+			{
+				QMutexLocker locker(&m_mutex);
+				m_state = ok ? State::Running : State::Failed;
+				m_idleCondition.wakeAll();
+			}
+
+			if(ok) {
+				writeLoop(db);
+				db.close();
+			}
+		}
+		QSqlDatabase::removeDatabase(m_connectionName);
+	}
+
+private:
+	enum class State { Starting, Running, Failed };
+
+	void writeLoop(QSqlDatabase &db)
+	{
+		QMutexLocker locker(&m_mutex);
+		while(true) {
+			while(m_pending.isEmpty() && !m_stopping)
+				m_pendingCondition.wait(&m_mutex);
+			if(m_pending.isEmpty())
+				break;
+
+			// Everything that piled up while the last batch was being written
+			// goes into a single transaction.
+			QVector<Log> batch;
+			batch.swap(m_pending);
+			const quint64 entries = quint64(batch.size());
+			quint64 dropped = m_droppedUnreported;
+			m_droppedUnreported = 0;
+			m_writing = true;
+			locker.unlock();
+
+			// The notice about dropped entries isn't counted as written.
+			if(dropped > 0) {
+				qWarning("Database log queue full, dropped %llu entries", (unsigned long long)dropped);
+				batch.append(Log().about(Log::Level::Warn, Log::Topic::Status).message(
+					QStringLiteral("Log writer couldn't keep up, dropped %1 entries").arg(dropped)));
+			}
+			QString error;
+			bool ok = writeBatch(db, batch, error);
+			if(!ok)
+				qWarning("Database log writer dropped %llu entries: %s", (unsigned long long)entries, qPrintable(error));
+
+			locker.relock();
+			if(ok)
+				m_written += entries;
+			else
+				m_dropped += entries;
+			m_writing = false;
+			m_idleCondition.wakeAll();
+		}
+	}
+
+	static bool writeBatch(QSqlDatabase &db, const QVector<Log> &batch, QString &outError)
+	{
+		QSqlQuery q(db);
+		bool ok = utils::db::tx(db, [&]() {
+			if(!utils::db::prepare(q, INSERT_SQL))
+				return false;
+			for(const Log &entry : batch) {
+				bindLogEntry(q, entry);
+				if(!utils::db::execPrepared(q, INSERT_SQL))
+					return false;
+			}
+			return true;
+		});
+		if(!ok) {
+			// Either a statement failed or the transaction itself did.
+			const QSqlError error = q.lastError().isValid() ? q.lastError() : db.lastError();
+			outError = error.text();
+		}
+		return ok;
+	}
+
+	const QString m_path;
+	const QString m_connectionName;
+	QMutex m_mutex;
+	QWaitCondition m_pendingCondition;
+	QWaitCondition m_idleCondition;
+	QVector<Log> m_pending;
+	quint64 m_written = 0;
+	quint64 m_dropped = 0;
+	quint64 m_droppedUnreported = 0;
+	State m_state = State::Starting;
+	bool m_writing = false;
+	bool m_stopping = false;
+};
+
+DbLog::DbLog(const utils::db::ThreadConnections &connections)
+	: m_connections(connections), m_writer(nullptr), m_written(0)
+{
+}
+
+DbLog::~DbLog()
+{
+	if(m_writer) {
+		m_writer->stop();
+		delete m_writer;
+	}
 }
 
 bool DbLog::initDb()
 {
-	QSqlQuery q(m_db);
-	return q.exec(
+	QSqlQuery q(m_connections.get());
+	if(!q.exec(
 		"CREATE TABLE IF NOT EXISTS serverlog ("
 			"timestamp, level, topic, user, session, message"
 		");"
-	);
+	))
+		return false;
+
+	// Indexes for the log view and for purging. Level and topic are included
+	// so that filtering on them doesn't have to look up every row.
+	if(!q.exec(
+		"CREATE INDEX IF NOT EXISTS serverlog_timestamp_idx "
+			"ON serverlog (timestamp, level, topic);"
+	))
+		return false;
+
+	if(!q.exec(
+		"CREATE INDEX IF NOT EXISTS serverlog_session_timestamp_idx "
+			"ON serverlog (session, timestamp, level, topic);"
+	))
+		return false;
+
+	if(m_connections.isInMemory())
+		return true;
+
+	// Lets the writer commit entries while the server threads keep using their
+	// own connections, instead of them locking each other out.
+	if(!q.exec("PRAGMA journal_mode=WAL") || !q.next() ||
+	   q.value(0).toString().compare(QStringLiteral("wal"), Qt::CaseInsensitive) != 0)
+		qWarning("Couldn't switch database to WAL mode");
+
+	Writer *writer = new Writer(m_connections.path());
+	if(writer->startWriting()) {
+		m_writer = writer;
+	} else {
+		qWarning("Database log writer failed to start, logging synchronously");
+		writer->wait();
+		delete writer;
+	}
+	return true;
 }
 
 QList<Log> DbLog::getLogEntries(const QString &session, const QDateTime &after, Log::Level atleast, bool omitSensitive, int offset, int limit) const
@@ -56,7 +284,7 @@ QList<Log> DbLog::getLogEntries(const QString &session, const QDateTime &after,
 		params << offset;
 	}
 
-	QSqlQuery q(m_db);
+	QSqlQuery q(m_connections.get());
 	q.prepare(sql);
 	for(int i=0;i<params.size();++i)
 		q.bindValue(i, params.at(i));
@@ -82,15 +310,15 @@ QList<Log> DbLog::getLogEntries(const QString &session, const QDateTime &after,
 
 void DbLog::storeMessage(const Log &entry)
 {
-	QSqlQuery q(m_db);
-	q.prepare("INSERT INTO serverlog (timestamp, level, topic, user, session, message) VALUES (?, ?, ?, ?, ?, ?)");
-	q.bindValue(0, entry.timestamp().toString(Qt::ISODate));
-	q.bindValue(1, int(entry.level()));
-	q.bindValue(2, QMetaEnum::fromType<Log::Topic>().valueToKey(int(entry.topic())));
-	q.bindValue(3, entry.user());
-	q.bindValue(4, entry.session());
-	q.bindValue(5, entry.message());
-	q.exec();
+	if(m_writer) {
+		m_writer->enqueue(entry);
+	} else {
+		QSqlQuery q(m_connections.get());
+		q.prepare(INSERT_SQL);
+		bindLogEntry(q, entry);
+		if(q.exec())
+			m_written.fetchAndAddRelaxed(1);
+	}
 }
 
 int DbLog::purgeLogs(int olderThanDays)
@@ -98,7 +326,9 @@ int DbLog::purgeLogs(int olderThanDays)
 	if(olderThanDays<=0)
 		return 0;
 
-	QSqlQuery q(m_db);
+	flush();
+
+	QSqlQuery q(m_connections.get());
 	q.prepare("DELETE FROM serverlog WHERE timestamp < DATE('now', ?)");
 	q.bindValue(0, QStringLiteral("-%1 days").arg(olderThanDays));
 	if(!q.exec())
@@ -106,4 +336,18 @@ int DbLog::purgeLogs(int olderThanDays)
 	return q.numRowsAffected();
 }
 
+void DbLog::flush() const
+{
+	if(m_writer)
+		m_writer->flush();
+}
+
+DbLog::WriteStats DbLog::writeStats() const
+{
+	WriteStats stats = {m_writer != nullptr, 0, m_written.loadAcquire(), 0};
+	if(m_writer)
+		m_writer->getStats(stats);
+	return stats;
+}
+
 }
@@ -5,14 +5,37 @@
 
 #include "libserver/serverlog.h"
 
-#include <QSqlDatabase>
+#include <QAtomicInteger>
+
+namespace utils {
+namespace db {
+class ThreadConnections;
+}
+}
 
 namespace server {
 
+/**
+ * @brief Server log stored in the serverlog table of the configuration database
+ *
+ * For file databases, entries are handed off to a background thread that
+ * writes them in batches through its own connection, so logging doesn't block
+ * the caller on disk writes. The queue is bounded: if the writer can't keep up,
+ * further entries are dropped and counted until it catches up again. In-memory
+ * databases don't support WAL mode, so those are written to directly instead.
+ */
 class DbLog final : public ServerLog
 {
 public:
-	explicit DbLog(const QSqlDatabase &db);
+	struct WriteStats {
+		bool async;
+		int queued;
+		quint64 written;
+		quint64 dropped;
+	};
+
+	explicit DbLog(const utils::db::ThreadConnections &connections);
+	~DbLog() override;
 
 	bool initDb();
 
@@ -25,11 +48,26 @@ public:
 	 */
 	int purgeLogs(int olderThanDays);
 
+	/**
+	 * @brief Wait until all queued entries have been written
+	 *
+	 * Queries through query() and purgeLogs do this on their own, so that
+	 * they see everything logged before them. Calling getLogEntries directly
+	 * doesn't.
+	 */
+	void flush() const override;
+
+	WriteStats writeStats() const;
+
 protected:
 	void storeMessage(const Log &entry) override;
 
 private:
-	QSqlDatabase m_db;
+	class Writer;
+
+	const utils::db::ThreadConnections &m_connections;
+	Writer *m_writer;
+	QAtomicInteger<quint64> m_written;
 };
 
 }
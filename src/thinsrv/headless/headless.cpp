@@ -235,6 +235,10 @@ bool start() {
 	QCommandLineOption templatesOption(QStringList() << "templates" << "t", "Session templates", "path");
 	parser.addOption(templatesOption);
 
+	// --session-threads <count>
+	QCommandLineOption sessionThreadsOption(QStringList() << "session-threads", "Number of threads to run sessions on (0 runs them on the main thread)", "count", "0");
+	parser.addOption(sessionThreadsOption);
+
 #ifdef HAVE_LIBSODIUM
 	QString sodiumOptionSuffix;
 #else
@@ -467,6 +471,16 @@ bool start() {
 		}
 	}
 
+	{
+		bool ok;
+		int sessionThreads = parser.value(sessionThreadsOption).toInt(&ok);
+		if(!ok || sessionThreads < 0 || sessionThreads > 256) {
+			qCritical("Invalid session thread count %s", qUtf8Printable(parser.value(sessionThreadsOption)));
+			return false;
+		}
+		server->setSessionThreads(sessionThreads);
+	}
+
 	if(parser.isSet(templatesOption)) {
 		QDir dir(parser.value(templatesOption));
 		if(!dir.exists()) {
@@ -7,9 +7,11 @@
 #include "libserver/sessionserver.h"
 #include "libserver/thinserverclient.h"
 #include "libshared/net/servercmd.h"
+#include "libshared/net/tcpmessagequeue.h"
 #include "libshared/util/qtcompat.h"
 #include "libshared/util/whatismyip.h"
 #include "thinsrv/database.h"
+#include "thinsrv/dblog.h"
 #include "thinsrv/extbans.h"
 #include "thinsrv/initsys.h"
 #include "thinsrv/templatefiles.h"
@@ -96,6 +98,11 @@ void MultiServer::setTemplateDirectory(const QDir &dir)
 	delete old;
 }
 
+void MultiServer::setSessionThreads(int count)
+{
+	m_sessions->setSessionThreads(count);
+}
+
 bool MultiServer::createServer()
 {
 	return createServer(false);
@@ -614,12 +621,33 @@ JsonApiResult MultiServer::statusJsonApi(JsonApiMethod method, const QStringList
 	result["sessions"] = m_sessions->sessionCount();
 	result["maxSessions"] = m_config->getConfigInt(config::SessionCountLimit);
 	result["users"] = m_sessions->totalUsers();
+	result["sessionThreads"] = m_sessions->sessionThreadCount();
 	QString localhost = m_config->internalConfig().localHostname;
 	if(localhost.isEmpty())
 		localhost = WhatIsMyIp::guessLocalAddress();
 	result["ext_host"] = localhost;
 	result["ext_port"] = m_config->internalConfig().getAnnouncePort();
 
+	const net::TcpMessageQueue::WriteStats ws = net::TcpMessageQueue::writeStats();
+	const double writes = double(ws.writes);
+	result["writes"] = QJsonObject {
+		{"calls", writes},
+		{"messages", double(ws.messages)},
+		{"bytes", double(ws.bytes)},
+		{"messagesPerWrite", writes > 0.0 ? double(ws.messages) / writes : 0.0},
+		{"bytesPerWrite", writes > 0.0 ? double(ws.bytes) / writes : 0.0},
+	};
+
+	if(const DbLog *dblog = dynamic_cast<const DbLog *>(m_config->logger())) {
+		const DbLog::WriteStats ls = dblog->writeStats();
+		result["log"] = QJsonObject {
+			{"async", ls.async},
+			{"queued", ls.queued},
+			{"written", double(ls.written)},
+			{"dropped", double(ls.dropped)},
+		};
+	}
+
 	return JsonApiResult { JsonApiResult::Ok, QJsonDocument(result) };
 }
 
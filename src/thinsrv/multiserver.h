@@ -42,6 +42,7 @@ public:
 	void setAutoStop(bool autostop);
 	void setRecordingPath(const QString &path);
 	void setTemplateDirectory(const QDir &dir);
+	void setSessionThreads(int count);
 
 	/**
 	 * @brief Get the port the server is running from
@@ -3,6 +3,9 @@
 #include "thinsrv/database.h"
 #include "thinsrv/dblog.h"
 
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryDir>
 #include <QtTest/QtTest>
 
 using server::Database;
@@ -47,10 +50,87 @@ private slots:
 		QCOMPARE(logEntryCount(), 1);
 	}
 
+	void testBackgroundWriter()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		const QString path = dir.filePath("log.db");
+		const QDateTime now = QDateTime::currentDateTimeUtc();
+
+		{
+			Database db;
+			QVERIFY(db.openFile(path));
+			DbLog *fileLogger = dynamic_cast<DbLog*>(db.logger());
+			QVERIFY(fileLogger);
+			fileLogger->setSilent(true);
+			QVERIFY(fileLogger->writeStats().async);
+
+			for(int i = 0; i < 100; ++i) {
+				fileLogger->logMessage(Log(now.addSecs(i), i % 2 == 0 ? "even" : "odd", "test", Log::Level::Info, Log::Topic::Status, QString::number(i)));
+			}
+
+			// Queries wait for the queue to be written out
+			const QList<Log> even = fileLogger->query().session("even").omitSensitive(false).get();
+			QCOMPARE(even.size(), 50);
+			QCOMPARE(even.first().message(), QStringLiteral("98"));
+			QCOMPARE(even.last().message(), QStringLiteral("0"));
+
+			const DbLog::WriteStats stats = fileLogger->writeStats();
+			QCOMPARE(stats.queued, 0);
+			QCOMPARE(stats.written, quint64(100));
+			QCOMPARE(stats.dropped, quint64(0));
+
+			// Entries still queued on shutdown get written out
+			fileLogger->logMessage(Log(now.addSecs(100), "even", "test", Log::Level::Info, Log::Topic::Status, "100"));
+		}
+
+		Database db;
+		QVERIFY(db.openFile(path));
+		DbLog *fileLogger = dynamic_cast<DbLog*>(db.logger());
+		QVERIFY(fileLogger);
+		QCOMPARE(fileLogger->query().omitSensitive(false).get().size(), 101);
+	}
+
+	void testFailedWritesCountAsDropped()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		const QString path = dir.filePath("log.db");
+		const QDateTime now = QDateTime::currentDateTimeUtc();
+
+		Database db;
+		QVERIFY(db.openFile(path));
+		DbLog *fileLogger = dynamic_cast<DbLog*>(db.logger());
+		QVERIFY(fileLogger);
+		fileLogger->setSilent(true);
+		QVERIFY(fileLogger->writeStats().async);
+
+		// Pull the table out from under the writer so that its inserts fail
+		const QString connectionName = QStringLiteral("testdblogdrop");
+		{
+			QSqlDatabase other = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+			other.setDatabaseName(path);
+			QVERIFY(other.open());
+			QSqlQuery q(other);
+			QVERIFY(q.exec("DROP TABLE serverlog"));
+		}
+		QSqlDatabase::removeDatabase(connectionName);
+
+		for(int i = 0; i < 3; ++i) {
+			fileLogger->logMessage(Log(now.addSecs(i), QString(), "test", Log::Level::Info, Log::Topic::Status, QString::number(i)));
+		}
+		fileLogger->flush();
+
+		const DbLog::WriteStats stats = fileLogger->writeStats();
+		QCOMPARE(stats.queued, 0);
+		QCOMPARE(stats.written, quint64(0));
+		QCOMPARE(stats.dropped, quint64(3));
+	}
+
 private:
 	int logEntryCount()
 	{
-		return logger->getLogEntries(QString(), QDateTime(), Log::Level::Debug, false, 0, 0).size();
+		return logger->query().omitSensitive(false).get().size();
 	}
 
 	QScopedPointer<Database> m_db;